@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""Compares Google Benchmark JSON results against a baseline.
+
+  $ bazel run -c opt //bench:decode-bench -- \
+      --benchmark_out=/tmp/decode-bench.json --benchmark_out_format=json
+  $ bench/compare.py bench/baseline/decode-bench.json /tmp/decode-bench.json
+
+Either argument can be a directory, in which case every <bench>.json in it
+is compared with the file of the same name in the other one. Benchmarks are
+matched by name; a regression is CPU time (wall clock time for the ones
+that UseRealTime()) above the baseline by more than --threshold percent,
+or more allocations per iteration (the "allocs" counter) than the baseline
+had. Exits with 1 if there's any.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+UNITS = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+  with open(path) as f:
+    results = json.load(f)
+  rv = {}
+  for b in results.get("benchmarks", []):
+    # aggregates (with --benchmark_repetitions) would shadow the runs
+    if b.get("run_type") == "aggregate" and b.get("aggregate_name") != "median":
+      continue
+    if b.get("error_occurred"):
+      continue
+    name = b["run_name"] if b.get("run_type") == "aggregate" else b["name"]
+    rv[name] = b
+  return rv
+
+
+def pairs(baseline, current):
+  if not os.path.isdir(baseline):
+    return [(baseline, current)]
+  rv = []
+  for name in sorted(os.listdir(baseline)):
+    if name.endswith(".json"):
+      other = os.path.join(current, name)
+      if os.path.exists(other):
+        rv.append((os.path.join(baseline, name), other))
+      else:
+        print("%s: no current results, skipped" % name)
+  return rv
+
+
+def compare(baseline_file, current_file, threshold):
+  baseline = load(baseline_file)
+  current = load(current_file)
+  regressions = 0
+
+  print("%-48s %12s %12s %8s %8s" % (os.path.basename(current_file), "base ns", "ns", "change", "allocs"))
+  for name, base in baseline.items():
+    cur = current.get(name)
+    if cur is None:
+      continue
+    # with decode threads the main thread's CPU time means little
+    key = "real_time" if name.endswith("/real_time") else "cpu_time"
+    base_ns = base[key] * UNITS[base.get("time_unit", "ns")]
+    cur_ns = cur[key] * UNITS[cur.get("time_unit", "ns")]
+    change = (cur_ns - base_ns) * 100.0 / base_ns if base_ns > 0 else 0.0
+
+    allocs = ""
+    more_allocs = False
+    if "allocs" in base and "allocs" in cur:
+      allocs = "%.1f" % cur["allocs"]
+      # fractions come from the mix benchmarks, don't flag rounding
+      more_allocs = cur["allocs"] > base["allocs"] + 0.05
+
+    slower = change > threshold
+    flag = ""
+    if slower or more_allocs:
+      regressions += 1
+      flag = "  <- " + ", ".join(
+        (["slower"] if slower else []) + (["allocates more"] if more_allocs else []))
+    print("%-48s %12.1f %12.1f %+7.1f%% %8s%s" % (name, base_ns, cur_ns, change, allocs, flag))
+
+  for name in sorted(set(current) - set(baseline)):
+    print("%-48s (not in the baseline)" % name)
+  print()
+  return regressions
+
+
+def main():
+  parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+  parser.add_argument("baseline", help="baseline JSON file or directory")
+  parser.add_argument("current", help="current JSON file or directory")
+  parser.add_argument("-t", "--threshold", type=float, default=10.0,
+                      help="percent of time above the baseline that counts as a regression (default: 10)")
+  args = parser.parse_args()
+
+  regressions = 0
+  for baseline, current in pairs(args.baseline, args.current):
+    regressions += compare(baseline, current, args.threshold)
+
+  if regressions:
+    print("%d regression(s)" % regressions)
+    return 1
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())
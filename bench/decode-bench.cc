@@ -0,0 +1,194 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "bench/synthetic.h"
+#include "src/decoder.h"
+
+using namespace std;
+
+// Every allocation in the process is counted, so decode benchmarks can
+// report allocations per message next to their time.
+namespace {
+atomic<uint64_t> allocations{0};
+}
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, memory_order_relaxed);
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw bad_alloc();
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+using Zktraffic::Opcodes;
+
+const auto client = Zktraffic::Endpoint::from_v4(0x0201000a, 40000);
+const auto server = Zktraffic::Endpoint::from_v4(0x0100000a, 2181);
+
+// payload size, for every opcode
+void opcode_args(benchmark::internal::Benchmark *b) {
+  for (size_t i = 0; i < Synthetic::opcodes().size(); i++)
+    for (int size : {16, 1024, 65536})
+      b->Args({(int)i, size});
+}
+
+void report_allocations(benchmark::State& state, uint64_t before) {
+  state.counters["allocs"] = benchmark::Counter(allocations.load() - before,
+    benchmark::Counter::kAvgIterations);
+  state.SetItemsProcessed(state.iterations());
+}
+
+void BM_DecodeRequest(benchmark::State& state) {
+  auto opcode = Synthetic::opcodes()[state.range(0)];
+  auto frame = Synthetic::request(opcode, 7, state.range(1));
+  // length prefix included, as the Decoder hands frames over
+  string_view payload = frame;
+  state.SetLabel(Zktraffic::ZKMessage::opcode_to_name(Zktraffic::enumToInt(opcode)));
+  if (!Zktraffic::ZKClientMessage::from_payload(client, server, payload)) {
+    state.SkipWithError("undecodable request");
+    return;
+  }
+
+  auto before = allocations.load();
+  for (auto _ : state) {
+    auto msg = Zktraffic::ZKClientMessage::from_payload(client, server, payload);
+    benchmark::DoNotOptimize(msg);
+  }
+  report_allocations(state, before);
+  state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_DecodeRequest)->Apply(opcode_args);
+
+void BM_DecodeReply(benchmark::State& state) {
+  auto opcode = Synthetic::opcodes()[state.range(0)];
+  auto frame = Synthetic::reply(opcode, 7, state.range(1));
+  string_view payload = frame;
+  bool connect = opcode == Opcodes::CONNECT;
+  auto decode = [&]() -> unique_ptr<Zktraffic::ZKMessage> {
+    if (connect)
+      return Zktraffic::ConnectReply::from_payload(client, server, payload);
+    return Zktraffic::ZKServerMessage::from_payload(client, server, payload,
+      Zktraffic::enumToInt(opcode));
+  };
+  state.SetLabel(Zktraffic::ZKMessage::opcode_to_name(Zktraffic::enumToInt(opcode)));
+  if (!decode()) {
+    state.SkipWithError("undecodable reply");
+    return;
+  }
+
+  auto before = allocations.load();
+  for (auto _ : state) {
+    auto msg = decode();
+    benchmark::DoNotOptimize(msg);
+  }
+  report_allocations(state, before);
+  state.SetBytesProcessed(state.iterations() * payload.size());
+}
+BENCHMARK(BM_DecodeReply)->Apply(opcode_args);
+
+void BM_DecodeWatchEvent(benchmark::State& state) {
+  auto frame = Synthetic::watch_event(Synthetic::path(7));
+  string_view payload = frame;
+
+  auto before = allocations.load();
+  for (auto _ : state) {
+    auto msg = Zktraffic::ZKServerMessage::from_payload(client, server, payload, -1);
+    benchmark::DoNotOptimize(msg);
+  }
+  report_allocations(state, before);
+}
+BENCHMARK(BM_DecodeWatchEvent);
+
+// Interning a request's path: mostly a few thousand hot ones, with one-off
+// sequential nodes mixed in (state.range(0) percent of them), more distinct
+// paths than fit so that one-offs keep being evicted.
+void BM_PathIntern(benchmark::State& state) {
+  mt19937 gen(42);
+  vector<double> weights;
+  for (int i = 1; i <= 5000; i++)
+    weights.push_back(1.0 / i);
+  discrete_distribution<int> hot(weights.begin(), weights.end());
+  uniform_int_distribution<int> percent(0, 99);
+  vector<string> paths;
+  for (int i = 0; i < 65536; i++) {
+    paths.push_back(percent(gen) < state.range(0) ? "/locks/lock-" + to_string(1000000000 + i) :
+      Synthetic::path(hot(gen)));
+  }
+
+  Zktraffic::PathInterner interner(16384);
+  size_t i = 0;
+  auto before = allocations.load();
+  for (auto _ : state)
+    benchmark::DoNotOptimize(interner.intern(paths[i++ & (paths.size() - 1)]));
+  report_allocations(state, before);
+  auto stats = interner.stats();
+  state.counters["hit_rate"] = (double)stats.hits / stats.lookups;
+  state.counters["bytes"] = stats.bytes;
+}
+BENCHMARK(BM_PathIntern)->Arg(0)->Arg(10)->Arg(50);
+
+// The whole per message path through a Decoder: stream reassembly, request
+// matching, latencies and the queue, over the synthetic mix of opcodes and
+// sizes. Messages are taken off the queue as they come, one by one (0) or
+// as MessageRecord batches (1), decoded whole (0) or lazily (1).
+void BM_DecoderMix(benchmark::State& state) {
+  static const char *labels[2][2] = {{"messages", "messages/lazy"}, {"records", "records/lazy"}};
+  bool records = state.range(0);
+  bool lazy = state.range(1);
+  state.SetLabel(labels[records][lazy]);
+
+  mt19937 gen(42);
+  vector<string> payloads;
+  for (int xid = 1; xid <= 4096; xid++) {
+    auto opcode = Synthetic::pick_opcode(gen);
+    auto size = Synthetic::pick_size(gen);
+    bool write = opcode == Opcodes::SETDATA || opcode == Opcodes::CREATE2 || opcode == Opcodes::MULTI;
+    payloads.push_back(Synthetic::request(opcode, xid, write ? size : 0));
+    payloads.push_back(Synthetic::reply(opcode, xid, write ? 0 : size));
+  }
+
+  Zktraffic::LatencyStats latencies;
+  Zktraffic::BoundedQueue<unique_ptr<Zktraffic::ZKMessage>> queue(1024);
+  Zktraffic::BoundedQueue<unique_ptr<Zktraffic::MessageBatch>> batches(16);
+  Zktraffic::Decoder decoder(latencies, queue);
+  if (records)
+    decoder.set_records(&batches);
+  decoder.set_lazy(lazy);
+  unique_ptr<Zktraffic::ZKMessage> msg;
+  unique_ptr<Zktraffic::MessageBatch> batch;
+  uint64_t timestamp = 1430935560000000;
+  uint32_t up = 1000, down = 5000;
+  size_t i = 0, bytes = 0;
+
+  auto before = allocations.load();
+  for (auto _ : state) {
+    // laps over the payloads carry on with the sequence numbers, xids
+    // repeat but by then the previous ones were answered
+    const auto& payload = payloads[i++ % payloads.size()];
+    if (i % 2)
+      decoder.handle(Zktraffic::TcpPacket(client, server, up, 0, payload), timestamp += 20);
+    else
+      decoder.handle(Zktraffic::TcpPacket(server, client, down, 0, payload), timestamp += 20);
+    (i % 2 ? up : down) += payload.size();
+    bytes += payload.size();
+    while (queue.try_pop(msg))
+      msg.reset();
+    while (batches.try_pop(batch))
+      batch.reset();
+  }
+  report_allocations(state, before);
+  state.SetBytesProcessed(bytes);
+  if (decoder.stats().undecoded > 0)
+    state.SkipWithError("undecoded frames");
+}
+BENCHMARK(BM_DecoderMix)->Args({0, 0})->Args({0, 1})->Args({1, 0})->Args({1, 1});
+
+}
@@ -0,0 +1,100 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "benchmark/benchmark.h"
+
+#include "src/event_log.h"
+
+using namespace std;
+
+namespace {
+
+// A mix of request/reply pairs from a few hundred clients over a few
+// thousand paths, 50us apart.
+vector<pair<Zktraffic::EventRecord, string>> traffic(size_t len) {
+  mt19937 gen(42);
+  uniform_int_distribution<int> clients(0, 299);
+  uniform_int_distribution<int> paths(0, 4999);
+  uniform_int_distribution<int> latencies(100, 5000);
+  auto server = Zktraffic::Endpoint::from_v4(0x0a000001, 2181);
+
+  vector<pair<Zktraffic::EventRecord, string>> rv;
+  uint64_t timestamp = 1430935560000000;
+  int64_t zxid = 0x100000000;
+  for (size_t i = 0; i < len; i += 2) {
+    Zktraffic::EventRecord request{};
+    request.timestamp = timestamp;
+    request.client = Zktraffic::Endpoint::from_v4(0x0a010000 + clients(gen), 40000);
+    request.server = server;
+    request.xid = i / 2;
+    request.size = 40;
+    request.opcode = 4;
+    request.latency = -1;
+    request.kind = Zktraffic::EventKind::REQUEST;
+    rv.emplace_back(request, "/service/members/node-" + to_string(paths(gen)));
+
+    auto reply = request;
+    reply.timestamp += latencies(gen);
+    reply.zxid = zxid++;
+    reply.size = 120;
+    reply.latency = reply.timestamp - request.timestamp;
+    reply.kind = Zktraffic::EventKind::REPLY;
+    rv.emplace_back(reply, "");
+
+    timestamp += 50;
+  }
+  return rv;
+}
+
+string write_log(size_t len) {
+  auto prefix = "/tmp/event-log-bench-" + to_string(getpid());
+  Zktraffic::EventLogWriter writer(prefix);
+  for (const auto& entry : traffic(len))
+    writer.append(entry.first, entry.second);
+  return Zktraffic::EventLogWriter::segment_name(prefix, 0);
+}
+
+void BM_EventLogAppend(benchmark::State& state) {
+  auto records = traffic(1 << 16);
+  auto prefix = "/tmp/event-log-bench-append-" + to_string(getpid());
+  Zktraffic::EventLogWriter writer(prefix);
+  size_t i = 0;
+
+  for (auto _ : state) {
+    const auto& entry = records[i++ & (records.size() - 1)];
+    writer.append(entry.first, entry.second);
+  }
+  writer.close();
+  state.SetItemsProcessed(state.iterations());
+
+  for (size_t i = 0; i < writer.segments(); i++)
+    unlink(Zktraffic::EventLogWriter::segment_name(prefix, i).c_str());
+}
+BENCHMARK(BM_EventLogAppend);
+
+void BM_EventLogScan(benchmark::State& state) {
+  auto file = write_log(1 << 20);
+  uint64_t records = 0;
+  size_t bytes = 0;
+
+  for (auto _ : state) {
+    Zktraffic::EventLogReader reader(file);
+    uint64_t latency = 0;
+    records += reader.for_each([&latency](const Zktraffic::EventRecord& record) {
+	latency += record.latency;
+      });
+    bytes = reader.bytes();
+    benchmark::DoNotOptimize(latency);
+  }
+
+  state.SetItemsProcessed(records);
+  state.SetBytesProcessed(records * sizeof(Zktraffic::EventRecord));
+  state.counters["bytes_per_record"] = (double)bytes / (1 << 20);
+  unlink(file.c_str());
+}
+BENCHMARK(BM_EventLogScan)->Unit(benchmark::kMillisecond);
+
+}
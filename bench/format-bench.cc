@@ -0,0 +1,77 @@
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "benchmark/benchmark.h"
+
+#include "bench/synthetic.h"
+#include "src/output_writer.h"
+#include "src/zkmessage.h"
+
+using namespace std;
+
+namespace {
+
+using Zktraffic::Opcodes;
+
+// requests and their replies, in the mix pipeline-bench's capture has
+const vector<unique_ptr<Zktraffic::ZKMessage>>& messages() {
+  static vector<unique_ptr<Zktraffic::ZKMessage>> rv;
+  if (!rv.empty())
+    return rv;
+
+  auto client = Zktraffic::Endpoint::from_v4(0x0201000a, 40000);
+  auto server = Zktraffic::Endpoint::from_v4(0x0100000a, 2181);
+  mt19937 gen(42);
+  while (rv.size() < 2048) {
+    auto opcode = Synthetic::pick_opcode(gen);
+    auto size = Synthetic::pick_size(gen);
+    rv.push_back(Zktraffic::ZKClientMessage::from_payload(client, server, Synthetic::request(opcode, 7, size)));
+    if (opcode == Opcodes::CONNECT)
+      rv.push_back(Zktraffic::ConnectReply::from_payload(client, server, Synthetic::reply(opcode, 7, size)));
+    else
+      rv.push_back(Zktraffic::ZKServerMessage::from_payload(client, server,
+        Synthetic::reply(opcode, 7, size), Zktraffic::enumToInt(opcode)));
+  }
+  return rv;
+}
+
+// What zkdump did: a string per message, written through a stream.
+void BM_FormatStream(benchmark::State& state) {
+  const auto& all = messages();
+  ofstream out("/dev/null");
+
+  for (auto _ : state) {
+    for (const auto& message : all)
+      out << (string)*message << "\n";
+  }
+  state.SetItemsProcessed(state.iterations() * all.size());
+}
+BENCHMARK(BM_FormatStream);
+
+// The OutputWriter, in TEXT, LINE and JSON
+void BM_FormatWriter(benchmark::State& state) {
+  static const char *formats[] = {"text", "line", "json"};
+  const auto& all = messages();
+  int fd = open("/dev/null", O_WRONLY);
+  auto format = static_cast<Zktraffic::OutputFormat>(state.range(0));
+  state.SetLabel(formats[state.range(0)]);
+
+  {
+    Zktraffic::OutputWriter writer(fd, format);
+    for (auto _ : state) {
+      for (const auto& message : all)
+	writer.write(*message);
+    }
+  }
+  close(fd);
+  state.SetItemsProcessed(state.iterations() * all.size());
+}
+BENCHMARK(BM_FormatWriter)->Arg(0)->Arg(1)->Arg(2);
+
+}
@@ -0,0 +1,77 @@
+#include <random>
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+
+#include "src/heavy_hitters.h"
+
+using namespace std;
+
+namespace {
+
+// paths with a skewed (~1/rank) popularity, like a busy ensemble
+vector<string> skewed_paths(size_t len, int keys) {
+  mt19937 gen(42);
+  vector<double> weights;
+  for (int i = 1; i <= keys; i++)
+    weights.push_back(1.0 / i);
+  discrete_distribution<int> dist(weights.begin(), weights.end());
+
+  vector<string> rv;
+  for (size_t i = 0; i < len; i++) {
+    auto key = dist(gen);
+    rv.push_back("/service/" + to_string(key % 97) + "/members/node-" + to_string(key));
+  }
+  return rv;
+}
+
+const vector<string>& paths() {
+  static auto rv = skewed_paths(1 << 16, 1000000);
+  return rv;
+}
+
+void BM_CountMinAdd(benchmark::State& state) {
+  Zktraffic::CountMinSketch sketch;
+  uint64_t i = 0;
+  for (auto _ : state)
+    sketch.add(Zktraffic::mix64(i++));
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CountMinAdd);
+
+void BM_SpaceSavingAdd(benchmark::State& state) {
+  Zktraffic::SpaceSaving<string> summary(state.range(0));
+  const auto& keys = paths();
+  size_t i = 0;
+  for (auto _ : state)
+    summary.add(keys[i++ & (keys.size() - 1)]);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SpaceSavingAdd)->Arg(256)->Arg(1024)->Arg(16384);
+
+// what a decoder pays per request: 4 tables, the lock, the prefix
+void BM_TrackerAdd(benchmark::State& state) {
+  Zktraffic::HeavyHitterTracker tracker(state.range(0), 2);
+  auto client = Zktraffic::Endpoint::from_v4(0x0100000a, 40000);
+  const auto& keys = paths();
+  size_t i = 0;
+  for (auto _ : state) {
+    client.addr[15] = i & 0xff;
+    tracker.add(client, 4, keys[i++ & (keys.size() - 1)]);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TrackerAdd)->Arg(1024)->Arg(16384);
+
+void BM_TrackerSnapshot(benchmark::State& state) {
+  Zktraffic::HeavyHitterTracker tracker(state.range(0), 2);
+  auto client = Zktraffic::Endpoint::from_v4(0x0100000a, 40000);
+  for (const auto& path : paths())
+    tracker.add(client, 4, path);
+  for (auto _ : state)
+    benchmark::DoNotOptimize(tracker.snapshot(20));
+}
+BENCHMARK(BM_TrackerSnapshot)->Arg(1024)->Arg(16384);
+
+}
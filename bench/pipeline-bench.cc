@@ -0,0 +1,184 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "benchmark/benchmark.h"
+
+#include "bench/synthetic.h"
+#include "src/bounded_queue.h"
+#include "src/sniffer.h"
+#include "src/stats.h"
+#include "src/tcp_packet.h"
+
+using namespace std;
+
+namespace {
+
+// the frame a GetData reply with size bytes of data goes in, kind being
+// plain Ethernet, 802.1Q or IPv6
+string frame(int kind, size_t size) {
+  auto payload = Synthetic::reply(Zktraffic::Opcodes::GETDATA, 7, size);
+  auto v4 = Synthetic::ipv4_frame(0x0a000001, 2181, 0x0a010001, 40000, 1000, 0x08, payload);
+  switch (kind) {
+  case 1:
+    return Synthetic::vlan_frame(v4);
+  case 2:
+    return Synthetic::ipv6_frame(1, 2181, 2, 40000, 1000, 0x08, payload);
+  default:
+    return v4;
+  }
+}
+
+void BM_FromPcap(benchmark::State& state) {
+  static const char *kinds[] = {"ipv4", "vlan", "ipv6"};
+  auto data = frame(state.range(0), 64);
+  struct pcap_pkthdr header{};
+  header.caplen = header.len = data.size();
+  Zktraffic::TcpPacket packet;
+  state.SetLabel(kinds[state.range(0)]);
+
+  for (auto _ : state) {
+    bool ok = Zktraffic::TcpPacket::from_pcap(&header, (const u_char *)data.data(), packet);
+    benchmark::DoNotOptimize(ok);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_FromPcap)->Arg(0)->Arg(1)->Arg(2);
+
+// a synthetic capture, for the whole run
+struct CaptureFile {
+  CaptureFile() : name("/tmp/pipeline-bench-" + to_string(getpid()) + ".pcap"),
+    capture(Synthetic::write_capture(name, 50000, 200)) {}
+  ~CaptureFile() { unlink(name.c_str()); }
+
+  string name;
+  Synthetic::Capture capture;
+};
+
+// End to end: reading a capture, decoding it and consuming every message,
+// on the capture thread (0) or with decode workers.
+void BM_PcapFile(benchmark::State& state) {
+  static CaptureFile file;
+  const auto& capture = file.capture;
+
+  Zktraffic::SnifferOptions options;
+  options.workers = state.range(0);
+  uint64_t messages = 0;
+  for (auto _ : state) {
+    Zktraffic::Sniffer sniffer(file.name, "tcp port 2181", true, options);
+    sniffer.run();
+    for (;;) {
+      auto batch = sniffer.get_batch(256);
+      if (batch.empty())
+	break;
+      messages += batch.size();
+    }
+    sniffer.wait();
+  }
+
+  if (messages != state.iterations() * capture.messages)
+    state.SkipWithError("messages lost");
+  state.SetBytesProcessed(state.iterations() * capture.bytes);
+  state.SetItemsProcessed(messages);
+  state.counters["packets"] = capture.packets;
+}
+BENCHMARK(BM_PcapFile)->Arg(0)->Arg(2)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+// workers, records, lazy
+void stats_args(benchmark::internal::Benchmark *b) {
+  for (int workers : {0, 2})
+    for (int records : {0, 1})
+      for (int lazy : {0, 1})
+	b->Args({workers, records, lazy});
+}
+
+// The same, aggregating into stats (as zkdump -s does) from messages (0)
+// or from MessageRecord batches (1), decoded whole (0) or lazily (1).
+void BM_PcapFileStats(benchmark::State& state) {
+  static CaptureFile file;
+  const auto& capture = file.capture;
+
+  Zktraffic::SnifferOptions options;
+  options.workers = state.range(0);
+  options.records = state.range(1);
+  options.lazy = state.range(2);
+  uint64_t messages = 0;
+  for (auto _ : state) {
+    Zktraffic::StatsAggregator stats;
+    Zktraffic::Sniffer sniffer(file.name, "tcp port 2181", true, options);
+    sniffer.run();
+    if (options.records) {
+      while (auto batch = sniffer.get_records()) {
+	for (size_t i = stats.add(*batch); i < batch->size(); i = stats.add(*batch, i))
+	  stats.rotate(batch->timestamps()[i]);
+	messages += batch->size();
+      }
+    } else {
+      for (;;) {
+	auto batch = sniffer.get_batch(256);
+	if (batch.empty())
+	  break;
+	for (const auto& message : batch) {
+	  if (stats.expired(message->timestamp()))
+	    stats.rotate(message->timestamp());
+	  stats.add(*message);
+	}
+	messages += batch.size();
+      }
+    }
+    sniffer.wait();
+    benchmark::DoNotOptimize(stats.rotate());
+  }
+
+  if (messages != state.iterations() * capture.messages)
+    state.SkipWithError("messages lost");
+  state.SetBytesProcessed(state.iterations() * capture.bytes);
+  state.SetItemsProcessed(messages);
+}
+BENCHMARK(BM_PcapFileStats)->Apply(stats_args)->UseRealTime()
+  ->Unit(benchmark::kMillisecond);
+
+// What handing messages from a decoder to a consumer costs, per message:
+// one at a time or in batches of state.range(0).
+void BM_QueueHandoff(benchmark::State& state) {
+  const size_t batch = state.range(0);
+  const uint64_t count = 1 << 16;
+  vector<unique_ptr<int>> out;
+
+  for (auto _ : state) {
+    Zktraffic::BoundedQueue<unique_ptr<int>> queue(4096, Zktraffic::Overflow::BLOCK, true);
+    thread producer([&queue, count] {
+      for (uint64_t i = 0; i < count; i++)
+	queue.push(unique_ptr<int>(new int(i)));
+      queue.close();
+    });
+
+    unique_ptr<int> item;
+    if (batch <= 1) {
+      while (queue.pop(item))
+	item.reset();
+    } else {
+      while (queue.pop_batch(out, batch) > 0)
+	out.clear();
+    }
+    producer.join();
+  }
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_QueueHandoff)->Arg(1)->Arg(64)->Arg(256)->UseRealTime();
+
+// the same without another thread: the queue's own bookkeeping
+void BM_QueuePushPop(benchmark::State& state) {
+  Zktraffic::BoundedQueue<unique_ptr<int>> queue(4096);
+  unique_ptr<int> item(new int(0));
+  for (auto _ : state) {
+    queue.push(move(item));
+    queue.try_pop(item);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_QueuePushPop);
+
+}
@@ -0,0 +1,400 @@
+#pragma once
+
+#include <arpa/inet.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "src/zkmessage.h"
+
+using namespace std;
+
+// Synthetic ZooKeeper traffic for the benchmarks: jute encoded requests and
+// replies for every opcode the decoders know, with payloads of a given
+// size, and whole pcap files of client connections doing a mix of them.
+namespace Synthetic {
+
+using Zktraffic::Opcodes;
+using Zktraffic::enumToInt;
+
+class Writer {
+public:
+  Writer& i32(int32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out_ += (char)((uint32_t)v >> shift);
+    return *this;
+  }
+  Writer& i64(int64_t v) { return i32(v >> 32).i32(v & 0xffffffff); }
+  Writer& boolean(bool v) { out_ += (char)v; return *this; }
+  Writer& str(const string& s) { i32(s.size()); out_ += s; return *this; }
+  Writer& strs(const vector<string>& v) {
+    i32(v.size());
+    for (const auto& s : v)
+      str(s);
+    return *this;
+  }
+  Writer& acls() { return i32(1).i32(31).str("world").str("anyone"); }
+  Writer& stat() { out_.append(68, '\0'); return *this; }
+  Writer& request_header(int xid, Opcodes opcode) { return i32(xid).i32(enumToInt(opcode)); }
+  Writer& reply_header(int xid, int64_t zxid = 0x100000001, int err = 0) { return i32(xid).i64(zxid).i32(err); }
+  Writer& multi_header(int type, bool done, int err) { return i32(type).boolean(done).i32(err); }
+  // with the length prefix, as it goes on the wire
+  string frame() const { return Writer().i32(out_.size()).out_ + out_; }
+
+private:
+  string out_;
+};
+
+// Everything with its own decoding path, each of the opcodes ZKClientMessage
+// and ZKServerMessage handle.
+inline const vector<Opcodes>& opcodes() {
+  static const vector<Opcodes> rv = {
+    Opcodes::CONNECT, Opcodes::CREATE, Opcodes::DELETE, Opcodes::EXISTS, Opcodes::GETDATA,
+    Opcodes::SETDATA, Opcodes::GETACL, Opcodes::SETACL, Opcodes::GETCHILDREN, Opcodes::SYNC,
+    Opcodes::PING, Opcodes::GETCHILDREN2, Opcodes::CHECK, Opcodes::MULTI, Opcodes::CREATE2,
+    Opcodes::RECONFIG, Opcodes::CHECKWATCHES, Opcodes::REMOVEWATCHES, Opcodes::CREATECONTAINER,
+    Opcodes::DELETECONTAINER, Opcodes::CREATETTL, Opcodes::MULTIREAD, Opcodes::SETAUTH,
+    Opcodes::SETWATCHES, Opcodes::GETEPHEMERALS, Opcodes::GETALLCHILDRENNUMBER,
+    Opcodes::SETWATCHES2, Opcodes::ADDWATCH, Opcodes::CLOSE,
+  };
+  return rv;
+}
+
+inline string path(size_t i) {
+  return "/service/members/node-" + to_string(i);
+}
+
+// size is what the request carries: data for writes, path lists for the
+// watch and multi ones; requests without either ignore it
+inline string request(Opcodes opcode, int xid, size_t size) {
+  Writer w;
+  string data(size, 'd');
+  vector<string> paths;
+  for (size_t i = 0; i * 32 < size; i++)
+    paths.push_back(path(i));
+
+  switch (opcode) {
+  case Opcodes::CONNECT:
+    w.i32(0).i64(0x100000001).i32(10000).i64(0).str(string(16, '\0')).boolean(false);
+    break;
+  case Opcodes::PING:
+    w.request_header(Zktraffic::PING_XID, opcode);
+    break;
+  case Opcodes::SETAUTH:
+    w.request_header(Zktraffic::AUTH_XID, opcode).i32(0).str("digest").str(data);
+    break;
+  case Opcodes::GETDATA:
+  case Opcodes::EXISTS:
+  case Opcodes::GETCHILDREN:
+  case Opcodes::GETCHILDREN2:
+    w.request_header(xid, opcode).str(path(xid)).boolean(true);
+    break;
+  case Opcodes::CREATE:
+  case Opcodes::CREATE2:
+  case Opcodes::CREATECONTAINER:
+    w.request_header(xid, opcode).str(path(xid)).str(data).acls()
+      .i32(opcode == Opcodes::CREATECONTAINER ? 4 : 1);
+    break;
+  case Opcodes::CREATETTL:
+    w.request_header(xid, opcode).str(path(xid)).str(data).acls().i32(5).i64(60000);
+    break;
+  case Opcodes::SETDATA:
+    w.request_header(xid, opcode).str(path(xid)).str(data).i32(-1);
+    break;
+  case Opcodes::DELETE:
+  case Opcodes::CHECK:
+    w.request_header(xid, opcode).str(path(xid)).i32(-1);
+    break;
+  case Opcodes::SYNC:
+  case Opcodes::GETACL:
+  case Opcodes::DELETECONTAINER:
+  case Opcodes::GETEPHEMERALS:
+  case Opcodes::GETALLCHILDRENNUMBER:
+    w.request_header(xid, opcode).str(path(xid));
+    break;
+  case Opcodes::SETACL:
+    w.request_header(xid, opcode).str(path(xid)).acls().i32(-1);
+    break;
+  case Opcodes::MULTI:
+    w.request_header(xid, opcode)
+      .multi_header(enumToInt(Opcodes::CHECK), false, -1).str(path(0)).i32(3)
+      .multi_header(enumToInt(Opcodes::CREATE), false, -1).str(path(1)).str(data).acls().i32(0)
+      .multi_header(enumToInt(Opcodes::SETDATA), false, -1).str(path(2)).str(data).i32(4)
+      .multi_header(enumToInt(Opcodes::DELETE), false, -1).str(path(3)).i32(-1)
+      .multi_header(-1, true, -1);
+    break;
+  case Opcodes::MULTIREAD:
+    w.request_header(xid, opcode);
+    for (size_t i = 0; i < max<size_t>(paths.size(), 2); i++) {
+      w.multi_header(enumToInt(i % 2 ? Opcodes::GETCHILDREN : Opcodes::GETDATA), false, -1)
+	.str(path(i)).boolean(false);
+    }
+    w.multi_header(-1, true, -1);
+    break;
+  case Opcodes::RECONFIG:
+    w.request_header(xid, opcode).str("server.4=10.0.0.4:2888:3888;2181").str("").str("").i64(-1);
+    break;
+  case Opcodes::SETWATCHES:
+    w.request_header(Zktraffic::SET_WATCHES_XID, opcode).i64(0x100000001)
+      .strs(paths).strs({}).strs(paths);
+    break;
+  case Opcodes::SETWATCHES2:
+    w.request_header(Zktraffic::SET_WATCHES_XID, opcode).i64(0x100000001)
+      .strs(paths).strs({}).strs(paths).strs({}).strs({path(0)});
+    break;
+  case Opcodes::ADDWATCH:
+    w.request_header(xid, opcode).str(path(xid)).i32(1);
+    break;
+  case Opcodes::REMOVEWATCHES:
+  case Opcodes::CHECKWATCHES:
+    w.request_header(xid, opcode).str(path(xid)).i32(1);
+    break;
+  case Opcodes::CLOSE:
+    w.request_header(xid, opcode);
+    break;
+  default:
+    break;
+  }
+
+  return w.frame();
+}
+
+// size is what the reply carries: data, or the children listed
+inline string reply(Opcodes opcode, int xid, size_t size) {
+  Writer w;
+  string data(size, 'd');
+  vector<string> names;
+  for (size_t i = 0; i * 16 < size; i++)
+    names.push_back("node-" + to_string(i));
+
+  switch (opcode) {
+  case Opcodes::CONNECT:
+    // no reply header
+    w.i32(0).i32(10000).i64(0x10006cf708c0003).str(string(16, 'p')).boolean(false);
+    break;
+  case Opcodes::PING:
+    w.reply_header(Zktraffic::PING_XID);
+    break;
+  case Opcodes::SETAUTH:
+    w.reply_header(Zktraffic::AUTH_XID);
+    break;
+  case Opcodes::GETDATA:
+    w.reply_header(xid).str(data).stat();
+    break;
+  case Opcodes::CREATE:
+  case Opcodes::SYNC:
+    w.reply_header(xid).str(path(xid));
+    break;
+  case Opcodes::CREATE2:
+  case Opcodes::CREATECONTAINER:
+  case Opcodes::CREATETTL:
+    w.reply_header(xid).str(path(xid)).stat();
+    break;
+  case Opcodes::SETDATA:
+  case Opcodes::EXISTS:
+  case Opcodes::SETACL:
+    w.reply_header(xid).stat();
+    break;
+  case Opcodes::GETCHILDREN:
+    w.reply_header(xid).strs(names);
+    break;
+  case Opcodes::GETCHILDREN2:
+    w.reply_header(xid).strs(names).stat();
+    break;
+  case Opcodes::GETEPHEMERALS:
+    w.reply_header(xid).strs(names);
+    break;
+  case Opcodes::GETACL:
+    w.reply_header(xid).acls().stat();
+    break;
+  case Opcodes::RECONFIG:
+    w.reply_header(xid).str(data).stat();
+    break;
+  case Opcodes::GETALLCHILDRENNUMBER:
+    w.reply_header(xid).i32(names.size());
+    break;
+  case Opcodes::MULTI:
+    w.reply_header(xid)
+      .multi_header(enumToInt(Opcodes::CHECK), false, 0)
+      .multi_header(enumToInt(Opcodes::CREATE), false, 0).str(path(1))
+      .multi_header(enumToInt(Opcodes::SETDATA), false, 0).stat()
+      .multi_header(enumToInt(Opcodes::DELETE), false, 0)
+      .multi_header(-1, true, -1);
+    break;
+  case Opcodes::MULTIREAD:
+    w.reply_header(xid);
+    for (size_t i = 0; i < 2; i++) {
+      if (i % 2)
+	w.multi_header(enumToInt(Opcodes::GETCHILDREN), false, 0).strs(names);
+      else
+	w.multi_header(enumToInt(Opcodes::GETDATA), false, 0).str(data).stat();
+    }
+    w.multi_header(-1, true, -1);
+    break;
+  default:
+    // just the header: DELETE, CHECK, CLOSE, the watch management ones
+    w.reply_header(xid);
+    break;
+  }
+
+  return w.frame();
+}
+
+inline string watch_event(const string& path) {
+  return Writer().reply_header(Zktraffic::WATCH_XID, -1).i32(3).i32(3).str(path).frame();
+}
+
+// Ethernet + IPv4 + TCP, addresses in host byte order
+inline string ipv4_frame(uint32_t src, uint16_t sport, uint32_t dst, uint16_t dport,
+  uint32_t seq, uint8_t flags, const string& payload) {
+  string rv;
+  auto u8 = [&rv](unsigned v) { rv += (char)v; };
+  auto u16 = [&u8](unsigned v) { u8(v >> 8); u8(v & 0xff); };
+  auto u32 = [&u16](uint32_t v) { u16(v >> 16); u16(v & 0xffff); };
+
+  rv.append(12, '\x02');
+  u16(0x0800);
+  u8(0x45); u8(0); u16(20 + 20 + payload.size()); u16(0); u16(0x4000);
+  u8(64); u8(6); u16(0); u32(src); u32(dst);
+  u16(sport); u16(dport); u32(seq); u32(0); u8(5 << 4); u8(flags | 0x10); u16(65535);
+  u16(0); u16(0);
+  return rv + payload;
+}
+
+// the same with an 802.1Q tag
+inline string vlan_frame(const string& ipv4_frame, uint16_t vlan = 100) {
+  string tag{'\x81', '\x00', (char)(vlan >> 8), (char)(vlan & 0xff)};
+  return ipv4_frame.substr(0, 12) + tag + ipv4_frame.substr(12);
+}
+
+// Ethernet + IPv6 + TCP, between fd00::<src> and fd00::<dst>
+inline string ipv6_frame(uint16_t src, uint16_t sport, uint16_t dst, uint16_t dport,
+  uint32_t seq, uint8_t flags, const string& payload) {
+  string rv;
+  auto u8 = [&rv](unsigned v) { rv += (char)v; };
+  auto u16 = [&u8](unsigned v) { u8(v >> 8); u8(v & 0xff); };
+  auto u32 = [&u16](uint32_t v) { u16(v >> 16); u16(v & 0xffff); };
+  auto addr = [&](uint16_t host) { u16(0xfd00); rv.append(12, '\0'); u16(host); };
+
+  rv.append(12, '\x02');
+  u16(0x86dd);
+  u32(0x60000000); u16(20 + payload.size()); u8(6); u8(64); addr(src); addr(dst);
+  u16(sport); u16(dport); u32(seq); u32(0); u8(5 << 4); u8(flags | 0x10); u16(65535);
+  u16(0); u16(0);
+  return rv + payload;
+}
+
+// A classic pcap file, written as frames come.
+class PcapWriter {
+public:
+  explicit PcapWriter(const string& path, uint32_t linktype = 1) : file_(fopen(path.c_str(), "wb")) {
+    uint32_t header[6] = {0xa1b2c3d4, 0x00040002, 0, 0, 65535, linktype};
+    fwrite(header, sizeof(header), 1, file_);
+  }
+  ~PcapWriter() { close(); }
+
+  void add(uint64_t timestamp, const string& frame) {
+    uint32_t header[4] = {(uint32_t)(timestamp / 1000000), (uint32_t)(timestamp % 1000000),
+      (uint32_t)frame.size(), (uint32_t)frame.size()};
+    fwrite(header, sizeof(header), 1, file_);
+    fwrite(frame.data(), frame.size(), 1, file_);
+    bytes_ += sizeof(header) + frame.size();
+  }
+
+  void close() {
+    if (file_ != nullptr)
+      fclose(file_);
+    file_ = nullptr;
+  }
+
+  uint64_t bytes() const { return bytes_; }
+
+private:
+  FILE *file_;
+  uint64_t bytes_ = 24;
+};
+
+// Read heavy, like most ensembles: mostly reads and pings, some writes.
+inline Opcodes pick_opcode(mt19937& gen) {
+  static const vector<pair<Opcodes, double>> mix = {
+    {Opcodes::GETDATA, 40}, {Opcodes::EXISTS, 15}, {Opcodes::GETCHILDREN2, 10},
+    {Opcodes::GETCHILDREN, 2}, {Opcodes::PING, 10}, {Opcodes::SETDATA, 10},
+    {Opcodes::CREATE2, 5}, {Opcodes::DELETE, 4}, {Opcodes::MULTI, 2}, {Opcodes::CHECK, 1},
+    {Opcodes::SYNC, 1},
+  };
+  static discrete_distribution<int> dist = [] {
+    vector<double> weights;
+    for (const auto& entry : mix)
+      weights.push_back(entry.second);
+    return discrete_distribution<int>(weights.begin(), weights.end());
+  }();
+  return mix[dist(gen)].first;
+}
+
+// Mostly small payloads with a long tail: 70% under 128 bytes, 25% up to
+// 4K, 5% up to 64K.
+inline size_t pick_size(mt19937& gen) {
+  uniform_real_distribution<double> bucket(0, 1);
+  auto b = bucket(gen);
+  if (b < 0.70)
+    return uniform_int_distribution<size_t>(0, 127)(gen);
+  if (b < 0.95)
+    return uniform_int_distribution<size_t>(128, 4095)(gen);
+  return uniform_int_distribution<size_t>(4096, 65535)(gen);
+}
+
+struct Capture {
+  uint64_t bytes;
+  uint64_t packets;
+  uint64_t messages;
+};
+
+// exchanges request/reply pairs from `clients` connections to one server,
+// in MSS sized segments, 20us apart
+inline Capture write_capture(const string& file, size_t exchanges, int clients, unsigned seed = 42) {
+  const size_t MSS = 1448;
+  const uint32_t server = 0x0a000001;
+  mt19937 gen(seed);
+  uniform_int_distribution<int> pick_client(0, clients - 1);
+  vector<uint32_t> client_seq(clients, 1000), server_seq(clients, 5000);
+  vector<int> xids(clients, 1);
+
+  PcapWriter writer(file);
+  uint64_t timestamp = 1430935560000000;
+  Capture rv{0, 0, 0};
+
+  auto send = [&](int client, bool from_client, const string& payload) {
+    auto& seq = from_client ? client_seq[client] : server_seq[client];
+    uint32_t addr = 0x0a010000 + client;
+    uint16_t port = 30000 + client;
+    for (size_t offset = 0; offset < payload.size(); offset += MSS) {
+      auto segment = payload.substr(offset, MSS);
+      auto frame = from_client ? ipv4_frame(addr, port, server, 2181, seq, 0x08, segment) :
+	ipv4_frame(server, 2181, addr, port, seq, 0x08, segment);
+      writer.add(timestamp, frame);
+      seq += segment.size();
+      timestamp += 20;
+      rv.packets++;
+    }
+  };
+
+  for (size_t i = 0; i < exchanges; i++) {
+    int client = pick_client(gen);
+    auto opcode = pick_opcode(gen);
+    auto size = pick_size(gen);
+    int xid = xids[client]++;
+    bool write = opcode == Opcodes::SETDATA || opcode == Opcodes::CREATE2 || opcode == Opcodes::MULTI;
+    send(client, true, request(opcode, xid, write ? size : 0));
+    send(client, false, reply(opcode, xid, write ? 0 : size));
+    rv.messages += 2;
+  }
+
+  writer.close();
+  rv.bytes = writer.bytes();
+  return rv;
+}
+
+}
@@ -0,0 +1,230 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace Zktraffic {
+
+// What push() does when the queue is full.
+enum class Overflow {
+  BLOCK,        // wait for a consumer (backpressure on the producer)
+  DROP_NEWEST,  // discard the item being pushed
+  DROP_OLDEST,  // discard the item at the head to make room
+};
+
+// Bounded lock-free queue, a ring of cells with per-cell sequence numbers
+// (Vyukov's MPMC design). With single_producer the tail is advanced with a
+// plain store instead of a CAS; consumers always claim cells with a CAS so
+// several of them can pop concurrently.
+//
+// Nobody takes a lock unless they have to sleep: a blocked consumer (empty)
+// or producer (full, Overflow::BLOCK) registers itself and the other side
+// only touches the mutex when someone is registered.
+//
+// After close() pushes fail and pops drain what's left, then fail.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity, Overflow overflow = Overflow::BLOCK,
+      bool single_producer = true)
+      : capacity_(round_up(capacity)), mask_(capacity_ - 1), overflow_(overflow),
+	single_producer_(single_producer), cells_(new Cell[capacity_]) {
+    for (size_t i = 0; i < capacity_; i++)
+      cells_[i].seq.store(i, memory_order_relaxed);
+  }
+  BoundedQueue(const BoundedQueue&) = delete;
+  BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+  // Returns false if the item was dropped (full and not blocking, or closed).
+  bool push(T&& item) {
+    for (int spins = 0; ; spins++) {
+      if (closed_.load(memory_order_acquire))
+	return false;
+      if (try_push(item))
+	return true;
+
+      switch (overflow_) {
+      case Overflow::DROP_NEWEST:
+	dropped_.fetch_add(1, memory_order_relaxed);
+	return false;
+      case Overflow::DROP_OLDEST: {
+	T oldest;
+	if (try_pop(oldest))
+	  dropped_.fetch_add(1, memory_order_relaxed);
+	break;
+      }
+      case Overflow::BLOCK:
+	if (spins < SPINS)
+	  this_thread::yield();
+	else
+	  wait(producers_waiting_, [this] { return !full(); });
+	break;
+      }
+    }
+  }
+
+  bool try_push(T& item) {
+    size_t pos = tail_.load(memory_order_relaxed);
+    Cell *cell;
+
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+      if (diff == 0) {
+	if (single_producer_) {
+	  tail_.store(pos + 1, memory_order_relaxed);
+	  break;
+	}
+	if (tail_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+	  break;
+      } else if (diff < 0) {
+	return false;
+      } else {
+	pos = tail_.load(memory_order_relaxed);
+      }
+    }
+
+    cell->value = move(item);
+    cell->seq.store(pos + 1, memory_order_release);
+
+    size_t size = pos + 1 - head_.load(memory_order_relaxed);
+    size_t high = high_water_.load(memory_order_relaxed);
+    while (size > high && !high_water_.compare_exchange_weak(high, size, memory_order_relaxed))
+      ;
+
+    wake(consumers_waiting_);
+    return true;
+  }
+
+  bool try_pop(T& item) {
+    size_t pos = head_.load(memory_order_relaxed);
+    Cell *cell;
+
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(memory_order_acquire);
+      intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (diff == 0) {
+	if (head_.compare_exchange_weak(pos, pos + 1, memory_order_relaxed))
+	  break;
+      } else if (diff < 0) {
+	return false;
+      } else {
+	pos = head_.load(memory_order_relaxed);
+      }
+    }
+
+    item = move(cell->value);
+    cell->seq.store(pos + capacity_, memory_order_release);
+
+    wake(producers_waiting_);
+    return true;
+  }
+
+  // Blocks until there's an item; false once closed and drained.
+  bool pop(T& item) {
+    for (;;) {
+      if (try_pop(item))
+	return true;
+      if (closed_.load(memory_order_acquire) && empty())
+	return try_pop(item);
+      wait(consumers_waiting_, [this] { return !empty() || closed_.load(memory_order_acquire); });
+    }
+  }
+
+  // Blocks until there's at least one item, then takes up to max without
+  // waiting any further. Returns how many were appended to out (0 once
+  // closed and drained).
+  size_t pop_batch(vector<T>& out, size_t max) {
+    T item;
+    if (max == 0 || !pop(item))
+      return 0;
+
+    out.push_back(move(item));
+    size_t count = 1;
+    while (count < max && try_pop(item)) {
+      out.push_back(move(item));
+      count++;
+    }
+    return count;
+  }
+
+  void close() {
+    closed_.store(true, memory_order_release);
+    lock_guard<mutex> guard(mutex_);
+    cv_.notify_all();
+  }
+
+  bool closed() const { return closed_.load(memory_order_acquire); }
+  size_t capacity() const { return capacity_; }
+  size_t size() const {
+    size_t head = head_.load(memory_order_acquire);
+    size_t tail = tail_.load(memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() >= capacity_; }
+  uint64_t dropped() const { return dropped_.load(memory_order_relaxed); }
+  size_t high_water() const { return high_water_.load(memory_order_relaxed); }
+
+private:
+  static const int SPINS = 64;
+
+  struct Cell {
+    atomic<size_t> seq;
+    T value;
+  };
+
+  static size_t round_up(size_t capacity) {
+    size_t rv = 2;
+    while (rv < capacity)
+      rv <<= 1;
+    return rv;
+  }
+
+  template <typename Ready>
+  void wait(atomic<int>& waiting, Ready ready) {
+    unique_lock<mutex> guard(mutex_);
+    waiting.fetch_add(1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    // the timeout only guards against a missed wakeup, it shouldn't happen
+    cv_.wait_for(guard, chrono::milliseconds(100), ready);
+    waiting.fetch_sub(1, memory_order_relaxed);
+  }
+
+  void wake(atomic<int>& waiting) {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (waiting.load(memory_order_relaxed) > 0) {
+      lock_guard<mutex> guard(mutex_);
+      cv_.notify_all();
+    }
+  }
+
+  const size_t capacity_;
+  const size_t mask_;
+  const Overflow overflow_;
+  const bool single_producer_;
+  unique_ptr<Cell[]> cells_;
+
+  alignas(64) atomic<size_t> tail_{0};
+  alignas(64) atomic<size_t> head_{0};
+  alignas(64) atomic<uint64_t> dropped_{0};
+  atomic<size_t> high_water_{0};
+  atomic<bool> closed_{false};
+  atomic<int> producers_waiting_{0};
+  atomic<int> consumers_waiting_{0};
+  mutex mutex_;
+  condition_variable cv_;
+};
+
+}
@@ -0,0 +1,253 @@
+#include "decoder.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace Zktraffic {
+
+DecoderStats& DecoderStats::operator+=(const DecoderStats& other) {
+  packets += other.packets;
+  ignored += other.ignored;
+  frames += other.frames;
+  requests += other.requests;
+  replies += other.replies;
+  watches += other.watches;
+  undecoded += other.undecoded;
+  unmatched += other.unmatched;
+  evictions += other.evictions;
+  in_flight += other.in_flight;
+  streams += other.streams;
+  for (int i = 0; i < OPCODE_SLOTS; i++)
+    requests_by_opcode[i] += other.requests_by_opcode[i];
+  for (int i = 0; i < ServerSet::MAX_ENSEMBLES; i++) {
+    requests_by_ensemble[i] += other.requests_by_ensemble[i];
+    replies_by_ensemble[i] += other.replies_by_ensemble[i];
+  }
+  paths += other.paths;
+  return *this;
+}
+
+DecoderStats Decoder::stats() const {
+  DecoderStats rv;
+
+  rv.packets = counters_.packets.load(memory_order_relaxed);
+  rv.ignored = counters_.ignored.load(memory_order_relaxed);
+  rv.frames = counters_.frames.load(memory_order_relaxed);
+  rv.requests = counters_.requests.load(memory_order_relaxed);
+  rv.replies = counters_.replies.load(memory_order_relaxed);
+  rv.watches = counters_.watches.load(memory_order_relaxed);
+  rv.undecoded = counters_.undecoded.load(memory_order_relaxed);
+  rv.unmatched = counters_.unmatched.load(memory_order_relaxed);
+  rv.evictions = counters_.evictions.load(memory_order_relaxed);
+  rv.in_flight = counters_.in_flight.load(memory_order_relaxed);
+  rv.streams = counters_.streams.load(memory_order_relaxed);
+  for (int i = 0; i < OPCODE_SLOTS; i++)
+    rv.requests_by_opcode[i] = counters_.requests_by_opcode[i].load(memory_order_relaxed);
+  for (int i = 0; i < ServerSet::MAX_ENSEMBLES; i++) {
+    rv.requests_by_ensemble[i] = counters_.requests_by_ensemble[i].load(memory_order_relaxed);
+    rv.replies_by_ensemble[i] = counters_.replies_by_ensemble[i].load(memory_order_relaxed);
+  }
+  if (paths_ != nullptr)
+    rv.paths = paths_->stats();
+
+  return rv;
+}
+
+void Decoder::handle(const TcpPacket& packet, uint64_t timestamp) {
+  bump(counters_.packets);
+
+  // the client is whoever talks to a server
+  int ensemble = servers_.ensemble(packet.dst());
+  bool from_client = ensemble >= 0;
+  if (!from_client && (ensemble = servers_.ensemble(packet.src())) < 0) {
+    if (quorum_ == nullptr || !quorum_->handle(packet, timestamp))
+      bump(counters_.ignored);
+    return;
+  }
+
+  auto flow = packet.flow();
+  if (packet.rst()) {
+    streams_.erase(flow);
+    streams_.erase(flow.reversed());
+    sessions_.disconnected(flow);
+    return;
+  }
+
+  auto& tcp_stream = stream(flow, timestamp / 1000000);
+  if (packet.syn())
+    tcp_stream.sync(packet.seq());
+
+  auto payload = packet.payload();
+  if (!payload.empty()) {
+    auto conn = from_client ? flow : flow.reversed();
+    tcp_stream.consume(packet.seq(), payload.data(), payload.size(),
+      [&](string_view frame) { handle_frame(conn, from_client, ensemble, timestamp, frame); });
+  }
+
+  if (packet.fin()) {
+    streams_.erase(flow);
+    sessions_.disconnected(flow);
+  }
+
+  counters_.streams.store(streams_.size(), memory_order_relaxed);
+  counters_.in_flight.store(requests_.size(), memory_order_relaxed);
+  counters_.unmatched.store(requests_.unmatched(), memory_order_relaxed);
+  counters_.evictions.store(requests_.evictions(), memory_order_relaxed);
+}
+
+void Decoder::handle_frame(const FlowKey& conn, bool from_client, int ensemble, uint64_t timestamp,
+  string_view frame) {
+  const auto& client = conn.src;
+  const auto& server = conn.dst;
+
+  bump(counters_.frames);
+
+  // batched messages are done with before frame goes away
+  bool copy = records_ == nullptr;
+
+  // extract zk requests/replies
+  unique_ptr<ZKMessage> message;
+  if (from_client) {
+    if (lazy_)
+      message = LazyRequest::from_payload(client, server, frame, copy, paths_.get());
+    else
+      message = ZKClientMessage::from_payload(client, server, frame, paths_.get());
+    if (message != nullptr) {
+      auto client_msg = dynamic_cast<ZKClientMessage *>(message.get());
+      requests_.add(conn, client_msg->xid(), client_msg->opcode(), timestamp);
+      bump(counters_.requests);
+      bump(counters_.requests_by_ensemble[ensemble]);
+      auto index = opcode_index(client_msg->opcode());
+      if (index >= 0)
+	bump(counters_.requests_by_opcode[index]);
+      if (heavy_hitters_ != nullptr)
+	heavy_hitters_->add(client, client_msg->opcode(), client_msg->path());
+      track_session(conn, *client_msg, timestamp);
+    }
+  } else {
+    int xid;
+    RequestTable::Request request{-1, 0};
+    unique_ptr<ZKServerMessage> reply;
+    if (sessions_.connecting(conn)) {
+      // no reply header, it goes with the ConnectRequest
+      xid = CONNECT_XID;
+      requests_.take(conn, xid, request);
+      auto connect = ConnectReply::from_payload(client, server, frame);
+      // either way the handshake is over, what follows are plain replies
+      if (connect != nullptr)
+	sessions_.connect_reply(conn, connect->session(), connect->timeout(), connect->readonly(), timestamp);
+      else
+	sessions_.connect_failed(conn);
+      reply = move(connect);
+    } else {
+      xid = ZKServerMessage::xid_from_payload(frame);
+      if (xid != WATCH_XID)
+	requests_.take(conn, xid, request);
+      if (lazy_)
+	reply = LazyReply::from_payload(client, server, frame, request.opcode, copy, paths_.get());
+      else
+	reply = ZKServerMessage::from_payload(client, server, frame, request.opcode, paths_.get());
+      if (reply != nullptr && request.opcode == enumToInt(Opcodes::CLOSE))
+	sessions_.close_reply(conn);
+    }
+
+    if (reply != nullptr && request.opcode != -1 && timestamp >= request.timestamp) {
+      reply->set_latency(timestamp - request.timestamp);
+      latencies_.record(conn, request.opcode, timestamp - request.timestamp,
+	per_ensemble_ ? ensemble : -1);
+    }
+    if (reply != nullptr && xid == WATCH_XID) {
+      bump(counters_.watches);
+    } else if (reply != nullptr) {
+      bump(counters_.replies);
+      bump(counters_.replies_by_ensemble[ensemble]);
+    }
+    message = move(reply);
+  }
+
+  if (message == nullptr) {
+    bump(counters_.undecoded);
+    return;
+  }
+
+  message->set_timestamp(timestamp);
+  message->set_size(frame.size());
+
+  if (records_ != nullptr) {
+    if (batch_ == nullptr)
+      batch_.reset(new MessageBatch(record_frames_));
+    batch_->add(*message, frame);
+    if (batch_->full())
+      flush();
+    return;
+  }
+
+  // add to the queue
+  out_.push(move(message));
+}
+
+void Decoder::flush() {
+  if (batch_ != nullptr && !batch_->empty())
+    records_->push(move(batch_));
+  batch_.reset();
+}
+
+void Decoder::track_session(const FlowKey& conn, const ZKClientMessage& msg, uint64_t timestamp) {
+  switch (msg.opcode()) {
+  case enumToInt(Opcodes::CONNECT): {
+    auto& connect = static_cast<const ConnectRequest&>(msg);
+    sessions_.connect_request(conn, connect.session(), connect.timeout(), timestamp);
+    break;
+  }
+  case enumToInt(Opcodes::CLOSE):
+    sessions_.close_request(conn, timestamp);
+    break;
+  default:
+    break;
+  }
+}
+
+TcpStream& Decoder::stream(const FlowKey& flow, time_t now) {
+  auto it = streams_.find(flow);
+  if (it == streams_.end()) {
+    if (streams_.size() >= MAX_STREAMS)
+      expire_streams(now);
+    it = streams_.emplace(flow, TcpStream()).first;
+  }
+  it->second.touch(now);
+  return it->second;
+}
+
+// Streams normally go away on FIN/RST, this catches the ones we never saw
+// closing. Drops idle streams and, if that's not enough, the oldest tenth.
+void Decoder::expire_streams(time_t now) {
+  using Stream = decltype(streams_)::iterator;
+  vector<Stream> seen;
+  seen.reserve(streams_.size());
+  for (auto it = streams_.begin(); it != streams_.end(); ) {
+    if (now - it->second.last_seen() > STREAM_IDLE_SECS) {
+      sessions_.forget(it->first);
+      it = streams_.erase(it);
+    } else {
+      seen.push_back(it);
+      ++it;
+    }
+  }
+
+  if (streams_.size() < MAX_STREAMS)
+    return;
+
+  // last_seen is in seconds, so plenty of streams share it: pick them
+  // rather than cutting at a timestamp
+  auto nth = seen.begin() + seen.size() / 10;
+  nth_element(seen.begin(), nth, seen.end(), [](Stream a, Stream b) {
+      return a->second.last_seen() < b->second.last_seen();
+    });
+  for (auto it = seen.begin(); it != nth; ++it) {
+    sessions_.forget((*it)->first);
+    streams_.erase(*it);
+  }
+}
+
+}
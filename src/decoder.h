@@ -0,0 +1,206 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "heavy_hitters.h"
+#include "latency.h"
+#include "message_record.h"
+#include "path_interner.h"
+#include "quorum.h"
+#include "request_table.h"
+#include "server_set.h"
+#include "session_table.h"
+#include "tcp_packet.h"
+#include "tcp_stream.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// What the decoders have seen, summed over all of them.
+struct DecoderStats {
+  uint64_t packets = 0;
+  uint64_t ignored = 0;    // packets neither to nor from a server (nor quorum traffic)
+  uint64_t frames = 0;
+  uint64_t requests = 0;
+  uint64_t replies = 0;
+  uint64_t watches = 0;
+  uint64_t undecoded = 0;  // frames we couldn't (or don't know how to) decode
+  uint64_t unmatched = 0;  // replies without a request
+  uint64_t evictions = 0;  // requests evicted before their reply showed up
+  uint64_t in_flight = 0;
+  uint64_t streams = 0;
+  uint64_t requests_by_opcode[OPCODE_SLOTS] = {};
+  // indexed like ServerSet::ensembles()
+  uint64_t requests_by_ensemble[ServerSet::MAX_ENSEMBLES] = {};
+  uint64_t replies_by_ensemble[ServerSet::MAX_ENSEMBLES] = {};
+  PathInternerStats paths;
+
+  DecoderStats& operator+=(const DecoderStats& other);
+};
+
+// Turns TCP packets into ZooKeeper messages: reassembles streams, decodes
+// frames and pairs replies with their requests.
+//
+// Not thread safe. Both directions of a connection must go through the
+// same Decoder (see FlowKey::conn_hash()), so a Sniffer with N workers runs
+// N of them without sharing any per-connection state. Messages come out in
+// the order they were seen on their connection.
+class Decoder {
+public:
+  static const size_t MAX_STREAMS = 131072;
+  static const time_t STREAM_IDLE_SECS = 300;
+
+  // servers tells which end of a connection is the server, packets
+  // between two other endpoints are ignored unless quorum decoding is
+  // enabled and they're quorum traffic. heavy_hitters is how many entries
+  // each heavy hitter table keeps (0 doesn't track them), prefix_depth how
+  // many path components prefixes have. interned_paths bounds how many
+  // paths get an id (see ZKClientMessage::path_id()), 0 doesn't intern them.
+  Decoder(LatencyStats& latencies, BoundedQueue<unique_ptr<ZKMessage>>& out,
+      const ServerSet& servers = ServerSet(), const QuorumOptions& quorum = QuorumOptions(),
+      size_t heavy_hitters = 0, int prefix_depth = 2,
+      size_t interned_paths = PathInterner::DEFAULT_CAPACITY)
+      : latencies_(latencies), out_(out), servers_(servers),
+	per_ensemble_(servers.ensembles().size() > 1) {
+    if (quorum.enabled)
+      quorum_.reset(new QuorumDecoder(quorum));
+    if (heavy_hitters > 0)
+      heavy_hitters_.reset(new HeavyHitterTracker(heavy_hitters, prefix_depth));
+    if (interned_paths > 0)
+      paths_.reset(new PathInterner(interned_paths));
+  }
+
+  // timestamp is the pcap timestamp in usecs
+  void handle(const TcpPacket& packet, uint64_t timestamp);
+
+  // Hands messages over in batches of MessageRecords (with their frames,
+  // if frames) to records rather than one by one to out. Batches go out as
+  // they fill up, flush() pushes a partial one.
+  void set_records(BoundedQueue<unique_ptr<MessageBatch>> *records, bool frames = false) {
+    records_ = records;
+    record_frames_ = frames;
+  }
+  void flush();
+
+  // Decodes only messages' headers (and requests' paths), see LazyRequest
+  // and LazyReply. Messages handed over one by one keep a copy of their
+  // frame, batched ones don't need to.
+  void set_lazy(bool lazy) { lazy_ = lazy; }
+
+  const RequestTable& requests() const { return requests_; }
+  // sessions() snapshots and stats() can be taken from any thread
+  const SessionTable& sessions() const { return sessions_; }
+  size_t streams() const { return streams_.size(); }
+
+  // Can be called from any thread while handle() runs.
+  DecoderStats stats() const;
+  // nullptr if not tracking them; safe to snapshot or merge from any thread
+  const HeavyHitterTracker *heavy_hitters() const { return heavy_hitters_.get(); }
+  // nullptr if not interning them; only stats() are safe from other threads
+  const PathInterner *paths() const { return paths_.get(); }
+  // nullptr unless decoding quorum traffic; stats() are safe from any thread
+  const QuorumDecoder *quorum() const { return quorum_.get(); }
+
+private:
+  // Only the decoding thread writes these, so there's no need for atomic
+  // increments; they're atomic so that stats() can read them at any time.
+  struct Counters {
+    atomic<uint64_t> packets{0};
+    atomic<uint64_t> ignored{0};
+    atomic<uint64_t> frames{0};
+    atomic<uint64_t> requests{0};
+    atomic<uint64_t> replies{0};
+    atomic<uint64_t> watches{0};
+    atomic<uint64_t> undecoded{0};
+    atomic<uint64_t> unmatched{0};
+    atomic<uint64_t> evictions{0};
+    atomic<uint64_t> in_flight{0};
+    atomic<uint64_t> streams{0};
+    atomic<uint64_t> requests_by_opcode[OPCODE_SLOTS] = {};
+    atomic<uint64_t> requests_by_ensemble[ServerSet::MAX_ENSEMBLES] = {};
+    atomic<uint64_t> replies_by_ensemble[ServerSet::MAX_ENSEMBLES] = {};
+  };
+
+  static void bump(atomic<uint64_t>& counter) {
+    counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+  }
+
+  void handle_frame(const FlowKey& conn, bool from_client, int ensemble, uint64_t timestamp,
+    string_view frame);
+  void track_session(const FlowKey& conn, const ZKClientMessage& msg, uint64_t timestamp);
+  TcpStream& stream(const FlowKey& flow, time_t now);
+  void expire_streams(time_t now);
+
+  LatencyStats& latencies_;
+  BoundedQueue<unique_ptr<ZKMessage>>& out_;
+  ServerSet servers_;
+  bool per_ensemble_;  // latencies too, only worth it with several ensembles
+  RequestTable requests_;
+  SessionTable sessions_;
+  unordered_map<FlowKey, TcpStream, FlowKeyHash> streams_;
+  Counters counters_;
+  unique_ptr<HeavyHitterTracker> heavy_hitters_;
+  unique_ptr<PathInterner> paths_;
+  unique_ptr<QuorumDecoder> quorum_;
+  BoundedQueue<unique_ptr<MessageBatch>> *records_ = nullptr;
+  bool record_frames_ = false;
+  unique_ptr<MessageBatch> batch_;
+  bool lazy_ = false;
+};
+
+// TcpPackets copied out of the capture buffer, so they can be decoded on
+// another thread. Payloads are packed back to back in one buffer.
+class PacketBatch {
+public:
+  static const size_t MAX_PACKETS = 256;
+  static const size_t MAX_BYTES = 256 * 1024;
+
+  PacketBatch() { entries_.reserve(MAX_PACKETS); }
+
+  void add(const TcpPacket& packet, uint64_t timestamp) {
+    auto payload = packet.payload();
+    entries_.push_back(Entry{packet.src(), packet.dst(), packet.seq(), packet.flags(),
+      timestamp, data_.size(), payload.size()});
+    data_.append(payload.data(), payload.size());
+  }
+
+  // calls f(const TcpPacket&, uint64_t timestamp) for every packet
+  template <typename F>
+  void for_each(F&& f) const {
+    for (const auto& entry : entries_) {
+      TcpPacket packet(entry.src, entry.dst, entry.seq, entry.flags,
+	string_view(data_).substr(entry.offset, entry.len));
+      f(packet, entry.timestamp);
+    }
+  }
+
+  bool full() const { return entries_.size() >= MAX_PACKETS || data_.size() >= MAX_BYTES; }
+  bool empty() const { return entries_.empty(); }
+  size_t size() const { return entries_.size(); }
+
+private:
+  struct Entry {
+    Endpoint src;
+    Endpoint dst;
+    uint32_t seq;
+    uint8_t flags;
+    uint64_t timestamp;
+    size_t offset;
+    size_t len;
+  };
+
+  vector<Entry> entries_;
+  string data_;
+};
+
+}
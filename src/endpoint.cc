@@ -0,0 +1,45 @@
+#include "endpoint.h"
+
+#include <cstdio>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+using namespace std;
+
+namespace Zktraffic {
+
+string Endpoint::ip() const {
+  char buf[INET6_ADDRSTRLEN];
+
+  if (v4)
+    inet_ntop(AF_INET, addr + 12, buf, sizeof(buf));
+  else
+    inet_ntop(AF_INET6, addr, buf, sizeof(buf));
+
+  return string(buf);
+}
+
+string Endpoint::str() const {
+  char buf[INET6_ADDRSTRLEN + 8];
+  size_t len;
+
+  if (v4) {
+    inet_ntop(AF_INET, addr + 12, buf, sizeof(buf));
+    len = strlen(buf);
+  } else {
+    buf[0] = '[';
+    inet_ntop(AF_INET6, addr, buf + 1, sizeof(buf) - 1);
+    len = strlen(buf);
+    buf[len++] = ']';
+  }
+  snprintf(buf + len, sizeof(buf) - len, ":%u", port);
+
+  return string(buf);
+}
+
+ostream& operator<<(ostream& os, const Endpoint& ep) {
+  return os << ep.str();
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+
+using namespace std;
+
+namespace Zktraffic {
+
+inline uint64_t mix64(uint64_t h) {
+  // murmur3's finalizer, so that every input bit reaches the low bits
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+// An IPv4 or IPv6 address and a port, 20 bytes, stored inline. IPv4
+// addresses are kept v4-mapped (::ffff:a.b.c.d) so both families compare
+// and hash the same way. Only turned into text when printing.
+struct Endpoint {
+  uint8_t addr[16];
+  uint16_t port;  // host byte order
+  uint8_t v4;
+  uint8_t pad;
+
+  // addr is in network byte order
+  static Endpoint from_v4(uint32_t addr, uint16_t port) {
+    Endpoint ep{};
+    ep.addr[10] = 0xff;
+    ep.addr[11] = 0xff;
+    memcpy(ep.addr + 12, &addr, 4);
+    ep.port = port;
+    ep.v4 = 1;
+    return ep;
+  }
+
+  static Endpoint from_v6(const uint8_t *addr, uint16_t port) {
+    Endpoint ep{};
+    memcpy(ep.addr, addr, 16);
+    ep.port = port;
+    return ep;
+  }
+
+  bool is_v4() const { return v4; }
+  // network byte order, only meaningful for IPv4
+  uint32_t v4_addr() const {
+    uint32_t rv;
+    memcpy(&rv, addr + 12, 4);
+    return rv;
+  }
+
+  bool operator==(const Endpoint& other) const { return memcmp(this, &other, sizeof(Endpoint)) == 0; }
+  bool operator!=(const Endpoint& other) const { return !(*this == other); }
+  bool operator<(const Endpoint& other) const { return memcmp(this, &other, sizeof(Endpoint)) < 0; }
+
+  uint64_t hash() const {
+    uint64_t hi, lo;
+    uint32_t rest;
+    memcpy(&hi, addr, 8);
+    memcpy(&lo, addr + 8, 8);
+    memcpy(&rest, &port, 4);
+    return mix64(hi ^ (lo * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)rest << 17));
+  }
+
+  string ip() const;
+  string str() const;
+};
+
+static_assert(sizeof(Endpoint) == 20, "Endpoint should stay compact");
+
+struct EndpointHash {
+  size_t operator()(const Endpoint& ep) const { return ep.hash(); }
+};
+
+ostream& operator<<(ostream& os, const Endpoint& ep);
+
+}
@@ -0,0 +1,469 @@
+#include "event_log.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Zktraffic {
+
+namespace {
+
+// Record flags, in the first byte of every encoded record along with the
+// kind (low two bits).
+const uint8_t SAME_CLIENT = 1 << 2;
+const uint8_t SAME_SERVER = 1 << 3;
+const uint8_t HAS_PATH = 1 << 4;
+
+uint64_t zigzag(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+void put_varint(string& out, uint64_t value) {
+  char buf[10];
+  size_t len = 0;
+  while (value >= 0x80) {
+    buf[len++] = (char)(value | 0x80);
+    value >>= 7;
+  }
+  buf[len++] = (char)value;
+  out.append(buf, len);
+}
+
+// Bounds checked, fails on a varint that runs past end or past 10 bytes.
+inline bool get_varint(const uint8_t *&p, const uint8_t *end, uint64_t& value) {
+  if (p < end && *p < 0x80) {
+    value = *p++;
+    return true;
+  }
+
+  value = 0;
+  for (int shift = 0; shift < 70 && p < end; shift += 7) {
+    uint8_t byte = *p++;
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (byte < 0x80)
+      return true;
+  }
+  return false;
+}
+
+}
+
+EventLogWriter::EventLogWriter(string prefix, EventLogOptions options) :
+  prefix_(move(prefix)), options_(options) {
+  if (options_.block_records == 0)
+    options_.block_records = 1;
+  start_block();
+}
+
+string EventLogWriter::segment_name(const string& prefix, size_t segment) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), ".%06zu.zkev", segment);
+  return prefix + buf;
+}
+
+void EventLogWriter::start_block() {
+  block_ = BlockHeader{EVENT_BLOCK_MAGIC, 0, 0, 0, 0, ~0ULL, 0};
+  new_strings_.clear();
+  new_endpoints_.clear();
+  encoded_.clear();
+  last_ = EventRecord{};
+  last_client_ = ~0U;
+  last_server_ = ~0U;
+}
+
+bool EventLogWriter::write_all(const void *data, size_t len) {
+  auto p = static_cast<const char *>(data);
+
+  while (len > 0) {
+    auto written = write(fd_, p, len);
+    if (written < 0) {
+      if (errno == EINTR)
+	continue;
+      cout << "couldn't write to " << segment_name(prefix_, segment_ - 1) << ": " <<
+	strerror(errno) << "\n";
+      failed_ = true;
+      return false;
+    }
+    p += written;
+    len -= written;
+  }
+  segment_size_ += p - static_cast<const char *>(data);
+
+  return true;
+}
+
+bool EventLogWriter::open_segment() {
+  auto name = segment_name(prefix_, segment_);
+  fd_ = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    cout << "couldn't create " << name << ": " << strerror(errno) << "\n";
+    failed_ = true;
+    return false;
+  }
+  segment_++;
+  segment_size_ = 0;
+
+  SegmentHeader header{};
+  memcpy(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic));
+  header.version = EVENT_LOG_VERSION;
+  return write_all(&header, sizeof(header));
+}
+
+uint32_t EventLogWriter::intern(string_view path) {
+  if (path.empty())
+    return 0;
+
+  auto it = strings_.find(path);
+  if (it != strings_.end())
+    return it->second;
+
+  uint32_t id = strings_.size() + 1;
+  paths_.emplace_back(path);
+  strings_.emplace(paths_.back(), id);
+  put_varint(new_strings_, path.size());
+  new_strings_.append(path.data(), path.size());
+  block_.strings++;
+  return id;
+}
+
+uint32_t EventLogWriter::intern(const Endpoint& endpoint) {
+  auto it = endpoints_.find(endpoint);
+  if (it != endpoints_.end())
+    return it->second;
+
+  uint32_t id = endpoints_.size();
+  endpoints_.emplace(endpoint, id);
+  new_endpoints_.append(reinterpret_cast<const char *>(&endpoint), sizeof(endpoint));
+  block_.endpoints++;
+  return id;
+}
+
+bool EventLogWriter::append(const ZKMessage& message) {
+  EventRecord record{};
+  string_view path;
+
+  record.timestamp = message.timestamp();
+  record.client = message.client();
+  record.server = message.server();
+  record.xid = message.xid();
+  record.size = message.size();
+  record.latency = -1;
+  record.opcode = -1;
+
+  record.kind = message.kind();
+
+  if (message.kind() == MessageKind::REQUEST) {
+    auto& request = static_cast<const ZKClientMessage&>(message);
+    record.opcode = request.opcode();
+    path = request.path();
+    return append(record, path);
+  }
+
+  auto& reply = static_cast<const ZKServerMessage&>(message);
+  record.zxid = reply.zxid();
+  record.error = reply.error();
+
+  if (message.kind() == MessageKind::WATCH) {
+    auto& watch = static_cast<const WatchEvent&>(message);
+    record.event_type = watch.event_type();
+    path = watch.path();
+  } else {
+    record.opcode = reply.opcode();
+    record.latency = reply.latency();
+  }
+
+  return append(record, path);
+}
+
+bool EventLogWriter::append(const MessageBatch& batch) {
+  for (size_t i = 0; i < batch.size(); i++) {
+    auto message = batch.record(i);
+    EventRecord record{};
+    record.timestamp = message.timestamp;
+    record.zxid = message.zxid;
+    record.latency = message.latency;
+    record.client = batch.endpoints()[message.client];
+    record.server = batch.endpoints()[message.server];
+    record.xid = message.xid;
+    record.error = message.error;
+    record.size = message.size;
+    record.opcode = message.opcode;
+    record.kind = message.kind;
+    record.event_type = message.event_type;
+    if (!append(record, batch.path(message.path)))
+      return false;
+  }
+  return !failed_;
+}
+
+bool EventLogWriter::append(const EventRecord& record, string_view path) {
+  if (failed_)
+    return false;
+
+  auto path_id = intern(path);
+  auto client = intern(record.client);
+  auto server = intern(record.server);
+
+  uint8_t flags = static_cast<uint8_t>(record.kind);
+  if (client == last_client_)
+    flags |= SAME_CLIENT;
+  if (server == last_server_)
+    flags |= SAME_SERVER;
+  if (path_id != 0)
+    flags |= HAS_PATH;
+  encoded_.push_back((char)flags);
+
+  if (client != last_client_)
+    put_varint(encoded_, client);
+  if (server != last_server_)
+    put_varint(encoded_, server);
+  put_varint(encoded_, zigzag(record.timestamp - last_.timestamp));
+  put_varint(encoded_, zigzag((int64_t)record.xid - last_.xid));
+  put_varint(encoded_, zigzag(record.opcode));
+  put_varint(encoded_, record.size);
+  if (path_id != 0)
+    put_varint(encoded_, path_id);
+
+  if (record.kind != EventKind::REQUEST) {
+    put_varint(encoded_, zigzag(record.zxid - last_.zxid));
+    put_varint(encoded_, zigzag(record.error));
+    if (record.kind == EventKind::WATCH)
+      put_varint(encoded_, record.event_type);
+    else
+      put_varint(encoded_, zigzag(record.latency));
+    last_.zxid = record.zxid;
+  }
+
+  last_.timestamp = record.timestamp;
+  last_.xid = record.xid;
+  last_client_ = client;
+  last_server_ = server;
+
+  block_.records++;
+  block_.min_timestamp = std::min(block_.min_timestamp, record.timestamp);
+  block_.max_timestamp = std::max(block_.max_timestamp, record.timestamp);
+  records_++;
+
+  if (block_.records >= options_.block_records)
+    return flush();
+
+  return true;
+}
+
+bool EventLogWriter::flush() {
+  if (failed_)
+    return false;
+  if (block_.records == 0)
+    return true;
+
+  if (fd_ < 0 && !open_segment())
+    return false;
+
+  block_.bytes = new_strings_.size() + new_endpoints_.size() + encoded_.size();
+  if (!write_all(&block_, sizeof(block_)) ||
+      !write_all(new_strings_.data(), new_strings_.size()) ||
+      !write_all(new_endpoints_.data(), new_endpoints_.size()) ||
+      !write_all(encoded_.data(), encoded_.size()))
+    return false;
+
+  start_block();
+
+  // the next block goes into a new segment, with its own tables
+  if (segment_size_ >= options_.segment_bytes) {
+    ::close(fd_);
+    fd_ = -1;
+    strings_.clear();
+    paths_.clear();
+    endpoints_.clear();
+  }
+
+  return true;
+}
+
+void EventLogWriter::close() {
+  flush();
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+EventLogReader::EventLogReader(const string& file) {
+  int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    cout << "couldn't open " << file << ": " << strerror(errno) << "\n";
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(SegmentHeader)) {
+    cout << file << " isn't an event log\n";
+    close(fd);
+    return;
+  }
+
+  auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    cout << "couldn't map " << file << ": " << strerror(errno) << "\n";
+    return;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  SegmentHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(header.magic, EVENT_LOG_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != EVENT_LOG_VERSION) {
+    cout << file << " isn't an event log (or it's from another version)\n";
+    munmap(data, st.st_size);
+    return;
+  }
+
+  data_ = static_cast<const uint8_t *>(data);
+  size_ = st.st_size;
+  offset_ = sizeof(SegmentHeader);
+  strings_.emplace_back();
+}
+
+EventLogReader::~EventLogReader() {
+  if (data_ != nullptr)
+    munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+bool EventLogReader::next(vector<EventRecord>& records) {
+  records.clear();
+  if (data_ == nullptr)
+    return false;
+
+  for (;;) {
+    if (size_ - offset_ < sizeof(BlockHeader)) {
+      truncated_ = offset_ != size_;
+      return false;
+    }
+
+    BlockHeader header;
+    memcpy(&header, data_ + offset_, sizeof(header));
+    if (header.magic != EVENT_BLOCK_MAGIC ||
+	header.bytes > size_ - offset_ - sizeof(header)) {
+      truncated_ = true;
+      return false;
+    }
+
+    const uint8_t *p = data_ + offset_ + sizeof(header);
+    const uint8_t *end = p + header.bytes;
+
+    // definitions are needed even if the records get skipped
+    for (uint32_t i = 0; i < header.strings; i++) {
+      uint64_t len;
+      if (!get_varint(p, end, len) || len > (uint64_t)(end - p)) {
+	truncated_ = true;
+	return false;
+      }
+      strings_.emplace_back(reinterpret_cast<const char *>(p), len);
+      p += len;
+    }
+    if (header.endpoints > (uint64_t)(end - p) / sizeof(Endpoint)) {
+      truncated_ = true;
+      return false;
+    }
+    for (uint32_t i = 0; i < header.endpoints; i++) {
+      Endpoint endpoint;
+      memcpy(&endpoint, p, sizeof(endpoint));
+      endpoints_.push_back(endpoint);
+      p += sizeof(endpoint);
+    }
+
+    offset_ += sizeof(header) + header.bytes;
+    if (header.records == 0 || header.max_timestamp < from_ || header.min_timestamp > until_)
+      continue;
+
+    records.resize(header.records);
+    EventRecord last{};
+    uint64_t client = ~0ULL;
+    uint64_t server = ~0ULL;
+    bool ok = true;
+
+    for (auto& record : records) {
+      uint64_t value;
+      if (p >= end) {
+	ok = false;
+	break;
+      }
+      uint8_t flags = *p++;
+
+      record.kind = static_cast<EventKind>(flags & 3);
+      if (!(flags & SAME_CLIENT))
+	ok &= get_varint(p, end, client);
+      if (!(flags & SAME_SERVER))
+	ok &= get_varint(p, end, server);
+      if (client >= endpoints_.size() || server >= endpoints_.size()) {
+	ok = false;
+	break;
+      }
+      record.client = endpoints_[client];
+      record.server = endpoints_[server];
+
+      ok &= get_varint(p, end, value);
+      record.timestamp = last.timestamp + unzigzag(value);
+      ok &= get_varint(p, end, value);
+      record.xid = last.xid + unzigzag(value);
+      ok &= get_varint(p, end, value);
+      record.opcode = unzigzag(value);
+      ok &= get_varint(p, end, value);
+      record.size = value;
+      record.path = 0;
+      if (flags & HAS_PATH) {
+	ok &= get_varint(p, end, value);
+	record.path = value < strings_.size() ? value : 0;
+      }
+
+      record.zxid = 0;
+      record.error = 0;
+      record.latency = -1;
+      record.event_type = 0;
+      if (record.kind != EventKind::REQUEST) {
+	ok &= get_varint(p, end, value);
+	record.zxid = last.zxid + unzigzag(value);
+	ok &= get_varint(p, end, value);
+	record.error = unzigzag(value);
+	ok &= get_varint(p, end, value);
+	if (record.kind == EventKind::WATCH)
+	  record.event_type = value;
+	else
+	  record.latency = unzigzag(value);
+	last.zxid = record.zxid;
+      }
+
+      if (!ok)
+	break;
+      last.timestamp = record.timestamp;
+      last.xid = record.xid;
+    }
+
+    if (!ok) {
+      cout << "corrupt event log block at offset " <<
+	offset_ - sizeof(header) - header.bytes << "\n";
+      records.clear();
+      truncated_ = true;
+      offset_ = size_;
+      return false;
+    }
+
+    return true;
+  }
+}
+
+}
@@ -0,0 +1,187 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "endpoint.h"
+#include "message_record.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// stored as is, its values can't change
+using EventKind = MessageKind;
+
+// One decoded message, as stored in an event log. Fixed layout, so a
+// block of them can be scanned (or handed to other tools) as plain memory.
+struct EventRecord {
+  uint64_t timestamp;  // usecs
+  int64_t zxid;        // replies and watches, 0 for requests
+  int64_t latency;     // usecs, replies only, -1 if unknown
+  Endpoint client;
+  Endpoint server;
+  int32_t xid;
+  int32_t error;
+  uint32_t path;       // id in the segment's string table, 0 for none
+  uint32_t size;       // bytes on the wire, length prefix included
+  int16_t opcode;      // the request's, -1 if unknown
+  EventKind kind;
+  uint8_t event_type;  // watches only
+};
+
+static_assert(sizeof(EventRecord) == 88, "EventRecord layout changed");
+
+// Event logs are append-only segment files:
+//
+//   SegmentHeader
+//   BlockHeader, body
+//   BlockHeader, body
+//   ...
+//
+// A body holds the strings (paths) and endpoints first seen in that block,
+// then its records, each one delta and varint encoded against the
+// previous, which takes them from 88 bytes to ~15. Strings and endpoints
+// are interned per segment, so any segment can be read on its own, and a
+// block only refers to what it or earlier blocks defined. A block cut
+// short by a crash is simply where the segment ends.
+struct SegmentHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+};
+
+struct BlockHeader {
+  uint32_t magic;
+  uint32_t records;
+  uint32_t strings;    // new in this block
+  uint32_t endpoints;  // new in this block
+  uint64_t bytes;      // body size
+  uint64_t min_timestamp;
+  uint64_t max_timestamp;
+};
+
+const char EVENT_LOG_MAGIC[8] = {'Z', 'K', 'E', 'V', 'L', 'O', 'G', '\0'};
+const uint32_t EVENT_LOG_VERSION = 1;
+const uint32_t EVENT_BLOCK_MAGIC = 0x5a4b4542;  // "ZKEB"
+
+struct EventLogOptions {
+  // records per block, they're encoded and written out together
+  size_t block_records = 4096;
+  // a new segment is started once the current one goes past this
+  uint64_t segment_bytes = 256ULL << 20;
+};
+
+// Writes messages to <prefix>.000000.zkev, <prefix>.000001.zkev, ...
+//
+// Not thread safe, meant to sit behind Sniffer::get() like StatsAggregator.
+// I/O errors are reported on cout and make append() return false.
+class EventLogWriter {
+public:
+  explicit EventLogWriter(string prefix, EventLogOptions options = EventLogOptions());
+  EventLogWriter(const EventLogWriter&) = delete;
+  EventLogWriter& operator=(const EventLogWriter&) = delete;
+  ~EventLogWriter() { close(); }
+
+  bool append(const ZKMessage& message);
+  bool append(const MessageBatch& batch);
+  // record.path is ignored, path (empty for none) is interned instead
+  bool append(const EventRecord& record, string_view path);
+  // Writes out the pending block, records appended so far can be read
+  // once this returns.
+  bool flush();
+  void close();
+
+  uint64_t records() const { return records_; }
+  size_t segments() const { return segment_; }
+  static string segment_name(const string& prefix, size_t segment);
+
+private:
+  bool open_segment();
+  void start_block();
+  bool write_all(const void *data, size_t len);
+  uint32_t intern(string_view path);
+  uint32_t intern(const Endpoint& endpoint);
+
+  string prefix_;
+  EventLogOptions options_;
+  int fd_ = -1;
+  size_t segment_ = 0;
+  uint64_t segment_size_ = 0;
+  uint64_t records_ = 0;
+  bool failed_ = false;
+
+  // per segment, keys point into paths_
+  unordered_map<string_view, uint32_t> strings_;
+  deque<string> paths_;
+  unordered_map<Endpoint, uint32_t, EndpointHash> endpoints_;
+
+  // the pending block, records are encoded as they're appended
+  BlockHeader block_;
+  string new_strings_;
+  string new_endpoints_;
+  string encoded_;
+  EventRecord last_;
+  uint32_t last_client_;
+  uint32_t last_server_;
+};
+
+// Reads one segment, mmapped, a block at a time. Decoding is a tight loop
+// over varints with no allocations once the vector has grown, so a scan
+// runs at a good fraction of memory bandwidth.
+class EventLogReader {
+public:
+  explicit EventLogReader(const string& file);
+  EventLogReader(const EventLogReader&) = delete;
+  EventLogReader& operator=(const EventLogReader&) = delete;
+  ~EventLogReader();
+
+  // false (with the reason on cout) if the file couldn't be mapped or
+  // isn't an event log
+  bool ok() const { return data_ != nullptr; }
+
+  // Only blocks that overlap [from, until] (usecs) are decoded, the rest
+  // are skipped over without touching their records. Records in the
+  // blocks that are decoded aren't filtered.
+  void set_range(uint64_t from, uint64_t until) { from_ = from; until_ = until; }
+
+  // Decodes the next block into records (replacing what's there), false
+  // at the end of the segment.
+  bool next(vector<EventRecord>& records);
+
+  // Calls f(const EventRecord&) for every record, returns how many.
+  template <typename F>
+  uint64_t for_each(F&& f) {
+    vector<EventRecord> records;
+    uint64_t count = 0;
+    while (next(records)) {
+      for (const auto& record : records)
+	f(record);
+      count += records.size();
+    }
+    return count;
+  }
+
+  // the path for a record's path id, empty for 0
+  string_view path(uint32_t id) const { return id < strings_.size() ? strings_[id] : string_view(); }
+  // whether the segment ended in the middle of a block
+  bool truncated() const { return truncated_; }
+  size_t bytes() const { return size_; }
+
+private:
+  const uint8_t *data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  uint64_t from_ = 0;
+  uint64_t until_ = ~0ULL;
+  bool truncated_ = false;
+  vector<string_view> strings_;
+  vector<Endpoint> endpoints_;
+};
+
+}
@@ -0,0 +1,298 @@
+#include "formatter.h"
+
+#include <charconv>
+
+using namespace std;
+
+namespace Zktraffic {
+namespace {
+
+const char HEX[] = "0123456789abcdef";
+
+void append_hex_byte(string& out, unsigned char c) {
+  out += HEX[c >> 4];
+  out += HEX[c & 0xf];
+}
+
+// What needs escaping, per byte. For LINE, anything that would split a
+// message or a field.
+struct EscapeTable {
+  bool line[256];
+  bool json[256];
+
+  EscapeTable() {
+    for (int c = 0; c < 256; c++) {
+      line[c] = c <= ' ' || c >= 0x7f || c == '\\';
+      json[c] = c < 0x20 || c >= 0x80 || c == '"' || c == '\\';
+    }
+  }
+};
+
+const EscapeTable escapes;
+
+// how much of value can go out as is
+size_t plain_prefix(string_view value, const bool (&escaped)[256]) {
+  auto p = reinterpret_cast<const unsigned char *>(value.data());
+  size_t i = 0;
+  while (i < value.size() && !escaped[p[i]])
+    i++;
+  return i;
+}
+
+}
+
+void Formatter::begin(string_view type) {
+  depth_ = 0;
+  push(false);
+
+  switch (format_) {
+  case OutputFormat::TEXT:
+    out_.append(type);
+    out_ += "(\n";
+    break;
+  case OutputFormat::LINE:
+    out_.append(type);
+    break;
+  case OutputFormat::JSON:
+    out_ += "{\"type\":\"";
+    out_.append(type);
+    out_ += '"';
+    break;
+  }
+}
+
+void Formatter::end() {
+  switch (format_) {
+  case OutputFormat::TEXT:
+    out_ += ")\n";
+    break;
+  case OutputFormat::LINE:
+    out_ += '\n';
+    break;
+  case OutputFormat::JSON:
+    out_ += "}\n";
+    break;
+  }
+  depth_ = 0;
+}
+
+void Formatter::begin_object(string_view name, string_view type) {
+  if (list_[depth_])
+    separator();
+  else
+    key(name);
+
+  if (format_ == OutputFormat::JSON) {
+    out_ += '{';
+  } else {
+    out_.append(type);
+    out_ += '(';
+  }
+  push(false);
+}
+
+void Formatter::end_object() {
+  out_ += format_ == OutputFormat::JSON ? '}' : ')';
+  depth_--;
+  done();
+}
+
+void Formatter::begin_list(string_view name) {
+  key(name);
+  if (format_ == OutputFormat::JSON)
+    out_ += '[';
+  push(true);
+}
+
+void Formatter::end_list() {
+  if (format_ == OutputFormat::JSON)
+    out_ += ']';
+  depth_--;
+  done();
+}
+
+void Formatter::item(string_view value) {
+  separator();
+  string_value(value);
+}
+
+void Formatter::field(string_view name, string_view value) {
+  key(name);
+  string_value(value);
+  done();
+}
+
+void Formatter::field(string_view name, long long value) {
+  key(name);
+  append_int(out_, value);
+  done();
+}
+
+void Formatter::field(string_view name, unsigned long long value) {
+  key(name);
+  append_uint(out_, value);
+  done();
+}
+
+void Formatter::field(string_view name, const Endpoint& value) {
+  key(name);
+  if (format_ == OutputFormat::JSON) {
+    out_ += '"';
+    append_endpoint(out_, value);
+    out_ += '"';
+  } else {
+    append_endpoint(out_, value);
+  }
+  done();
+}
+
+void Formatter::field_hex(string_view name, unsigned long long value) {
+  char buf[16];
+  auto end = to_chars(buf, buf + sizeof(buf), value, 16).ptr;
+
+  key(name);
+  if (format_ == OutputFormat::JSON)
+    out_ += '"';
+  out_ += "0x";
+  out_.append(buf, end - buf);
+  if (format_ == OutputFormat::JSON)
+    out_ += '"';
+  done();
+}
+
+void Formatter::field_null(string_view name) {
+  key(name);
+  if (format_ == OutputFormat::JSON)
+    out_ += "null";
+  done();
+}
+
+void Formatter::field(string_view name, const StringList& values, size_t from, size_t to) {
+  to = min(to, values.size());
+  begin_list(name);
+  for (size_t i = from; i < to; i++)
+    item(values[i]);
+  end_list();
+}
+
+void Formatter::append_int(string& out, long long value) {
+  char buf[24];
+  auto end = to_chars(buf, buf + sizeof(buf), value).ptr;
+  out.append(buf, end - buf);
+}
+
+void Formatter::append_uint(string& out, unsigned long long value) {
+  char buf[24];
+  auto end = to_chars(buf, buf + sizeof(buf), value).ptr;
+  out.append(buf, end - buf);
+}
+
+void Formatter::append_endpoint(string& out, const Endpoint& endpoint) {
+  if (!endpoint.is_v4()) {
+    out += endpoint.str();
+    return;
+  }
+
+  // what inet_ntop() gives, without the round trip through a string
+  char buf[24];
+  char *p = buf;
+  for (int i = 12; i < 16; i++) {
+    p = to_chars(p, buf + sizeof(buf), endpoint.addr[i]).ptr;
+    *p++ = i < 15 ? '.' : ':';
+  }
+  p = to_chars(p, buf + sizeof(buf), endpoint.port).ptr;
+  out.append(buf, p - buf);
+}
+
+void Formatter::key(string_view name) {
+  if (depth_ == 1) {
+    switch (format_) {
+    case OutputFormat::TEXT:
+      out_ += "  ";
+      break;
+    case OutputFormat::LINE:
+      out_ += ' ';
+      break;
+    case OutputFormat::JSON:
+      out_ += ',';
+      break;
+    }
+    empty_[depth_] = false;
+  } else {
+    separator();
+  }
+
+  if (format_ == OutputFormat::JSON) {
+    out_ += '"';
+    out_.append(name);
+    out_ += "\":";
+  } else {
+    out_.append(name);
+    out_ += '=';
+  }
+}
+
+void Formatter::separator() {
+  if (!empty_[depth_])
+    out_ += ',';
+  empty_[depth_] = false;
+}
+
+// message level fields are a line each in TEXT
+void Formatter::done() {
+  if (depth_ == 1 && format_ == OutputFormat::TEXT)
+    out_ += '\n';
+}
+
+void Formatter::string_value(string_view value) {
+  switch (format_) {
+  case OutputFormat::TEXT:
+    out_.append(value);
+    break;
+  case OutputFormat::LINE: {
+    for (;;) {
+      auto plain = plain_prefix(value, escapes.line);
+      out_.append(value.data(), plain);
+      if (plain == value.size())
+	break;
+      out_ += "\\x";
+      append_hex_byte(out_, value[plain]);
+      value.remove_prefix(plain + 1);
+    }
+    break;
+  }
+  case OutputFormat::JSON: {
+    out_ += '"';
+    for (;;) {
+      auto plain = plain_prefix(value, escapes.json);
+      out_.append(value.data(), plain);
+      if (plain == value.size())
+	break;
+      unsigned char c = value[plain];
+      if (c == '"' || c == '\\') {
+	out_ += '\\';
+	out_ += c;
+      } else if (c == '\n') {
+	out_ += "\\n";
+      } else if (c == '\t') {
+	out_ += "\\t";
+      } else {
+	out_ += "\\u00";
+	append_hex_byte(out_, c);
+      }
+      value.remove_prefix(plain + 1);
+    }
+    out_ += '"';
+    break;
+  }
+  }
+}
+
+void Formatter::push(bool list) {
+  // messages go as deep as message, list, object
+  depth_++;
+  empty_[depth_] = true;
+  list_[depth_] = list;
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "endpoint.h"
+#include "string_list.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+enum class OutputFormat {
+  TEXT,  // Type(, then key=value per line, then ): what operator std::string() gives
+  LINE,  // Type key=value key=value ..., one line per message
+  JSON   // JSON lines: {"type":"Type","key":value,...}
+};
+
+// Writes messages field by field into out, appending to whatever is there
+// already, with no temporaries or streams in between. Messages describe
+// themselves through it (see ZKMessage::format()), so all formats come out
+// of the same code:
+//
+//   out.begin("GetReply");
+//   out.field("xid", xid);
+//   out.begin_object("stat", "Stat"); ... out.end_object();
+//   out.begin_list("acls"); ... out.end_list();
+//   out.end();
+//
+// Objects nest inside messages and lists, lists inside messages. In TEXT
+// they come out inline (Stat(czxid=1,...), items separated by commas),
+// as they always have. LINE escapes whitespace, backslashes and anything
+// non-printable as \xNN, so a message stays on one line and splits on
+// spaces. JSON escapes bytes past ASCII as \u00NN (znode data needn't be
+// UTF-8), so it's always valid JSON and maps back to the original bytes.
+class Formatter {
+public:
+  explicit Formatter(string& out, OutputFormat format = OutputFormat::TEXT)
+    : out_(out), format_(format) {}
+
+  OutputFormat format() const { return format_; }
+
+  void begin(string_view type);
+  void end();
+  // name is ignored inside lists, type in JSON
+  void begin_object(string_view name, string_view type);
+  void end_object();
+  void begin_list(string_view name);
+  void end_list();
+  // a string in a list
+  void item(string_view value);
+
+  void field(string_view name, string_view value);
+  void field(string_view name, const char *value) { field(name, string_view(value)); }
+  void field(string_view name, long long value);
+  void field(string_view name, unsigned long long value);
+  void field(string_view name, long value) { field(name, (long long)value); }
+  void field(string_view name, unsigned long value) { field(name, (unsigned long long)value); }
+  void field(string_view name, int value) { field(name, (long long)value); }
+  void field(string_view name, unsigned value) { field(name, (unsigned long long)value); }
+  // 0 or 1, as streams print them
+  void field(string_view name, bool value) { field(name, (long long)value); }
+  void field(string_view name, const Endpoint& value);
+  // 0x..., a string in JSON
+  void field_hex(string_view name, unsigned long long value);
+  // nothing after the = in TEXT/LINE, null in JSON
+  void field_null(string_view name);
+  // comma separated in TEXT/LINE, an array in JSON
+  void field(string_view name, const StringList& values, size_t from = 0, size_t to = SIZE_MAX);
+
+  static void append_int(string& out, long long value);
+  static void append_uint(string& out, unsigned long long value);
+  static void append_endpoint(string& out, const Endpoint& endpoint);
+
+private:
+  static const int MAX_DEPTH = 4;
+
+  void key(string_view name);
+  void separator();
+  void done();
+  void string_value(string_view value);
+  void push(bool list);
+
+  string& out_;
+  OutputFormat format_;
+  int depth_ = 0;
+  // whether the current level has anything in it yet
+  bool empty_[MAX_DEPTH] = {};
+  // whether the current level is a list
+  bool list_[MAX_DEPTH] = {};
+};
+
+}
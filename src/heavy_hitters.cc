@@ -0,0 +1,77 @@
+#include "heavy_hitters.h"
+
+#include "stats.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+CountMinSketch::CountMinSketch(size_t width, size_t depth) : depth_(std::max<size_t>(depth, 1)) {
+  // a power of two, so columns are a mask away
+  width_ = 1;
+  while (width_ < width)
+    width_ <<= 1;
+  counts_.resize(width_ * depth_, 0);
+}
+
+void CountMinSketch::merge(const CountMinSketch& other) {
+  if (other.width_ != width_ || other.depth_ != depth_)
+    return;
+
+  for (size_t i = 0; i < counts_.size(); i++)
+    counts_[i] += other.counts_[i];
+  total_ += other.total_;
+}
+
+HeavyHitterTracker::HeavyHitterTracker(size_t capacity, int prefix_depth) :
+  capacity_(capacity),
+  prefix_depth_(prefix_depth),
+  paths_(capacity),
+  prefixes_(capacity),
+  clients_(capacity),
+  client_opcodes_(capacity) {}
+
+void HeavyHitterTracker::add(const Endpoint& client, int opcode, string_view path) {
+  auto ip = client;
+  ip.port = 0;
+
+  lock_guard<mutex> guard(mutex_);
+  requests_++;
+  clients_.add(ip);
+  client_opcodes_.add(ClientOpcode{ip, opcode});
+  if (!path.empty()) {
+    paths_.add(string(path));
+    if (prefix_depth_ > 0)
+      prefixes_.add(string(StatsAggregator::prefix(path, prefix_depth_)));
+  }
+}
+
+void HeavyHitterTracker::merge(const HeavyHitterTracker& other) {
+  lock_guard<mutex> guard(mutex_);
+  lock_guard<mutex> other_guard(other.mutex_);
+
+  requests_ += other.requests_;
+  paths_.merge(other.paths_);
+  prefixes_.merge(other.prefixes_);
+  clients_.merge(other.clients_);
+  client_opcodes_.merge(other.client_opcodes_);
+}
+
+HeavyHittersSnapshot HeavyHitterTracker::snapshot(size_t n) const {
+  HeavyHittersSnapshot rv;
+  auto same = [](const string& key) { return key; };
+
+  lock_guard<mutex> guard(mutex_);
+  rv.requests = requests_;
+  rv.paths = paths_.top(n, same);
+  rv.prefixes = prefixes_.top(n, same);
+  rv.clients = clients_.top(n, [](const Endpoint& key) { return key.ip(); });
+  rv.client_opcodes = client_opcodes_.top(n, [](const ClientOpcode& key) {
+      return key.client.ip() + " " + ZKMessage::opcode_to_name(key.opcode);
+    });
+
+  return rv;
+}
+
+}
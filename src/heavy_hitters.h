@@ -0,0 +1,324 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "endpoint.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// Count-Min sketch (Cormode & Muthukrishnan). estimate() never
+// underestimates. With N the total count added, width w and depth d it
+// overestimates by more than (e / w) * N with probability at most e^-d:
+// the defaults (2048 x 4, 64KB) give 0.13% of N, 98% of the time.
+//
+// Takes hashes rather than keys, each row remixes them with its own seed.
+class CountMinSketch {
+public:
+  static const size_t DEFAULT_WIDTH = 2048;
+  static const size_t DEFAULT_DEPTH = 4;
+
+  explicit CountMinSketch(size_t width = DEFAULT_WIDTH, size_t depth = DEFAULT_DEPTH);
+
+  void add(uint64_t hash, uint64_t count = 1) {
+    for (size_t row = 0; row < depth_; row++)
+      counts_[row * width_ + column(row, hash)] += count;
+    total_ += count;
+  }
+
+  uint64_t estimate(uint64_t hash) const {
+    uint64_t rv = ~0ULL;
+    for (size_t row = 0; row < depth_; row++)
+      rv = std::min(rv, counts_[row * width_ + column(row, hash)]);
+    return rv;
+  }
+
+  // Both sketches must have the same dimensions.
+  void merge(const CountMinSketch& other);
+
+  uint64_t total() const { return total_; }
+  size_t width() const { return width_; }
+  size_t depth() const { return depth_; }
+
+private:
+  size_t column(size_t row, uint64_t hash) const {
+    return mix64(hash + (row + 1) * 0x9e3779b97f4a7c15ULL) & (width_ - 1);
+  }
+
+  size_t width_;
+  size_t depth_;
+  vector<uint64_t> counts_;
+  uint64_t total_ = 0;
+};
+
+// Space-Saving (Metwally et al.) top-k summary over `capacity` counters.
+// Every key seen more than N / capacity times is in it, and each entry's
+// count overestimates the real one by at most its error (<= N / capacity),
+// so count - error is a guaranteed lower bound.
+//
+// Counters live in a fixed array; a min-heap of their indexes finds the
+// least counted one, which is what a new key takes over. Updates are
+// O(log capacity) and, once full, don't allocate: the evicted key's index
+// node is reused for the new one.
+template <typename K, typename Hash = hash<K>>
+class SpaceSaving {
+public:
+  struct Entry {
+    K key;
+    uint64_t count;
+    uint64_t error;
+  };
+
+  explicit SpaceSaving(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {
+    counters_.reserve(capacity_);
+    heap_.reserve(capacity_);
+    index_.reserve(capacity_);
+  }
+
+  void add(const K& key, uint64_t count = 1) {
+    total_ += count;
+
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      counters_[it->second].count += count;
+      sift_down(counters_[it->second].pos);
+      return;
+    }
+
+    if (counters_.size() < capacity_) {
+      uint32_t slot = counters_.size();
+      counters_.push_back(Counter{key, count, 0, heap_.size()});
+      heap_.push_back(slot);
+      index_.emplace(key, slot);
+      sift_up(heap_.size() - 1);
+      return;
+    }
+
+    // take over the least counted entry, inheriting its count as error
+    auto slot = heap_[0];
+    auto& min = counters_[slot];
+    auto node = index_.extract(min.key);
+    node.key() = key;
+    index_.insert(move(node));
+    min.key = key;
+    min.error = min.count;
+    min.count += count;
+    sift_down(0);
+  }
+
+  // Most counted first.
+  vector<Entry> top(size_t n) const {
+    vector<Entry> rv;
+    rv.reserve(counters_.size());
+    for (const auto& counter : counters_)
+      rv.push_back(Entry{counter.key, counter.count, counter.error});
+    auto by_count = [](const Entry& a, const Entry& b) { return a.count > b.count; };
+    n = std::min(n, rv.size());
+    partial_sort(rv.begin(), rv.begin() + n, rv.end(), by_count);
+    rv.resize(n);
+    return rv;
+  }
+
+  // Merging keeps the guarantees, with N the combined total (Agarwal et
+  // al., "Mergeable summaries"): a key missing from a full summary might
+  // have been counted up to that summary's minimum.
+  void merge(const SpaceSaving& other) {
+    unordered_map<K, Entry, Hash> merged;
+    merged.reserve(counters_.size() + other.counters_.size());
+
+    auto this_min = min_count();
+    auto other_min = other.min_count();
+    for (const auto& counter : counters_) {
+      merged.emplace(counter.key,
+	Entry{counter.key, counter.count + other_min, counter.error + other_min});
+    }
+    for (const auto& counter : other.counters_) {
+      auto it = merged.find(counter.key);
+      if (it == merged.end()) {
+	merged.emplace(counter.key,
+	  Entry{counter.key, counter.count + this_min, counter.error + this_min});
+      } else {
+	it->second.count += counter.count - other_min;
+	it->second.error += counter.error - other_min;
+      }
+    }
+
+    vector<Entry> entries;
+    entries.reserve(merged.size());
+    for (auto& entry : merged)
+      entries.push_back(move(entry.second));
+    auto by_count = [](const Entry& a, const Entry& b) { return a.count > b.count; };
+    if (entries.size() > capacity_) {
+      nth_element(entries.begin(), entries.begin() + capacity_, entries.end(), by_count);
+      entries.resize(capacity_);
+    }
+
+    counters_.clear();
+    heap_.clear();
+    index_.clear();
+    for (auto& entry : entries) {
+      uint32_t slot = counters_.size();
+      counters_.push_back(Counter{move(entry.key), entry.count, entry.error, heap_.size()});
+      heap_.push_back(slot);
+      index_.emplace(counters_.back().key, slot);
+      sift_up(heap_.size() - 1);
+    }
+    total_ += other.total_;
+  }
+
+  uint64_t total() const { return total_; }
+  size_t size() const { return counters_.size(); }
+  size_t capacity() const { return capacity_; }
+  bool full() const { return counters_.size() >= capacity_; }
+
+private:
+  struct Counter {
+    K key;
+    uint64_t count;
+    uint64_t error;
+    size_t pos;  // in heap_
+  };
+
+  // what a key that isn't in here might have been counted up to
+  uint64_t min_count() const { return full() ? counters_[heap_[0]].count : 0; }
+
+  uint64_t count_at(size_t pos) const { return counters_[heap_[pos]].count; }
+
+  void swap_at(size_t a, size_t b) {
+    swap(heap_[a], heap_[b]);
+    counters_[heap_[a]].pos = a;
+    counters_[heap_[b]].pos = b;
+  }
+
+  void sift_up(size_t i) {
+    while (i > 0) {
+      auto parent = (i - 1) / 2;
+      if (count_at(parent) <= count_at(i))
+	break;
+      swap_at(i, parent);
+      i = parent;
+    }
+  }
+
+  void sift_down(size_t i) {
+    for (;;) {
+      auto smallest = i;
+      auto left = 2 * i + 1;
+      auto right = left + 1;
+      if (left < heap_.size() && count_at(left) < count_at(smallest))
+	smallest = left;
+      if (right < heap_.size() && count_at(right) < count_at(smallest))
+	smallest = right;
+      if (smallest == i)
+	return;
+      swap_at(i, smallest);
+      i = smallest;
+    }
+  }
+
+  size_t capacity_;
+  vector<Counter> counters_;
+  vector<uint32_t> heap_;
+  unordered_map<K, uint32_t, Hash> index_;
+  uint64_t total_ = 0;
+};
+
+struct HeavyHitter {
+  string key;
+  uint64_t count;        // estimate, never below the real count
+  uint64_t lower_bound;  // the real count is at least this
+};
+
+// Space-Saving for the candidates, Count-Min to tighten their estimates.
+template <typename K, typename Hash = hash<K>>
+class HeavyHitters {
+public:
+  explicit HeavyHitters(size_t capacity) : summary_(capacity) {}
+
+  void add(const K& key) {
+    summary_.add(key);
+    sketch_.add(Hash()(key));
+  }
+
+  void merge(const HeavyHitters& other) {
+    summary_.merge(other.summary_);
+    sketch_.merge(other.sketch_);
+  }
+
+  // to_string turns a key into what's reported
+  template <typename F>
+  vector<HeavyHitter> top(size_t n, F&& to_string) const {
+    vector<HeavyHitter> rv;
+    for (const auto& entry : summary_.top(n)) {
+      auto count = std::min(entry.count, sketch_.estimate(Hash()(entry.key)));
+      auto lower_bound = entry.count - entry.error;
+      rv.push_back(HeavyHitter{to_string(entry.key), count, std::min(lower_bound, count)});
+    }
+    return rv;
+  }
+
+  uint64_t total() const { return summary_.total(); }
+
+private:
+  SpaceSaving<K, Hash> summary_;
+  CountMinSketch sketch_;
+};
+
+struct HeavyHittersSnapshot {
+  uint64_t requests = 0;
+  vector<HeavyHitter> paths;
+  vector<HeavyHitter> prefixes;
+  vector<HeavyHitter> clients;
+  vector<HeavyHitter> client_opcodes;
+};
+
+// Heavy hitters among requests: paths, path prefixes, client IPs and
+// (client IP, opcode) pairs, in fixed memory (capacity entries per table
+// plus a 64KB sketch each).
+//
+// Each Decoder owns one and updates it from its own thread; snapshot()
+// can run from any other thread, it only holds the lock while copying.
+class HeavyHitterTracker {
+public:
+  HeavyHitterTracker(size_t capacity, int prefix_depth);
+
+  void add(const Endpoint& client, int opcode, string_view path);
+  void merge(const HeavyHitterTracker& other);
+  HeavyHittersSnapshot snapshot(size_t n) const;
+
+private:
+  struct ClientOpcode {
+    Endpoint client;
+    int opcode;
+
+    bool operator==(const ClientOpcode& other) const {
+      return client == other.client && opcode == other.opcode;
+    }
+  };
+
+  struct ClientOpcodeHash {
+    size_t operator()(const ClientOpcode& key) const {
+      return mix64(key.client.hash() ^ (uint64_t)(key.opcode + 1000));
+    }
+  };
+
+  size_t capacity_;
+  int prefix_depth_;
+  mutable mutex mutex_;
+  uint64_t requests_ = 0;
+  HeavyHitters<string> paths_;
+  HeavyHitters<string> prefixes_;
+  HeavyHitters<Endpoint, EndpointHash> clients_;
+  HeavyHitters<ClientOpcode, ClientOpcodeHash> client_opcodes_;
+};
+
+}
@@ -0,0 +1,55 @@
+#include "histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace Zktraffic {
+
+Histogram::Histogram() : sum_(0), max_(0) {
+  for (auto& count : counts_)
+    count.store(0, memory_order_relaxed);
+}
+
+HistogramSnapshot Histogram::snapshot() const {
+  HistogramSnapshot snap;
+
+  for (int i = 0; i < BUCKETS; i++) {
+    snap.counts_[i] = counts_[i].load(memory_order_relaxed);
+    snap.count_ += snap.counts_[i];
+  }
+  snap.sum_ = sum_.load(memory_order_relaxed);
+  snap.max_ = max_.load(memory_order_relaxed);
+
+  return snap;
+}
+
+uint64_t HistogramSnapshot::percentile(double q) const {
+  if (count_ == 0)
+    return 0;
+
+  auto rank = (uint64_t)ceil(std::min(std::max(q, 0.0), 1.0) * count_);
+  if (rank == 0)
+    rank = 1;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < Histogram::BUCKETS; i++) {
+    seen += counts_[i];
+    if (seen >= rank)
+      return std::min(Histogram::bucket_limit(i), max_);
+  }
+
+  return max_;
+}
+
+HistogramSnapshot& HistogramSnapshot::operator+=(const HistogramSnapshot& other) {
+  for (int i = 0; i < Histogram::BUCKETS; i++)
+    counts_[i] += other.counts_[i];
+  count_ += other.count_;
+  sum_ += other.sum_;
+  max_ = std::max(max_, other.max_);
+  return *this;
+}
+
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+namespace Zktraffic {
+
+class HistogramSnapshot;
+
+// HDR style log-linear histogram: values below 128 get their own bucket,
+// above that every power of two is split into 64 buckets, so any recorded
+// value is off by at most 1/64 (~1.6%). Covers values below 2^38 (~3 days
+// in usecs), larger ones land in the last bucket.
+//
+// record() is lock-free and can be called from several threads,
+// snapshot() can run concurrently with it from any other thread.
+class Histogram {
+public:
+  static const int SUB_BITS = 6;
+  static const int SUB_COUNT = 1 << SUB_BITS;
+  static const int MAX_SHIFT = 31;
+  static const int BUCKETS = (MAX_SHIFT + 2) * SUB_COUNT;
+
+  Histogram();
+  Histogram(const Histogram&) = delete;
+  Histogram& operator=(const Histogram&) = delete;
+
+  void record(uint64_t value) {
+    counts_[bucket_for(value)].fetch_add(1, memory_order_relaxed);
+    sum_.fetch_add(value, memory_order_relaxed);
+    auto max = max_.load(memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(max, value, memory_order_relaxed))
+      ;
+  }
+
+  HistogramSnapshot snapshot() const;
+
+  static int bucket_for(uint64_t value) {
+    if (value < 2 * SUB_COUNT)
+      return value;
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    if (shift > MAX_SHIFT)
+      return BUCKETS - 1;
+    return (shift + 1) * SUB_COUNT + (value >> shift) - SUB_COUNT;
+  }
+
+  // Highest value that maps to the bucket.
+  static uint64_t bucket_limit(int bucket) {
+    if (bucket < 2 * SUB_COUNT)
+      return bucket;
+    int shift = bucket / SUB_COUNT - 1;
+    uint64_t base = (uint64_t)(bucket % SUB_COUNT + SUB_COUNT) << shift;
+    return base + ((uint64_t)1 << shift) - 1;
+  }
+
+private:
+  atomic<uint64_t> counts_[BUCKETS];
+  atomic<uint64_t> sum_;
+  atomic<uint64_t> max_;
+};
+
+class HistogramSnapshot {
+public:
+  HistogramSnapshot() : counts_(Histogram::BUCKETS, 0) {}
+
+  uint64_t count() const { return count_; }
+  uint64_t max() const { return max_; }
+  uint64_t sum() const { return sum_; }
+  double mean() const { return count_ ? (double)sum_ / count_ : 0; }
+  // q in [0, 1], e.g. 0.999 for p999
+  uint64_t percentile(double q) const;
+
+  HistogramSnapshot& operator+=(const HistogramSnapshot& other);
+
+private:
+  friend class Histogram;
+
+  vector<uint64_t> counts_;
+  uint64_t count_ = 0;
+  uint64_t sum_ = 0;
+  uint64_t max_ = 0;
+};
+
+}
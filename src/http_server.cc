@@ -0,0 +1,274 @@
+#include "http_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Zktraffic {
+
+namespace {
+
+const char *status_text(int status) {
+  switch (status) {
+  case 200:
+    return "OK";
+  case 400:
+    return "Bad Request";
+  case 404:
+    return "Not Found";
+  case 405:
+    return "Method Not Allowed";
+  }
+  return "Internal Server Error";
+}
+
+}
+
+bool HttpServer::start() {
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port_);
+  if (inet_pton(AF_INET, address_.c_str(), &addr.sin_addr) != 1) {
+    cout << "bad http address: " << address_ << "\n";
+    return false;
+  }
+
+  listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (listen_fd_ < 0) {
+    cout << "couldn't create the http socket: " << strerror(errno) << "\n";
+    return false;
+  }
+
+  int one = 1;
+  setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+  if (bind(listen_fd_, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+      listen(listen_fd_, SOMAXCONN) < 0) {
+    cout << "couldn't listen on " << address_ << ":" << port_ << ": " << strerror(errno) << "\n";
+    close(listen_fd_);
+    listen_fd_ = -1;
+    return false;
+  }
+
+  socklen_t len = sizeof(addr);
+  getsockname(listen_fd_, (struct sockaddr *)&addr, &len);
+  port_ = ntohs(addr.sin_port);
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = listen_fd_;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &ev);
+  ev.data.fd = wake_fd_;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &ev);
+
+  running_ = true;
+  runner_ = thread([this]() { loop(); });
+
+  return true;
+}
+
+void HttpServer::stop() {
+  if (!running_.exchange(false))
+    return;
+
+  uint64_t one = 1;
+  if (write(wake_fd_, &one, sizeof(one)) < 0)
+    cout << "couldn't wake up the http server\n";
+  runner_.join();
+
+  for (auto& entry : connections_)
+    close(entry.first);
+  connections_.clear();
+  close(listen_fd_);
+  close(wake_fd_);
+  close(epoll_fd_);
+}
+
+void HttpServer::loop() {
+  struct epoll_event events[32];
+
+  while (running_) {
+    int count = epoll_wait(epoll_fd_, events, 32, close_stale());
+    if (count < 0 && errno != EINTR)
+      break;
+
+    for (int i = 0; i < count; i++) {
+      int fd = events[i].data.fd;
+      if (fd == wake_fd_)
+	continue;
+      if (fd == listen_fd_) {
+	accept_connections();
+	continue;
+      }
+      if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+	close_connection(fd);
+	continue;
+      }
+      if (events[i].events & EPOLLIN)
+	on_readable(fd);
+      else if (events[i].events & EPOLLOUT)
+	on_writable(fd);
+    }
+  }
+}
+
+void HttpServer::accept_connections() {
+  for (;;) {
+    int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+
+    if (connections_.size() >= MAX_CONNECTIONS) {
+      close(fd);
+      continue;
+    }
+
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    connections_.emplace(fd, Connection());
+  }
+}
+
+void HttpServer::on_readable(int fd) {
+  auto& conn = connections_[fd];
+  char buf[4096];
+  bool eof = false;
+
+  for (;;) {
+    auto len = read(fd, buf, sizeof(buf));
+    if (len > 0) {
+      conn.in.append(buf, len);
+      if (conn.in.size() > MAX_REQUEST)
+	break;
+      continue;
+    }
+    if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      close_connection(fd);
+      return;
+    }
+    eof = len == 0;
+    break;
+  }
+
+  auto end = conn.in.find("\r\n\r\n");
+  if (end == string::npos && conn.in.size() <= MAX_REQUEST) {
+    if (eof)
+      close_connection(fd);
+    return;
+  }
+
+  HttpResponse response;
+  if (end == string::npos) {
+    response.status = 400;
+    response.body = "request too large\n";
+  } else {
+    response = respond(conn.in.substr(0, end));
+  }
+
+  stringstream ss;
+  ss << "HTTP/1.0 " << response.status << " " << status_text(response.status) << "\r\n" <<
+    "Content-Type: " << response.content_type << "\r\n" <<
+    "Content-Length: " << response.body.size() << "\r\n" <<
+    "Connection: close\r\n" <<
+    "\r\n" << response.body;
+  conn.out = ss.str();
+  conn.in.clear();
+
+  struct epoll_event ev = {};
+  ev.events = EPOLLOUT;
+  ev.data.fd = fd;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+  on_writable(fd);
+}
+
+void HttpServer::on_writable(int fd) {
+  auto& conn = connections_[fd];
+
+  while (conn.written < conn.out.size()) {
+    auto len = write(fd, conn.out.data() + conn.written, conn.out.size() - conn.written);
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+	return;
+      break;
+    }
+    conn.written += len;
+  }
+
+  close_connection(fd);
+}
+
+int HttpServer::close_stale() {
+  auto now = chrono::steady_clock::now();
+  auto next = chrono::steady_clock::time_point::max();
+
+  for (auto it = connections_.begin(); it != connections_.end(); ) {
+    int fd = it->first;
+    auto expires = it->second.accepted + idle_timeout_;
+    // close_connection() erases fd, so move past it first
+    ++it;
+    if (expires <= now)
+      close_connection(fd);
+    else
+      next = min(next, expires);
+  }
+
+  if (next == chrono::steady_clock::time_point::max())
+    return -1;
+  // rounded up, so we don't wake up just before the deadline
+  return chrono::ceil<chrono::milliseconds>(next - now).count();
+}
+
+void HttpServer::close_connection(int fd) {
+  epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, nullptr);
+  close(fd);
+  connections_.erase(fd);
+}
+
+HttpResponse HttpServer::respond(const string& request) const {
+  HttpResponse response;
+
+  // request line: METHOD SP PATH SP VERSION
+  auto line = request.substr(0, request.find("\r\n"));
+  auto method_end = line.find(' ');
+  auto path_end = line.find(' ', method_end + 1);
+  if (method_end == string::npos || path_end == string::npos) {
+    response.status = 400;
+    response.body = "bad request\n";
+    return response;
+  }
+
+  if (line.compare(0, method_end, "GET") != 0) {
+    response.status = 405;
+    response.body = "only GET is supported\n";
+    return response;
+  }
+
+  auto path = line.substr(method_end + 1, path_end - method_end - 1);
+  path = path.substr(0, path.find('?'));
+  auto it = handlers_.find(path);
+  if (it == handlers_.end()) {
+    response.status = 404;
+    response.body = "not found\n";
+    return response;
+  }
+
+  return it->second();
+}
+
+}
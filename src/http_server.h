@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+namespace Zktraffic {
+
+struct HttpResponse {
+  int status = 200;
+  string content_type = "text/plain; charset=utf-8";
+  string body;
+};
+
+// Minimal HTTP/1.0 server for metrics: GET only, one request per
+// connection, responses built in full by the handler. Runs a single epoll
+// loop on its own thread with non-blocking sockets, so a slow client can't
+// hold up anybody else, and closes connections that outlive the idle
+// timeout, so idle ones can't use up MAX_CONNECTIONS either.
+class HttpServer {
+public:
+  using Handler = function<HttpResponse()>;
+
+  // largest request (headers included) we're willing to read
+  static const size_t MAX_REQUEST = 8192;
+  static const int MAX_CONNECTIONS = 64;
+  // how long a connection gets to send its request and read the response
+  static constexpr chrono::milliseconds IDLE_TIMEOUT{5000};
+
+  HttpServer(string address, int port, chrono::milliseconds idle_timeout = IDLE_TIMEOUT) :
+    address_(move(address)), port_(port), idle_timeout_(idle_timeout) {}
+  HttpServer(const HttpServer&) = delete;
+  HttpServer& operator=(const HttpServer&) = delete;
+  ~HttpServer() { stop(); }
+
+  // Must be called before start().
+  void handle(const string& path, Handler handler) { handlers_[path] = move(handler); }
+
+  // Binds and starts serving; false (with the reason on cout) if the
+  // socket couldn't be set up.
+  bool start();
+  void stop();
+
+  // the port we're bound to (useful when asking for port 0)
+  int port() const { return port_; }
+
+private:
+  struct Connection {
+    chrono::steady_clock::time_point accepted = chrono::steady_clock::now();
+    string in;
+    string out;
+    size_t written = 0;
+  };
+
+  void loop();
+  void accept_connections();
+  void on_readable(int fd);
+  void on_writable(int fd);
+  void close_connection(int fd);
+  // closes connections older than idle_timeout_, and returns how long
+  // epoll_wait() may wait until the next one is (-1 if there are none)
+  int close_stale();
+  HttpResponse respond(const string& request) const;
+
+  string address_;
+  int port_;
+  chrono::milliseconds idle_timeout_;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int wake_fd_ = -1;
+  atomic<bool> running_{false};
+  thread runner_;
+  map<string, Handler> handlers_;
+  unordered_map<int, Connection> connections_;
+};
+
+}
@@ -0,0 +1,109 @@
+#include "latency.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+LatencyStats::OpcodeHistograms::OpcodeHistograms() {
+  for (auto& histogram : histograms_)
+    histogram.store(nullptr, memory_order_relaxed);
+}
+
+LatencyStats::OpcodeHistograms::~OpcodeHistograms() {
+  for (auto& histogram : histograms_)
+    delete histogram.load(memory_order_relaxed);
+}
+
+void LatencyStats::OpcodeHistograms::record(int index, uint64_t usecs) {
+  auto histogram = histograms_[index].load(memory_order_acquire);
+  if (histogram == nullptr) {
+    auto fresh = new Histogram();
+    if (histograms_[index].compare_exchange_strong(histogram, fresh, memory_order_acq_rel)) {
+      histogram = fresh;
+    } else {
+      delete fresh;
+    }
+  }
+  histogram->record(usecs);
+}
+
+map<int, HistogramSnapshot> LatencyStats::OpcodeHistograms::snapshot() const {
+  map<int, HistogramSnapshot> rv;
+  for (int i = 0; i < OPCODE_SLOTS; i++) {
+    auto histogram = histograms_[i].load(memory_order_acquire);
+    if (histogram != nullptr)
+      rv.emplace(opcode_from_index(i), histogram->snapshot());
+  }
+  return rv;
+}
+
+LatencyStats::~LatencyStats() {
+  for (auto& server : servers_)
+    delete server.load(memory_order_relaxed);
+}
+
+void LatencyStats::record(const FlowKey& conn, int opcode, uint64_t usecs, int ensemble) {
+  auto index = opcode_index(opcode);
+  if (index < 0)
+    return;
+
+  histograms_.record(index, usecs);
+
+  if (ensemble >= 0 && ensemble < ServerSet::MAX_ENSEMBLES)
+    ensembles_[ensemble].record(index, usecs);
+
+  if (per_server_) {
+    auto srv = server(conn.dst);
+    if (srv != nullptr)
+      srv->histograms.record(index, usecs);
+  }
+}
+
+LatencyStats::Server *LatencyStats::server(const Endpoint& endpoint) {
+  auto slot = endpoint.hash() % MAX_SERVERS;
+  for (int i = 0; i < MAX_SERVERS; i++) {
+    auto& entry = servers_[(slot + i) % MAX_SERVERS];
+    auto srv = entry.load(memory_order_acquire);
+    if (srv == nullptr) {
+      auto fresh = new Server{endpoint, {}};
+      if (entry.compare_exchange_strong(srv, fresh, memory_order_acq_rel))
+	return fresh;
+      delete fresh;
+    }
+    if (srv->endpoint == endpoint)
+      return srv;
+  }
+
+  servers_dropped_.fetch_add(1, memory_order_relaxed);
+  return nullptr;
+}
+
+map<int, HistogramSnapshot> LatencyStats::by_opcode() const {
+  return histograms_.snapshot();
+}
+
+map<Endpoint, map<int, HistogramSnapshot>> LatencyStats::by_server() const {
+  map<Endpoint, map<int, HistogramSnapshot>> rv;
+
+  for (auto& entry : servers_) {
+    auto srv = entry.load(memory_order_acquire);
+    if (srv != nullptr)
+      rv.emplace(srv->endpoint, srv->histograms.snapshot());
+  }
+
+  return rv;
+}
+
+map<int, map<int, HistogramSnapshot>> LatencyStats::by_ensemble() const {
+  map<int, map<int, HistogramSnapshot>> rv;
+
+  for (int i = 0; i < ServerSet::MAX_ENSEMBLES; i++) {
+    auto snapshot = ensembles_[i].snapshot();
+    if (!snapshot.empty())
+      rv.emplace(i, move(snapshot));
+  }
+
+  return rv;
+}
+
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "histogram.h"
+#include "server_set.h"
+#include "tcp_packet.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// Request -> reply latencies (usecs) per opcode and, optionally, per server
+// and per ensemble (see ServerSet).
+//
+// Histograms are allocated the first time an opcode (or server) shows up,
+// with a CAS, so recording stays lock-free and snapshots can be taken from
+// any thread.
+class LatencyStats {
+public:
+  static const int MAX_SERVERS = 64;
+
+  explicit LatencyStats(bool per_server = false) : per_server_(per_server) {}
+  LatencyStats(const LatencyStats&) = delete;
+  LatencyStats& operator=(const LatencyStats&) = delete;
+  ~LatencyStats();
+
+  // conn is the client -> server flow the request went over, ensemble its
+  // index in the ServerSet (-1 doesn't record it per ensemble).
+  void record(const FlowKey& conn, int opcode, uint64_t usecs, int ensemble = -1);
+
+  // opcode -> snapshot, only for opcodes that were seen
+  map<int, HistogramSnapshot> by_opcode() const;
+  // server -> opcode -> snapshot
+  map<Endpoint, map<int, HistogramSnapshot>> by_server() const;
+  // ensemble -> opcode -> snapshot, only for ensembles that were recorded
+  map<int, map<int, HistogramSnapshot>> by_ensemble() const;
+  // servers that didn't fit in the per server table
+  uint64_t servers_dropped() const { return servers_dropped_.load(memory_order_relaxed); }
+
+private:
+  class OpcodeHistograms {
+  public:
+    OpcodeHistograms();
+    ~OpcodeHistograms();
+    void record(int index, uint64_t usecs);
+    map<int, HistogramSnapshot> snapshot() const;
+
+  private:
+    atomic<Histogram *> histograms_[OPCODE_SLOTS];
+  };
+
+  struct Server {
+    Endpoint endpoint;
+    OpcodeHistograms histograms;
+  };
+
+  Server *server(const Endpoint& endpoint);
+
+  bool per_server_;
+  OpcodeHistograms histograms_;
+  OpcodeHistograms ensembles_[ServerSet::MAX_ENSEMBLES];
+  atomic<Server *> servers_[MAX_SERVERS] = {};
+  atomic<uint64_t> servers_dropped_{0};
+};
+
+}
@@ -0,0 +1,152 @@
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include "message_pool.h"
+
+namespace Zktraffic {
+
+const size_t MessagePool::ALIGN;
+const size_t MessagePool::MAX_SIZE;
+const size_t MessagePool::CLASSES;
+const size_t MessagePool::BATCH;
+const size_t MessagePool::DEPOT_BATCHES;
+
+namespace {
+
+// free blocks are linked through their first word
+struct Block {
+  Block *next;
+};
+
+struct FreeList {
+  Block *head = nullptr;
+  size_t count = 0;
+};
+
+// Batches of up to BATCH blocks (fewer when a thread flushes what it has).
+struct Depot {
+  mutex lock;
+  vector<FreeList> batches[MessagePool::CLASSES];
+};
+
+Depot& depot() {
+  // never destroyed: threads may still flush into it on the way out
+  static Depot *depot = new Depot();
+  return *depot;
+}
+
+atomic<uint64_t> heap_blocks{0};
+
+void free_batch(Block *block) {
+  while (block) {
+    auto next = block->next;
+    ::operator delete(block);
+    block = next;
+  }
+}
+
+struct Cache {
+  FreeList lists[MessagePool::CLASSES];
+
+  ~Cache() { flush(); }
+
+  void flush() {
+    for (size_t i = 0; i < MessagePool::CLASSES; i++) {
+      auto& list = lists[i];
+      while (list.count > 0) {
+	auto n = min(list.count, MessagePool::BATCH);
+	give_back(i, list, n);
+      }
+    }
+  }
+
+  // Moves the first n blocks of the list to the depot.
+  void give_back(size_t cls, FreeList& list, size_t n) {
+    Block *head = list.head;
+    Block *tail = head;
+    for (size_t i = 1; i < n; i++)
+      tail = tail->next;
+    list.head = tail->next;
+    list.count -= n;
+    tail->next = nullptr;
+
+    auto& d = depot();
+    {
+      lock_guard<mutex> lock(d.lock);
+      if (d.batches[cls].size() < MessagePool::DEPOT_BATCHES) {
+	d.batches[cls].push_back(FreeList{head, n});
+	return;
+      }
+    }
+    free_batch(head);
+  }
+
+  bool take(size_t cls, FreeList& list) {
+    auto& d = depot();
+    lock_guard<mutex> lock(d.lock);
+    if (d.batches[cls].empty())
+      return false;
+    list = d.batches[cls].back();
+    d.batches[cls].pop_back();
+    return true;
+  }
+};
+
+thread_local Cache cache;
+
+}
+
+void *MessagePool::allocate(size_t size) {
+  if (size == 0 || size > MAX_SIZE)
+    return ::operator new(size);
+
+  size_t cls = (size - 1) / ALIGN;
+  auto& list = cache.lists[cls];
+  if (list.head == nullptr && !cache.take(cls, list)) {
+    heap_blocks.fetch_add(1, memory_order_relaxed);
+    return ::operator new((cls + 1) * ALIGN);
+  }
+
+  auto block = list.head;
+  list.head = block->next;
+  list.count--;
+  return block;
+}
+
+void MessagePool::release(void *p, size_t size) {
+  if (p == nullptr)
+    return;
+  if (size == 0 || size > MAX_SIZE) {
+    ::operator delete(p);
+    return;
+  }
+
+  size_t cls = (size - 1) / ALIGN;
+  auto& list = cache.lists[cls];
+  auto block = static_cast<Block *>(p);
+  block->next = list.head;
+  list.head = block;
+  list.count++;
+  if (list.count > 2 * BATCH)
+    cache.give_back(cls, list, BATCH);
+}
+
+void MessagePool::flush() {
+  cache.flush();
+}
+
+MessagePoolStats MessagePool::stats() {
+  MessagePoolStats rv;
+  rv.heap = heap_blocks.load(memory_order_relaxed);
+  auto& d = depot();
+  lock_guard<mutex> lock(d.lock);
+  for (size_t i = 0; i < CLASSES; i++) {
+    for (const auto& batch : d.batches[i])
+      rv.depot += batch.count;
+  }
+  return rv;
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <utility>
+
+using namespace std;
+
+namespace Zktraffic {
+
+struct MessagePoolStats {
+  uint64_t heap = 0;      // blocks that had to come from the heap
+  uint64_t depot = 0;     // blocks waiting in the shared depot
+};
+
+// Recycles the memory decoded messages live in (see ZKMessage::operator
+// new), so that at steady state decoding one doesn't hit the allocator.
+//
+// Blocks come in size classes of 16 bytes, up to MAX_SIZE; bigger ones go
+// straight to the heap. Each thread keeps free lists of its own, so
+// allocating and releasing take no locks. Messages are usually released
+// by a different thread than the one that decoded them: when a thread has
+// more than 2 * BATCH free blocks of a class, BATCH of them move to a
+// shared depot, and a thread that runs out takes a batch from there before
+// going to the heap. The depot is bounded too (DEPOT_BATCHES per class),
+// past that blocks are freed.
+class MessagePool {
+public:
+  static const size_t ALIGN = 16;
+  static const size_t MAX_SIZE = 512;
+  static const size_t CLASSES = MAX_SIZE / ALIGN;
+  static const size_t BATCH = 64;
+  static const size_t DEPOT_BATCHES = 1024;
+
+  static void *allocate(size_t size);
+  static void release(void *p, size_t size);
+
+  // Returns the calling thread's free blocks to the depot (threads do it
+  // when they exit).
+  static void flush();
+  static MessagePoolStats stats();
+};
+
+// A string kept in MessagePool blocks, for the bits of a frame a decoded
+// message holds on to (request paths): they come and go with the message,
+// so recycling them keeps decoding off the allocator too. Move only.
+class PooledString {
+public:
+  PooledString() = default;
+  explicit PooledString(string_view s) : size_(s.size()) {
+    if (size_ > 0) {
+      data_ = static_cast<char *>(MessagePool::allocate(size_));
+      memcpy(data_, s.data(), size_);
+    }
+  }
+  PooledString(PooledString&& other) noexcept : data_(other.data_), size_(other.size_) {
+    other.data_ = nullptr;
+    other.size_ = 0;
+  }
+  PooledString& operator=(PooledString&& other) noexcept {
+    std::swap(data_, other.data_);
+    std::swap(size_, other.size_);
+    return *this;
+  }
+  ~PooledString() { MessagePool::release(data_, size_); }
+
+  operator string_view() const { return string_view(data_, size_); }
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+
+private:
+  char *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+}
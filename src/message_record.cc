@@ -0,0 +1,152 @@
+#include "message_record.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+const size_t MessageBatch::CAPACITY;
+
+MessageBatch::MessageBatch(bool frames) {
+  timestamps_.reserve(CAPACITY);
+  zxids_.reserve(CAPACITY);
+  latencies_.reserve(CAPACITY);
+  xids_.reserve(CAPACITY);
+  errors_.reserve(CAPACITY);
+  clients_.reserve(CAPACITY);
+  servers_.reserve(CAPACITY);
+  paths_.reserve(CAPACITY);
+  sizes_.reserve(CAPACITY);
+  opcodes_.reserve(CAPACITY);
+  kinds_.reserve(CAPACITY);
+  event_types_.reserve(CAPACITY);
+  if (frames)
+    frames_.reset(new StringList());
+}
+
+void MessageBatch::add(const ZKMessage& message, string_view frame) {
+  long long zxid = 0;
+  long long latency = -1;
+  int error = 0;
+  int opcode = -1;
+  int event_type = 0;
+  uint32_t path = 0;
+
+  switch (message.kind()) {
+  case MessageKind::REQUEST: {
+    auto& request = static_cast<const ZKClientMessage&>(message);
+    opcode = request.opcode();
+    path = path_id(request.path(), request.path_id());
+    break;
+  }
+  case MessageKind::REPLY: {
+    auto& reply = static_cast<const ZKServerMessage&>(message);
+    zxid = reply.zxid();
+    error = reply.error();
+    opcode = reply.opcode();
+    latency = reply.latency();
+    break;
+  }
+  case MessageKind::WATCH: {
+    auto& watch = static_cast<const WatchEvent&>(message);
+    zxid = watch.zxid();
+    error = watch.error();
+    event_type = watch.event_type();
+    path = path_id(watch.path(), watch.path_id());
+    break;
+  }
+  }
+
+  timestamps_.push_back(message.timestamp());
+  zxids_.push_back(zxid);
+  latencies_.push_back(latency);
+  xids_.push_back(message.xid());
+  errors_.push_back(error);
+  clients_.push_back(endpoint_id(message.client()));
+  servers_.push_back(endpoint_id(message.server()));
+  paths_.push_back(path);
+  sizes_.push_back(message.size());
+  opcodes_.push_back(opcode);
+  kinds_.push_back(message.kind());
+  event_types_.push_back(event_type);
+  if (frames_ != nullptr)
+    frames_->push_back(frame);
+}
+
+MessageRecord MessageBatch::record(size_t i) const {
+  return MessageRecord{
+    timestamps_[i],
+    zxids_[i],
+    latencies_[i],
+    xids_[i],
+    errors_[i],
+    clients_[i],
+    servers_[i],
+    paths_[i],
+    sizes_[i],
+    opcodes_[i],
+    kinds_[i],
+    event_types_[i],
+  };
+}
+
+// Decodes the frame the way the Decoder did, minus the state it kept: the
+// request's opcode (and whether it was a handshake) comes from the record.
+unique_ptr<ZKMessage> MessageBatch::message(size_t i) const {
+  if (frames_ == nullptr)
+    return nullptr;
+
+  const auto& client = endpoints_[clients_[i]];
+  const auto& server = endpoints_[servers_[i]];
+  auto frame = (*frames_)[i];
+
+  unique_ptr<ZKMessage> rv;
+  if (kinds_[i] == MessageKind::REQUEST) {
+    rv = ZKClientMessage::from_payload(client, server, frame);
+  } else {
+    unique_ptr<ZKServerMessage> reply;
+    if (opcodes_[i] == enumToInt(Opcodes::CONNECT))
+      reply = ConnectReply::from_payload(client, server, frame);
+    else
+      reply = ZKServerMessage::from_payload(client, server, frame, opcodes_[i]);
+    if (reply != nullptr)
+      reply->set_latency(latencies_[i]);
+    rv = move(reply);
+  }
+
+  if (rv != nullptr) {
+    rv->set_timestamp(timestamps_[i]);
+    rv->set_size(sizes_[i]);
+  }
+  return rv;
+}
+
+uint32_t MessageBatch::endpoint_id(const Endpoint& endpoint) {
+  auto it = endpoint_ids_.find(endpoint);
+  if (it != endpoint_ids_.end())
+    return it->second;
+
+  uint32_t id = endpoints_.size();
+  endpoints_.push_back(endpoint);
+  endpoint_ids_.emplace(endpoint, id);
+  return id;
+}
+
+uint32_t MessageBatch::path_id(string_view path, uint32_t interned) {
+  if (path.empty())
+    return 0;
+
+  if (interned != PathInterner::NONE) {
+    auto it = path_ids_.find(interned);
+    // ids of evicted paths get reused eventually
+    if (it != path_ids_.end() && path_strings_[it->second - 1] == path)
+      return it->second;
+  }
+
+  path_strings_.push_back(path);
+  uint32_t id = path_strings_.size();
+  if (interned != PathInterner::NONE)
+    path_ids_[interned] = id;
+  return id;
+}
+
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "endpoint.h"
+#include "string_list.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// What aggregations need from a message, in a fixed-size plain struct:
+// no virtual calls or casts to get at it, and it can live in arrays.
+// Endpoints and paths are ids into the MessageBatch it came from.
+struct MessageRecord {
+  uint64_t timestamp;  // usecs
+  int64_t zxid;        // replies and watches, 0 for requests
+  int64_t latency;     // usecs, replies only, -1 if unknown
+  int32_t xid;
+  int32_t error;
+  uint32_t client;     // index into MessageBatch::endpoints()
+  uint32_t server;
+  uint32_t path;       // MessageBatch::path() id, 0 for none
+  uint32_t size;       // bytes on the wire, length prefix included
+  int16_t opcode;      // the request's, -1 if unknown
+  MessageKind kind;
+  uint8_t event_type;  // watches only
+};
+
+static_assert(sizeof(MessageRecord) == 56, "MessageRecord layout changed");
+
+// Up to CAPACITY messages from one Decoder, stored by column (one array
+// per MessageRecord field), so a pass that only needs, say, opcodes and
+// sizes reads just those. Endpoints and paths are stored once per batch.
+//
+// With frames, the frames themselves are kept too and message() can
+// decode the full message again, for when something has to be printed.
+class MessageBatch {
+public:
+  static const size_t CAPACITY = 1024;
+
+  explicit MessageBatch(bool frames = false);
+  MessageBatch(const MessageBatch&) = delete;
+  MessageBatch& operator=(const MessageBatch&) = delete;
+
+  // frame is ignored unless keeping frames
+  void add(const ZKMessage& message, string_view frame = string_view());
+
+  size_t size() const { return timestamps_.size(); }
+  bool empty() const { return timestamps_.empty(); }
+  bool full() const { return size() >= CAPACITY; }
+  bool has_frames() const { return frames_ != nullptr; }
+
+  // gathers the i-th message's columns
+  MessageRecord record(size_t i) const;
+  // nullptr without frames (or if decoding fails, which it shouldn't). The
+  // message has no path_id(), those belong to the Decoder's PathInterner.
+  unique_ptr<ZKMessage> message(size_t i) const;
+
+  const vector<uint64_t>& timestamps() const { return timestamps_; }
+  const vector<int64_t>& zxids() const { return zxids_; }
+  const vector<int64_t>& latencies() const { return latencies_; }
+  const vector<int32_t>& xids() const { return xids_; }
+  const vector<int32_t>& errors() const { return errors_; }
+  const vector<uint32_t>& clients() const { return clients_; }
+  const vector<uint32_t>& servers() const { return servers_; }
+  const vector<uint32_t>& paths() const { return paths_; }
+  const vector<uint32_t>& sizes() const { return sizes_; }
+  const vector<int16_t>& opcodes() const { return opcodes_; }
+  const vector<MessageKind>& kinds() const { return kinds_; }
+  const vector<uint8_t>& event_types() const { return event_types_; }
+
+  const vector<Endpoint>& endpoints() const { return endpoints_; }
+  // empty for 0
+  string_view path(uint32_t id) const { return id == 0 ? string_view() : path_strings_[id - 1]; }
+
+private:
+  uint32_t endpoint_id(const Endpoint& endpoint);
+  uint32_t path_id(string_view path, uint32_t interned);
+
+  vector<uint64_t> timestamps_;
+  vector<int64_t> zxids_;
+  vector<int64_t> latencies_;
+  vector<int32_t> xids_;
+  vector<int32_t> errors_;
+  vector<uint32_t> clients_;
+  vector<uint32_t> servers_;
+  vector<uint32_t> paths_;
+  vector<uint32_t> sizes_;
+  vector<int16_t> opcodes_;
+  vector<MessageKind> kinds_;
+  vector<uint8_t> event_types_;
+
+  vector<Endpoint> endpoints_;
+  unordered_map<Endpoint, uint32_t, EndpointHash> endpoint_ids_;
+  StringList path_strings_;
+  // PathInterner id -> path id, so interned paths are stored once
+  unordered_map<uint32_t, uint32_t> path_ids_;
+  unique_ptr<StringList> frames_;
+};
+
+}
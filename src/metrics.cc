@@ -0,0 +1,531 @@
+#include "metrics.h"
+
+#include <iomanip>
+#include <map>
+#include <sstream>
+
+using namespace std;
+
+namespace Zktraffic {
+
+namespace {
+
+const double QUANTILES[] = {0.5, 0.9, 0.99, 0.999};
+
+void metric(stringstream& ss, const char *name, const char *type, const char *help) {
+  ss << "# HELP " << name << " " << help << "\n" <<
+    "# TYPE " << name << " " << type << "\n";
+}
+
+// units is how many of what was recorded make a second
+void summary(stringstream& ss, const char *name, const string& labels,
+  const HistogramSnapshot& histogram, double units = 1e6) {
+  auto sep = labels.empty() ? "" : ",";
+  for (auto q : QUANTILES) {
+    ss << name << "{" << labels << sep << "quantile=\"" << q << "\"} " <<
+      histogram.percentile(q) / units << "\n";
+  }
+  ss << name << "_sum{" << labels << "} " << histogram.sum() / units << "\n" <<
+    name << "_count{" << labels << "} " << histogram.count() << "\n";
+}
+
+string json_escape(const string& str) {
+  static const char *hex = "0123456789abcdef";
+  string rv;
+
+  rv.reserve(str.size());
+  for (unsigned char c : str) {
+    if (c == '"' || c == '\\') {
+      rv += '\\';
+      rv += c;
+    } else if (c < 0x20) {
+      rv += "\\u00";
+      rv += hex[c >> 4];
+      rv += hex[c & 0xf];
+    } else {
+      rv += c;
+    }
+  }
+
+  return rv;
+}
+
+// Prometheus label values only escape backslashes, quotes and newlines,
+// anything else goes through as is.
+string label_escape(const string& str) {
+  string rv;
+
+  rv.reserve(str.size());
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      rv += '\\';
+      rv += c;
+    } else if (c == '\n') {
+      rv += "\\n";
+    } else {
+      rv += c;
+    }
+  }
+
+  return rv;
+}
+
+void json_heavy_hitters(stringstream& ss, const char *name, const vector<HeavyHitter>& table) {
+  bool first = true;
+
+  ss << "\"" << name << "\":[";
+  for (const auto& entry : table) {
+    ss << (first ? "" : ",") <<
+      "{\"key\":\"" << json_escape(entry.key) << "\"," <<
+      "\"count\":" << entry.count << "," <<
+      "\"lower_bound\":" << entry.lower_bound << "}";
+    first = false;
+  }
+  ss << "]";
+}
+
+void json_histogram(stringstream& ss, const HistogramSnapshot& histogram) {
+  ss << "{" <<
+    "\"count\":" << histogram.count() << "," <<
+    "\"mean\":" << histogram.mean() / 1e6 << "," <<
+    "\"p50\":" << histogram.percentile(0.5) / 1e6 << "," <<
+    "\"p90\":" << histogram.percentile(0.9) / 1e6 << "," <<
+    "\"p99\":" << histogram.percentile(0.99) / 1e6 << "," <<
+    "\"p999\":" << histogram.percentile(0.999) / 1e6 << "," <<
+    "\"max\":" << histogram.max() / 1e6 << "}";
+}
+
+void json_latency(stringstream& ss, const map<int, HistogramSnapshot>& by_opcode) {
+  bool first = true;
+
+  ss << "{";
+  for (const auto& entry : by_opcode) {
+    ss << (first ? "" : ",") << "\"" << ZKMessage::opcode_to_name(entry.first) << "\":";
+    json_histogram(ss, entry.second);
+    first = false;
+  }
+  ss << "}";
+}
+
+void prometheus_quorum(stringstream& ss, const QuorumStats& quorum) {
+  metric(ss, "zktraffic_quorum_packets_total", "counter", "Leader/learner packets, by type.");
+  for (int i = 0; i < QUORUM_TYPES; i++) {
+    if (quorum.packets_by_type[i]) {
+      ss << "zktraffic_quorum_packets_total{type=\"" << quorum_type_name(i) << "\"} " <<
+	quorum.packets_by_type[i] << "\n";
+    }
+  }
+  metric(ss, "zktraffic_quorum_proposals_total", "counter", "Proposals sent to learners, by txn type.");
+  for (int i = 0; i < OPCODE_SLOTS; i++) {
+    if (quorum.proposals_by_txn[i]) {
+      ss << "zktraffic_quorum_proposals_total{opcode=\"" <<
+	ZKMessage::opcode_to_name(opcode_from_index(i)) << "\"} " << quorum.proposals_by_txn[i] << "\n";
+    }
+  }
+  metric(ss, "zktraffic_quorum_undecoded_total", "counter", "Times quorum traffic couldn't be decoded.");
+  ss << "zktraffic_quorum_undecoded_total " << quorum.undecoded << "\n";
+  metric(ss, "zktraffic_quorum_connections", "gauge", "Quorum and election connections being decoded.");
+  ss << "zktraffic_quorum_connections " << quorum.connections << "\n";
+
+  metric(ss, "zktraffic_follower_proposals_total", "counter", "Proposals sent to a follower.");
+  for (const auto& f : quorum.followers)
+    ss << "zktraffic_follower_proposals_total{follower=\"" << f.learner.ip() << "\"} " << f.proposals << "\n";
+  metric(ss, "zktraffic_follower_acks_total", "counter", "Proposals a follower acked.");
+  for (const auto& f : quorum.followers)
+    ss << "zktraffic_follower_acks_total{follower=\"" << f.learner.ip() << "\"} " << f.acks << "\n";
+  metric(ss, "zktraffic_follower_commits_total", "counter", "Commits (informs, for observers) sent to a follower.");
+  for (const auto& f : quorum.followers) {
+    ss << "zktraffic_follower_commits_total{follower=\"" << f.learner.ip() << "\"} " <<
+      f.commits + f.informs << "\n";
+  }
+  metric(ss, "zktraffic_follower_pending_acks", "gauge", "Proposals waiting for a follower's ACK.");
+  for (const auto& f : quorum.followers)
+    ss << "zktraffic_follower_pending_acks{follower=\"" << f.learner.ip() << "\"} " << f.pending_acks << "\n";
+  metric(ss, "zktraffic_follower_pending_commits", "gauge", "Proposals sent to a follower but not committed yet.");
+  for (const auto& f : quorum.followers) {
+    ss << "zktraffic_follower_pending_commits{follower=\"" << f.learner.ip() << "\"} " <<
+      f.pending_commits << "\n";
+  }
+  metric(ss, "zktraffic_follower_syncs_total", "counter", "Times a follower synced with the leader, by kind.");
+  for (const auto& f : quorum.followers) {
+    auto labels = "follower=\"" + f.learner.ip() + "\",kind=";
+    ss << "zktraffic_follower_syncs_total{" << labels << "\"diff\"} " << f.diffs << "\n" <<
+      "zktraffic_follower_syncs_total{" << labels << "\"trunc\"} " << f.truncs << "\n" <<
+      "zktraffic_follower_syncs_total{" << labels << "\"snap\"} " << f.snapshots << "\n";
+  }
+  metric(ss, "zktraffic_follower_snapshot_bytes_total", "counter", "Snapshot bytes sent to a follower.");
+  for (const auto& f : quorum.followers) {
+    ss << "zktraffic_follower_snapshot_bytes_total{follower=\"" << f.learner.ip() << "\"} " <<
+      f.snapshot_bytes << "\n";
+  }
+  metric(ss, "zktraffic_follower_ack_latency_seconds", "summary", "Proposal to ACK latency, by follower.");
+  for (const auto& f : quorum.followers)
+    summary(ss, "zktraffic_follower_ack_latency_seconds", "follower=\"" + f.learner.ip() + "\"", f.ack_latency);
+  metric(ss, "zktraffic_follower_commit_latency_seconds", "summary", "Proposal to COMMIT latency, by follower.");
+  for (const auto& f : quorum.followers) {
+    summary(ss, "zktraffic_follower_commit_latency_seconds", "follower=\"" + f.learner.ip() + "\"",
+      f.commit_latency);
+  }
+
+  metric(ss, "zktraffic_election_notifications_total", "counter", "Leader election votes, by the sender's state.");
+  for (int i = 0; i < SERVER_STATES; i++) {
+    ss << "zktraffic_election_notifications_total{state=\"" << server_state_name(i) << "\"} " <<
+      quorum.notifications_by_state[i] << "\n";
+  }
+  metric(ss, "zktraffic_elections_total", "counter", "Election epochs seen.");
+  ss << "zktraffic_elections_total " << quorum.elections << "\n";
+  metric(ss, "zktraffic_election_epoch", "gauge", "The latest election epoch.");
+  ss << "zktraffic_election_epoch " << quorum.election_epoch << "\n";
+  metric(ss, "zktraffic_election_duration_seconds", "gauge", "How long the latest election had servers LOOKING.");
+  ss << "zktraffic_election_duration_seconds " << quorum.election_usecs / 1e6 << "\n";
+}
+
+}
+
+string prometheus_metrics(const Sniffer& sniffer) {
+  auto capture = sniffer.capture_stats();
+  auto decoder = sniffer.decoder_stats();
+  stringstream ss;
+
+  ss << setprecision(9);
+
+  metric(ss, "zktraffic_packets_total", "counter", "Packets captured.");
+  ss << "zktraffic_packets_total " << capture.packets << "\n";
+  metric(ss, "zktraffic_bytes_total", "counter", "Bytes captured (on the wire).");
+  ss << "zktraffic_bytes_total " << capture.bytes << "\n";
+  metric(ss, "zktraffic_pcap_received_total", "counter", "Packets seen by the kernel filter.");
+  ss << "zktraffic_pcap_received_total " << capture.received << "\n";
+  metric(ss, "zktraffic_pcap_dropped_total", "counter", "Packets dropped by the kernel, no room in the buffer.");
+  ss << "zktraffic_pcap_dropped_total " << capture.dropped << "\n";
+  metric(ss, "zktraffic_pcap_if_dropped_total", "counter", "Packets dropped by the interface.");
+  ss << "zktraffic_pcap_if_dropped_total " << capture.if_dropped << "\n";
+  metric(ss, "zktraffic_queue_dropped_total", "counter", "Messages dropped because consumers fell behind.");
+  ss << "zktraffic_queue_dropped_total " << capture.queue_dropped << "\n";
+  metric(ss, "zktraffic_queue_high_water", "gauge", "Most messages ever waiting for consumers.");
+  ss << "zktraffic_queue_high_water " << capture.queue_high_water << "\n";
+
+  metric(ss, "zktraffic_ignored_packets_total", "counter", "Packets neither to nor from a server.");
+  ss << "zktraffic_ignored_packets_total " << decoder.ignored << "\n";
+  metric(ss, "zktraffic_frames_total", "counter", "ZooKeeper frames reassembled.");
+  ss << "zktraffic_frames_total " << decoder.frames << "\n";
+  metric(ss, "zktraffic_undecoded_frames_total", "counter", "Frames that couldn't be decoded.");
+  ss << "zktraffic_undecoded_frames_total " << decoder.undecoded << "\n";
+  metric(ss, "zktraffic_requests_total", "counter", "Requests, by opcode.");
+  for (int i = 0; i < OPCODE_SLOTS; i++) {
+    if (decoder.requests_by_opcode[i]) {
+      ss << "zktraffic_requests_total{opcode=\"" <<
+	ZKMessage::opcode_to_name(opcode_from_index(i)) << "\"} " <<
+	decoder.requests_by_opcode[i] << "\n";
+    }
+  }
+  metric(ss, "zktraffic_replies_total", "counter", "Replies.");
+  ss << "zktraffic_replies_total " << decoder.replies << "\n";
+  metric(ss, "zktraffic_watch_events_total", "counter", "Watches fired.");
+  ss << "zktraffic_watch_events_total " << decoder.watches << "\n";
+  metric(ss, "zktraffic_unmatched_replies_total", "counter", "Replies whose request wasn't seen.");
+  ss << "zktraffic_unmatched_replies_total " << decoder.unmatched << "\n";
+  metric(ss, "zktraffic_evicted_requests_total", "counter", "Requests given up on before their reply.");
+  ss << "zktraffic_evicted_requests_total " << decoder.evictions << "\n";
+  metric(ss, "zktraffic_requests_in_flight", "gauge", "Requests waiting for a reply.");
+  ss << "zktraffic_requests_in_flight " << decoder.in_flight << "\n";
+  metric(ss, "zktraffic_tcp_streams", "gauge", "TCP streams being reassembled.");
+  ss << "zktraffic_tcp_streams " << decoder.streams << "\n";
+  metric(ss, "zktraffic_path_intern_lookups_total", "counter", "Paths looked up in the interner.");
+  ss << "zktraffic_path_intern_lookups_total " << decoder.paths.lookups << "\n";
+  metric(ss, "zktraffic_path_intern_hits_total", "counter", "Lookups that found the path already interned.");
+  ss << "zktraffic_path_intern_hits_total " << decoder.paths.hits << "\n";
+  metric(ss, "zktraffic_path_intern_evictions_total", "counter", "Paths evicted to make room.");
+  ss << "zktraffic_path_intern_evictions_total " << decoder.paths.evictions << "\n";
+  metric(ss, "zktraffic_interned_paths", "gauge", "Paths interned.");
+  ss << "zktraffic_interned_paths " << decoder.paths.entries << "\n";
+  metric(ss, "zktraffic_path_intern_bytes", "gauge", "Memory taken by interned paths and their tables.");
+  ss << "zktraffic_path_intern_bytes " << decoder.paths.bytes << "\n";
+
+  auto sessions = sniffer.session_stats();
+  metric(ss, "zktraffic_sessions", "gauge", "Connections with a known session.");
+  ss << "zktraffic_sessions " << sessions.connections - sessions.connecting << "\n";
+  metric(ss, "zktraffic_sessions_connecting", "gauge", "Connections waiting for their ConnectResponse.");
+  ss << "zktraffic_sessions_connecting " << sessions.connecting << "\n";
+  metric(ss, "zktraffic_session_events_total", "counter", "Session starts and ends, by kind.");
+  ss << "zktraffic_session_events_total{event=\"created\"} " << sessions.created << "\n" <<
+    "zktraffic_session_events_total{event=\"resumed\"} " << sessions.resumed << "\n" <<
+    "zktraffic_session_events_total{event=\"expired\"} " << sessions.expired << "\n" <<
+    "zktraffic_session_events_total{event=\"closed\"} " << sessions.closed << "\n" <<
+    "zktraffic_session_events_total{event=\"disconnected\"} " << sessions.disconnected << "\n" <<
+    "zktraffic_session_events_total{event=\"evicted\"} " << sessions.evicted << "\n";
+  metric(ss, "zktraffic_session_timeout_seconds", "summary", "Negotiated session timeouts.");
+  summary(ss, "zktraffic_session_timeout_seconds", "", sessions.timeouts, 1e3);
+
+  metric(ss, "zktraffic_latency_seconds", "summary", "Request to reply latency, by opcode.");
+  for (const auto& entry : sniffer.latencies().by_opcode()) {
+    string labels = string("opcode=\"") + ZKMessage::opcode_to_name(entry.first) + "\"";
+    summary(ss, "zktraffic_latency_seconds", labels, entry.second);
+  }
+
+  auto by_server = sniffer.latencies().by_server();
+  if (!by_server.empty()) {
+    metric(ss, "zktraffic_server_latency_seconds", "summary", "Request to reply latency, by server and opcode.");
+    for (const auto& server : by_server) {
+      for (const auto& entry : server.second) {
+	string labels = "server=\"" + server.first.str() + "\",opcode=\"" +
+	  ZKMessage::opcode_to_name(entry.first) + "\"";
+	summary(ss, "zktraffic_server_latency_seconds", labels, entry.second);
+      }
+    }
+  }
+
+  if (sniffer.decodes_quorum())
+    prometheus_quorum(ss, sniffer.quorum_stats());
+
+  // a single ensemble would just repeat the totals
+  const auto& ensembles = sniffer.servers().ensembles();
+  if (ensembles.size() > 1) {
+    metric(ss, "zktraffic_ensemble_requests_total", "counter", "Requests, by ensemble.");
+    for (size_t i = 0; i < ensembles.size(); i++) {
+      ss << "zktraffic_ensemble_requests_total{ensemble=\"" << label_escape(ensembles[i]) << "\"} " <<
+	decoder.requests_by_ensemble[i] << "\n";
+    }
+    metric(ss, "zktraffic_ensemble_replies_total", "counter", "Replies, by ensemble.");
+    for (size_t i = 0; i < ensembles.size(); i++) {
+      ss << "zktraffic_ensemble_replies_total{ensemble=\"" << label_escape(ensembles[i]) << "\"} " <<
+	decoder.replies_by_ensemble[i] << "\n";
+    }
+    metric(ss, "zktraffic_ensemble_latency_seconds", "summary", "Request to reply latency, by ensemble and opcode.");
+    for (const auto& ensemble : sniffer.latencies().by_ensemble()) {
+      for (const auto& entry : ensemble.second) {
+	string labels = "ensemble=\"" + label_escape(ensembles[ensemble.first]) + "\",opcode=\"" +
+	  ZKMessage::opcode_to_name(entry.first) + "\"";
+	summary(ss, "zktraffic_ensemble_latency_seconds", labels, entry.second);
+      }
+    }
+  }
+
+  return ss.str();
+}
+
+string json_metrics(const Sniffer& sniffer) {
+  auto capture = sniffer.capture_stats();
+  auto decoder = sniffer.decoder_stats();
+  stringstream ss;
+  bool first = true;
+
+  ss << setprecision(9);
+
+  ss << "{\"capture\":{" <<
+    "\"packets\":" << capture.packets << "," <<
+    "\"bytes\":" << capture.bytes << "," <<
+    "\"elapsed_seconds\":" << capture.elapsed_usecs / 1e6 << "," <<
+    "\"received\":" << capture.received << "," <<
+    "\"dropped\":" << capture.dropped << "," <<
+    "\"if_dropped\":" << capture.if_dropped << "," <<
+    "\"queue_dropped\":" << capture.queue_dropped << "," <<
+    "\"queue_high_water\":" << capture.queue_high_water << "}";
+
+  ss << ",\"decoder\":{" <<
+    "\"ignored\":" << decoder.ignored << "," <<
+    "\"frames\":" << decoder.frames << "," <<
+    "\"undecoded\":" << decoder.undecoded << "," <<
+    "\"requests\":" << decoder.requests << "," <<
+    "\"replies\":" << decoder.replies << "," <<
+    "\"watch_events\":" << decoder.watches << "," <<
+    "\"unmatched\":" << decoder.unmatched << "," <<
+    "\"evictions\":" << decoder.evictions << "," <<
+    "\"in_flight\":" << decoder.in_flight << "," <<
+    "\"streams\":" << decoder.streams << "," <<
+    "\"paths\":{" <<
+      "\"lookups\":" << decoder.paths.lookups << "," <<
+      "\"hits\":" << decoder.paths.hits << "," <<
+      "\"evictions\":" << decoder.paths.evictions << "," <<
+      "\"entries\":" << decoder.paths.entries << "," <<
+      "\"bytes\":" << decoder.paths.bytes << "}," <<
+    "\"requests_by_opcode\":{";
+  for (int i = 0; i < OPCODE_SLOTS; i++) {
+    if (decoder.requests_by_opcode[i]) {
+      ss << (first ? "" : ",") << "\"" << ZKMessage::opcode_to_name(opcode_from_index(i)) << "\":" <<
+	decoder.requests_by_opcode[i];
+      first = false;
+    }
+  }
+  ss << "}}";
+
+  auto sessions = sniffer.session_stats();
+  ss << ",\"sessions\":{" <<
+    "\"active\":" << sessions.connections - sessions.connecting << "," <<
+    "\"connecting\":" << sessions.connecting << "," <<
+    "\"created\":" << sessions.created << "," <<
+    "\"resumed\":" << sessions.resumed << "," <<
+    "\"expired\":" << sessions.expired << "," <<
+    "\"closed\":" << sessions.closed << "," <<
+    "\"disconnected\":" << sessions.disconnected << "," <<
+    "\"evicted\":" << sessions.evicted << "," <<
+    "\"churn_per_second\":" << sessions.churn(capture.elapsed_usecs) << "," <<
+    "\"timeout_seconds\":{" <<
+    "\"count\":" << sessions.timeouts.count() << "," <<
+    "\"mean\":" << sessions.timeouts.mean() / 1e3 << "," <<
+    "\"p50\":" << sessions.timeouts.percentile(0.5) / 1e3 << "," <<
+    "\"p90\":" << sessions.timeouts.percentile(0.9) / 1e3 << "," <<
+    "\"p99\":" << sessions.timeouts.percentile(0.99) / 1e3 << "," <<
+    "\"max\":" << sessions.timeouts.max() / 1e3 << "}}";
+
+  ss << ",\"latency\":";
+  json_latency(ss, sniffer.latencies().by_opcode());
+
+  ss << ",\"servers\":{";
+  first = true;
+  for (const auto& server : sniffer.latencies().by_server()) {
+    ss << (first ? "" : ",") << "\"" << server.first.str() << "\":";
+    json_latency(ss, server.second);
+    first = false;
+  }
+  ss << "}";
+
+  const auto& ensembles = sniffer.servers().ensembles();
+  if (ensembles.size() > 1) {
+    auto latencies = sniffer.latencies().by_ensemble();
+    ss << ",\"ensembles\":{";
+    for (size_t i = 0; i < ensembles.size(); i++) {
+      ss << (i > 0 ? "," : "") << "\"" << json_escape(ensembles[i]) << "\":{" <<
+	"\"requests\":" << decoder.requests_by_ensemble[i] << "," <<
+	"\"replies\":" << decoder.replies_by_ensemble[i] << "," <<
+	"\"latency\":";
+      json_latency(ss, latencies[i]);
+      ss << "}";
+    }
+    ss << "}";
+  }
+  ss << "}\n";
+
+  return ss.str();
+}
+
+string json_heavy_hitters(const Sniffer& sniffer, size_t n) {
+  auto snapshot = sniffer.heavy_hitters(n);
+  stringstream ss;
+
+  ss << "{\"requests\":" << snapshot.requests << ",";
+  json_heavy_hitters(ss, "paths", snapshot.paths);
+  ss << ",";
+  json_heavy_hitters(ss, "prefixes", snapshot.prefixes);
+  ss << ",";
+  json_heavy_hitters(ss, "clients", snapshot.clients);
+  ss << ",";
+  json_heavy_hitters(ss, "client_opcodes", snapshot.client_opcodes);
+  ss << "}\n";
+
+  return ss.str();
+}
+
+string json_sessions(const Sniffer& sniffer) {
+  stringstream ss;
+  bool first = true;
+
+  ss << "{\"sessions\":[";
+  for (const auto& session : sniffer.sessions()) {
+    if (session.state == SessionState::CONNECTING)
+      continue;
+    ss << (first ? "" : ",") << "{" <<
+      "\"client\":\"" << session.conn.src.str() << "\"," <<
+      "\"server\":\"" << session.conn.dst.str() << "\"," <<
+      "\"session\":\"0x" << hex << session.id << dec << "\"," <<
+      "\"timeout_ms\":" << session.timeout << "," <<
+      "\"readonly\":" << (session.readonly ? "true" : "false") << "," <<
+      "\"closing\":" << (session.state == SessionState::CLOSING ? "true" : "false") << "}";
+    first = false;
+  }
+  ss << "]}\n";
+
+  return ss.str();
+}
+
+string json_quorum(const Sniffer& sniffer) {
+  auto capture = sniffer.capture_stats();
+  auto quorum = sniffer.quorum_stats();
+  stringstream ss;
+  bool first = true;
+
+  ss << setprecision(9);
+
+  ss << "{\"packets_by_type\":{";
+  for (int i = 0; i < QUORUM_TYPES; i++) {
+    if (quorum.packets_by_type[i]) {
+      ss << (first ? "" : ",") << "\"" << quorum_type_name(i) << "\":" << quorum.packets_by_type[i];
+      first = false;
+    }
+  }
+  ss << "},\"proposals\":" << quorum.proposals << "," <<
+    "\"proposals_per_second\":" <<
+    (capture.elapsed_usecs ? quorum.proposals * 1e6 / capture.elapsed_usecs : 0) << "," <<
+    "\"proposals_by_opcode\":{";
+  first = true;
+  for (int i = 0; i < OPCODE_SLOTS; i++) {
+    if (quorum.proposals_by_txn[i]) {
+      ss << (first ? "" : ",") << "\"" << ZKMessage::opcode_to_name(opcode_from_index(i)) << "\":" <<
+	quorum.proposals_by_txn[i];
+      first = false;
+    }
+  }
+  ss << "},\"undecoded\":" << quorum.undecoded << "," <<
+    "\"connections\":" << quorum.connections << "," <<
+    "\"followers\":[";
+
+  first = true;
+  for (const auto& f : quorum.followers) {
+    ss << (first ? "" : ",") << "{" <<
+      "\"learner\":\"" << f.learner.ip() << "\"," <<
+      "\"sid\":" << f.sid << "," <<
+      "\"observer\":" << (f.observer ? "true" : "false") << "," <<
+      "\"proposals\":" << f.proposals << "," <<
+      "\"acks\":" << f.acks << "," <<
+      "\"commits\":" << f.commits << "," <<
+      "\"informs\":" << f.informs << "," <<
+      "\"pings\":" << f.pings << "," <<
+      "\"syncs\":" << f.syncs << "," <<
+      "\"revalidates\":" << f.revalidates << "," <<
+      "\"requests\":" << f.requests << "," <<
+      "\"diffs\":" << f.diffs << "," <<
+      "\"truncs\":" << f.truncs << "," <<
+      "\"snapshots\":" << f.snapshots << "," <<
+      "\"snapshot_bytes\":" << f.snapshot_bytes << "," <<
+      "\"pending_acks\":" << f.pending_acks << "," <<
+      "\"pending_commits\":" << f.pending_commits << "," <<
+      "\"dropped\":" << f.dropped << "," <<
+      "\"last_proposed\":\"0x" << hex << f.last_proposed << "\"," <<
+      "\"last_acked\":\"0x" << f.last_acked << "\"," <<
+      "\"last_committed\":\"0x" << f.last_committed << dec << "\"," <<
+      "\"ack_latency\":";
+    json_histogram(ss, f.ack_latency);
+    ss << ",\"commit_latency\":";
+    json_histogram(ss, f.commit_latency);
+    ss << "}";
+    first = false;
+  }
+
+  ss << "],\"election\":{" <<
+    "\"notifications\":" << quorum.notifications << "," <<
+    "\"notifications_by_state\":{";
+  for (int i = 0; i < SERVER_STATES; i++) {
+    ss << (i ? "," : "") << "\"" << server_state_name(i) << "\":" << quorum.notifications_by_state[i];
+  }
+  ss << "},\"elections\":" << quorum.elections << "," <<
+    "\"epoch\":" << quorum.election_epoch << "," <<
+    "\"duration_seconds\":" << quorum.election_usecs / 1e6 << "," <<
+    "\"votes\":[";
+  first = true;
+  for (const auto& vote : quorum.votes) {
+    const auto& n = vote.notification;
+    ss << (first ? "" : ",") << "{" <<
+      "\"from\":\"" << (vote.from.port ? vote.from.str() : vote.from.ip()) << "\"," <<
+      "\"sid\":" << vote.sid << "," <<
+      "\"state\":\"" << server_state_name(n.state) << "\"," <<
+      "\"leader\":" << n.leader << "," <<
+      "\"zxid\":\"0x" << hex << n.zxid << dec << "\"," <<
+      "\"election_epoch\":" << n.election_epoch << "," <<
+      "\"peer_epoch\":" << n.peer_epoch << "}";
+    first = false;
+  }
+  ss << "]}}\n";
+
+  return ss.str();
+}
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+
+#include "sniffer.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// What a Sniffer has counted so far, rendered for scraping. Everything is
+// read from atomics and lock-free histograms, so this never blocks the
+// capture or decode threads. Latencies are exported in seconds.
+
+// Prometheus text exposition format (version 0.0.4).
+string prometheus_metrics(const Sniffer& sniffer);
+string json_metrics(const Sniffer& sniffer);
+// The n heaviest paths, prefixes, clients and client/opcode pairs.
+string json_heavy_hitters(const Sniffer& sniffer, size_t n);
+// Every connection whose session is known: session id, negotiated timeout
+// and state.
+string json_sessions(const Sniffer& sniffer);
+// Quorum traffic: packets, proposals, every follower's ACK/COMMIT latencies
+// and backlog, elections and the latest vote from each peer.
+string json_quorum(const Sniffer& sniffer);
+
+}
@@ -0,0 +1,66 @@
+#include "output_writer.h"
+
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+#include <unistd.h>
+
+using namespace std;
+
+namespace Zktraffic {
+
+OutputWriter::OutputWriter(int fd, OutputFormat format, size_t flush_bytes) :
+  fd_(fd), format_(format), flush_bytes_(flush_bytes), out_(buffer_, format) {
+  // a message or two past flush_bytes, at most
+  buffer_.reserve(flush_bytes_ + 4096);
+}
+
+bool OutputWriter::parse_format(const string& name, OutputFormat& format) {
+  if (name == "text")
+    format = OutputFormat::TEXT;
+  else if (name == "line")
+    format = OutputFormat::LINE;
+  else if (name == "json")
+    format = OutputFormat::JSON;
+  else
+    return false;
+  return true;
+}
+
+bool OutputWriter::write(const ZKMessage& message) {
+  if (failed_)
+    return false;
+
+  message.format(out_);
+  if (format_ == OutputFormat::TEXT)
+    buffer_ += '\n';
+  messages_++;
+
+  if (buffer_.size() >= flush_bytes_)
+    return flush();
+  return true;
+}
+
+bool OutputWriter::flush() {
+  auto p = buffer_.data();
+  auto len = buffer_.size();
+
+  while (len > 0 && !failed_) {
+    auto written = ::write(fd_, p, len);
+    if (written < 0) {
+      if (errno == EINTR)
+	continue;
+      cerr << "couldn't write messages: " << strerror(errno) << "\n";
+      failed_ = true;
+      break;
+    }
+    p += written;
+    len -= written;
+  }
+  buffer_.clear();
+
+  return !failed_;
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "formatter.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// Formats messages into a buffer it keeps (and reuses) and writes them out
+// to fd in big write()s, rather than a stream write per message. TEXT
+// messages are followed by a blank line, as zkdump always printed them.
+//
+// Not thread safe: each thread that prints gets its own writer, and with
+// it its own buffer. Write errors are reported on stderr (fd is likely
+// stdout) and make write() and flush() return false.
+class OutputWriter {
+public:
+  explicit OutputWriter(int fd, OutputFormat format = OutputFormat::TEXT, size_t flush_bytes = 1 << 20);
+  OutputWriter(const OutputWriter&) = delete;
+  OutputWriter& operator=(const OutputWriter&) = delete;
+  ~OutputWriter() { flush(); }
+
+  bool write(const ZKMessage& message);
+  bool flush();
+
+  uint64_t messages() const { return messages_; }
+  // text, line or json
+  static bool parse_format(const string& name, OutputFormat& format);
+
+private:
+  int fd_;
+  OutputFormat format_;
+  size_t flush_bytes_;
+  string buffer_;
+  Formatter out_;
+  uint64_t messages_ = 0;
+  bool failed_ = false;
+};
+
+}
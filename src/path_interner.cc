@@ -0,0 +1,183 @@
+#include <cstring>
+
+#include "path_interner.h"
+
+namespace Zktraffic {
+
+// tests compare against them by reference
+const uint32_t PathInterner::NONE;
+const size_t PathInterner::DEFAULT_CAPACITY;
+const size_t PathInterner::MAX_CAPACITY;
+const size_t PathInterner::CHUNK_SIZE;
+
+PathInternerStats& PathInternerStats::operator+=(const PathInternerStats& other) {
+  lookups += other.lookups;
+  hits += other.hits;
+  evictions += other.evictions;
+  entries += other.entries;
+  bytes += other.bytes;
+  return *this;
+}
+
+PathInterner::PathInterner(size_t capacity)
+    : capacity_(max<size_t>(1, min(capacity, MAX_CAPACITY))) {
+  // at most half full
+  size_t slots = 16;
+  while (slots < capacity_ * 2)
+    slots <<= 1;
+  table_.assign(slots, 0);
+  mask_ = slots - 1;
+  update_bytes();
+}
+
+uint64_t PathInterner::hash(string_view bytes) {
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ bytes.size();
+  size_t i = 0;
+  for (; i + 8 <= bytes.size(); i += 8) {
+    uint64_t v;
+    memcpy(&v, bytes.data() + i, 8);
+    h = mix64(h ^ v);
+  }
+  if (i < bytes.size()) {
+    uint64_t v = 0;
+    memcpy(&v, bytes.data() + i, bytes.size() - i);
+    h = mix64(h ^ v);
+  }
+  return h;
+}
+
+uint32_t PathInterner::intern(string_view path) {
+  if (path.empty() || path.size() > CHUNK_SIZE)
+    return NONE;
+
+  bump(lookups_);
+  auto h = hash(path);
+  size_t slot = h & mask_;
+  for (; table_[slot] != 0; slot = (slot + 1) & mask_) {
+    auto& entry = entries_[table_[slot] - 1];
+    if (entry.hash == h && entry.len == path.size() && memcmp(entry.data, path.data(), path.size()) == 0) {
+      if (entry.hits < UINT32_MAX)
+	entry.hits++;
+      bump(hits_);
+      return id(table_[slot] - 1);
+    }
+  }
+
+  if (live_ >= capacity_) {
+    sweep();
+    for (slot = h & mask_; table_[slot] != 0; slot = (slot + 1) & mask_)
+      ;
+  }
+
+  uint32_t index;
+  if (!free_.empty()) {
+    index = free_.back();
+    free_.pop_back();
+  } else {
+    index = entries_.size();
+    entries_.push_back(Entry{0, nullptr, 0, 0, 0, false});
+  }
+  auto& entry = entries_[index];
+  entry.hash = h;
+  entry.data = store(path);
+  entry.len = path.size();
+  entry.hits = 1;
+  entry.live = true;
+  table_[slot] = index + 1;
+  live_++;
+  live_bytes_ += path.size();
+  update_bytes();
+
+  return id(index);
+}
+
+string_view PathInterner::path(uint32_t id) const {
+  size_t index = (id & 0xffffff) - 1;
+  if (id == NONE || index >= entries_.size())
+    return string_view();
+  const auto& entry = entries_[index];
+  if (!entry.live || entry.generation != (id >> 24))
+    return string_view();
+  return string_view(entry.data, entry.len);
+}
+
+PathInternerStats PathInterner::stats() const {
+  PathInternerStats rv;
+  rv.lookups = lookups_.load(memory_order_relaxed);
+  rv.hits = hits_.load(memory_order_relaxed);
+  rv.evictions = evictions_.load(memory_order_relaxed);
+  rv.entries = entries_count_.load(memory_order_relaxed);
+  rv.bytes = bytes_.load(memory_order_relaxed);
+  return rv;
+}
+
+const char *PathInterner::store(string_view path) {
+  if (chunk_used_ + path.size() > CHUNK_SIZE) {
+    chunks_.emplace_back(new char[CHUNK_SIZE]);
+    chunk_used_ = 0;
+  }
+  char *rv = chunks_.back().get() + chunk_used_;
+  memcpy(rv, path.data(), path.size());
+  chunk_used_ += path.size();
+  return rv;
+}
+
+// Makes room for a quarter of the capacity: one-offs go first, then
+// whatever stays coldest as counts are halved.
+void PathInterner::sweep() {
+  size_t target = capacity_ * 3 / 4;
+  do {
+    for (uint32_t i = 0; i < entries_.size(); i++) {
+      auto& entry = entries_[i];
+      if (!entry.live)
+	continue;
+      if (entry.hits < 2) {
+	entry.live = false;
+	entry.generation++;
+	free_.push_back(i);
+	live_--;
+	live_bytes_ -= entry.len;
+	dead_bytes_ += entry.len;
+	bump(evictions_);
+      } else {
+	entry.hits /= 2;
+      }
+    }
+  } while (live_ > target);
+
+  if (dead_bytes_ > live_bytes_)
+    compact();
+  rehash();
+}
+
+// Copies what's live into new chunks, releasing the old ones.
+void PathInterner::compact() {
+  auto old = move(chunks_);
+  chunks_.clear();
+  chunk_used_ = CHUNK_SIZE;
+  for (auto& entry : entries_) {
+    if (entry.live)
+      entry.data = store(string_view(entry.data, entry.len));
+  }
+  dead_bytes_ = 0;
+}
+
+void PathInterner::rehash() {
+  fill(table_.begin(), table_.end(), 0);
+  for (uint32_t i = 0; i < entries_.size(); i++) {
+    if (!entries_[i].live)
+      continue;
+    size_t slot = entries_[i].hash & mask_;
+    while (table_[slot] != 0)
+      slot = (slot + 1) & mask_;
+    table_[slot] = i + 1;
+  }
+}
+
+void PathInterner::update_bytes() {
+  entries_count_.store(live_, memory_order_relaxed);
+  bytes_.store(chunks_.size() * CHUNK_SIZE + entries_.capacity() * sizeof(Entry) +
+    table_.size() * sizeof(uint32_t) + free_.capacity() * sizeof(uint32_t), memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "endpoint.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+struct PathInternerStats {
+  uint64_t lookups = 0;
+  uint64_t hits = 0;        // lookups that found the path already interned
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;       // arena and table memory
+
+  PathInternerStats& operator+=(const PathInternerStats& other);
+};
+
+// Gives every distinct znode path a 32-bit id, so paths can be counted and
+// compared without copying or rehashing them. The bytes live back to back
+// in an arena of 64KB chunks and ids are found through an open addressing
+// (linear probing) table of their hashes.
+//
+// An id refers to the same path for as long as the path stays interned;
+// once it's evicted the id stops matching (slots carry an 8-bit
+// generation, bumped whenever they're reused). Capacity is bounded: when
+// it's reached, paths seen only once since the last sweep (sequential and
+// ephemeral nodes, mostly) are evicted first, and survivors' counts are
+// halved so that paths that went cold make room too.
+//
+// Not thread safe, each Decoder has its own (so ids are only meaningful to
+// the Decoder that handed them out). stats() can be called from any thread.
+class PathInterner {
+public:
+  static const uint32_t NONE = 0;
+  static const size_t DEFAULT_CAPACITY = 65536;
+  static const size_t MAX_CAPACITY = (1 << 24) - 1;
+  static const size_t CHUNK_SIZE = 65536;
+
+  explicit PathInterner(size_t capacity = DEFAULT_CAPACITY);
+  PathInterner(const PathInterner&) = delete;
+  PathInterner& operator=(const PathInterner&) = delete;
+
+  // NONE for an empty path (or one longer than a chunk)
+  uint32_t intern(string_view path);
+  // empty if the id was evicted; valid until the next intern()
+  string_view path(uint32_t id) const;
+  bool contains(uint32_t id) const { return !path(id).empty(); }
+
+  size_t size() const { return live_; }
+  size_t capacity() const { return capacity_; }
+  PathInternerStats stats() const;
+
+  // 8 bytes at a time, mixed like everything else in here
+  static uint64_t hash(string_view bytes);
+
+private:
+  struct Entry {
+    uint64_t hash;
+    const char *data;
+    uint32_t len;
+    uint32_t hits;   // since the last sweep, halved by each one
+    uint8_t generation;
+    bool live;
+  };
+
+  static void bump(atomic<uint64_t>& counter, uint64_t n = 1) {
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+  }
+
+  uint32_t id(uint32_t index) const {
+    return ((uint32_t)entries_[index].generation << 24) | (index + 1);
+  }
+  const char *store(string_view path);
+  void sweep();
+  void compact();
+  void rehash();
+  void update_bytes();
+
+  size_t capacity_;
+  vector<Entry> entries_;
+  vector<uint32_t> free_;
+  // index + 1 into entries_, 0 is an empty slot
+  vector<uint32_t> table_;
+  size_t mask_;
+  size_t live_ = 0;
+
+  vector<unique_ptr<char[]>> chunks_;
+  size_t chunk_used_ = CHUNK_SIZE;
+  size_t live_bytes_ = 0;
+  size_t dead_bytes_ = 0;
+
+  atomic<uint64_t> lookups_{0};
+  atomic<uint64_t> hits_{0};
+  atomic<uint64_t> evictions_{0};
+  atomic<uint64_t> entries_count_{0};
+  atomic<uint64_t> bytes_{0};
+};
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#include <endian.h>
+
+using namespace std;
+
+namespace Zktraffic {
+
+// Cursor over a jute encoded (big-endian) payload. Never allocates: buffers
+// come back as views into the payload.
+//
+// Reading past the end doesn't throw, it returns zeros/empty views and
+// flips ok() to false for good, so decoders can read a whole record and
+// check once at the end.
+class PayloadReader {
+public:
+  explicit PayloadReader(string_view data, size_t offset = 0) :
+    data_(data), offset_(offset), ok_(offset <= data.size()) {}
+
+  bool ok() const { return ok_; }
+  size_t offset() const { return offset_; }
+  size_t remaining() const { return ok_ ? data_.size() - offset_ : 0; }
+
+  int32_t read_int() {
+    uint32_t rv = 0;
+    if (take(4))
+      memcpy(&rv, data_.data() + offset_ - 4, 4);
+    return (int32_t)be32toh(rv);
+  }
+
+  int64_t read_long() {
+    uint64_t rv = 0;
+    if (take(8))
+      memcpy(&rv, data_.data() + offset_ - 8, 8);
+    return (int64_t)be64toh(rv);
+  }
+
+  bool read_bool() {
+    if (!take(1))
+      return false;
+    return data_[offset_ - 1] != 0;
+  }
+
+  // int length + bytes, a negative length is a null buffer
+  string_view read_buffer() {
+    int32_t len = read_int();
+    if (len <= 0)
+      return string_view();
+    if (!take(len))
+      return string_view();
+    return data_.substr(offset_ - len, len);
+  }
+
+  bool skip(size_t len) { return take(len); }
+  // for what's out of bounds without reading past the end, like a count
+  // that can't fit in what's left
+  void fail() { ok_ = false; }
+
+private:
+  bool take(size_t len) {
+    if (!ok_ || data_.size() - offset_ < len) {
+      ok_ = false;
+      return false;
+    }
+    offset_ += len;
+    return true;
+  }
+
+  string_view data_;
+  size_t offset_;
+  bool ok_;
+};
+
+}
@@ -0,0 +1,299 @@
+#include "pcap_file.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace Zktraffic {
+
+namespace {
+
+const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+const size_t PCAP_HEADER_SIZE = 24;
+const size_t PCAP_RECORD_HEADER_SIZE = 16;
+
+const uint32_t PCAPNG_SECTION_HEADER = 0x0a0d0d0a;
+const uint32_t PCAPNG_INTERFACE = 1;
+const uint32_t PCAPNG_PACKET = 2;  // obsolete
+const uint32_t PCAPNG_SIMPLE_PACKET = 3;
+const uint32_t PCAPNG_ENHANCED_PACKET = 6;
+const uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+const uint16_t PCAPNG_OPT_TSRESOL = 9;
+
+// Files hold LINKTYPE_ values, which match DLT_ ones except for a few
+// (RAW being the one that shows up in practice).
+const int LINKTYPE_RAW = 101;
+
+int to_dlt(int linktype) {
+  return linktype == LINKTYPE_RAW ? DLT_RAW : linktype;
+}
+
+}
+
+PcapFile::PcapFile(const string& path) : path_(path) {
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    error_ = strerror(errno);
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < 12) {
+    error_ = "not a capture file";
+    close(fd);
+    return;
+  }
+
+  auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    error_ = strerror(errno);
+    return;
+  }
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  data_ = static_cast<const u_char *>(data);
+  size_ = st.st_size;
+
+  uint32_t magic = read32(0);
+  if (magic == PCAPNG_SECTION_HEADER) {
+    pcapng_ = true;
+    if (!read_section_header()) {
+      error_ = "bad pcapng section header";
+    } else {
+      // the link type should be known up front (to compile filters),
+      // it's in the first interface block
+      for (size_t pos = offset_; size_ - pos >= 12; ) {
+	uint32_t type = read32(pos);
+	uint32_t len = read32(pos + 4);
+	if (type == PCAPNG_SECTION_HEADER || len < 12 || len > size_ - pos)
+	  break;
+	if (type == PCAPNG_INTERFACE && len >= 20) {
+	  linktype_ = to_dlt(read16(pos + 8));
+	  break;
+	}
+	pos += len;
+      }
+      if (linktype_ < 0)
+	error_ = "no interfaces in the pcapng file";
+    }
+  } else {
+    swapped_ = magic == __builtin_bswap32(PCAP_MAGIC_USEC) || magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+    nanos_ = magic == PCAP_MAGIC_NSEC || magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+    if (magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC && !swapped_) {
+      error_ = "not a pcap or pcapng file";
+    } else if (size_ < PCAP_HEADER_SIZE) {
+      error_ = "truncated pcap header";
+    } else {
+      linktype_ = to_dlt(read32(20) & 0xffff);
+      offset_ = PCAP_HEADER_SIZE;
+    }
+  }
+
+  if (!error_.empty()) {
+    munmap(const_cast<u_char *>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+  }
+}
+
+PcapFile::~PcapFile() {
+  if (data_ != nullptr)
+    munmap(const_cast<u_char *>(data_), size_);
+}
+
+uint16_t PcapFile::read16(size_t offset) const {
+  uint16_t rv;
+  memcpy(&rv, data_ + offset, sizeof(rv));
+  return swapped_ ? __builtin_bswap16(rv) : rv;
+}
+
+uint32_t PcapFile::read32(size_t offset) const {
+  uint32_t rv;
+  memcpy(&rv, data_ + offset, sizeof(rv));
+  return swapped_ ? __builtin_bswap32(rv) : rv;
+}
+
+bool PcapFile::next(PcapRecord& record) {
+  if (data_ == nullptr)
+    return false;
+  return pcapng_ ? next_pcapng(record) : next_pcap(record);
+}
+
+bool PcapFile::next_pcap(PcapRecord& record) {
+  if (size_ - offset_ < PCAP_RECORD_HEADER_SIZE)
+    return false;
+
+  uint64_t secs = read32(offset_);
+  uint64_t frac = read32(offset_ + 4);
+  record.caplen = read32(offset_ + 8);
+  record.len = read32(offset_ + 12);
+  if (record.caplen > size_ - offset_ - PCAP_RECORD_HEADER_SIZE)
+    return false;
+
+  record.timestamp = secs * 1000000 + (nanos_ ? frac / 1000 : frac);
+  record.linktype = linktype_;
+  record.data = data_ + offset_ + PCAP_RECORD_HEADER_SIZE;
+  offset_ += PCAP_RECORD_HEADER_SIZE + record.caplen;
+
+  return true;
+}
+
+// Section headers set the byte order for everything up to the next one.
+bool PcapFile::read_section_header() {
+  if (size_ - offset_ < 28)
+    return false;
+
+  uint32_t magic;
+  memcpy(&magic, data_ + offset_ + 8, sizeof(magic));
+  if (magic == PCAPNG_BYTE_ORDER_MAGIC)
+    swapped_ = false;
+  else if (magic == __builtin_bswap32(PCAPNG_BYTE_ORDER_MAGIC))
+    swapped_ = true;
+  else
+    return false;
+
+  uint32_t len = read32(offset_ + 4);
+  if (len < 28 || len % 4 != 0 || len > size_ - offset_)
+    return false;
+
+  interfaces_.clear();
+  offset_ += len;
+  return true;
+}
+
+void PcapFile::read_interface(size_t body, size_t len) {
+  Interface interface{-1, 1000000};
+  if (len < 8)
+    return;
+  interface.linktype = to_dlt(read16(body));
+
+  // options: code, length, value padded to 32 bits
+  size_t pos = body + 8;
+  size_t end = body + len;
+  while (end - pos >= 4) {
+    auto code = read16(pos);
+    auto optlen = read16(pos + 2);
+    pos += 4;
+    if (code == 0 || optlen > end - pos)
+      break;
+    if (code == PCAPNG_OPT_TSRESOL && optlen >= 1) {
+      uint8_t value = data_[pos];
+      if (value & 0x80) {
+	interface.units_per_sec = 1ULL << std::min(value & 0x7f, 63);
+      } else {
+	interface.units_per_sec = 1;
+	for (int i = 0; i < std::min<int>(value, 19); i++)
+	  interface.units_per_sec *= 10;
+      }
+    }
+    size_t padded = (optlen + 3) & ~3;
+    if (padded > end - pos)
+      break;
+    pos += padded;
+  }
+
+  if (linktype_ < 0)
+    linktype_ = interface.linktype;
+  interfaces_.push_back(interface);
+}
+
+bool PcapFile::next_pcapng(PcapRecord& record) {
+  for (;;) {
+    if (size_ - offset_ < 12)
+      return false;
+
+    uint32_t type = read32(offset_);
+    if (type == PCAPNG_SECTION_HEADER) {
+      if (!read_section_header())
+	return false;
+      continue;
+    }
+
+    uint32_t len = read32(offset_ + 4);
+    if (len < 12 || len % 4 != 0 || len > size_ - offset_)
+      return false;
+    size_t body = offset_ + 8;
+    size_t body_len = len - 12;
+    offset_ += len;
+
+    uint32_t interface;
+    uint64_t timestamp;
+    size_t data;
+
+    switch (type) {
+    case PCAPNG_INTERFACE:
+      read_interface(body, body_len);
+      continue;
+    case PCAPNG_ENHANCED_PACKET:
+    case PCAPNG_PACKET:
+      if (body_len < 20)
+	return false;
+      interface = type == PCAPNG_PACKET ? read16(body) : read32(body);
+      timestamp = (uint64_t)read32(body + 4) << 32 | read32(body + 8);
+      record.caplen = read32(body + 12);
+      record.len = read32(body + 16);
+      data = body + 20;
+      if (record.caplen > body_len - 20)
+	return false;
+      break;
+    case PCAPNG_SIMPLE_PACKET:
+      // no timestamp, it gets the previous packet's
+      if (body_len < 4)
+	return false;
+      interface = 0;
+      timestamp = 0;
+      record.len = read32(body);
+      record.caplen = std::min<uint64_t>(record.len, body_len - 4);
+      data = body + 4;
+      break;
+    default:
+      continue;
+    }
+
+    if (interface >= interfaces_.size())
+      return false;
+
+    const auto& iface = interfaces_[interface];
+    if (type == PCAPNG_SIMPLE_PACKET)
+      record.timestamp = last_timestamp_;
+    else if (iface.units_per_sec == 1000000)
+      record.timestamp = timestamp;
+    else
+      record.timestamp = (unsigned __int128)timestamp * 1000000 / iface.units_per_sec;
+    last_timestamp_ = record.timestamp;
+    record.linktype = iface.linktype;
+    record.data = data_ + data;
+
+    return true;
+  }
+}
+
+PcapFilter::PcapFilter(const string& expression, int linktype, int snaplen) {
+  if (expression.empty())
+    return;
+
+  auto handle = pcap_open_dead(linktype < 0 ? DLT_EN10MB : linktype, snaplen);
+  if (handle == nullptr) {
+    ok_ = false;
+    return;
+  }
+
+  ok_ = pcap_compile(handle, &program_, expression.c_str(), 1, PCAP_NETMASK_UNKNOWN) == 0;
+  compiled_ = ok_;
+  pcap_close(handle);
+}
+
+PcapFilter::~PcapFilter() {
+  if (compiled_)
+    pcap_freecode(&program_);
+}
+
+}
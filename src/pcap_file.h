@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "pcap.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// A packet in a capture file. data points into the mapped file, so it's
+// valid for as long as the PcapFile is.
+struct PcapRecord {
+  uint64_t timestamp;  // usecs
+  uint32_t caplen;
+  uint32_t len;
+  int linktype;
+  const u_char *data;
+
+  // what libpcap would have handed out
+  struct pcap_pkthdr header() const {
+    struct pcap_pkthdr rv;
+    rv.ts.tv_sec = timestamp / 1000000;
+    rv.ts.tv_usec = timestamp % 1000000;
+    rv.caplen = caplen;
+    rv.len = len;
+    return rv;
+  }
+};
+
+// Reads pcap (either byte order, usec or nsec timestamps) and pcapng
+// (enhanced, simple and obsolete packet blocks; several sections and
+// interfaces) files straight out of an mmap, without copying packets.
+//
+// A truncated or malformed record ends the file: whatever came before it
+// is still read.
+class PcapFile {
+public:
+  explicit PcapFile(const string& path);
+  PcapFile(const PcapFile&) = delete;
+  PcapFile& operator=(const PcapFile&) = delete;
+  ~PcapFile();
+
+  bool ok() const { return data_ != nullptr; }
+  // why it isn't ok()
+  const string& error() const { return error_; }
+
+  // false at the end of the file
+  bool next(PcapRecord& record);
+
+  const string& path() const { return path_; }
+  // the first interface's link type (a DLT_ value), -1 if none was seen yet
+  int linktype() const { return linktype_; }
+  size_t size() const { return size_; }
+
+private:
+  struct Interface {
+    int linktype;
+    uint64_t units_per_sec;  // timestamp resolution
+  };
+
+  uint16_t read16(size_t offset) const;
+  uint32_t read32(size_t offset) const;
+  bool next_pcap(PcapRecord& record);
+  bool next_pcapng(PcapRecord& record);
+  bool read_section_header();
+  void read_interface(size_t body, size_t len);
+
+  string path_;
+  string error_;
+  const u_char *data_ = nullptr;
+  size_t size_ = 0;
+  size_t offset_ = 0;
+  bool pcapng_ = false;
+  bool swapped_ = false;
+  bool nanos_ = false;
+  int linktype_ = -1;
+  uint64_t last_timestamp_ = 0;
+  vector<Interface> interfaces_;
+};
+
+// A capture filter evaluated in userspace, for packets that don't come
+// from a pcap_t (i.e.: PcapFile). An empty expression matches everything.
+class PcapFilter {
+public:
+  PcapFilter(const string& expression, int linktype, int snaplen = 65535);
+  PcapFilter(const PcapFilter&) = delete;
+  PcapFilter& operator=(const PcapFilter&) = delete;
+  ~PcapFilter();
+
+  bool ok() const { return ok_; }
+  bool matches(const struct pcap_pkthdr *header, const u_char *data) const {
+    return !compiled_ || pcap_offline_filter(&program_, header, data) != 0;
+  }
+
+private:
+  struct bpf_program program_ = {};
+  bool compiled_ = false;
+  bool ok_ = true;
+};
+
+}
@@ -0,0 +1,609 @@
+#include "quorum.h"
+
+#include <algorithm>
+
+#include "payload_reader.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+namespace {
+
+// sanity limits, to tell packets from garbage when joining mid-stream
+const int MAX_AUTHS = 16;
+const int MAX_AUTH_LEN = 4096;
+const int MAX_ADDRESS_LEN = 4096;
+// QuorumCnxManager's default packet limit
+const int MAX_NOTIFICATION = 512 * 1024;
+// QuorumCnxManager.PROTOCOL_VERSION and PROTOCOL_VERSION_V2
+const long long MIN_PROTOCOL_VERSION = -65536;
+const long long MAX_PROTOCOL_VERSION = -65535;
+
+// what a snapshot sent after SNAP ends with: writeString("BenWasHere")
+const char SNAPSHOT_SIGNATURE[] = "\0\0\0\x0a" "BenWasHere";
+const size_t SIGNATURE_LEN = sizeof(SNAPSHOT_SIGNATURE) - 1;
+
+const char *quorum_type_names[QUORUM_TYPES] = {
+  nullptr, "REQUEST", "PROPOSAL", "ACK", "COMMIT", "PING", "REVALIDATE", "SYNC", "INFORM",
+  "COMMITANDACTIVATE", "NEWLEADER", "FOLLOWERINFO", "UPTODATE", "DIFF", "TRUNC", "SNAP",
+  "OBSERVERINFO", "LEADERINFO", "ACKEPOCH", "INFORMANDACTIVATE"
+};
+
+const char *server_state_names[SERVER_STATES] = {
+  "LOOKING", "FOLLOWING", "LEADING", "OBSERVING"
+};
+
+Endpoint address(Endpoint endpoint) {
+  endpoint.port = 0;
+  return endpoint;
+}
+
+void merge(FollowerStats& into, const FollowerStats& other) {
+  if (into.sid < 0)
+    into.sid = other.sid;
+  into.observer = into.observer || other.observer;
+  into.proposals += other.proposals;
+  into.acks += other.acks;
+  into.commits += other.commits;
+  into.informs += other.informs;
+  into.pings += other.pings;
+  into.syncs += other.syncs;
+  into.revalidates += other.revalidates;
+  into.requests += other.requests;
+  into.snapshots += other.snapshots;
+  into.diffs += other.diffs;
+  into.truncs += other.truncs;
+  into.snapshot_bytes += other.snapshot_bytes;
+  into.pending_acks += other.pending_acks;
+  into.pending_commits += other.pending_commits;
+  into.dropped += other.dropped;
+  into.last_proposed = max(into.last_proposed, other.last_proposed);
+  into.last_acked = max(into.last_acked, other.last_acked);
+  into.last_committed = max(into.last_committed, other.last_committed);
+  into.ack_latency += other.ack_latency;
+  into.commit_latency += other.commit_latency;
+}
+
+}
+
+const char *quorum_type_name(int type) {
+  if (type <= 0 || type >= QUORUM_TYPES)
+    return "UNKNOWN";
+  return quorum_type_names[type];
+}
+
+const char *server_state_name(int state) {
+  if (state < 0 || state >= SERVER_STATES)
+    return "UNKNOWN";
+  return server_state_names[state];
+}
+
+long QuorumPacket::parse(const char *data, size_t len, QuorumPacket& packet) {
+  PayloadReader reader(string_view(data, len));
+
+  int type = reader.read_int();
+  long long zxid = reader.read_long();
+  int data_len = reader.read_int();
+  if (!reader.ok())
+    return 0;
+  if (type <= 0 || type >= QUORUM_TYPES || data_len < -1 || data_len > (long)MAX_DATA)
+    return -1;
+
+  size_t offset = reader.offset();
+  if (data_len > 0 && !reader.skip(data_len))
+    return 0;
+
+  int auths = reader.read_int();
+  if (!reader.ok())
+    return 0;
+  if (auths < -1 || auths > MAX_AUTHS)
+    return -1;
+  for (int i = 0; i < auths * 2; i++) {
+    // scheme, then id
+    int str_len = reader.read_int();
+    if (!reader.ok())
+      return 0;
+    if (str_len < -1 || str_len > MAX_AUTH_LEN)
+      return -1;
+    if (str_len > 0 && !reader.skip(str_len))
+      return 0;
+  }
+
+  packet.type = type;
+  packet.zxid = zxid;
+  packet.data = data_len > 0 ? string_view(data + offset, data_len) : string_view();
+  return reader.offset();
+}
+
+int QuorumPacket::txn_type() const {
+  if (type != enumToInt(QuorumType::PROPOSAL) && type != enumToInt(QuorumType::INFORM))
+    return -1;
+
+  // TxnHeader: clientId, cxid, zxid, time, type
+  PayloadReader reader(data);
+  reader.skip(8 + 4 + 8 + 8);
+  int rv = reader.read_int();
+  return reader.ok() ? rv : -1;
+}
+
+bool Notification::from_payload(string_view body, Notification& notification) {
+  // 28 bytes from the oldest peers, then peer epoch, version and config
+  if (body.size() < 28)
+    return false;
+
+  PayloadReader reader(body);
+  notification.state = reader.read_int();
+  notification.leader = reader.read_long();
+  notification.zxid = reader.read_long();
+  notification.election_epoch = reader.read_long();
+  notification.peer_epoch = body.size() >= 36 ? reader.read_long() : -1;
+  notification.version = body.size() >= 40 ? reader.read_int() : 0;
+
+  return reader.ok() && notification.state >= 0 && notification.state < SERVER_STATES;
+}
+
+QuorumStats& QuorumStats::operator+=(const QuorumStats& other) {
+  for (int i = 0; i < QUORUM_TYPES; i++)
+    packets_by_type[i] += other.packets_by_type[i];
+  proposals += other.proposals;
+  for (int i = 0; i < OPCODE_SLOTS; i++)
+    proposals_by_txn[i] += other.proposals_by_txn[i];
+  undecoded += other.undecoded;
+  connections += other.connections;
+
+  // a learner's connections can land on different decoders
+  for (const auto& follower : other.followers) {
+    auto it = find_if(followers.begin(), followers.end(),
+      [&](const FollowerStats& f) { return f.learner == follower.learner; });
+    if (it == followers.end())
+      followers.push_back(follower);
+    else
+      merge(*it, follower);
+  }
+
+  notifications += other.notifications;
+  for (int i = 0; i < SERVER_STATES; i++)
+    notifications_by_state[i] += other.notifications_by_state[i];
+  // every decoder sees some of the same election, keep the latest one
+  if (other.election_epoch > election_epoch ||
+      (other.election_epoch == election_epoch && other.election_usecs > election_usecs)) {
+    election_epoch = other.election_epoch;
+    election_usecs = other.election_usecs;
+  }
+  elections = max(elections, other.elections);
+
+  for (const auto& vote : other.votes) {
+    auto it = find_if(votes.begin(), votes.end(),
+      [&](const Vote& v) { return v.sid == vote.sid && v.from == vote.from; });
+    if (it == votes.end())
+      votes.push_back(vote);
+    else if (vote.timestamp > it->timestamp)
+      *it = vote;
+  }
+
+  return *this;
+}
+
+bool QuorumDecoder::handle(const TcpPacket& packet, uint64_t timestamp) {
+  bool zab, up;
+  if (zab_.is_server(packet.dst()) || zab_.is_server(packet.src())) {
+    zab = true;
+    up = zab_.is_server(packet.dst());
+  } else if (election_.is_server(packet.dst()) || election_.is_server(packet.src())) {
+    zab = false;
+    up = election_.is_server(packet.dst());
+  } else {
+    return false;
+  }
+
+  auto flow = packet.flow();
+  auto conn = up ? flow : flow.reversed();
+
+  lock_guard<mutex> lock(mutex_);
+
+  if (packet.rst()) {
+    connections_.erase(conn);
+    return true;
+  }
+
+  // a new connection starts over
+  if (packet.syn() && up)
+    connections_.erase(conn);
+
+  auto& c = connection(conn, zab, timestamp / 1000000);
+  auto& direction = up ? c.up : c.down;
+  if (packet.syn()) {
+    direction.stream.sync(packet.seq());
+    direction.buf.clear();
+    direction.stage = !zab && up ? Stage::HEADER : Stage::PACKETS;
+  }
+
+  auto payload = packet.payload();
+  if (!payload.empty()) {
+    direction.stream.consume_bytes(packet.seq(), payload.data(), payload.size(),
+      [&](const char *data, size_t len) { feed(conn, c, up, data, len, timestamp); });
+  }
+
+  if (packet.fin())
+    connections_.erase(conn);
+
+  return true;
+}
+
+QuorumDecoder::Connection& QuorumDecoder::connection(const FlowKey& conn, bool zab, time_t now) {
+  auto it = connections_.find(conn);
+  if (it == connections_.end()) {
+    if (connections_.size() >= MAX_CONNECTIONS)
+      expire(now);
+    it = connections_.emplace(conn, Connection()).first;
+    it->second.zab = zab;
+    if (zab)
+      it->second.follower = follower(conn.src);
+  }
+  it->second.last_seen = now;
+  return it->second;
+}
+
+// Connections normally go away on FIN/RST. Drops the idle ones and, if
+// none are, the one seen longest ago.
+void QuorumDecoder::expire(time_t now) {
+  auto oldest = connections_.end();
+  for (auto it = connections_.begin(); it != connections_.end(); ) {
+    if (now - it->second.last_seen > IDLE_SECS) {
+      it = connections_.erase(it);
+      continue;
+    }
+    if (oldest == connections_.end() || it->second.last_seen < oldest->second.last_seen)
+      oldest = it;
+    ++it;
+  }
+
+  if (connections_.size() >= MAX_CONNECTIONS && oldest != connections_.end())
+    connections_.erase(oldest);
+}
+
+QuorumDecoder::Follower *QuorumDecoder::follower(const Endpoint& learner) {
+  auto key = address(learner);
+  auto it = followers_.find(key);
+  if (it != followers_.end())
+    return it->second.get();
+  if (followers_.size() >= MAX_FOLLOWERS)
+    return nullptr;
+
+  auto follower = new Follower();
+  follower->stats.learner = key;
+  follower->stats.sid = -1;
+  followers_.emplace(key, unique_ptr<Follower>(follower));
+  return follower;
+}
+
+// Bytes come in order, data is nullptr when there's a gap before them.
+// Complete packets are decoded in place, only a trailing partial one is
+// buffered (as TcpStream does with frames).
+void QuorumDecoder::feed(const FlowKey& conn, Connection& c, bool up, const char *data, size_t len,
+  uint64_t timestamp) {
+  auto& direction = up ? c.up : c.down;
+
+  if (data == nullptr) {
+    // assume the next bytes start a packet; a snapshot is still scanned
+    // for its end, which works from anywhere
+    direction.buf.clear();
+    if (direction.stage == Stage::HEADER)
+      direction.stage = Stage::PACKETS;
+    return;
+  }
+
+  if (direction.buf.empty()) {
+    long used = parse(conn, c, up, data, len, timestamp);
+    if (used == BAD) {
+      counters_.undecoded++;
+      return;
+    }
+    direction.buf.assign(data + used, len - used);
+    return;
+  }
+
+  direction.buf.append(data, len);
+  long used = parse(conn, c, up, direction.buf.data(), direction.buf.size(), timestamp);
+  if (used == BAD) {
+    counters_.undecoded++;
+    direction.buf.clear();
+    return;
+  }
+  direction.buf.erase(0, used);
+}
+
+// Returns the bytes used, BAD if they make no sense (the rest of the
+// segment is dropped and the next one is assumed to start a packet).
+long QuorumDecoder::parse(const FlowKey& conn, Connection& c, bool up, const char *data, size_t len,
+  uint64_t timestamp) {
+  auto& direction = up ? c.up : c.down;
+  size_t offset = 0;
+
+  while (offset < len) {
+    const char *p = data + offset;
+    size_t left = len - offset;
+    long used;
+
+    if (direction.stage == Stage::SNAPSHOT) {
+      used = skip_snapshot(c, p, left);
+    } else if (direction.stage == Stage::HEADER) {
+      used = election_header(c, p, left);
+    } else if (c.zab) {
+      QuorumPacket packet;
+      used = QuorumPacket::parse(p, left, packet);
+      if (used > 0) {
+	counters_.packets_by_type[packet.type]++;
+	zab_packet(c, up, packet, timestamp);
+      }
+    } else {
+      PayloadReader reader(string_view(p, left));
+      int body_len = reader.read_int();
+      if (!reader.ok())
+	break;
+      if (body_len < 0 || body_len > MAX_NOTIFICATION)
+	return BAD;
+      if (left - 4 < (size_t)body_len)
+	break;
+      used = 4 + body_len;
+
+      Notification notification;
+      if (Notification::from_payload(string_view(p + 4, body_len), notification))
+	vote(conn, c, up, notification, timestamp);
+      else
+	counters_.undecoded++;
+    }
+
+    if (used < 0)
+      return BAD;
+    if (used == 0)
+      break;
+    offset += used;
+  }
+
+  return offset;
+}
+
+// Snapshots are long and their encoding is the data tree's, there's no
+// point decoding them: the bytes are counted until the signature that
+// ends them shows up. Keeps the last few bytes in case it's split.
+long QuorumDecoder::skip_snapshot(Connection& c, const char *data, size_t len) {
+  auto pos = string_view(data, len).find(string_view(SNAPSHOT_SIGNATURE, SIGNATURE_LEN));
+
+  long used;
+  if (pos != string_view::npos) {
+    used = pos + SIGNATURE_LEN;
+    c.down.stage = Stage::PACKETS;
+  } else if (len < SIGNATURE_LEN) {
+    return 0;
+  } else {
+    used = len - (SIGNATURE_LEN - 1);
+  }
+
+  if (c.follower != nullptr)
+    c.follower->stats.snapshot_bytes += used;
+  return used;
+}
+
+// The initiator's sid, after a protocol version and its addresses on newer
+// versions.
+long QuorumDecoder::election_header(Connection& c, const char *data, size_t len) {
+  PayloadReader reader(string_view(data, len));
+
+  long long first = reader.read_long();
+  if (!reader.ok())
+    return 0;
+
+  if (first >= 0) {
+    c.sid = first;
+    c.up.stage = Stage::PACKETS;
+    return reader.offset();
+  }
+
+  if (first < MIN_PROTOCOL_VERSION || first > MAX_PROTOCOL_VERSION)
+    return BAD;
+  long long sid = reader.read_long();
+  int address_len = reader.read_int();
+  if (!reader.ok())
+    return 0;
+  if (address_len < 0 || address_len > MAX_ADDRESS_LEN)
+    return BAD;
+  if (!reader.skip(address_len))
+    return 0;
+
+  c.sid = sid;
+  c.up.stage = Stage::PACKETS;
+  return reader.offset();
+}
+
+void QuorumDecoder::zab_packet(Connection& c, bool up, const QuorumPacket& packet, uint64_t timestamp) {
+  auto f = c.follower;
+  FollowerStats ignored{};
+  auto& stats = f != nullptr ? f->stats : ignored;
+
+  switch ((QuorumType)packet.type) {
+  case QuorumType::PROPOSAL: {
+    // while syncing, these replay history
+    if (c.syncing)
+      break;
+    counters_.proposals++;
+    auto index = opcode_index(packet.txn_type());
+    if (index >= 0)
+      counters_.proposals_by_txn[index]++;
+    stats.proposals++;
+    stats.last_proposed = packet.zxid;
+    pending(c, c.awaiting_ack, Pending{packet.zxid, timestamp});
+    pending(c, c.awaiting_commit, Pending{packet.zxid, timestamp});
+    break;
+  }
+  case QuorumType::ACK: {
+    if (c.syncing || !up)
+      break;
+    stats.acks++;
+    stats.last_acked = max(stats.last_acked, packet.zxid);
+    auto sent = settle(c, c.awaiting_ack, packet.zxid);
+    if (f != nullptr && sent > 0 && timestamp >= sent)
+      f->ack_latency.record(timestamp - sent);
+    break;
+  }
+  case QuorumType::COMMIT:
+  case QuorumType::COMMITANDACTIVATE: {
+    if (c.syncing)
+      break;
+    stats.commits++;
+    stats.last_committed = packet.zxid;
+    auto sent = settle(c, c.awaiting_commit, packet.zxid);
+    if (f != nullptr && sent > 0 && timestamp >= sent)
+      f->commit_latency.record(timestamp - sent);
+    break;
+  }
+  case QuorumType::INFORM:
+  case QuorumType::INFORMANDACTIVATE:
+    if (c.syncing)
+      break;
+    if (packet.type == enumToInt(QuorumType::INFORM)) {
+      counters_.proposals++;
+      auto index = opcode_index(packet.txn_type());
+      if (index >= 0)
+	counters_.proposals_by_txn[index]++;
+    }
+    stats.observer = true;
+    stats.informs++;
+    stats.last_committed = packet.zxid;
+    break;
+  case QuorumType::PING:
+    stats.pings++;
+    break;
+  case QuorumType::SYNC:
+    stats.syncs++;
+    break;
+  case QuorumType::REVALIDATE:
+    stats.revalidates++;
+    break;
+  case QuorumType::REQUEST:
+    stats.requests++;
+    break;
+  case QuorumType::DIFF:
+  case QuorumType::TRUNC:
+  case QuorumType::SNAP:
+    c.syncing = true;
+    c.awaiting_ack.clear();
+    c.awaiting_commit.clear();
+    if (packet.type == enumToInt(QuorumType::DIFF))
+      stats.diffs++;
+    else if (packet.type == enumToInt(QuorumType::TRUNC))
+      stats.truncs++;
+    else
+      stats.snapshots++;
+    // the snapshot itself follows, raw
+    if (packet.type == enumToInt(QuorumType::SNAP))
+      c.down.stage = Stage::SNAPSHOT;
+    break;
+  case QuorumType::UPTODATE:
+    c.syncing = false;
+    break;
+  case QuorumType::FOLLOWERINFO:
+  case QuorumType::OBSERVERINFO: {
+    // LearnerInfo: serverid, protocol version, config version
+    PayloadReader reader(packet.data);
+    auto sid = reader.read_long();
+    if (reader.ok()) {
+      c.sid = sid;
+      stats.sid = sid;
+    }
+    stats.observer = packet.type == enumToInt(QuorumType::OBSERVERINFO);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void QuorumDecoder::pending(Connection& c, deque<Pending>& queue, const Pending& proposal) {
+  if (queue.size() >= MAX_PENDING) {
+    queue.pop_front();
+    if (c.follower != nullptr)
+      c.follower->stats.dropped++;
+  }
+  queue.push_back(proposal);
+}
+
+// Zxids are acked and committed in order: drops what's older than zxid
+// (missed, or never coming) and returns when zxid was proposed, 0 if it
+// wasn't waiting.
+uint64_t QuorumDecoder::settle(Connection& c, deque<Pending>& queue, long long zxid) {
+  uint64_t rv = 0;
+  while (!queue.empty() && queue.front().zxid <= zxid) {
+    if (queue.front().zxid == zxid)
+      rv = queue.front().timestamp;
+    else if (c.follower != nullptr)
+      c.follower->stats.dropped++;
+    queue.pop_front();
+  }
+  return rv;
+}
+
+void QuorumDecoder::vote(const FlowKey& conn, const Connection& c, bool up,
+  const Notification& notification, uint64_t timestamp) {
+  counters_.notifications++;
+  counters_.notifications_by_state[notification.state]++;
+
+  if (notification.election_epoch > counters_.election_epoch) {
+    counters_.elections++;
+    counters_.election_epoch = notification.election_epoch;
+    counters_.election_usecs = 0;
+    election_started_ = timestamp;
+  }
+  if (notification.state == enumToInt(ServerState::LOOKING) &&
+      notification.election_epoch == counters_.election_epoch && timestamp >= election_started_)
+    counters_.election_usecs = timestamp - election_started_;
+
+  // the initiator says who it is, the other side is known by where it listens
+  long long sid = up ? c.sid : -1;
+  auto from = sid >= 0 ? address(conn.src) : (up ? conn.src : conn.dst);
+  auto key = make_pair(sid, from);
+  auto it = votes_.find(key);
+  if (it == votes_.end()) {
+    if (votes_.size() >= MAX_VOTERS)
+      return;
+    it = votes_.emplace(key, Vote()).first;
+  }
+  it->second = Vote{sid, from, notification, timestamp};
+}
+
+QuorumStats QuorumDecoder::stats() const {
+  lock_guard<mutex> lock(mutex_);
+
+  QuorumStats rv = counters_;
+  rv.connections = connections_.size();
+
+  map<const Follower *, pair<uint64_t, uint64_t>> pending;
+  for (const auto& entry : connections_) {
+    const auto& c = entry.second;
+    if (c.follower != nullptr) {
+      pending[c.follower].first += c.awaiting_ack.size();
+      pending[c.follower].second += c.awaiting_commit.size();
+    }
+  }
+
+  for (const auto& entry : followers_) {
+    const auto& f = *entry.second;
+    auto stats = f.stats;
+    auto it = pending.find(&f);
+    if (it != pending.end()) {
+      stats.pending_acks = it->second.first;
+      stats.pending_commits = it->second.second;
+    }
+    stats.ack_latency = f.ack_latency.snapshot();
+    stats.commit_latency = f.commit_latency.snapshot();
+    rv.followers.push_back(move(stats));
+  }
+
+  for (const auto& entry : votes_)
+    rv.votes.push_back(entry.second);
+
+  return rv;
+}
+
+}
@@ -0,0 +1,242 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "histogram.h"
+#include "server_set.h"
+#include "tcp_packet.h"
+#include "tcp_stream.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// Leader <-> learner packet types, as in Leader.java.
+enum class QuorumType {
+  REQUEST = 1,
+  PROPOSAL = 2,
+  ACK = 3,
+  COMMIT = 4,
+  PING = 5,
+  REVALIDATE = 6,
+  SYNC = 7,
+  INFORM = 8,
+  COMMITANDACTIVATE = 9,
+  NEWLEADER = 10,
+  FOLLOWERINFO = 11,
+  UPTODATE = 12,
+  DIFF = 13,
+  TRUNC = 14,
+  SNAP = 15,
+  OBSERVERINFO = 16,
+  LEADERINFO = 17,
+  ACKEPOCH = 18,
+  INFORMANDACTIVATE = 19
+};
+
+// types index straight into per type tables
+const int QUORUM_TYPES = 20;
+const char *quorum_type_name(int type);
+
+// A QuorumPacket, what the leader and its learners exchange over the
+// quorum port. There's no length prefix: the record delimits itself (type,
+// zxid, a buffer and a vector of auth ids).
+struct QuorumPacket {
+  static const size_t MAX_DATA = TcpStream::MAX_FRAME_SIZE;
+
+  int type;
+  long long zxid;
+  string_view data;  // points into what was parsed
+
+  // The bytes the packet at the start of data takes, 0 if it isn't all
+  // there yet, -1 if that isn't a packet.
+  static long parse(const char *data, size_t len, QuorumPacket& packet);
+
+  // PROPOSAL and INFORM carry a txn: its type (an opcode), -1 otherwise
+  int txn_type() const;
+};
+
+enum class ServerState { LOOKING, FOLLOWING, LEADING, OBSERVING };
+const int SERVER_STATES = 4;
+const char *server_state_name(int state);
+
+// A leader election vote, as sent over the election port.
+struct Notification {
+  int state;
+  long long leader;
+  long long zxid;
+  long long election_epoch;
+  long long peer_epoch;  // -1 from peers too old to send it
+  int version;           // 0 from peers too old to send it
+
+  static bool from_payload(string_view body, Notification& notification);
+};
+
+// One learner, as seen on its connections to the leader. Reconnects from
+// the same address add up.
+struct FollowerStats {
+  Endpoint learner;   // port 0
+  long long sid;      // -1 until its FOLLOWERINFO/OBSERVERINFO is seen
+  bool observer;
+  uint64_t proposals;
+  uint64_t acks;
+  uint64_t commits;
+  uint64_t informs;
+  uint64_t pings;
+  uint64_t syncs;
+  uint64_t revalidates;
+  uint64_t requests;  // forwarded client writes
+  uint64_t snapshots;
+  uint64_t diffs;
+  uint64_t truncs;
+  uint64_t snapshot_bytes;
+  uint64_t pending_acks;     // proposals waiting for an ACK, right now
+  uint64_t pending_commits;  // proposals waiting for a COMMIT, right now
+  uint64_t dropped;          // proposals given up on (see MAX_PENDING)
+  long long last_proposed;
+  long long last_acked;
+  long long last_committed;
+  HistogramSnapshot ack_latency;     // PROPOSAL -> ACK, usecs
+  HistogramSnapshot commit_latency;  // PROPOSAL -> COMMIT, usecs
+};
+
+// The latest vote from one peer.
+struct Vote {
+  long long sid;  // -1 unless it started the connection
+  Endpoint from;  // the peer's listening endpoint, or its address if sid is known
+  Notification notification;
+  uint64_t timestamp;
+};
+
+struct QuorumStats {
+  uint64_t packets_by_type[QUORUM_TYPES] = {};
+  // proposed as they happen, not replayed while a learner syncs
+  uint64_t proposals = 0;
+  uint64_t proposals_by_txn[OPCODE_SLOTS] = {};
+  // times a stream stopped making sense and decoding skipped ahead
+  uint64_t undecoded = 0;
+  uint64_t connections = 0;
+  vector<FollowerStats> followers;
+
+  uint64_t notifications = 0;
+  uint64_t notifications_by_state[SERVER_STATES] = {};
+  // how many times a higher election epoch showed up, the last one and how
+  // long it went on (first to last LOOKING vote)
+  uint64_t elections = 0;
+  long long election_epoch = 0;
+  uint64_t election_usecs = 0;
+  vector<Vote> votes;
+
+  QuorumStats& operator+=(const QuorumStats& other);
+};
+
+struct QuorumOptions {
+  bool enabled = false;
+  ServerSet zab = ServerSet("2888");
+  ServerSet election = ServerSet("3888");
+};
+
+// Decodes quorum (ZAB) and leader election traffic into QuorumStats:
+// packet counts, per follower proposal -> ACK and proposal -> COMMIT
+// latencies and backlogs, snapshot transfers and the votes going around.
+//
+// Like Decoder it must see both directions of a connection, which is how
+// ACKs and COMMITs are paired with the PROPOSALs the leader sent on that
+// same connection. Memory is bounded: connections, followers, voters and
+// pending proposals are capped, snapshots are skipped without buffering.
+//
+// handle() runs on the decoding thread, stats() from any thread.
+class QuorumDecoder {
+public:
+  static const size_t MAX_CONNECTIONS = 4096;
+  static const size_t MAX_FOLLOWERS = 256;
+  static const size_t MAX_VOTERS = 256;
+  // per connection, waiting for their ACK (and, separately, their COMMIT)
+  static const size_t MAX_PENDING = 65536;
+  static const time_t IDLE_SECS = 300;
+
+  explicit QuorumDecoder(const QuorumOptions& options) :
+    zab_(options.zab), election_(options.election) {}
+
+  // timestamp is the pcap timestamp in usecs. false if the packet isn't on
+  // a quorum or election port.
+  bool handle(const TcpPacket& packet, uint64_t timestamp);
+
+  QuorumStats stats() const;
+
+private:
+  enum class Stage {
+    HEADER,    // an election connection's initiator introduces itself
+    PACKETS,
+    SNAPSHOT   // the leader is streaming a snapshot, not packets
+  };
+
+  struct Direction {
+    TcpStream stream;
+    string buf;
+    Stage stage = Stage::PACKETS;
+  };
+
+  struct Pending {
+    long long zxid;
+    uint64_t timestamp;
+  };
+
+  struct Follower {
+    FollowerStats stats{};
+    Histogram ack_latency;
+    Histogram commit_latency;
+  };
+
+  // learner -> leader, or initiator -> peer for elections
+  struct Connection {
+    bool zab;
+    long long sid = -1;
+    bool syncing = false;  // between DIFF/SNAP/TRUNC and UPTODATE
+    time_t last_seen = 0;
+    Direction up;    // from the learner/initiator
+    Direction down;  // to it
+    deque<Pending> awaiting_ack;
+    deque<Pending> awaiting_commit;
+    Follower *follower = nullptr;
+  };
+
+  static const long BAD = -1;
+
+  Connection& connection(const FlowKey& conn, bool zab, time_t now);
+  void expire(time_t now);
+  void feed(const FlowKey& conn, Connection& c, bool up, const char *data, size_t len,
+    uint64_t timestamp);
+  long parse(const FlowKey& conn, Connection& c, bool up, const char *data, size_t len,
+    uint64_t timestamp);
+  long skip_snapshot(Connection& c, const char *data, size_t len);
+  long election_header(Connection& c, const char *data, size_t len);
+  void zab_packet(Connection& c, bool up, const QuorumPacket& packet, uint64_t timestamp);
+  void vote(const FlowKey& conn, const Connection& c, bool up, const Notification& notification,
+    uint64_t timestamp);
+  Follower *follower(const Endpoint& learner);
+  void pending(Connection& c, deque<Pending>& queue, const Pending& proposal);
+  uint64_t settle(Connection& c, deque<Pending>& queue, long long zxid);
+
+  ServerSet zab_;
+  ServerSet election_;
+  mutable mutex mutex_;
+  unordered_map<FlowKey, Connection, FlowKeyHash> connections_;
+  map<Endpoint, unique_ptr<Follower>> followers_;
+  map<pair<long long, Endpoint>, Vote> votes_;
+  QuorumStats counters_;  // everything but followers and votes
+  uint64_t election_started_ = 0;
+};
+
+}
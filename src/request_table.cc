@@ -0,0 +1,125 @@
+#include "request_table.h"
+
+using namespace std;
+
+namespace Zktraffic {
+namespace {
+
+const size_t NOT_FOUND = ~(size_t)0;
+
+}
+
+RequestTable::RequestTable(size_t capacity, time_t max_age) :
+  capacity_(capacity ? capacity : 1), max_age_((uint64_t)max_age * 1000000) {
+  size_t slots = 16;
+  while (slots < capacity_ * 2)
+    slots <<= 1;
+  mask_ = slots - 1;
+  slots_.resize(slots, Slot{FlowKey{0, 0, 0, 0}, 0, 0, 0, 0});
+  ring_.resize(capacity_ * 2);
+}
+
+void RequestTable::add(const FlowKey& conn, int xid, int opcode, uint64_t timestamp) {
+  auto idx = find(conn, xid);
+  if (idx != NOT_FOUND)
+    remove(idx);
+
+  evict_oldest(timestamp);
+
+  idx = slot_for(conn, xid);
+  while (slots_[idx].stamp != 0)
+    idx = (idx + 1) & mask_;
+
+  auto stamp = next_stamp_++;
+  slots_[idx] = Slot{conn, xid, opcode, stamp, timestamp};
+  size_++;
+
+  ring_[(ring_head_ + ring_len_) % ring_.size()] = Pending{conn, xid, stamp};
+  ring_len_++;
+}
+
+bool RequestTable::take(const FlowKey& conn, int xid, Request& request) {
+  auto idx = find(conn, xid);
+  if (idx == NOT_FOUND) {
+    unmatched_++;
+    return false;
+  }
+
+  request.opcode = slots_[idx].opcode;
+  request.timestamp = slots_[idx].timestamp;
+  remove(idx);
+  return true;
+}
+
+size_t RequestTable::slot_for(const FlowKey& conn, int xid) const {
+  uint64_t h = FlowKeyHash()(conn) ^ ((uint32_t)xid * 0x9e3779b97f4a7c15ULL);
+  h ^= h >> 32;
+  return h & mask_;
+}
+
+size_t RequestTable::find(const FlowKey& conn, int xid) const {
+  for (auto idx = slot_for(conn, xid); slots_[idx].stamp != 0; idx = (idx + 1) & mask_) {
+    if (slots_[idx].xid == xid && slots_[idx].conn == conn)
+      return idx;
+  }
+  return NOT_FOUND;
+}
+
+void RequestTable::remove(size_t idx) {
+  size_--;
+
+  // backward shift: pull up entries whose probe sequence crosses the hole
+  auto hole = idx;
+  for (auto next = (idx + 1) & mask_; slots_[next].stamp != 0; next = (next + 1) & mask_) {
+    auto home = slot_for(slots_[next].conn, slots_[next].xid);
+    if (((next - home) & mask_) >= ((next - hole) & mask_)) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+  }
+  slots_[hole].stamp = 0;
+}
+
+// Pops the ring from its oldest end: records for requests that already got
+// their reply are skipped, requests past max_age are evicted, and if the
+// table is full the oldest live request goes too. When the ring fills up
+// with fewer than capacity requests in flight, it's compacted instead.
+void RequestTable::evict_oldest(uint64_t now) {
+  while (ring_len_ > 0) {
+    auto oldest = ring_[ring_head_];
+    auto idx = find(oldest.conn, oldest.xid);
+    bool live = idx != NOT_FOUND && slots_[idx].stamp == oldest.stamp;
+
+    if (live && size_ < capacity_ &&
+	(now < slots_[idx].timestamp || now - slots_[idx].timestamp <= max_age_)) {
+      if (ring_len_ < ring_.size())
+	break;
+
+      compact();
+      continue;
+    }
+
+    if (live) {
+      remove(idx);
+      evictions_++;
+    }
+    ring_head_ = (ring_head_ + 1) % ring_.size();
+    ring_len_--;
+  }
+}
+
+// Drops the records of completed requests in one pass, keeping the order of
+// the live ones. The ring is twice the capacity, so this leaves at least
+// half of it free.
+void RequestTable::compact() {
+  size_t len = 0;
+  for (size_t i = 0; i < ring_len_; i++) {
+    auto pending = ring_[(ring_head_ + i) % ring_.size()];
+    auto idx = find(pending.conn, pending.xid);
+    if (idx != NOT_FOUND && slots_[idx].stamp == pending.stamp)
+      ring_[(ring_head_ + len++) % ring_.size()] = pending;
+  }
+  ring_len_ = len;
+}
+
+}
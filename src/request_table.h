@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+#include "tcp_packet.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// In-flight requests, keyed by connection (client -> server flow) and xid.
+//
+// A flat open addressing table (linear probing, backward shift deletion)
+// sized to stay under half full, plus a ring remembering insertion order.
+// Once `capacity` requests are in flight the oldest one is evicted to make
+// room, and requests older than max_age are dropped as new ones come in.
+//
+// Timestamps are pcap timestamps in usecs.
+class RequestTable {
+public:
+  struct Request {
+    int opcode;
+    uint64_t timestamp;
+  };
+
+  static const size_t DEFAULT_CAPACITY = 65536;
+  static const time_t DEFAULT_MAX_AGE = 60;
+
+  explicit RequestTable(size_t capacity = DEFAULT_CAPACITY, time_t max_age = DEFAULT_MAX_AGE);
+
+  void add(const FlowKey& conn, int xid, int opcode, uint64_t timestamp);
+  // Finds and removes the request matching a reply.
+  bool take(const FlowKey& conn, int xid, Request& request);
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return capacity_; }
+  uint64_t evictions() const { return evictions_; }
+  uint64_t unmatched() const { return unmatched_; }
+
+private:
+  struct Slot {
+    FlowKey conn;
+    int xid;
+    int opcode;
+    uint64_t stamp;  // 0 means empty
+    uint64_t timestamp;
+  };
+
+  struct Pending {
+    FlowKey conn;
+    int xid;
+    uint64_t stamp;
+  };
+
+  size_t slot_for(const FlowKey& conn, int xid) const;
+  size_t find(const FlowKey& conn, int xid) const;
+  void remove(size_t idx);
+  void evict_oldest(uint64_t now);
+  void compact();
+
+  size_t capacity_;
+  uint64_t max_age_;
+  size_t mask_;
+  vector<Slot> slots_;
+  vector<Pending> ring_;
+  size_t ring_head_ = 0;
+  size_t ring_len_ = 0;
+  size_t size_ = 0;
+  uint64_t next_stamp_ = 1;
+  uint64_t evictions_ = 0;
+  uint64_t unmatched_ = 0;
+};
+
+}
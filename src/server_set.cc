@@ -0,0 +1,274 @@
+#include "server_set.h"
+
+#include <arpa/inet.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+using namespace std;
+
+namespace Zktraffic {
+
+namespace {
+
+string trim(const string& s) {
+  auto first = s.find_first_not_of(" \t");
+  if (first == string::npos)
+    return "";
+  auto last = s.find_last_not_of(" \t");
+  return s.substr(first, last - first + 1);
+}
+
+vector<string> split(const string& s, char delim) {
+  vector<string> rv;
+  stringstream ss(s);
+  string item;
+  while (getline(ss, item, delim))
+    rv.push_back(trim(item));
+  return rv;
+}
+
+bool parse_number(const string& s, long max, long& out) {
+  if (s.empty() || s.find_first_not_of("0123456789") != string::npos)
+    return false;
+  out = strtol(s.c_str(), nullptr, 10);
+  return out <= max;
+}
+
+bool parse_ports(const string& s, uint16_t& first, uint16_t& last) {
+  long a, b;
+  auto dash = s.find('-');
+  if (dash == string::npos) {
+    if (!parse_number(s, 65535, a) || a == 0)
+      return false;
+    first = last = a;
+    return true;
+  }
+  if (!parse_number(s.substr(0, dash), 65535, a) || !parse_number(s.substr(dash + 1), 65535, b))
+    return false;
+  if (a == 0 || a > b)
+    return false;
+  first = a;
+  last = b;
+  return true;
+}
+
+string address(const uint8_t *prefix, bool v4) {
+  char buf[INET6_ADDRSTRLEN];
+  if (v4)
+    inet_ntop(AF_INET, prefix + 12, buf, sizeof(buf));
+  else
+    inet_ntop(AF_INET6, prefix, buf, sizeof(buf));
+  return buf;
+}
+
+bool is_v4_mapped(const uint8_t *prefix) {
+  static const uint8_t mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+  return memcmp(prefix, mapped, sizeof(mapped)) == 0;
+}
+
+string ports_filter(const string& qualifier, uint16_t first, uint16_t last) {
+  if (first == last)
+    return qualifier + "port " + to_string(first);
+  return qualifier + "portrange " + to_string(first) + "-" + to_string(last);
+}
+
+}
+
+ServerSet::ServerSet() : ServerSet("2181") {}
+
+ServerSet::ServerSet(const string& spec) {
+  if (!parse(spec)) {
+    names_.clear();
+    rules_.clear();
+  }
+  build();
+}
+
+bool ServerSet::parse(const string& spec) {
+  for (auto& group : split(spec, ';')) {
+    if (group.empty())
+      continue;
+
+    if ((int)names_.size() == MAX_ENSEMBLES) {
+      error_ = "more than " + to_string(MAX_ENSEMBLES) + " ensembles";
+      return false;
+    }
+
+    string name = group;
+    string endpoints = group;
+    auto eq = group.find('=');
+    if (eq != string::npos) {
+      name = trim(group.substr(0, eq));
+      endpoints = group.substr(eq + 1);
+      if (name.empty()) {
+	error_ = "empty ensemble name in " + group;
+	return false;
+      }
+    }
+    if (find(names_.begin(), names_.end(), name) != names_.end()) {
+      error_ = "duplicate ensemble " + name;
+      return false;
+    }
+
+    names_.push_back(name);
+    for (auto& endpoint : split(endpoints, ',')) {
+      if (!parse_endpoint(endpoint, names_.size() - 1))
+	return false;
+    }
+  }
+
+  if (names_.empty()) {
+    error_ = "no servers given";
+    return false;
+  }
+
+  return true;
+}
+
+// port[-port], addr[/bits]:port[-port] or [addr6[/bits]]:port[-port]
+bool ServerSet::parse_endpoint(const string& text, int ensemble) {
+  Rule rule{};
+  rule.ensemble = ensemble;
+
+  string addr, ports = text;
+  if (!text.empty() && text[0] == '[') {
+    auto close = text.find(']');
+    if (close == string::npos || close + 1 >= text.size() || text[close + 1] != ':') {
+      error_ = "bad endpoint " + text;
+      return false;
+    }
+    addr = text.substr(1, close - 1);
+    ports = text.substr(close + 2);
+  } else {
+    auto colon = text.rfind(':');
+    if (colon != string::npos) {
+      addr = text.substr(0, colon);
+      ports = text.substr(colon + 1);
+    }
+  }
+
+  if (!parse_ports(ports, rule.first_port, rule.last_port)) {
+    error_ = "bad port in " + text;
+    return false;
+  }
+
+  if (!addr.empty()) {
+    long bits = -1;
+    auto slash = addr.find('/');
+    if (slash != string::npos) {
+      if (!parse_number(addr.substr(slash + 1), 128, bits)) {
+	error_ = "bad prefix length in " + text;
+	return false;
+      }
+      addr = addr.substr(0, slash);
+    }
+
+    uint32_t v4;
+    if (inet_pton(AF_INET, addr.c_str(), &v4) == 1) {
+      if (bits > 32) {
+	error_ = "bad prefix length in " + text;
+	return false;
+      }
+      memcpy(rule.prefix, Endpoint::from_v4(v4, 0).addr, 16);
+      rule.bits = 96 + (bits < 0 ? 32 : bits);
+    } else if (inet_pton(AF_INET6, addr.c_str(), rule.prefix) == 1) {
+      rule.bits = bits < 0 ? 128 : bits;
+    } else {
+      error_ = "bad address in " + text;
+      return false;
+    }
+
+    // clear the host bits so filter() prints a proper network
+    for (int i = rule.bits; i < 128; i++)
+      rule.prefix[i / 8] &= ~(0x80 >> (i % 8));
+  }
+
+  rules_.push_back(rule);
+  return true;
+}
+
+// Ports only some addresses serve are marked CHECK_RULES; the others map
+// straight to their ensemble. Rules are sorted longest prefix first so the
+// most specific one wins, with a port-only rule catching the rest.
+void ServerSet::build() {
+  stable_sort(rules_.begin(), rules_.end(),
+    [](const Rule& a, const Rule& b) { return a.bits > b.bits; });
+
+  by_port_.assign(65536, NONE);
+  for (auto& rule : rules_) {
+    for (int port = rule.first_port; port <= rule.last_port; port++) {
+      if (rule.bits > 0)
+	by_port_[port] = CHECK_RULES;
+      else if (by_port_[port] == NONE)
+	by_port_[port] = rule.ensemble;
+    }
+  }
+}
+
+bool ServerSet::matches(const Rule& rule, const Endpoint& endpoint) {
+  if (endpoint.port < rule.first_port || endpoint.port > rule.last_port)
+    return false;
+
+  int whole = rule.bits / 8;
+  if (memcmp(rule.prefix, endpoint.addr, whole) != 0)
+    return false;
+  int rest = rule.bits % 8;
+  if (rest == 0)
+    return true;
+  uint8_t mask = 0xff << (8 - rest);
+  return (rule.prefix[whole] & mask) == (endpoint.addr[whole] & mask);
+}
+
+int ServerSet::match_rules(const Endpoint& endpoint) const {
+  for (auto& rule : rules_) {
+    if (matches(rule, endpoint))
+      return rule.ensemble;
+  }
+  return NONE;
+}
+
+// Port-only rules go in as port/portrange primitives, merged where they
+// touch. Address rules only match their own side: the server's address is
+// the source when its port is, so a client that happens to be in the
+// network on the same port doesn't get through.
+string ServerSet::filter() const {
+  vector<pair<int, int>> any;
+  vector<string> terms;
+
+  for (auto& rule : rules_) {
+    if (rule.bits == 0) {
+      any.emplace_back(rule.first_port, rule.last_port);
+      continue;
+    }
+
+    bool v4 = rule.bits >= 96 && is_v4_mapped(rule.prefix);
+    auto net = address(rule.prefix, v4) + "/" + to_string(v4 ? rule.bits - 96 : rule.bits);
+    terms.push_back("(src net " + net + " and " + ports_filter("src ", rule.first_port, rule.last_port) +
+      ") or (dst net " + net + " and " + ports_filter("dst ", rule.first_port, rule.last_port) + ")");
+  }
+
+  sort(any.begin(), any.end());
+  vector<string> ports;
+  for (size_t i = 0; i < any.size(); ) {
+    int first = any[i].first, last = any[i].second;
+    for (i++; i < any.size() && any[i].first <= last + 1; i++)
+      last = max(last, any[i].second);
+    ports.push_back(ports_filter("", first, last));
+  }
+  terms.insert(terms.begin(), ports.begin(), ports.end());
+
+  if (terms.empty())
+    return "tcp";
+
+  string rv = "tcp and (";
+  for (size_t i = 0; i < terms.size(); i++) {
+    if (i > 0)
+      rv += " or ";
+    rv += terms[i];
+  }
+  return rv + ")";
+}
+
+}
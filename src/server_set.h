@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "endpoint.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+// The endpoints ZooKeeper servers listen on, grouped into ensembles. Tells
+// which side of a packet is the server and which ensemble it belongs to,
+// and turns into a capture filter matching just them.
+//
+// The spec is a ';' separated list of ensembles, each an optional name and
+// a ',' separated list of endpoints:
+//
+//   2181                                   one ensemble, on any address
+//   prod=2181,2182;test=10.1.0.0/16:2281  two of them
+//   2181-2183,[fd00::/8]:2281,10.0.0.5:2181
+//
+// An endpoint is a port (or port range), optionally behind an address or
+// CIDR; IPv6 ones go in brackets. Unnamed ensembles are named after their
+// spec.
+//
+// Lookups are one table access by port; only ports that some rule ties to
+// an address look further, at that port's rules (longest prefix first).
+class ServerSet {
+public:
+  static const int MAX_ENSEMBLES = 16;
+
+  // port 2181 on any address
+  ServerSet();
+  explicit ServerSet(const string& spec);
+
+  bool ok() const { return error_.empty(); }
+  // why it isn't ok()
+  const string& error() const { return error_; }
+
+  // the ensemble the endpoint is a server of, -1 if it isn't one
+  int ensemble(const Endpoint& endpoint) const {
+    int rv = by_port_[endpoint.port];
+    return rv == CHECK_RULES ? match_rules(endpoint) : rv;
+  }
+  bool is_server(const Endpoint& endpoint) const { return ensemble(endpoint) >= 0; }
+
+  const vector<string>& ensembles() const { return names_; }
+  // a pcap filter expression for TCP traffic to or from any of them
+  string filter() const;
+
+private:
+  static constexpr int8_t NONE = -1;
+  static constexpr int8_t CHECK_RULES = -2;
+
+  struct Rule {
+    uint8_t prefix[16];  // v4-mapped for IPv4
+    int bits;            // of prefix that must match, 0 for any address
+    uint16_t first_port;
+    uint16_t last_port;
+    int ensemble;
+  };
+
+  bool parse(const string& spec);
+  bool parse_endpoint(const string& text, int ensemble);
+  void build();
+  int match_rules(const Endpoint& endpoint) const;
+  static bool matches(const Rule& rule, const Endpoint& endpoint);
+
+  string error_;
+  vector<string> names_;
+  vector<Rule> rules_;
+  vector<int8_t> by_port_;
+};
+
+}
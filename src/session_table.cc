@@ -0,0 +1,189 @@
+#include "session_table.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace Zktraffic {
+
+SessionStats& SessionStats::operator+=(const SessionStats& other) {
+  connections += other.connections;
+  connecting += other.connecting;
+  created += other.created;
+  resumed += other.resumed;
+  expired += other.expired;
+  closed += other.closed;
+  disconnected += other.disconnected;
+  evicted += other.evicted;
+  timeouts += other.timeouts;
+  return *this;
+}
+
+void SessionTable::connect_request(const FlowKey& conn, long long session, int timeout,
+  uint64_t timestamp) {
+  lock_guard<mutex> lock(mutex_);
+
+  auto it = sessions_.find(conn);
+  if (it == sessions_.end()) {
+    if (sessions_.size() >= capacity_)
+      expire();
+    it = sessions_.emplace(conn, Session{conn, 0, 0, 0, 0, 0, SessionState::CONNECTING, false}).first;
+  } else if (it->second.state == SessionState::CONNECTING) {
+    connecting_--;
+  }
+
+  // a new handshake on the same connection starts over
+  it->second = Session{conn, session, timeout, 0, 0, timestamp, SessionState::CONNECTING, false};
+  connecting_++;
+}
+
+void SessionTable::connect_reply(const FlowKey& conn, long long session, int timeout, bool readonly,
+  uint64_t timestamp) {
+  lock_guard<mutex> lock(mutex_);
+
+  auto it = sessions_.find(conn);
+  if (it == sessions_.end() || it->second.state != SessionState::CONNECTING)
+    return;
+  connecting_--;
+
+  auto& entry = it->second;
+  if (session == 0) {
+    // the server closes the connection right after
+    counters_.expired++;
+    sessions_.erase(it);
+    return;
+  }
+
+  if (entry.id == 0)
+    counters_.created++;
+  else
+    counters_.resumed++;
+  entry.id = session;
+  entry.timeout = timeout;
+  entry.readonly = readonly;
+  entry.connected = timestamp;
+  entry.last_seen = timestamp;
+  entry.state = SessionState::CONNECTED;
+  timeouts_.record(timeout);
+}
+
+void SessionTable::connect_failed(const FlowKey& conn) {
+  lock_guard<mutex> lock(mutex_);
+
+  auto it = sessions_.find(conn);
+  if (it == sessions_.end() || it->second.state != SessionState::CONNECTING)
+    return;
+  connecting_--;
+  sessions_.erase(it);
+}
+
+void SessionTable::close_request(const FlowKey& conn, uint64_t timestamp) {
+  lock_guard<mutex> lock(mutex_);
+
+  auto it = sessions_.find(conn);
+  if (it == sessions_.end() || it->second.state != SessionState::CONNECTED)
+    return;
+  it->second.state = SessionState::CLOSING;
+  it->second.last_seen = timestamp;
+}
+
+void SessionTable::close_reply(const FlowKey& conn) {
+  lock_guard<mutex> lock(mutex_);
+
+  auto it = sessions_.find(conn);
+  if (it == sessions_.end() || it->second.state != SessionState::CLOSING)
+    return;
+  counters_.closed++;
+  sessions_.erase(it);
+}
+
+void SessionTable::disconnected(const FlowKey& conn) {
+  if (sessions_.empty())
+    return;
+
+  lock_guard<mutex> lock(mutex_);
+  if (remove(conn))
+    counters_.disconnected++;
+}
+
+void SessionTable::forget(const FlowKey& conn) {
+  if (sessions_.empty())
+    return;
+
+  lock_guard<mutex> lock(mutex_);
+  if (remove(conn))
+    counters_.evicted++;
+}
+
+// true if it was past the handshake
+bool SessionTable::remove(const FlowKey& conn) {
+  auto it = sessions_.find(conn);
+  if (it == sessions_.end())
+    it = sessions_.find(conn.reversed());
+  if (it == sessions_.end())
+    return false;
+
+  bool connected = it->second.state != SessionState::CONNECTING;
+  if (!connected)
+    connecting_--;
+  sessions_.erase(it);
+  return connected;
+}
+
+bool SessionTable::find(const FlowKey& conn, Session& session) const {
+  lock_guard<mutex> lock(mutex_);
+
+  auto it = sessions_.find(conn);
+  if (it == sessions_.end())
+    return false;
+  session = it->second;
+  return true;
+}
+
+vector<Session> SessionTable::sessions() const {
+  lock_guard<mutex> lock(mutex_);
+
+  vector<Session> rv;
+  rv.reserve(sessions_.size());
+  for (const auto& entry : sessions_)
+    rv.push_back(entry.second);
+  return rv;
+}
+
+SessionStats SessionTable::stats() const {
+  lock_guard<mutex> lock(mutex_);
+
+  SessionStats rv = counters_;
+  rv.connections = sessions_.size();
+  rv.connecting = connecting_;
+  rv.timeouts = timeouts_.snapshot();
+  return rv;
+}
+
+size_t SessionTable::size() const {
+  lock_guard<mutex> lock(mutex_);
+  return sessions_.size();
+}
+
+// Evicts the oldest tenth (at least one), picked by iterator since
+// last_seen can tie.
+void SessionTable::expire() {
+  using Entry = decltype(sessions_)::iterator;
+  vector<Entry> seen;
+  seen.reserve(sessions_.size());
+  for (auto it = sessions_.begin(); it != sessions_.end(); ++it)
+    seen.push_back(it);
+
+  auto nth = seen.begin() + std::max<size_t>(seen.size() / 10, 1);
+  nth_element(seen.begin(), nth - 1, seen.end(), [](Entry a, Entry b) {
+      return a->second.last_seen < b->second.last_seen;
+    });
+  for (auto it = seen.begin(); it != nth; ++it) {
+    if ((*it)->second.state == SessionState::CONNECTING)
+      connecting_--;
+    counters_.evicted++;
+    sessions_.erase(*it);
+  }
+}
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "histogram.h"
+#include "tcp_packet.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+enum class SessionState {
+  CONNECTING,  // ConnectRequest sent, waiting for the ConnectResponse
+  CONNECTED,
+  CLOSING      // CLOSE sent, waiting for its reply
+};
+
+struct Session {
+  FlowKey conn;               // client -> server
+  long long id;               // 0 until the server hands one out
+  int requested_timeout;      // msecs
+  int timeout;                // negotiated, msecs
+  uint64_t connected;         // usecs, when the handshake completed
+  uint64_t last_seen;         // usecs, of the last handshake or CLOSE
+  SessionState state;
+  bool readonly;
+};
+
+struct SessionStats {
+  uint64_t connections = 0;   // tracked right now
+  uint64_t connecting = 0;
+  uint64_t created = 0;       // new sessions
+  uint64_t resumed = 0;       // sessions moved to another connection
+  uint64_t expired = 0;       // resumes refused, the session was gone
+  uint64_t closed = 0;        // ended with a CLOSE
+  uint64_t disconnected = 0;  // connections dropped without a CLOSE
+  uint64_t evicted = 0;       // given up on to stay within capacity
+  HistogramSnapshot timeouts; // negotiated, msecs
+
+  // session starts and ends per second over elapsed_usecs
+  double churn(uint64_t elapsed_usecs) const {
+    return elapsed_usecs ? (created + resumed + closed + disconnected) * 1e6 / elapsed_usecs : 0;
+  }
+
+  SessionStats& operator+=(const SessionStats& other);
+};
+
+// Which session each connection carries, learnt from the connect
+// handshake, CLOSE and FIN/RST. Connections whose handshake wasn't
+// captured aren't tracked.
+//
+// Connections stay until they are closed or the decoder gives up on their
+// stream (forget()). On top of that at most `capacity` are held: when full,
+// the tenth that handshaked longest ago is dropped.
+//
+// Each Decoder owns one and updates it from its own thread; stats() and
+// sessions() can run from any other thread.
+class SessionTable {
+public:
+  static const size_t DEFAULT_CAPACITY = 131072;
+
+  explicit SessionTable(size_t capacity = DEFAULT_CAPACITY) : capacity_(capacity ? capacity : 1) {}
+
+  // timestamps are pcap timestamps in usecs
+  void connect_request(const FlowKey& conn, long long session, int timeout, uint64_t timestamp);
+  void connect_reply(const FlowKey& conn, long long session, int timeout, bool readonly,
+    uint64_t timestamp);
+  // the server answered the handshake with something that isn't a
+  // ConnectResponse: the session stays unknown
+  void connect_failed(const FlowKey& conn);
+  void close_request(const FlowKey& conn, uint64_t timestamp);
+  void close_reply(const FlowKey& conn);
+  // FIN or RST, in either direction
+  void disconnected(const FlowKey& conn);
+  // the connection went idle, in either direction
+  void forget(const FlowKey& conn);
+
+  // true if the next thing the server sends on conn is a ConnectResponse.
+  // Only for the owning thread, it doesn't lock.
+  bool connecting(const FlowKey& conn) const {
+    if (connecting_ == 0)
+      return false;
+    auto it = sessions_.find(conn);
+    return it != sessions_.end() && it->second.state == SessionState::CONNECTING;
+  }
+
+  bool find(const FlowKey& conn, Session& session) const;
+  // every tracked connection
+  vector<Session> sessions() const;
+  SessionStats stats() const;
+  size_t size() const;
+
+private:
+  bool remove(const FlowKey& conn);
+  void expire();
+
+  size_t capacity_;
+  mutable mutex mutex_;
+  unordered_map<FlowKey, Session, FlowKeyHash> sessions_;
+  size_t connecting_ = 0;
+  SessionStats counters_;
+  Histogram timeouts_;
+};
+
+}
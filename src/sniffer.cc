@@ -1,9 +1,16 @@
+#include <algorithm>
+#include <cstdio>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <queue>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <pcap.h>
 
+#include "decoder.h"
 #include "tcp_packet.h"
 #include "sniffer.h"
 
@@ -17,94 +24,427 @@ void Sniffer::run() {
   struct bpf_program fp;
 
   stopped_ = false;
+  started_usecs_ = steady_usecs();
 
-  if (from_file_)
-    handle = pcap_open_offline(iface_.c_str(), errbuf);
-  else
-    handle = pcap_open_live(iface_.c_str(), 8192, 1, 1000, errbuf);
+  if (from_file_) {
+    runFiles();
+    return;
+  }
 
+  handle = openLive(errbuf);
   if (handle == NULL) {
-    if (from_file_)
-      cout << "couldn't sniff (file: " << iface_ << "): " << errbuf << "\n";
-    else
-      cout << "couldn't sniff (iface: " << iface_ << "): " << errbuf << "\n";
-    stopped_ = true;
+    cout << "couldn't sniff (iface: " << iface_ << "): " << errbuf << "\n";
+    finish();
     return;
   }
 
   if (pcap_compile(handle, &fp, filter_.c_str(), 0, PCAP_NETMASK_UNKNOWN) == -1) {
     cout << "couldn't compile the filter (iface: " << iface_ << ")\n";
-    stopped_ = true;
+    pcap_close(handle);
+    finish();
     return;
   }
 
   if (pcap_setfilter(handle, &fp) == -1) {
     cout << "couldn't set the filter (iface: " << iface_ << ")\n";
-    stopped_ = true;
+    pcap_freecode(&fp);
+    pcap_close(handle);
+    finish();
     return;
   }
+  pcap_freecode(&fp);
 
-  if (from_file_)
-    cout << "running (file: " << iface_ << ")\n";
-  else
-    cout << "running (iface: " << iface_ << ")\n";
+  linktype_ = pcap_datalink(handle);
+  cout << "running (iface: " << iface_ << ")\n";
 
   running_ = true;
-  runner_ = new thread([this, handle]() {
-      const u_char *packet;
-      struct pcap_pkthdr header;
-
+  startWorkers();
+  runner_ = thread([this, handle]() {
+      // without workers packets are processed in place, straight out of
+      // libpcap's buffer (the mmap'ed ring)
       while (running_) {
-	packet = pcap_next(handle, &header);
-	if (packet == nullptr)
+	int count = pcap_dispatch(handle, options_.batch, &Sniffer::dispatchHandler, (u_char *)this);
+	if (count < 0)
 	  break;
-	packetHandler(&header, packet);
+	packets_.fetch_add(count, memory_order_relaxed);
+	bytes_.fetch_add(batch_bytes_, memory_order_relaxed);
+	batch_bytes_ = 0;
+	decoder_.flush();
+	for (auto& worker : workers_)
+	  flushWorker(*worker);
+	updateCaptureStats(handle, false);
       }
+      updateCaptureStats(handle, true);
       cout << "exiting sniffing loop...\n";
       pcap_close(handle);
-      stopped_ = true;
+      stopWorkers();
+      finish();
+    });
+}
+
+// Files are mmapped and parsed here rather than through libpcap, which
+// would copy every packet into its own buffer first; the filter still
+// runs through libpcap's BPF interpreter.
+void Sniffer::runFiles() {
+  vector<unique_ptr<PcapFile>> files;
+  vector<unique_ptr<PcapFilter>> filters;
+  string names;
+
+  for (const auto& name : files_) {
+    files.emplace_back(new PcapFile(name));
+    if (!files.back()->ok()) {
+      cout << "couldn't sniff (file: " << name << "): " << files.back()->error() << "\n";
+      finish();
+      return;
+    }
+    filters.emplace_back(new PcapFilter(filter_, files.back()->linktype(), options_.snaplen));
+    if (!filters.back()->ok()) {
+      cout << "couldn't compile the filter (file: " << name << ")\n";
+      finish();
+      return;
+    }
+    names += (names.empty() ? "" : ", ") + name;
+  }
+
+  cout << "running (file: " << names << ")\n";
+
+  running_ = true;
+  if (!file_decoders_.empty()) {
+    runner_ = thread([this, files = move(files), filters = move(filters)]() mutable {
+	replayParallel(files, filters);
+	cout << "exiting sniffing loop...\n";
+	finish();
+      });
+    return;
+  }
+
+  startWorkers();
+  runner_ = thread([this, files = move(files), filters = move(filters)]() mutable {
+      replayMerged(files, filters);
+      cout << "exiting sniffing loop...\n";
+      stopWorkers();
+      finish();
     });
-  runner_->detach();
+}
+
+// One capture, spread over files: always hand out the earliest packet.
+void Sniffer::replayMerged(vector<unique_ptr<PcapFile>>& files,
+    vector<unique_ptr<PcapFilter>>& filters) {
+  // (timestamp, file), ties go to the file that came first
+  using Head = pair<uint64_t, size_t>;
+  priority_queue<Head, vector<Head>, greater<Head>> heads;
+  vector<PcapRecord> records(files.size());
+
+  for (size_t i = 0; i < files.size(); i++) {
+    if (files[i]->next(records[i]))
+      heads.emplace(records[i].timestamp, i);
+  }
+
+  int count = 0;
+  while (running_ && !heads.empty()) {
+    auto i = heads.top().second;
+    heads.pop();
+
+    auto header = records[i].header();
+    if (filters[i]->matches(&header, records[i].data)) {
+      batch_bytes_ += header.len;
+      packetHandler(&header, records[i].data, records[i].linktype);
+      count++;
+    }
+
+    if (files[i]->next(records[i]))
+      heads.emplace(records[i].timestamp, i);
+
+    if (count >= options_.batch || heads.empty()) {
+      packets_.fetch_add(count, memory_order_relaxed);
+      bytes_.fetch_add(batch_bytes_, memory_order_relaxed);
+      count = 0;
+      batch_bytes_ = 0;
+      decoder_.flush();
+      for (auto& worker : workers_)
+	flushWorker(*worker);
+    }
+  }
+}
+
+// Separate captures: each thread takes the next file that's left and
+// decodes it on its own, so connections never span files.
+void Sniffer::replayParallel(vector<unique_ptr<PcapFile>>& files,
+    vector<unique_ptr<PcapFilter>>& filters) {
+  atomic<size_t> next{0};
+  vector<thread> threads;
+
+  for (auto& decoder : file_decoders_) {
+    threads.emplace_back([this, &files, &filters, &next, &decoder]() {
+	for (size_t i = next++; i < files.size() && running_; i = next++) {
+	  PcapRecord record;
+	  uint64_t packets = 0;
+	  uint64_t bytes = 0;
+
+	  while (running_ && files[i]->next(record)) {
+	    auto header = record.header();
+	    if (!filters[i]->matches(&header, record.data))
+	      continue;
+	    packets++;
+	    bytes += header.len;
+
+	    TcpPacket tcpp;
+	    if (TcpPacket::from_pcap(&header, record.data, tcpp, record.linktype))
+	      decoder->handle(tcpp, record.timestamp);
+
+	    if (packets % options_.batch == 0) {
+	      packets_.fetch_add(packets, memory_order_relaxed);
+	      bytes_.fetch_add(bytes, memory_order_relaxed);
+	      packets = 0;
+	      bytes = 0;
+	      decoder->flush();
+	    }
+	  }
+
+	  packets_.fetch_add(packets, memory_order_relaxed);
+	  bytes_.fetch_add(bytes, memory_order_relaxed);
+	  decoder->flush();
+	}
+      });
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+}
+
+uint64_t Sniffer::steady_usecs() {
+  auto now = chrono::steady_clock::now().time_since_epoch();
+  return chrono::duration_cast<chrono::microseconds>(now).count();
+}
+
+// The capture is over, for whatever reason.
+void Sniffer::finish() {
+  elapsed_usecs_ = steady_usecs() - started_usecs_;
+  {
+    lock_guard<mutex> lock(stopped_mutex_);
+    stopped_ = true;
+  }
+  stopped_cond_.notify_all();
+  queue_.close();
+  records_.close();
+}
+
+void Sniffer::wait() {
+  unique_lock<mutex> lock(stopped_mutex_);
+  stopped_cond_.wait(lock, [this]() { return stopped_.load(); });
 }
 
 void Sniffer::stop() {
   running_ = false;
-  runner_->join();
+  // unblocks the capture thread and the workers if they're waiting for room
+  queue_.close();
+  records_.close();
+  for (auto& worker : workers_)
+    worker->inbox.close();
+  if (runner_.joinable())
+    runner_.join();
 }
 
-void Sniffer::packetHandler(const struct pcap_pkthdr* header,  const u_char *packet) {
-  auto tcpp = TcpPacket::from_pcap(header, packet);
-  if (tcpp == nullptr) {
+void Sniffer::setupDecoder(Decoder& decoder) {
+  if (options_.records)
+    decoder.set_records(&records_, options_.record_frames);
+  decoder.set_lazy(options_.lazy);
+}
+
+// Every decoder exists before the capture starts: the stats getters walk
+// them from other threads while it runs.
+void Sniffer::createDecoders() {
+  setupDecoder(decoder_);
+
+  if (from_file_ && files_.size() > 1 && !options_.merge_files) {
+    size_t threads = options_.file_threads > 0 ? options_.file_threads :
+      std::max(thread::hardware_concurrency(), 1U);
+    threads = std::min(threads, files_.size());
+    for (size_t i = 0; i < threads; i++) {
+      file_decoders_.emplace_back(new Decoder(latencies_, queue_,
+	  options_.servers, options_.quorum, options_.heavy_hitters, options_.heavy_hitters_depth,
+	  options_.interned_paths));
+      setupDecoder(*file_decoders_.back());
+    }
     return;
   }
 
-  // extract zk requests/replies
-  unique_ptr<ZKMessage> message;
-  if (tcpp->dst_port() == 2181) {
-    auto client = tcpp->src();
-    auto server = tcpp->dst();
-    message = ZKClientMessage::from_payload(move(client), move(server), tcpp->payload());
-    if (message != nullptr) {
-      auto client_msg = dynamic_cast<ZKClientMessage *>(message.get());
-      // TODO: check for max msgs
-      if (client_msg->xid() != PING_XID)
-	requests_.emplace(client_msg->xid(), client_msg->opcode());
-    }
-  } else {
-    auto server = tcpp->src();
-    auto client = tcpp->dst();
-    message = ZKServerMessage::from_payload(move(client), move(server), tcpp->payload(), requests_);
-    if (message != nullptr && message->xid() != PING_XID)
-      requests_.erase(message->xid());
+  for (int i = 0; i < options_.workers; i++) {
+    workers_.emplace_back(new Worker(latencies_, queue_, options_));
+    setupDecoder(workers_.back()->decoder);
+    workers_.back()->pending.reset(new PacketBatch());
+  }
+}
+
+void Sniffer::startWorkers() {
+  for (auto& w : workers_) {
+    auto worker = w.get();
+    worker->runner = thread([worker]() {
+	unique_ptr<PacketBatch> batch;
+	while (worker->inbox.pop(batch)) {
+	  batch->for_each([worker](const TcpPacket& packet, uint64_t timestamp) {
+	      worker->decoder.handle(packet, timestamp);
+	    });
+	  worker->decoder.flush();
+	}
+      });
+  }
+}
+
+void Sniffer::flushWorker(Worker& worker) {
+  if (worker.pending->empty())
+    return;
+  worker.inbox.push(move(worker.pending));
+  worker.pending.reset(new PacketBatch());
+}
+
+// Lets the workers drain what they were handed before they exit.
+void Sniffer::stopWorkers() {
+  for (auto& worker : workers_)
+    flushWorker(*worker);
+  for (auto& worker : workers_) {
+    worker->inbox.close();
+    worker->runner.join();
+  }
+}
+
+pcap_t *Sniffer::openLive(char *errbuf) {
+  auto handle = pcap_create(iface_.c_str(), errbuf);
+  if (handle == nullptr)
+    return nullptr;
+
+  pcap_set_snaplen(handle, options_.snaplen);
+  pcap_set_promisc(handle, 1);
+  pcap_set_timeout(handle, options_.timeout_ms);
+  pcap_set_buffer_size(handle, options_.buffer_size);
+  if (options_.immediate)
+    pcap_set_immediate_mode(handle, 1);
+
+  // > 0 are warnings
+  if (pcap_activate(handle) < 0) {
+    snprintf(errbuf, PCAP_ERRBUF_SIZE, "%s", pcap_geterr(handle));
+    pcap_close(handle);
+    return nullptr;
+  }
+
+  return handle;
+}
+
+void Sniffer::dispatchHandler(u_char *user, const struct pcap_pkthdr* header, const u_char *packet) {
+  auto sniffer = (Sniffer *)user;
+  sniffer->batch_bytes_ += header->len;
+  sniffer->packetHandler(header, packet, sniffer->linktype_);
+}
+
+void Sniffer::packetHandler(const struct pcap_pkthdr* header, const u_char *packet, int linktype) {
+  TcpPacket tcpp;
+  if (!TcpPacket::from_pcap(header, packet, tcpp, linktype)) {
+    return;
+  }
+
+  uint64_t timestamp = header->ts.tv_sec * 1000000ULL + header->ts.tv_usec;
+  if (workers_.empty()) {
+    decoder_.handle(tcpp, timestamp);
+    return;
   }
 
-  // add to the queue
-  if (message != nullptr) {
-    unique_lock<mutex> lock(mutex_);
-    queue_.push(move(message));
-    lock.unlock();
-    cv_.notify_one();
+  // both directions of a connection go to the same worker
+  auto& worker = *workers_[tcpp.flow().conn_hash() % workers_.size()];
+  worker.pending->add(tcpp, timestamp);
+  if (worker.pending->full())
+    flushWorker(worker);
+}
+
+void Sniffer::updateCaptureStats(pcap_t *handle, bool force) {
+  auto now = chrono::steady_clock::now();
+  if (!force && now - stats_updated_ < chrono::seconds(1))
+    return;
+  stats_updated_ = now;
+
+  struct pcap_stat stat;
+  if (pcap_stats(handle, &stat) < 0)
+    return;
+
+  // libpcap's counters are 32 bits, accumulate deltas so they don't wrap
+  received_.fetch_add((uint32_t)(stat.ps_recv - last_pcap_stat_.ps_recv), memory_order_relaxed);
+  dropped_.fetch_add((uint32_t)(stat.ps_drop - last_pcap_stat_.ps_drop), memory_order_relaxed);
+  if_dropped_.fetch_add((uint32_t)(stat.ps_ifdrop - last_pcap_stat_.ps_ifdrop), memory_order_relaxed);
+  last_pcap_stat_ = stat;
+}
+
+CaptureStats Sniffer::capture_stats() const {
+  uint64_t elapsed = elapsed_usecs_.load(memory_order_relaxed);
+  uint64_t started = started_usecs_.load(memory_order_relaxed);
+  if (!stopped_ && started != 0)
+    elapsed = steady_usecs() - started;
+
+  return CaptureStats{
+    packets_.load(memory_order_relaxed),
+    bytes_.load(memory_order_relaxed),
+    elapsed,
+    received_.load(memory_order_relaxed),
+    dropped_.load(memory_order_relaxed),
+    if_dropped_.load(memory_order_relaxed),
+    queue_.dropped() + records_.dropped(),
+    std::max(queue_.high_water(), records_.high_water()),
+  };
+}
+
+vector<const Decoder *> Sniffer::decoders() const {
+  vector<const Decoder *> rv;
+  for (auto& worker : workers_)
+    rv.push_back(&worker->decoder);
+  for (auto& decoder : file_decoders_)
+    rv.push_back(decoder.get());
+  if (rv.empty())
+    rv.push_back(&decoder_);
+  return rv;
+}
+
+DecoderStats Sniffer::decoder_stats() const {
+  DecoderStats rv;
+  for (auto decoder : decoders())
+    rv += decoder->stats();
+  return rv;
+}
+
+HeavyHittersSnapshot Sniffer::heavy_hitters(size_t n) const {
+  if (options_.heavy_hitters == 0)
+    return HeavyHittersSnapshot();
+
+  auto decoders = this->decoders();
+  if (decoders.size() == 1)
+    return decoders[0]->heavy_hitters()->snapshot(n);
+
+  HeavyHitterTracker merged(options_.heavy_hitters, options_.heavy_hitters_depth);
+  for (auto decoder : decoders)
+    merged.merge(*decoder->heavy_hitters());
+  return merged.snapshot(n);
+}
+
+SessionStats Sniffer::session_stats() const {
+  SessionStats rv;
+  for (auto decoder : decoders())
+    rv += decoder->sessions().stats();
+  return rv;
+}
+
+vector<Session> Sniffer::sessions() const {
+  vector<Session> rv;
+  for (auto decoder : decoders()) {
+    auto sessions = decoder->sessions().sessions();
+    rv.insert(rv.end(), sessions.begin(), sessions.end());
+  }
+  return rv;
+}
+
+QuorumStats Sniffer::quorum_stats() const {
+  QuorumStats rv;
+  for (auto decoder : decoders()) {
+    if (decoder->quorum() != nullptr)
+      rv += decoder->quorum()->stats();
   }
+  return rv;
 }
 
 }
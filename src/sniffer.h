@@ -1,55 +1,245 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <string>
 #include <thread>
-#include <unordered_map>
+#include <vector>
 
 #include "pcap.h"
 
+#include "bounded_queue.h"
+#include "decoder.h"
+#include "latency.h"
+#include "message_record.h"
+#include "pcap_file.h"
+#include "server_set.h"
+#include "tcp_packet.h"
 #include "zkmessage.h"
 
 using namespace std;
 
 namespace Zktraffic {
 
+struct SnifferOptions {
+  // live capture: bytes kept per packet, size of the kernel ring (with
+  // TPACKET_V3 libpcap hands out whole blocks of it per pcap_dispatch()),
+  // how long the kernel holds a partially filled block and how many packets
+  // are processed per pcap_dispatch() call (-1: all that are ready)
+  int snaplen = 65535;
+  int buffer_size = 32 * 1024 * 1024;
+  int timeout_ms = 100;
+  int batch = 512;
+  bool immediate = false;
+
+  bool latency_per_server = false;
+
+  // where the servers listen, which tells clients from servers and splits
+  // stats by ensemble. The capture filter isn't derived from it, see
+  // ServerSet::filter().
+  ServerSet servers;
+
+  // decode leader/learner (ZAB) and leader election traffic too, see
+  // Sniffer::quorum_stats(). Off by default, a leader sees a lot of it.
+  QuorumOptions quorum;
+
+  // messages waiting for consumers, and what to do when they fall behind.
+  // BLOCK stalls the capture thread, so for live captures the kernel ends
+  // up dropping packets instead (see CaptureStats::dropped).
+  size_t queue_capacity = 65536;
+  Overflow queue_overflow = Overflow::BLOCK;
+
+  // hand messages over as MessageBatches (see get_records()) rather than
+  // one by one, for consumers that only aggregate them. With
+  // record_frames batches keep the frames too, so messages can be
+  // materialized again (MessageBatch::message()).
+  bool records = false;
+  bool record_frames = false;
+
+  // decode only what the Decoder and MessageRecords need (headers and
+  // request paths) and the rest of a message when it's looked at, see
+  // LazyRequest. Pays off with records, or consumers that mostly count.
+  bool lazy = false;
+
+  // 0 decodes on the capture thread. Otherwise packets are copied out of
+  // the capture buffer and sharded by connection over this many decode
+  // threads; messages from one connection stay in order, messages from
+  // different connections may interleave differently than on the wire.
+  int workers = 0;
+
+  // offline, with several files: merge them by timestamp and decode them
+  // as one capture (as the workers option says). Otherwise they're taken
+  // to be separate captures and each one is read and decoded by its own
+  // thread, file_threads of them at a time (0: one per core); workers
+  // doesn't apply.
+  bool merge_files = false;
+  int file_threads = 0;
+
+  // entries kept per heavy hitter table (paths, path prefixes, clients,
+  // client/opcode pairs), 0 doesn't track them
+  size_t heavy_hitters = 0;
+  int heavy_hitters_depth = 2;
+
+  // distinct paths each decoder gives an id to (ZKClientMessage::path_id()),
+  // 0 doesn't intern them
+  size_t interned_paths = PathInterner::DEFAULT_CAPACITY;
+};
+
+// Counters from the capture loop. received/dropped/if_dropped come from
+// pcap_stats() (live captures only) and are refreshed about once a second.
+struct CaptureStats {
+  uint64_t packets;
+  uint64_t bytes;
+  // wall clock time since run(), up to when the capture stopped
+  uint64_t elapsed_usecs;
+  uint64_t received;
+  uint64_t dropped;
+  uint64_t if_dropped;
+  // messages dropped by the queue's overflow policy and its peak size
+  // (batches, with SnifferOptions::records)
+  uint64_t queue_dropped;
+  uint64_t queue_high_water;
+};
+
 class Sniffer {
 public:
-  Sniffer(const std::string iface, const std::string filter, bool from_file=false)
-      : iface_(iface), filter_(filter), from_file_(from_file), running_(false),
-	stopped_(false) {}
+  // with from_file, iface is a pcap or pcapng file
+  Sniffer(const std::string iface, const std::string filter, bool from_file=false,
+      SnifferOptions options=SnifferOptions())
+      : Sniffer(iface, from_file ? vector<string>{iface} : vector<string>{}, filter, from_file,
+	  options) {}
+  // offline, from several pcap or pcapng files (see SnifferOptions::merge_files)
+  Sniffer(const vector<string>& files, const std::string filter,
+      SnifferOptions options=SnifferOptions())
+      : Sniffer(files.empty() ? "" : files[0], files, filter, true, options) {}
+  ~Sniffer() { stop(); }
   void run();
   void stop();
+  // Blocks until the capture is over: the end of the files was reached (or
+  // the capture failed, or stop() was called) and every packet has been
+  // decoded. Messages might still be waiting in the queue, and with
+  // Overflow::BLOCK the capture won't finish if nobody consumes them.
+  void wait();
+  // Blocks until there's a message; nullptr once the capture is over and
+  // everything has been consumed.
   std::unique_ptr<ZKMessage> get() {
-      unique_lock<mutex> guard(mutex_);
-      while (queue_.empty())
-	  cv_.wait(guard);
-
-      auto rv = std::move(queue_.front());
-      queue_.pop();
+      std::unique_ptr<ZKMessage> rv;
+      queue_.pop(rv);
       return rv;
   }
-  bool empty() {
-      unique_lock<mutex> guard(mutex_);
-      return queue_.empty();
+  // Blocks until there's at least one message, returns up to max of them
+  // (none once the capture is over and everything has been consumed).
+  vector<unique_ptr<ZKMessage>> get_batch(size_t max) {
+      vector<unique_ptr<ZKMessage>> rv;
+      queue_.pop_batch(rv, max);
+      return rv;
+  }
+  // With SnifferOptions::records, instead of get(): blocks until there's a
+  // batch of messages, nullptr once the capture is over and everything has
+  // been consumed.
+  std::unique_ptr<MessageBatch> get_records() {
+      std::unique_ptr<MessageBatch> rv;
+      records_.pop(rv);
+      return rv;
   }
+  bool empty() const { return queue_.empty() && records_.empty(); }
   bool stopped() const { return stopped_; }
+  const LatencyStats& latencies() const { return latencies_; }
+  const ServerSet& servers() const { return options_.servers; }
+  bool decodes_quorum() const { return options_.quorum.enabled; }
+  CaptureStats capture_stats() const;
+  // summed over the decoders, safe to call while capturing
+  DecoderStats decoder_stats() const;
+  // the n heaviest of each table, merged over the decoders (empty unless
+  // SnifferOptions::heavy_hitters is set); safe to call while capturing
+  HeavyHittersSnapshot heavy_hitters(size_t n) const;
+  // summed over the decoders, safe to call while capturing
+  SessionStats session_stats() const;
+  // every connection whose session is known
+  vector<Session> sessions() const;
+  // merged over the decoders (empty unless SnifferOptions::quorum is
+  // enabled); safe to call while capturing
+  QuorumStats quorum_stats() const;
 
 private:
-  void packetHandler(const struct pcap_pkthdr* header,  const u_char *packet);
+  // batches in flight per worker
+  static const size_t WORKER_QUEUE_SIZE = 64;
+
+  struct Worker {
+    Worker(LatencyStats& latencies, BoundedQueue<unique_ptr<ZKMessage>>& out,
+	const SnifferOptions& options)
+      : inbox(WORKER_QUEUE_SIZE),
+	decoder(latencies, out, options.servers, options.quorum, options.heavy_hitters,
+	  options.heavy_hitters_depth, options.interned_paths) {}
+
+    BoundedQueue<unique_ptr<PacketBatch>> inbox;
+    unique_ptr<PacketBatch> pending;
+    Decoder decoder;
+    thread runner;
+  };
+
+  Sniffer(const std::string iface, vector<string> files, const std::string filter,
+      bool from_file, SnifferOptions options)
+      : iface_(iface), files_(move(files)), filter_(filter), from_file_(from_file),
+	options_(options), running_(false), stopped_(false),
+	queue_(options.queue_capacity, options.queue_overflow,
+	  options.workers <= 1 && (files_.size() <= 1 || options.merge_files)),
+	records_(std::max<size_t>(options.queue_capacity / MessageBatch::CAPACITY, 16),
+	  options.queue_overflow, options.workers <= 1 && (files_.size() <= 1 || options.merge_files)),
+	latencies_(options.latency_per_server),
+	decoder_(latencies_, queue_, options.servers, options.quorum, options.heavy_hitters,
+	  options.heavy_hitters_depth, options.interned_paths) {
+    createDecoders();
+  }
+
+  static void dispatchHandler(u_char *user, const struct pcap_pkthdr* header, const u_char *packet);
+  pcap_t *openLive(char *errbuf);
+  void updateCaptureStats(pcap_t *handle, bool force);
+  void packetHandler(const struct pcap_pkthdr* header, const u_char *packet, int linktype);
+  void createDecoders();
+  void setupDecoder(Decoder& decoder);
+  void startWorkers();
+  void flushWorker(Worker& worker);
+  void stopWorkers();
+  void runFiles();
+  void replayMerged(vector<unique_ptr<PcapFile>>& files,
+    vector<unique_ptr<PcapFilter>>& filters);
+  void replayParallel(vector<unique_ptr<PcapFile>>& files,
+    vector<unique_ptr<PcapFilter>>& filters);
+  void finish();
+  static uint64_t steady_usecs();
+  vector<const Decoder *> decoders() const;
   std::string iface_;
+  vector<string> files_;
   std::string filter_;
   bool from_file_;
-  volatile bool running_;
-  volatile bool stopped_;
-  thread *runner_;
-  queue<unique_ptr<ZKMessage>> queue_;
-  mutex mutex_;
-  condition_variable cv_;
-  unordered_map<int, int> requests_;  // TODO: protect with lock
+  SnifferOptions options_;
+  atomic<bool> running_;
+  atomic<bool> stopped_;
+  mutex stopped_mutex_;
+  condition_variable stopped_cond_;
+  thread runner_;
+  atomic<uint64_t> started_usecs_{0};
+  atomic<uint64_t> elapsed_usecs_{0};
+  uint64_t batch_bytes_ = 0;
+  int linktype_ = DLT_EN10MB;  // the live capture's
+  chrono::steady_clock::time_point stats_updated_;
+  struct pcap_stat last_pcap_stat_ = {};
+  atomic<uint64_t> packets_{0};
+  atomic<uint64_t> bytes_{0};
+  atomic<uint64_t> received_{0};
+  atomic<uint64_t> dropped_{0};
+  atomic<uint64_t> if_dropped_{0};
+  BoundedQueue<unique_ptr<ZKMessage>> queue_;
+  BoundedQueue<unique_ptr<MessageBatch>> records_;
+  LatencyStats latencies_;
+  Decoder decoder_;
+  vector<unique_ptr<Worker>> workers_;
+  // offline, separate captures: one per file thread
+  vector<unique_ptr<Decoder>> file_decoders_;
 };
 
 }
@@ -0,0 +1,226 @@
+#include "stats.h"
+
+#include <sstream>
+
+using namespace std;
+
+namespace Zktraffic {
+
+namespace {
+
+void print_table(stringstream& ss, const char *name, const vector<pair<string, Counter>>& table) {
+  for (const auto& entry : table) {
+    ss << "  " << name << " " << entry.first <<
+      " count=" << entry.second.count <<
+      " bytes=" << entry.second.bytes << "\n";
+  }
+}
+
+}
+
+StatsSnapshot::operator std::string() const {
+  stringstream ss;
+
+  ss << "Stats(\n" <<
+    "  start=" << start / 1000000 << "\n" <<
+    "  window=" << window << "\n" <<
+    "  requests=" << requests << "\n" <<
+    "  replies=" << replies << "\n";
+
+  for (const auto& entry : opcodes) {
+    ss << "  opcode " << ZKMessage::opcode_to_name(entry.first) <<
+      " requests=" << entry.second.requests.count <<
+      " request_bytes=" << entry.second.requests.bytes <<
+      " replies=" << entry.second.replies.count <<
+      " reply_bytes=" << entry.second.replies.bytes << "\n";
+  }
+  print_table(ss, "client", clients);
+  print_table(ss, "path", paths);
+  print_table(ss, "prefix", prefixes);
+  for (const auto& entry : watches)
+    ss << "  watch type=" << entry.first << " count=" << entry.second << "\n";
+  print_table(ss, "watch_path", watch_paths);
+  for (const auto& entry : errors)
+    ss << "  error code=" << entry.first << " count=" << entry.second << "\n";
+  ss << ")\n";
+
+  return ss.str();
+}
+
+StatsAggregator::StatsAggregator(StatsOptions options) :
+  options_(options),
+  clients_(options.top * 4),
+  paths_(options.top * 4),
+  prefixes_(options.top * 4),
+  watch_paths_(options.top * 4) {
+  if (options_.window <= 0)
+    options_.window = 1;
+}
+
+string_view StatsAggregator::prefix(string_view path, int depth) {
+  size_t pos = 0;
+
+  for (int i = 0; i < depth; i++) {
+    pos = path.find('/', pos + 1);
+    if (pos == string_view::npos)
+      return path;
+  }
+
+  return path.substr(0, pos);
+}
+
+void StatsAggregator::start(uint64_t timestamp) {
+  start_ = timestamp - timestamp % window_usecs();
+}
+
+void StatsAggregator::add(const ZKMessage& message) {
+  if (start_ == 0)
+    start(message.timestamp());
+
+  auto size = message.size();
+
+  switch (message.kind()) {
+  case MessageKind::REQUEST: {
+    auto& request = static_cast<const ZKClientMessage&>(message);
+    add_request(request.opcode(), message.client(), request.path(), size);
+    break;
+  }
+  case MessageKind::REPLY: {
+    auto& reply = static_cast<const ZKServerMessage&>(message);
+    add_reply(reply.opcode(), reply.error(), size);
+    break;
+  }
+  case MessageKind::WATCH: {
+    auto& watch = static_cast<const WatchEvent&>(message);
+    add_watch(watch.event_type(), watch.error(), watch.path(), size);
+    break;
+  }
+  }
+}
+
+size_t StatsAggregator::add(const MessageBatch& batch, size_t from) {
+  const auto& timestamps = batch.timestamps();
+  const auto& kinds = batch.kinds();
+  const auto& opcodes = batch.opcodes();
+  const auto& sizes = batch.sizes();
+
+  size_t i = from;
+  for (; i < batch.size(); i++) {
+    if (start_ == 0)
+      start(timestamps[i]);
+    else if (expired(timestamps[i]))
+      break;
+
+    switch (kinds[i]) {
+    case MessageKind::REQUEST:
+      add_request(opcodes[i], batch.endpoints()[batch.clients()[i]], batch.path(batch.paths()[i]),
+	sizes[i]);
+      break;
+    case MessageKind::REPLY:
+      add_reply(opcodes[i], batch.errors()[i], sizes[i]);
+      break;
+    case MessageKind::WATCH:
+      add_watch(batch.event_types()[i], batch.errors()[i], batch.path(batch.paths()[i]), sizes[i]);
+      break;
+    }
+  }
+
+  return i;
+}
+
+void StatsAggregator::add_request(int opcode, Endpoint client, string_view path, uint32_t size) {
+  requests_++;
+
+  auto index = opcode_index(opcode);
+  if (index >= 0) {
+    opcodes_[index].requests.count++;
+    opcodes_[index].requests.bytes += size;
+  }
+
+  client.port = 0;
+  clients_.add(client, size);
+
+  if (!path.empty()) {
+    key_.assign(path.data(), path.size());
+    paths_.add(key_, size);
+    if (options_.prefix_depth > 0) {
+      auto p = prefix(path, options_.prefix_depth);
+      key_.assign(p.data(), p.size());
+      prefixes_.add(key_, size);
+    }
+  }
+}
+
+void StatsAggregator::add_reply(int opcode, int error, uint32_t size) {
+  add_error(error);
+
+  replies_++;
+  auto index = opcode_index(opcode);
+  if (opcode != -1 && index >= 0) {
+    opcodes_[index].replies.count++;
+    opcodes_[index].replies.bytes += size;
+  }
+}
+
+void StatsAggregator::add_watch(int type, int error, string_view path, uint32_t size) {
+  add_error(error);
+
+  if (type >= 0 && type < EVENT_SLOTS)
+    watches_[type]++;
+  if (!path.empty()) {
+    key_.assign(path.data(), path.size());
+    watch_paths_.add(key_, size);
+  }
+}
+
+void StatsAggregator::add_error(int error) {
+  if (error < 0 && error > -ERROR_SLOTS)
+    errors_[-error]++;
+}
+
+StatsSnapshot StatsAggregator::rotate(uint64_t timestamp) {
+  StatsSnapshot snapshot;
+
+  snapshot.start = start_;
+  snapshot.window = options_.window;
+  snapshot.requests = requests_;
+  snapshot.replies = replies_;
+
+  for (int i = 0; i < OPCODE_SLOTS; i++) {
+    if (opcodes_[i].requests.count || opcodes_[i].replies.count)
+      snapshot.opcodes.emplace(opcode_from_index(i), opcodes_[i]);
+    opcodes_[i] = OpcodeCounters();
+  }
+  for (int i = 0; i < EVENT_SLOTS; i++) {
+    if (watches_[i])
+      snapshot.watches.emplace(i, watches_[i]);
+    watches_[i] = 0;
+  }
+  for (int i = 1; i < ERROR_SLOTS; i++) {
+    if (errors_[i])
+      snapshot.errors.emplace(-i, errors_[i]);
+    errors_[i] = 0;
+  }
+
+  for (const auto& entry : clients_.top(options_.top))
+    snapshot.clients.emplace_back(entry.first.ip(), entry.second);
+  snapshot.paths = paths_.top(options_.top);
+  snapshot.prefixes = prefixes_.top(options_.top);
+  snapshot.watch_paths = watch_paths_.top(options_.top);
+
+  clients_.clear();
+  paths_.clear();
+  prefixes_.clear();
+  watch_paths_.clear();
+  requests_ = 0;
+  replies_ = 0;
+
+  if (timestamp != 0)
+    start(timestamp);
+  else
+    start_ = 0;
+
+  return snapshot;
+}
+
+}
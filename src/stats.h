@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "endpoint.h"
+#include "message_record.h"
+#include "zkmessage.h"
+
+using namespace std;
+
+namespace Zktraffic {
+
+struct Counter {
+  uint64_t count = 0;
+  uint64_t bytes = 0;
+};
+
+// Counts per key in at most `capacity` entries. When it fills up, the
+// lower half (by count) is folded into other(), so heavy keys stay and
+// memory doesn't grow with the number of distinct keys. Counts for keys
+// that were folded and then came back are underestimated.
+template <typename K, typename Hash = hash<K>>
+class TopTable {
+public:
+  explicit TopTable(size_t capacity) : capacity_(std::max<size_t>(capacity, 2)) {
+    entries_.reserve(capacity_);
+  }
+
+  void add(const K& key, uint64_t bytes) {
+    auto it = entries_.find(key);
+    if (it == entries_.end()) {
+      if (entries_.size() >= capacity_)
+	shrink();
+      it = entries_.emplace(key, Counter()).first;
+    }
+    it->second.count++;
+    it->second.bytes += bytes;
+  }
+
+  // the n biggest entries, by count
+  vector<pair<K, Counter>> top(size_t n) const {
+    vector<pair<K, Counter>> rv(entries_.begin(), entries_.end());
+    auto by_count = [](const pair<K, Counter>& a, const pair<K, Counter>& b) {
+      return a.second.count > b.second.count;
+    };
+    n = std::min(n, rv.size());
+    partial_sort(rv.begin(), rv.begin() + n, rv.end(), by_count);
+    rv.resize(n);
+    return rv;
+  }
+
+  const Counter& other() const { return other_; }
+  size_t size() const { return entries_.size(); }
+
+  void clear() {
+    entries_.clear();
+    other_ = Counter();
+  }
+
+private:
+  void shrink() {
+    vector<uint64_t> counts;
+    counts.reserve(entries_.size());
+    for (const auto& entry : entries_)
+      counts.push_back(entry.second.count);
+    auto mid = counts.begin() + counts.size() / 2;
+    nth_element(counts.begin(), mid, counts.end());
+    auto cutoff = *mid;
+
+    for (auto it = entries_.begin(); it != entries_.end(); ) {
+      if (it->second.count <= cutoff && entries_.size() > capacity_ / 2) {
+	other_.count += it->second.count;
+	other_.bytes += it->second.bytes;
+	it = entries_.erase(it);
+      } else {
+	++it;
+      }
+    }
+  }
+
+  size_t capacity_;
+  unordered_map<K, Counter, Hash> entries_;
+  Counter other_;
+};
+
+struct StatsOptions {
+  // seconds per window, by pcap timestamps
+  int window = 60;
+  // path prefixes are the first prefix_depth components (0 disables them)
+  int prefix_depth = 2;
+  // entries reported per table; each one keeps 4x as many
+  size_t top = 20;
+};
+
+struct OpcodeCounters {
+  Counter requests;
+  Counter replies;
+};
+
+// Everything counted during one window.
+struct StatsSnapshot {
+  uint64_t start = 0;  // usecs
+  int window = 0;      // secs
+  uint64_t requests = 0;
+  uint64_t replies = 0;
+  map<int, OpcodeCounters> opcodes;
+  vector<pair<string, Counter>> clients;
+  vector<pair<string, Counter>> paths;
+  vector<pair<string, Counter>> prefixes;
+  vector<pair<string, Counter>> watch_paths;
+  map<int, uint64_t> watches;  // event type -> fires
+  map<int, uint64_t> errors;   // error code -> replies
+
+  operator std::string() const;
+};
+
+// Aggregates messages into fixed-size windows of counters: per opcode, per
+// client IP, per path and path prefix (top-K), watch fires and errors.
+// Memory is bounded by the options, not by the traffic.
+//
+// Not thread safe, meant to sit behind Sniffer::get().
+class StatsAggregator {
+public:
+  explicit StatsAggregator(StatsOptions options = StatsOptions());
+
+  // Whether a message at timestamp (usecs) falls past the current window.
+  bool expired(uint64_t timestamp) const {
+    return start_ != 0 && timestamp >= start_ + window_usecs();
+  }
+  void add(const ZKMessage& message);
+  // Adds the batch's messages from `from` on, up to the first one past the
+  // current window. Returns where it stopped (batch.size() once it's all
+  // added), so the caller can rotate() there and carry on.
+  size_t add(const MessageBatch& batch, size_t from = 0);
+  // Closes the current window and starts a new one with the window that
+  // contains timestamp (0: starts with the next message).
+  StatsSnapshot rotate(uint64_t timestamp = 0);
+
+  static string_view prefix(string_view path, int depth);
+
+private:
+  // ZooKeeper error codes go from -1 to -127
+  static const int ERROR_SLOTS = 128;
+  static const int EVENT_SLOTS = 8;
+
+  uint64_t window_usecs() const { return options_.window * 1000000ULL; }
+  void start(uint64_t timestamp);
+  void add_request(int opcode, Endpoint client, string_view path, uint32_t size);
+  void add_reply(int opcode, int error, uint32_t size);
+  void add_watch(int type, int error, string_view path, uint32_t size);
+  void add_error(int error);
+
+  StatsOptions options_;
+  uint64_t start_ = 0;
+  uint64_t requests_ = 0;
+  uint64_t replies_ = 0;
+  OpcodeCounters opcodes_[OPCODE_SLOTS];
+  uint64_t watches_[EVENT_SLOTS] = {};
+  uint64_t errors_[ERROR_SLOTS] = {};
+  TopTable<Endpoint, EndpointHash> clients_;
+  TopTable<string> paths_;
+  TopTable<string> prefixes_;
+  TopTable<string> watch_paths_;
+  // reused for lookups, so known keys don't allocate
+  string key_;
+};
+
+}
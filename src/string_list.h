@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+namespace Zktraffic {
+
+// Strings packed back to back in a single buffer, for lists that can run
+// into the thousands (SetWatches after a reconnect, multi ops). Two
+// allocations however many strings there are, elements come out as views.
+class StringList {
+public:
+  class const_iterator {
+  public:
+    using iterator_category = forward_iterator_tag;
+    using value_type = string_view;
+    using difference_type = ptrdiff_t;
+    using pointer = const string_view *;
+    using reference = string_view;
+
+    const_iterator(const StringList *list, size_t index) : list_(list), index_(index) {}
+    string_view operator*() const { return (*list_)[index_]; }
+    const_iterator& operator++() { index_++; return *this; }
+    bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+    bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+
+  private:
+    const StringList *list_;
+    size_t index_;
+  };
+
+  using value_type = string_view;
+
+  void reserve(size_t count, size_t bytes) {
+    offsets_.reserve(count);
+    data_.reserve(bytes);
+  }
+
+  void push_back(string_view s) {
+    offsets_.push_back(data_.size());
+    data_.append(s.data(), s.size());
+  }
+
+  string_view operator[](size_t i) const {
+    size_t end = i + 1 < offsets_.size() ? offsets_[i + 1] : data_.size();
+    return string_view(data_).substr(offsets_[i], end - offsets_[i]);
+  }
+
+  size_t size() const { return offsets_.size(); }
+  bool empty() const { return offsets_.empty(); }
+  // bytes taken by the strings themselves
+  size_t bytes() const { return data_.size(); }
+
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, offsets_.size()); }
+
+  string join(string_view delim, size_t from = 0, size_t to = SIZE_MAX) const {
+    string rv;
+    to = to < size() ? to : size();
+    for (size_t i = from; i < to; i++) {
+      if (i > from)
+	rv.append(delim.data(), delim.size());
+      auto s = (*this)[i];
+      rv.append(s.data(), s.size());
+    }
+    return rv;
+  }
+
+private:
+  vector<uint32_t> offsets_;
+  string data_;
+};
+
+}
@@ -1,7 +1,7 @@
 #include "tcp_packet.h"
 
+#include <cstring>
 #include <iostream>
-#include <memory>
 #include <string>
 
 #include <arpa/inet.h>
@@ -67,54 +67,233 @@ struct sniff_tcp {
   u_short th_urp;               /* urgent pointer */
 };
 
-/* ethernet headers are always exactly 14 bytes */
+/* IPv6 header */
+struct sniff_ip6 {
+  uint32_t ip6_flow;            /* version, traffic class, flow label */
+  u_short ip6_plen;             /* payload length, extension headers included */
+  u_char ip6_nxt;               /* next header */
+  u_char ip6_hlim;              /* hop limit */
+  uint8_t ip6_src[16];
+  uint8_t ip6_dst[16];
+};
+
+/* ethernet headers are always exactly 14 bytes, plus 4 per VLAN tag */
 #define SIZE_ETHERNET 14
+#define SIZE_IP6 40
 
-std::unique_ptr<TcpPacket> TcpPacket::from_pcap(const struct pcap_pkthdr* header,  const u_char *packet) {
-  if (packet == nullptr) {
-    return nullptr;
+#define ETHERTYPE_IP 0x0800
+#define ETHERTYPE_IPV6 0x86dd
+#define ETHERTYPE_VLAN 0x8100
+#define ETHERTYPE_QINQ 0x88a8
+#define ETHERTYPE_QINQ_OLD 0x9100
+
+/* older libpcaps don't have these */
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2 276
+#endif
+#ifndef DLT_IPV4
+#define DLT_IPV4 228
+#define DLT_IPV6 229
+#endif
+
+namespace {
+
+uint16_t read16(const u_char *p) {
+  return (uint16_t)p[0] << 8 | p[1];
+}
+
+// Ethertype the link header announces and where the network header starts.
+// false for link types (or protocols) we don't know.
+bool parse_link(int linktype, const u_char *packet, size_t caplen, uint16_t& ethertype, size_t& offset) {
+  switch (linktype) {
+  case DLT_EN10MB:
+    if (caplen < SIZE_ETHERNET)
+      return false;
+    ethertype = read16(packet + 12);
+    offset = SIZE_ETHERNET;
+    // 802.1Q, 802.1ad (QinQ) and pre-standard QinQ tags
+    while (ethertype == ETHERTYPE_VLAN || ethertype == ETHERTYPE_QINQ || ethertype == ETHERTYPE_QINQ_OLD) {
+      if (caplen < offset + 4)
+	return false;
+      ethertype = read16(packet + offset + 2);
+      offset += 4;
+    }
+    return true;
+  case DLT_LINUX_SLL:
+    // packet type, ARPHRD type, address length, address (8), protocol
+    if (caplen < 16)
+      return false;
+    ethertype = read16(packet + 14);
+    offset = 16;
+    return true;
+  case DLT_LINUX_SLL2:
+    // protocol, reserved, ifindex, ARPHRD type, packet type, address length, address (8)
+    if (caplen < 20)
+      return false;
+    ethertype = read16(packet);
+    offset = 20;
+    return true;
+  case DLT_NULL:
+  case DLT_LOOP: {
+    // the address family: host byte order (of the capturing host) for
+    // NULL, network byte order for LOOP
+    if (caplen < 4)
+      return false;
+    uint32_t family;
+    memcpy(&family, packet, 4);
+    if (linktype == DLT_LOOP)
+      family = ntohl(family);
+    else if (family > 0xffff)
+      family = __builtin_bswap32(family);
+    offset = 4;
+    switch (family) {
+    case 2:                                // AF_INET everywhere
+      ethertype = ETHERTYPE_IP;
+      return true;
+    case 10: case 24: case 28: case 30:    // AF_INET6: Linux, BSDs, FreeBSD, Darwin
+      ethertype = ETHERTYPE_IPV6;
+      return true;
+    }
+    return false;
+  }
+  case DLT_RAW:
+  case DLT_IPV4:
+  case DLT_IPV6:
+    // no link header, the IP version tells
+    if (caplen < 1)
+      return false;
+    ethertype = (packet[0] >> 4) == 6 ? ETHERTYPE_IPV6 : ETHERTYPE_IP;
+    offset = 0;
+    return true;
+  }
+  return false;
+}
+
+}
+
+// segment_len is what the IP header says the TCP header and payload take
+bool TcpPacket::from_tcp(const u_char *packet, size_t caplen, size_t offset, int segment_len,
+  const Endpoint& src, const Endpoint& dst, TcpPacket& tcpp) {
+  if (caplen < offset + 20)
+    return false;
+
+  auto tcp = (const struct sniff_tcp*)(packet + offset);
+  u_int size_tcp_header = TH_OFF(tcp)*4;
+  if (size_tcp_header < 20) {
+    cout << "Invalid TCP header length\n";
+    return false;
   }
 
-  const struct sniff_ip *ip; /* The IP header */
-  const struct sniff_tcp *tcp; /* The TCP header */
-  const char *payload; /* Packet payload */
+  size_t payload_offset = offset + size_tcp_header;
+  int data_length = segment_len - size_tcp_header;
+
+  // empty segments only matter to the stream tracker when they open or close it
+  if (data_length <= 0 && !(tcp->th_flags & (TH_SYN|TH_FIN|TH_RST)))
+    return false;
+  if (data_length < 0)
+    data_length = 0;
 
-  u_int size_ip_header;
-  u_int size_tcp_header;
+  // truncated by the snaplen, keep what we have (the stream will see a gap)
+  if (payload_offset + data_length > caplen)
+    data_length = caplen > payload_offset ? caplen - payload_offset : 0;
 
-  ip = (struct sniff_ip*)(packet + SIZE_ETHERNET);
-  size_ip_header = IP_HL(ip)*4;
+  tcpp.src_ = src;
+  tcpp.dst_ = dst;
+  tcpp.src_.port = ntohs(tcp->th_sport);
+  tcpp.dst_.port = ntohs(tcp->th_dport);
+  tcpp.seq_ = ntohl(tcp->th_seq);
+  tcpp.flags_ = tcp->th_flags;
+  tcpp.payload_ = string_view((const char *)(packet + payload_offset), data_length);
+
+  return true;
+}
+
+bool TcpPacket::from_ipv4(const u_char *packet, size_t caplen, size_t offset, TcpPacket& tcpp) {
+  if (caplen < offset + 40)
+    return false;
+
+  auto ip = (const struct sniff_ip*)(packet + offset);
+  if (IP_V(ip) != 4 || ip->ip_p != IPPROTO_TCP)
+    return false;
+
+  // fragments are dropped, as with IPv6
+  if (ntohs(ip->ip_off) & (IP_MF | IP_OFFMASK))
+    return false;
+
+  u_int size_ip_header = IP_HL(ip)*4;
   if (size_ip_header < 20) {
     cout << "Invalid IP header length\n";
-    return nullptr;
+    return false;
   }
 
-  tcp = (struct sniff_tcp*)(packet + SIZE_ETHERNET + size_ip_header);
-  size_tcp_header = TH_OFF(tcp)*4;
-  if (size_tcp_header < 20) {
-    cout << "Invalid TCP header length\n";
-    return nullptr;
+  return from_tcp(packet, caplen, offset + size_ip_header, (int)ntohs(ip->ip_len) - (int)size_ip_header,
+    Endpoint::from_v4(ip->ip_src.s_addr, 0), Endpoint::from_v4(ip->ip_dst.s_addr, 0), tcpp);
+}
+
+// Walks extension headers up to TCP. Fragments are dropped: the first one
+// would hand the stream a partial segment, the others have no TCP header.
+bool TcpPacket::from_ipv6(const u_char *packet, size_t caplen, size_t offset, TcpPacket& tcpp) {
+  if (caplen < offset + SIZE_IP6 + 20)
+    return false;
+
+  auto ip6 = (const struct sniff_ip6*)(packet + offset);
+  if ((packet[offset] >> 4) != 6)
+    return false;
+
+  size_t end = offset + SIZE_IP6 + ntohs(ip6->ip6_plen);
+  uint8_t next = ip6->ip6_nxt;
+  size_t pos = offset + SIZE_IP6;
+  for (int headers = 0; next != IPPROTO_TCP; headers++) {
+    if (headers >= 8 || caplen < pos + 8)
+      return false;
+    switch (next) {
+    case IPPROTO_HOPOPTS:
+    case IPPROTO_ROUTING:
+    case IPPROTO_DSTOPTS:
+      next = packet[pos];
+      pos += (packet[pos + 1] + 1) * 8;
+      break;
+    case IPPROTO_AH:
+      next = packet[pos];
+      pos += (packet[pos + 1] + 2) * 4;
+      break;
+    default:
+      // IPPROTO_FRAGMENT, ESP, no next header, not TCP
+      return false;
+    }
   }
 
-  char src_ip[INET_ADDRSTRLEN];
-  char dst_ip[INET_ADDRSTRLEN];
-
-  inet_ntop(AF_INET, &(ip->ip_src), src_ip, INET_ADDRSTRLEN);
-  inet_ntop(AF_INET, &(ip->ip_dst), dst_ip, INET_ADDRSTRLEN);
-
-  int data_length = htons(ip->ip_len) - size_ip_header - size_tcp_header;
-
-  if (data_length == 0)
-    return nullptr;
-  
-  payload = (const char *)(packet + SIZE_ETHERNET + size_ip_header + size_tcp_header);
-  return std::make_unique<TcpPacket>(
-                                     ntohs(tcp->th_sport),
-                                     ntohs(tcp->th_dport),
-				     src_ip,
-				     dst_ip,
-                                     payload,
-				     data_length);
+  // a jumbogram (or a bogus length) has no usable payload length
+  if (ip6->ip6_plen == 0 || end < pos)
+    end = caplen;
+
+  return from_tcp(packet, caplen, pos, end - pos,
+    Endpoint::from_v6(ip6->ip6_src, 0), Endpoint::from_v6(ip6->ip6_dst, 0), tcpp);
+}
+
+bool TcpPacket::from_pcap(const struct pcap_pkthdr* header, const u_char *packet, TcpPacket& tcpp,
+  int linktype) {
+  if (packet == nullptr) {
+    return false;
+  }
+
+  // the common case, untagged IPv4 over ethernet, without the dispatch
+  if (__builtin_expect(linktype == DLT_EN10MB && header->caplen >= SIZE_ETHERNET &&
+      packet[12] == 0x08 && packet[13] == 0x00, 1))
+    return from_ipv4(packet, header->caplen, SIZE_ETHERNET, tcpp);
+
+  uint16_t ethertype;
+  size_t offset;
+  if (!parse_link(linktype, packet, header->caplen, ethertype, offset))
+    return false;
+
+  switch (ethertype) {
+  case ETHERTYPE_IP:
+    return from_ipv4(packet, header->caplen, offset, tcpp);
+  case ETHERTYPE_IPV6:
+    return from_ipv6(packet, header->caplen, offset, tcpp);
+  }
+  return false;
 }
 
 }
@@ -1,46 +1,81 @@
 #pragma once
 
-#include <memory>
-#include <sstream>
+#include <cstdint>
 #include <string>
+#include <string_view>
 
 #include "pcap.h"
 
+#include "endpoint.h"
+
 using namespace std;
 
 namespace Zktraffic {
 
-class TcpPacket {
-public:
-  TcpPacket(
-      int sport, int dport, const char *src_ip, const char *dst_ip,
-      const char *payload, int payload_len) : src_port_(sport), dst_port_(dport),
-	src_ip_(src_ip), dst_ip_(dst_ip),
-	payload_(payload, payload_len) {};
-  static std::unique_ptr<TcpPacket> from_pcap(const struct pcap_pkthdr*,  const u_char *);
-  int src_port() const { return src_port_; }
-  int dst_port() const { return dst_port_; }
-  const std::string& src_ip() const { return src_ip_; }
-  const std::string& dst_ip() const { return dst_ip_; }
-  const std::string& payload() const { return payload_; }
-  string src() const {
-    stringstream ss;
-    ss << src_ip_ << ":" << src_port_;
-    return ss.str();
+// One direction of a TCP connection.
+struct FlowKey {
+  Endpoint src;
+  Endpoint dst;
+
+  FlowKey reversed() const { return FlowKey{dst, src}; }
+  bool operator==(const FlowKey& other) const {
+    return src == other.src && dst == other.dst;
   }
+  // the same for both directions of a connection
+  uint64_t conn_hash() const { return mix64(src.hash() ^ dst.hash()); }
+};
 
-  string dst() {
-    stringstream ss;
-    ss << dst_ip_ << ":" << dst_port_;
-    return ss.str();
+struct FlowKeyHash {
+  size_t operator()(const FlowKey& key) const {
+    return mix64(key.src.hash() * 0x9e3779b97f4a7c15ULL ^ key.dst.hash());
   }
+};
+
+// A parsed TCP packet, over IPv4 or IPv6. It doesn't own anything: payload() points into
+// the capture buffer, so it's only valid for as long as that buffer is
+// (i.e.: within the pcap callback). Addresses are kept in binary form and
+// only formatted when printing.
+class TcpPacket {
+public:
+  static const uint8_t FIN = 0x01;
+  static const uint8_t SYN = 0x02;
+  static const uint8_t RST = 0x04;
+
+  TcpPacket() = default;
+  TcpPacket(const Endpoint& src, const Endpoint& dst, uint32_t seq, uint8_t flags,
+      string_view payload)
+      : src_(src), dst_(dst), seq_(seq), flags_(flags), payload_(payload) {}
+
+  // Returns false for anything that isn't a TCP packet we care about.
+  // linktype is the capture's DLT_*: EN10MB (with VLAN/QinQ tags),
+  // LINUX_SLL/SLL2, NULL/LOOP and RAW/IPV4/IPV6 are understood.
+  static bool from_pcap(const struct pcap_pkthdr*, const u_char *, TcpPacket&,
+    int linktype = DLT_EN10MB);
+
+  int src_port() const { return src_.port; }
+  int dst_port() const { return dst_.port; }
+  const Endpoint& src() const { return src_; }
+  const Endpoint& dst() const { return dst_; }
+  uint32_t seq() const { return seq_; }
+  uint8_t flags() const { return flags_; }
+  bool syn() const { return flags_ & SYN; }
+  bool fin() const { return flags_ & FIN; }
+  bool rst() const { return flags_ & RST; }
+  FlowKey flow() const { return FlowKey{src_, dst_}; }
+  string_view payload() const { return payload_; }
 
 private:
-  int src_port_;
-  int dst_port_;
-  std::string src_ip_;
-  std::string dst_ip_;
-  std::string payload_;
+  // offset is where the IP (or TCP) header starts
+  static bool from_ipv4(const u_char *packet, size_t caplen, size_t offset, TcpPacket&);
+  static bool from_ipv6(const u_char *packet, size_t caplen, size_t offset, TcpPacket&);
+  static bool from_tcp(const u_char *packet, size_t caplen, size_t offset, int segment_len,
+    const Endpoint& src, const Endpoint& dst, TcpPacket&);
+
+  Endpoint src_;
+  Endpoint dst_;
+  uint32_t seq_ = 0;
+  uint8_t flags_ = 0;
+  string_view payload_;
 };
 
 }
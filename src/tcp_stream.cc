@@ -0,0 +1,88 @@
+#include "tcp_stream.h"
+
+#include <string>
+
+using namespace std;
+
+namespace Zktraffic {
+
+void TcpStream::sync(uint32_t isn) {
+  buf_.clear();
+  trim();
+  out_of_order_.clear();
+  out_of_order_bytes_ = 0;
+  synced_ = true;
+  next_seq_ = isn + 1;
+}
+
+// Returns false if the segment can't be buffered, in which case the stream
+// was restarted at seq and the caller should consume the segment in order.
+bool TcpStream::buffer_out_of_order(uint32_t seq, const char *data, size_t len) {
+  auto it = out_of_order_.find(seq);
+  if (it != out_of_order_.end()) {
+    if (it->second.size() >= len) {
+      retransmits_++;
+      return true;
+    }
+    out_of_order_bytes_ -= it->second.size();
+    out_of_order_.erase(it);
+  }
+
+  if (out_of_order_bytes_ + len > max_out_of_order_) {
+    // the hole isn't getting filled, give up on what we have and
+    // restart framing from this segment
+    dropped_bytes_ += buf_.size() + out_of_order_bytes_;
+    desync();
+    synced_ = true;
+    next_seq_ = seq;
+    return false;
+  }
+
+  out_of_order_.emplace(seq, string(data, len));
+  out_of_order_bytes_ += len;
+  return true;
+}
+
+bool TcpStream::next_out_of_order(string& segment) {
+  // out of order segments are few, a linear scan keeps sequence
+  // wraparound handling simple
+  for (auto it = out_of_order_.begin(); it != out_of_order_.end(); ) {
+    int32_t delta = it->first - next_seq_;
+    if (delta > 0) {
+      ++it;
+      continue;
+    }
+
+    size_t skip = -delta;
+    out_of_order_bytes_ -= it->second.size();
+    if (skip >= it->second.size()) {
+      retransmits_++;
+      it = out_of_order_.erase(it);
+      continue;
+    }
+
+    segment = it->second.substr(skip);
+    out_of_order_.erase(it);
+    return true;
+  }
+
+  return false;
+}
+
+// A big frame leaves a big buffer behind, which shouldn't stay with the
+// stream for as long as it lives.
+void TcpStream::trim() {
+  if (buf_.capacity() > MAX_RESERVE && buf_.size() <= MAX_RESERVE)
+    buf_.shrink_to_fit();
+}
+
+void TcpStream::desync() {
+  resyncs_++;
+  buf_.clear();
+  trim();
+  out_of_order_.clear();
+  out_of_order_bytes_ = 0;
+  synced_ = false;
+}
+
+}
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+namespace Zktraffic {
+
+// Reassembles one direction of a TCP connection and splits the byte stream
+// into ZooKeeper frames: a 4-byte big-endian length followed by the body.
+// Frames are handed out with their length prefix, which is what the
+// decoders in zkmessage.cc expect.
+//
+// Frames that lie entirely inside an in-order segment are handed out as
+// views into that segment (no copy); only partial frames and out-of-order
+// segments are buffered.
+//
+// consume_bytes() skips the framing and hands out the reassembled bytes as
+// they become contiguous, for protocols framed some other way.
+class TcpStream {
+public:
+  // well above the default jute.maxbuffer (1M)
+  static const size_t MAX_FRAME_SIZE = 4 * 1024 * 1024;
+  static const size_t MAX_OUT_OF_ORDER = 256 * 1024;
+  // the most a partial frame gets reserved upfront (its length prefix is
+  // whatever the wire says) and the most a stream keeps once its frames
+  // are done with
+  static constexpr size_t MAX_RESERVE = 64 * 1024;
+
+  explicit TcpStream(size_t max_out_of_order = MAX_OUT_OF_ORDER) :
+    max_out_of_order_(max_out_of_order) {}
+
+  // Called on SYN: the stream starts at isn + 1.
+  void sync(uint32_t isn);
+
+  // Feeds a segment, calling on_frame(string_view) for every complete frame.
+  template <typename F>
+  void consume(uint32_t seq, const char *data, size_t len, F&& on_frame);
+  // Feeds a segment, calling on_bytes(const char *, size_t) for every run of
+  // in-order bytes. A run that doesn't follow the previous one (the stream
+  // was joined mid-way or resynced after a hole) comes right after a call
+  // to on_bytes(nullptr, 0).
+  template <typename F>
+  void consume_bytes(uint32_t seq, const char *data, size_t len, F&& on_bytes);
+
+  time_t last_seen() const { return last_seen_; }
+  void touch(time_t now) { last_seen_ = now; }
+
+  uint64_t frames() const { return frames_; }
+  uint64_t resyncs() const { return resyncs_; }
+  uint64_t retransmits() const { return retransmits_; }
+  uint64_t dropped_bytes() const { return dropped_bytes_; }
+  size_t buffered() const { return buf_.size() + out_of_order_bytes_; }
+  // what the frame buffer holds on to, used or not
+  size_t buffer_capacity() const { return buf_.capacity(); }
+
+private:
+  template <typename F>
+  void reassemble(uint32_t seq, const char *data, size_t len, F& on_bytes);
+  template <typename F>
+  void append(const char *data, size_t len, F& on_frame);
+  template <typename F>
+  size_t split_frames(const char *data, size_t len, F& on_frame);
+  bool buffer_out_of_order(uint32_t seq, const char *data, size_t len);
+  bool next_out_of_order(string& segment);
+  void desync();
+  void trim();
+
+  static const size_t BAD_FRAME = ~(size_t)0;
+
+  size_t max_out_of_order_;
+  bool synced_ = false;
+  uint32_t next_seq_ = 0;
+  string buf_;
+  map<uint32_t, string> out_of_order_;
+  size_t out_of_order_bytes_ = 0;
+  time_t last_seen_ = 0;
+  uint64_t frames_ = 0;
+  uint64_t resyncs_ = 0;
+  uint64_t retransmits_ = 0;
+  uint64_t dropped_bytes_ = 0;
+};
+
+template <typename F>
+void TcpStream::consume(uint32_t seq, const char *data, size_t len, F&& on_frame) {
+  auto on_bytes = [&](const char *bytes, size_t n) {
+    if (bytes != nullptr)
+      append(bytes, n, on_frame);
+  };
+  reassemble(seq, data, len, on_bytes);
+}
+
+template <typename F>
+void TcpStream::consume_bytes(uint32_t seq, const char *data, size_t len, F&& on_bytes) {
+  reassemble(seq, data, len, on_bytes);
+}
+
+template <typename F>
+void TcpStream::reassemble(uint32_t seq, const char *data, size_t len, F& on_bytes) {
+  if (len == 0)
+    return;
+
+  // joining mid-stream: assume the segment starts on a frame boundary,
+  // split_frames() will notice if it doesn't
+  if (!synced_) {
+    synced_ = true;
+    next_seq_ = seq;
+    on_bytes(nullptr, 0);
+  }
+
+  int32_t delta = seq - next_seq_;
+  if (delta > 0) {
+    if (buffer_out_of_order(seq, data, len))
+      return;
+    // gave up on the hole, starting over from this segment
+    on_bytes(nullptr, 0);
+  }
+
+  if (delta < 0) {
+    if ((size_t)-delta >= len) {
+      retransmits_++;
+      return;
+    }
+    data += -delta;
+    len -= -delta;
+  }
+
+  next_seq_ += len;
+  on_bytes(data, len);
+
+  string segment;
+  while (synced_ && next_out_of_order(segment)) {
+    next_seq_ += segment.size();
+    on_bytes(segment.data(), segment.size());
+  }
+}
+
+template <typename F>
+void TcpStream::append(const char *data, size_t len, F& on_frame) {
+  if (buf_.empty()) {
+    size_t used = split_frames(data, len, on_frame);
+    if (used == BAD_FRAME) {
+      dropped_bytes_ += len;
+      desync();
+      return;
+    }
+    buf_.assign(data + used, len - used);
+    return;
+  }
+
+  buf_.append(data, len);
+  size_t used = split_frames(buf_.data(), buf_.size(), on_frame);
+  if (used == BAD_FRAME) {
+    dropped_bytes_ += buf_.size();
+    desync();
+    return;
+  }
+  buf_.erase(0, used);
+  if (used > 0)
+    trim();
+}
+
+template <typename F>
+size_t TcpStream::split_frames(const char *data, size_t len, F& on_frame) {
+  size_t offset = 0;
+
+  while (len - offset >= 4) {
+    auto p = (const unsigned char *)data + offset;
+    uint32_t frame_len = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+      ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+    if (frame_len == 0 || frame_len > MAX_FRAME_SIZE)
+      return BAD_FRAME;
+
+    if (len - offset - 4 < frame_len) {
+      // partial frame, make room for (some of) the rest of it upfront
+      auto want = std::min<size_t>(frame_len + 4, MAX_RESERVE);
+      if (buf_.capacity() < want)
+	buf_.reserve(want);
+      break;
+    }
+
+    frames_++;
+    on_frame(string_view(data + offset, frame_len + 4));
+    offset += frame_len + 4;
+  }
+
+  return offset;
+}
+
+}
@@ -1,26 +1,286 @@
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <unistd.h>
 
+#include "event_log.h"
+#include "http_server.h"
+#include "metrics.h"
+#include "output_writer.h"
 #include "sniffer.h"
+#include "stats.h"
 
 using namespace std;
 
+namespace {
+
+void usage() {
+  cout << "Usage: zk-dump [options] <iface>\n" <<
+    "       zk-dump [options] -r <file>...\n" <<
+    "  -r          read packets from pcap or pcapng files instead of an iface\n" <<
+    "  -m          with several files: merge them by timestamp into one capture\n" <<
+    "              (default: they're separate captures, read in parallel)\n" <<
+    "  -S servers  where the servers listen, as ensembles of [addr[/bits]:]port\n" <<
+    "              e.g. prod=2181,2182;test=10.1.0.0/16:2281 (default: 2181)\n" <<
+    "  -q          decode quorum (ZAB, port 2888) and election (port 3888) traffic,\n" <<
+    "              served as /quorum.json and in /metrics\n" <<
+    "  -Q servers  quorum ports, as for -S (implies -q)\n" <<
+    "  -E servers  election ports, as for -S (implies -q)\n" <<
+    "  -f filter   capture filter (default: built from the servers)\n" <<
+    "  -w workers  decode threads (default: 0, decode on the capture thread)\n" <<
+    "  -F format   how messages are printed: text, line (one per line) or json\n" <<
+    "              (JSON lines) (default: text)\n" <<
+    "  -s secs     print aggregated stats every secs instead of each message\n" <<
+    "  -d depth    stats: path prefix depth (default: 2, 0 disables)\n" <<
+    "  -k count    stats: entries reported per table (default: 20)\n" <<
+    "  -p port     serve /metrics (Prometheus), /metrics.json and /sessions.json\n" <<
+    "              over http\n" <<
+    "  -a address  address to serve metrics on (default: 0.0.0.0)\n" <<
+    "  -t count    track heavy hitters, serve the top count as /heavy_hitters.json\n" <<
+    "  -P count    distinct paths interned per decode thread (default: 65536,\n" <<
+    "              0 disables)\n" <<
+    "  -o prefix   write messages to a binary event log (prefix.NNNNNN.zkev)\n";
+}
+
+int print_messages(Zktraffic::Sniffer& sniffer, Zktraffic::OutputFormat format, bool live) {
+  // what's been printed so far goes first
+  cout.flush();
+  Zktraffic::OutputWriter writer(STDOUT_FILENO, format);
+
+  for (;;) {
+    auto message = sniffer.get();
+    if (message == nullptr)
+      break;
+    if (!writer.write(*message))
+      return 1;
+    // live traffic can be slow, don't sit on what's there
+    if (live && sniffer.empty() && !writer.flush())
+      return 1;
+  }
+
+  return writer.flush() ? 0 : 1;
+}
+
+int write_events(Zktraffic::Sniffer& sniffer, const string& prefix) {
+  Zktraffic::EventLogWriter writer(prefix);
+
+  for (;;) {
+    auto batch = sniffer.get_records();
+    if (batch == nullptr)
+      break;
+    if (!writer.append(*batch))
+      return 1;
+  }
+
+  writer.close();
+  cout << "wrote " << writer.records() << " messages to " << writer.segments() << " segment(s)\n";
+
+  return 0;
+}
+
+// on stderr, so it doesn't get mixed up with the messages
+void print_replay_stats(Zktraffic::Sniffer& sniffer) {
+  sniffer.wait();
+  auto capture = sniffer.capture_stats();
+  auto secs = max(capture.elapsed_usecs, (uint64_t)1) / 1e6;
+
+  cerr << "read " << capture.packets << " packets (" << capture.bytes / 1e6 << "MB) in " <<
+    secs << "s: " << (uint64_t)(capture.packets / secs) << " packets/s, " <<
+    capture.bytes / 1e6 / secs << "MB/s\n";
+}
+
+void print_stats(Zktraffic::Sniffer& sniffer, Zktraffic::StatsOptions options) {
+  Zktraffic::StatsAggregator stats(options);
+  bool seen = false;
+
+  for (;;) {
+    auto batch = sniffer.get_records();
+    if (batch == nullptr)
+      break;
+    for (size_t i = stats.add(*batch); i < batch->size(); i = stats.add(*batch, i))
+      cout << (string)stats.rotate(batch->timestamps()[i]) << "\n";
+    seen = true;
+  }
+
+  if (seen)
+    cout << (string)stats.rotate() << "\n";
+}
+
+}
+
 int main(int argc, char **argv) {
+  string filter;
+  bool from_file = false;
+  Zktraffic::SnifferOptions options;
+  Zktraffic::StatsOptions stats_options;
+  bool stats = false;
+  string metrics_address = "0.0.0.0";
+  int metrics_port = -1;
+  size_t heavy_hitters = 0;
+  string events;
+  auto format = Zktraffic::OutputFormat::TEXT;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "rmS:qQ:E:f:w:F:s:d:k:p:a:t:P:o:")) != -1) {
+    switch (opt) {
+    case 'r':
+      from_file = true;
+      break;
+    case 'm':
+      options.merge_files = true;
+      break;
+    case 'S':
+      options.servers = Zktraffic::ServerSet(optarg);
+      if (!options.servers.ok()) {
+	cout << "bad servers: " << options.servers.error() << "\n";
+	return 1;
+      }
+      break;
+    case 'q':
+      options.quorum.enabled = true;
+      break;
+    case 'Q':
+    case 'E': {
+      Zktraffic::ServerSet servers(optarg);
+      if (!servers.ok()) {
+	cout << "bad " << (opt == 'Q' ? "quorum" : "election") << " servers: " << servers.error() << "\n";
+	return 1;
+      }
+      (opt == 'Q' ? options.quorum.zab : options.quorum.election) = servers;
+      options.quorum.enabled = true;
+      break;
+    }
+    case 'f':
+      filter = optarg;
+      break;
+    case 'w':
+      options.workers = atoi(optarg);
+      break;
+    case 'F':
+      if (!Zktraffic::OutputWriter::parse_format(optarg, format)) {
+	cout << "bad format: " << optarg << "\n";
+	return 1;
+      }
+      break;
+    case 's':
+      stats = true;
+      stats_options.window = atoi(optarg);
+      break;
+    case 'd':
+      stats_options.prefix_depth = atoi(optarg);
+      break;
+    case 'k':
+      stats_options.top = atoi(optarg);
+      break;
+    case 'p':
+      metrics_port = atoi(optarg);
+      break;
+    case 'a':
+      metrics_address = optarg;
+      break;
+    case 't':
+      heavy_hitters = atoi(optarg);
+      break;
+    case 'P':
+      options.interned_paths = atoi(optarg);
+      break;
+    case 'o':
+      events = optarg;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
 
-  if (argc != 2) {
-    cout << "Usage: zk-dump <iface>\n";
+  if (optind == argc || (!from_file && optind != argc - 1)) {
+    usage();
     return 1;
   }
 
-  Zktraffic::Sniffer sniffer{argv[1], "port 2181"};
+  if (filter.empty()) {
+    filter = options.servers.filter();
+    if (options.quorum.enabled) {
+      filter = "(" + filter + ") or (" + options.quorum.zab.filter() + ") or (" +
+	options.quorum.election.filter() + ")";
+    }
+  }
 
-  sniffer.run();
+  // the event log and stats only need what's in MessageRecords, which
+  // doesn't include message bodies
+  options.records = !events.empty() || stats;
+  options.lazy = options.records;
 
-  while (1) {
-    auto message = sniffer.get();
-    cout << (string)*message << "\n";
+  if (heavy_hitters > 0) {
+    // plenty more than what's reported, so the top ones are accurate
+    options.heavy_hitters = max<size_t>(heavy_hitters * 16, 1024);
+    options.heavy_hitters_depth = stats_options.prefix_depth;
   }
 
-  return 0;
+  unique_ptr<Zktraffic::Sniffer> capture;
+  if (from_file)
+    capture.reset(new Zktraffic::Sniffer(vector<string>(argv + optind, argv + argc), filter, options));
+  else
+    capture.reset(new Zktraffic::Sniffer(argv[optind], filter, false, options));
+  auto& sniffer = *capture;
+
+  Zktraffic::HttpServer http(metrics_address, metrics_port);
+  if (metrics_port >= 0) {
+    http.handle("/metrics", [&sniffer]() {
+	Zktraffic::HttpResponse response;
+	response.content_type = "text/plain; version=0.0.4; charset=utf-8";
+	response.body = Zktraffic::prometheus_metrics(sniffer);
+	return response;
+      });
+    http.handle("/metrics.json", [&sniffer]() {
+	Zktraffic::HttpResponse response;
+	response.content_type = "application/json";
+	response.body = Zktraffic::json_metrics(sniffer);
+	return response;
+      });
+    http.handle("/sessions.json", [&sniffer]() {
+	Zktraffic::HttpResponse response;
+	response.content_type = "application/json";
+	response.body = Zktraffic::json_sessions(sniffer);
+	return response;
+      });
+    if (options.quorum.enabled) {
+      http.handle("/quorum.json", [&sniffer]() {
+	  Zktraffic::HttpResponse response;
+	  response.content_type = "application/json";
+	  response.body = Zktraffic::json_quorum(sniffer);
+	  return response;
+	});
+    }
+    if (heavy_hitters > 0) {
+      http.handle("/heavy_hitters.json", [&sniffer, heavy_hitters]() {
+	  Zktraffic::HttpResponse response;
+	  response.content_type = "application/json";
+	  response.body = Zktraffic::json_heavy_hitters(sniffer, heavy_hitters);
+	  return response;
+	});
+    }
+    if (!http.start())
+      return 1;
+    cout << "serving metrics on " << metrics_address << ":" << http.port() << "\n";
+  }
+
+  sniffer.run();
+
+  int rv = 0;
+  if (!events.empty())
+    rv = write_events(sniffer, events);
+  else if (stats)
+    print_stats(sniffer, stats_options);
+  else
+    rv = print_messages(sniffer, format, !from_file);
+
+  if (from_file && rv == 0)
+    print_replay_stats(sniffer);
+
+  return rv;
 }
@@ -0,0 +1,179 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+
+#include <unistd.h>
+
+#include "event_log.h"
+
+using namespace std;
+
+namespace {
+
+void usage() {
+  cout << "Usage: zkevents [options] <segment>...\n" <<
+    "  -s          print a summary instead of each record\n" <<
+    "  -f secs     skip blocks that end before secs (since the epoch)\n" <<
+    "  -u secs     skip blocks that start after secs (since the epoch)\n";
+}
+
+const char *kind_name(Zktraffic::EventKind kind) {
+  switch (kind) {
+  case Zktraffic::EventKind::REQUEST:
+    return "request";
+  case Zktraffic::EventKind::REPLY:
+    return "reply";
+  case Zktraffic::EventKind::WATCH:
+    return "watch";
+  }
+  return "unknown";
+}
+
+void print_record(const Zktraffic::EventLogReader& reader, const Zktraffic::EventRecord& record) {
+  printf("%llu.%06llu %s %s client=%s server=%s xid=%d size=%u",
+    (unsigned long long)(record.timestamp / 1000000),
+    (unsigned long long)(record.timestamp % 1000000),
+    kind_name(record.kind),
+    Zktraffic::ZKMessage::opcode_to_name(record.opcode),
+    record.client.str().c_str(), record.server.str().c_str(),
+    record.xid, record.size);
+
+  if (record.kind != Zktraffic::EventKind::REQUEST)
+    printf(" zxid=%lld error=%d", (long long)record.zxid, record.error);
+  if (record.kind == Zktraffic::EventKind::REPLY)
+    printf(" latency=%lld", (long long)record.latency);
+  if (record.kind == Zktraffic::EventKind::WATCH)
+    printf(" event_type=%d", record.event_type);
+  if (record.path != 0) {
+    auto path = reader.path(record.path);
+    printf(" path=%.*s", (int)path.size(), path.data());
+  }
+  printf("\n");
+}
+
+struct OpcodeSummary {
+  uint64_t requests = 0;
+  uint64_t replies = 0;
+  uint64_t latency_sum = 0;
+  uint64_t latency_count = 0;
+};
+
+struct Summary {
+  uint64_t records = 0;
+  uint64_t bytes = 0;
+  uint64_t first = ~0ULL;
+  uint64_t last = 0;
+  uint64_t watches = 0;
+  uint64_t errors = 0;
+  map<int, OpcodeSummary> opcodes;
+
+  void add(const Zktraffic::EventRecord& record) {
+    records++;
+    first = min(first, record.timestamp);
+    last = max(last, record.timestamp);
+
+    switch (record.kind) {
+    case Zktraffic::EventKind::REQUEST:
+      opcodes[record.opcode].requests++;
+      break;
+    case Zktraffic::EventKind::REPLY: {
+      auto& opcode = opcodes[record.opcode];
+      opcode.replies++;
+      if (record.latency >= 0) {
+	opcode.latency_sum += record.latency;
+	opcode.latency_count++;
+      }
+      if (record.error != 0)
+	errors++;
+      break;
+    }
+    case Zktraffic::EventKind::WATCH:
+      watches++;
+      break;
+    }
+  }
+
+  void print(double secs) const {
+    cout << "records=" << records << "\n";
+    if (records > 0)
+      cout << "span=" << (last - first) / 1e6 << "s\n";
+    cout << "watches=" << watches << "\n" <<
+      "errors=" << errors << "\n";
+    for (const auto& entry : opcodes) {
+      const auto& opcode = entry.second;
+      cout << "opcode " << Zktraffic::ZKMessage::opcode_to_name(entry.first) <<
+	" requests=" << opcode.requests <<
+	" replies=" << opcode.replies;
+      if (opcode.latency_count > 0)
+	cout << " avg_latency=" << opcode.latency_sum / opcode.latency_count << "us";
+      cout << "\n";
+    }
+    if (secs > 0) {
+      cout << "scanned " << bytes / 1e6 << "MB in " << secs << "s (" <<
+	(uint64_t)(records / secs) << " records/s, " <<
+	(uint64_t)(records * sizeof(Zktraffic::EventRecord) / secs / 1e6) << "MB/s decoded)\n";
+    }
+  }
+};
+
+}
+
+int main(int argc, char **argv) {
+  bool summary = false;
+  uint64_t from = 0;
+  uint64_t until = ~0ULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "sf:u:")) != -1) {
+    switch (opt) {
+    case 's':
+      summary = true;
+      break;
+    case 'f':
+      from = strtoull(optarg, nullptr, 10) * 1000000;
+      break;
+    case 'u':
+      until = strtoull(optarg, nullptr, 10) * 1000000;
+      break;
+    default:
+      usage();
+      return 1;
+    }
+  }
+
+  if (optind >= argc) {
+    usage();
+    return 1;
+  }
+
+  Summary totals;
+  auto start = chrono::steady_clock::now();
+
+  for (int i = optind; i < argc; i++) {
+    Zktraffic::EventLogReader reader(argv[i]);
+    if (!reader.ok())
+      return 1;
+    reader.set_range(from, until);
+
+    if (summary) {
+      reader.for_each([&totals](const Zktraffic::EventRecord& record) { totals.add(record); });
+      totals.bytes += reader.bytes();
+    } else {
+      reader.for_each([&reader](const Zktraffic::EventRecord& record) {
+	  print_record(reader, record);
+	});
+    }
+
+    if (reader.truncated())
+      cerr << argv[i] << " ends with a partial block\n";
+  }
+
+  if (summary) {
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    totals.print(elapsed.count());
+  }
+
+  return 0;
+}
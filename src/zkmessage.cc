@@ -2,29 +2,20 @@
 
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <string>
+#include <string_view>
+
+#include "payload_reader.h"
 
 using namespace std;
 
 namespace Zktraffic {
 namespace {
 
+// frames start with their length, which doesn't count itself
 #define CHECK_LENGTH(P, MINL)                       \
-  if (read_number(P, 0) < MINL) return nullptr
-
-// https://commandcenter.blogspot.fr/2012/04/byte-order-fallacy.html
-int read_number(const string& data, unsigned int offset) {
-  if (offset + 4 > data.length())
-    return -1;
-
-  auto n = data.substr(offset, 4);
-  int number = ((unsigned char)n[3]<<0) | \
-    ((unsigned char)n[2]<<8) | \
-    ((unsigned char)n[1]<<16) | \
-    ((unsigned char)n[0]<<24);
-
-  return number;
-}
+  if (PayloadReader(P).read_int() < MINL) return nullptr
 
 string to_bits(unsigned char c) {
   stringstream ss;
@@ -37,268 +28,461 @@ string to_bits(unsigned char c) {
   return ss.str();
 }
 
-void dump(const string& payload) {
+void dump(string_view payload) {
   for (unsigned int i=0; i<payload.length(); i++)
     cout << "payload[" << i << "] = " << to_bits(payload[i]) << "\n";
 }
 
-long long read_long(const string& data, int offset) {
-  auto n = data.substr(offset, 8);
-
-  // careful when casting, watch out for 2's complement
-  unsigned long long number = ((unsigned long long)(unsigned char)n[7]<<0) |	\
-    ((unsigned long long)(unsigned char)n[6]<<8) | \
-    ((unsigned long long)(unsigned char)n[5]<<16) | \
-    ((unsigned long long)(unsigned char)n[4]<<24) | \
-    ((unsigned long long)(unsigned char)n[3]<<32) | \
-    ((unsigned long long)(unsigned char)n[2]<<40) | \
-    ((unsigned long long)(unsigned char)n[1]<<48) | \
-    ((unsigned long long)(unsigned char)n[0]<<56);
-
-  return number;
-}
-
-bool read_bool(const string& data, unsigned int offset) {
-  if (offset >= data.length()) {
-    return false;
+vector<Acl> read_acls(PayloadReader& reader) {
+  vector<Acl> acls{};
+  int count = reader.read_int();
+
+  // -1 is a null list
+  if (count <= 0)
+    return acls;
+  if ((size_t)count > reader.remaining() / 12) {
+    reader.fail();
+    return acls;
   }
-  return (bool)(data[offset] & 255);
-}
-
-string read_buffer(const string& data, int offset, int maxlen=1048576) {
-  int length = read_number(data, offset);
-  return data.substr(offset + 4, length);
-}
-
-pair<vector<string>, int> read_vector(const string& payload, int offset, int max=1048576) {
-  vector<string> vec{};
-  int count = read_number(payload, offset);
-
-  offset += 4;
-
-  if (count < 0)
-    return pair<vector<string>, int>{vec, offset};
 
+  acls.reserve(count);
   for (int i=0; i<count; i++) {
-    auto item = read_buffer(payload, offset);
-    offset += 4 + item.length();
-    vec.push_back(move(item));
+    int perms = reader.read_int();
+    auto scheme = reader.read_buffer();
+    auto credential = reader.read_buffer();
+    acls.emplace_back(perms, string(scheme), string(credential));
   }
 
-  return pair<vector<string>, int>{vec, offset};
+  return acls;
 }
 
-pair<vector<Acl>, int> read_acls(const string& payload, int offset) {
-  vector<Acl> acls{};
-  int count = read_number(payload, offset);
+// appends count(int) + strs, the strings stay packed in the list
+void read_string_list(PayloadReader& reader, StringList& list) {
+  int count = reader.read_int();
 
-  offset += 4;
+  // -1 is a null list
+  if (count <= 0)
+    return;
+  if ((size_t)count > reader.remaining() / 4) {
+    reader.fail();
+    return;
+  }
 
-  if (count < 0)
-    return pair<vector<Acl>, int>{acls, offset};
+  list.reserve(list.size() + count, list.bytes() + reader.remaining());
+  for (int i=0; i<count; i++)
+    list.push_back(reader.read_buffer());
+}
 
-  for (int i=0; i<count; i++) {
-    int perms = read_number(payload, offset);
-    offset += 4;
-    string scheme = read_buffer(payload, offset);
-    offset += 4 + scheme.length();
-    string credential = read_buffer(payload, offset);
-    offset += 4 + credential.length();
-
-    auto acl = Acl(perms, move(scheme), move(credential));
-    acls.push_back(move(acl));
+void skip_acls(PayloadReader& reader) {
+  int count = reader.read_int();
+  for (int i=0; i<count && reader.ok(); i++) {
+    reader.read_int();
+    reader.read_buffer();
+    reader.read_buffer();
   }
+}
 
-  return pair<vector<Acl>, int>{acls, offset};
+void skip_vector(PayloadReader& reader) {
+  int count = reader.read_int();
+  for (int i=0; i<count && reader.ok(); i++)
+    reader.read_buffer();
+}
+
+const size_t STAT_SIZE = 68;
+
+ZnodeStat read_stat(PayloadReader& reader) {
+  long long czxid = reader.read_long();
+  long long mzxid = reader.read_long();
+  long long ctime = reader.read_long();
+  long long mtime = reader.read_long();
+  int version = reader.read_int();
+  int cversion = reader.read_int();
+  int aversion = reader.read_int();
+  long long ephemeralOwner = reader.read_long();
+  int dataLength = reader.read_int();
+  int numChildren = reader.read_int();
+  long long pzxid = reader.read_long();
+
+  return ZnodeStat(czxid, mzxid, ctime, mtime,
+    version, cversion, aversion, ephemeralOwner, dataLength, numChildren, pzxid);
 }
 
 template <typename T>
-unique_ptr<T> from_payload_path_watch(string client, string server, const string& payload) {
+unique_ptr<T> from_payload_path_watch(const Endpoint& client, const Endpoint& server, string_view payload) {
   // xid(int) + opcode(int) + path(int + str) + watch(bool)
   CHECK_LENGTH(payload, 14);
 
-  int xid = read_number(payload, 4);
-  int opcode = read_number(payload, 8);
-  string path = read_buffer(payload, 12);
-  bool watch = read_bool(payload, 12 + 4 + path.length());
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  int opcode = reader.read_int();
+  auto path = reader.read_buffer();
+  bool watch = reader.read_bool();
+  if (!reader.ok())
+    return nullptr;
 
-  return make_unique<T>(move(client), move(server), xid, move(path), watch, opcode);
+  return make_unique<T>(client, server, xid, path, watch, opcode);
 }
 
 template <typename T>
-unique_ptr<T> from_payload_path_data_version(string client, string server, const string& payload) {
+unique_ptr<T> from_payload_path_data_version(const Endpoint& client, const Endpoint& server, string_view payload) {
   // xid(int) + opcode(int) + path(int + str) + data(str) + version(int)
   CHECK_LENGTH(payload, 22);
 
-  int xid = read_number(payload, 4);
-  string path = read_buffer(payload, 12);
-  int data_len = read_number(payload, 16 + path.length());
-  int version = read_number(payload, 20 + path.length() + data_len);
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  reader.read_int();
+  auto path = reader.read_buffer();
+  reader.read_buffer();
+  int version = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
 
-  return make_unique<T>(move(client), move(server), xid, move(path), version);
+  return make_unique<T>(client, server, xid, path, version);
 }
 
 template <typename T>
-unique_ptr<T> from_payload_path_version(string client, string server, const string& payload) {
+unique_ptr<T> from_payload_path_version(const Endpoint& client, const Endpoint& server, string_view payload) {
   // xid(int) + opcode(int) + path(int + str) + version(int)
   CHECK_LENGTH(payload, 17);
 
-  int xid = read_number(payload, 4);
-  string path = read_buffer(payload, 12);
-  int version = read_number(payload, 16 + path.length());
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  reader.read_int();
+  auto path = reader.read_buffer();
+  int version = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
 
-  return make_unique<T>(move(client), move(server), xid, move(path), version);
+  return make_unique<T>(client, server, xid, path, version);
 }
 
 template <typename T>
-unique_ptr<T> from_payload_path(string client, string server, const string& payload) {
+unique_ptr<T> from_payload_path(const Endpoint& client, const Endpoint& server, string_view payload) {
   // xid(int) + opcode(int) + path(int + str)
   CHECK_LENGTH(payload, 17);
 
-  int xid = read_number(payload, 4);
-  string path = read_buffer(payload, 12);
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  reader.read_int();
+  auto path = reader.read_buffer();
+  if (!reader.ok())
+    return nullptr;
 
-  return make_unique<T>(move(client), move(server), xid, move(path));
+  return make_unique<T>(client, server, xid, path);
 }
 
-unique_ptr<ZnodeStat> read_stat(const string& payload, unsigned int offset) {
-  long long czxid = read_long(payload, offset);
-  long long mzxid = read_long(payload, offset + 8);
-  long long ctime = read_long(payload, offset + 16);
-  long long mtime = read_long(payload, offset + 24);
-  int version = read_number(payload, offset + 32);
-  int cversion = read_number(payload, offset + 36);
-  int aversion = read_number(payload, offset + 40);
-  long long ephemeralOwner = read_long(payload, offset + 44);
-  int dataLength = read_number(payload, offset + 52);
-  int numChildren = read_number(payload, offset + 56);
-  long long pzxid = read_long(payload, offset + 60);
+template <typename T>
+unique_ptr<T> from_payload_path_opcode(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + path(int + str)
+  CHECK_LENGTH(payload, 12);
 
-  return make_unique<ZnodeStat>(czxid, mzxid, ctime, mtime,
-    version, cversion, aversion, ephemeralOwner, dataLength, numChildren, pzxid);
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  int opcode = reader.read_int();
+  auto path = reader.read_buffer();
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<T>(client, server, xid, path, opcode);
 }
 
 template <typename T>
-unique_ptr<T> from_reply_payload_data_stat(string client, string server, int xid, long zxid, int error, const string& payload)
+unique_ptr<T> from_reply_payload_data_stat(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
 {
   // xid(int) + zxid(long) + error(int) + data(int + str) + stat(68)
   CHECK_LENGTH(payload, 16);
 
   if (error) {
-    return make_unique<T>(move(client), move(server), xid, zxid, error);
+    return make_unique<T>(client, server, xid, zxid, error);
   }
 
   CHECK_LENGTH(payload, 88);
 
-  auto data = read_buffer(payload, 20);
-  auto stat = read_stat(payload, 24 + data.length());
+  PayloadReader reader(payload, 20);
+  auto data = reader.read_buffer();
+  auto stat = read_stat(reader);
+  if (!reader.ok())
+    return nullptr;
 
-  return make_unique<T>(move(client), move(server), xid, zxid, error, move(data), move(stat));
+  return make_unique<T>(client, server, xid, zxid, error, string(data), stat);
 }
 
 template <typename T>
-unique_ptr<T> from_reply_payload_stat(string client, string server, int xid, long zxid, int error, const string& payload)
+unique_ptr<T> from_reply_payload_stat(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
 {
   // xid(int) + zxid(long) + error(int) + stat(68)
   CHECK_LENGTH(payload, 16);
 
   if (error) {
-    return make_unique<T>(move(client), move(server), xid, zxid, error);
+    return make_unique<T>(client, server, xid, zxid, error);
   }
 
   CHECK_LENGTH(payload, 84);
-  auto stat = read_stat(payload, 20);
 
-  return make_unique<T>(move(client), move(server), xid, zxid, error, move(stat));
+  PayloadReader reader(payload, 20);
+  auto stat = read_stat(reader);
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<T>(client, server, xid, zxid, error, stat);
 }
 
 template <typename T>
-unique_ptr<T> from_reply_payload_data(string client, string server, int xid, long zxid, int error, const string& payload)
+unique_ptr<T> from_reply_payload_data(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
 {
   // xid(int) + zxid(long) + error(int) + data(int + str)
   CHECK_LENGTH(payload, 16);
 
   if (error) {
-    return make_unique<T>(move(client), move(server), xid, zxid, error);
+    return make_unique<T>(client, server, xid, zxid, error);
   }
 
   CHECK_LENGTH(payload, 20);
-  auto data = read_buffer(payload, 20);
 
-  return make_unique<T>(move(client), move(server), xid, zxid, error, move(data));
+  PayloadReader reader(payload, 20);
+  auto data = reader.read_buffer();
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<T>(client, server, xid, zxid, error, string(data));
 }
 
 template <typename T>
-unique_ptr<T> from_reply_payload_vector(string client, string server, int xid, long zxid, int error, const string& payload)
+unique_ptr<T> from_reply_payload_vector(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
 {
   // xid(int) + zxid(long) + error(int) + vector(int + strs)
   CHECK_LENGTH(payload, 16);
 
   if (error) {
-    return make_unique<T>(move(client), move(server), xid, zxid, error);
+    return make_unique<T>(client, server, xid, zxid, error);
   }
 
   CHECK_LENGTH(payload, 20);
-  auto vec = read_vector(payload, 20);
 
-  return make_unique<T>(move(client), move(server), xid, zxid, error, move(vec.first));
+  PayloadReader reader(payload, 20);
+  StringList vec;
+  read_string_list(reader, vec);
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<T>(client, server, xid, zxid, error, move(vec));
 }
 
 template <typename T>
-unique_ptr<T> from_reply_payload_vector_stat(string client, string server, int xid, long zxid, int error, const string& payload)
+unique_ptr<T> from_reply_payload_vector_stat(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
 {
   // xid(int) + zxid(long) + error(int) + vector(int + strs) + stat(68)
   CHECK_LENGTH(payload, 16);
 
   if (error) {
-    return make_unique<T>(move(client), move(server), xid, zxid, error);
+    return make_unique<T>(client, server, xid, zxid, error);
+  }
+
+  CHECK_LENGTH(payload, 20);
+
+  PayloadReader reader(payload, 20);
+  StringList vec;
+  read_string_list(reader, vec);
+  auto stat = read_stat(reader);
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<T>(client, server, xid, zxid, error, move(vec), stat);
+}
+
+unique_ptr<GetAclReply> from_reply_payload_acls_stat(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
+{
+  // xid(int) + zxid(long) + error(int) + acls(vector) + stat(68)
+  if (error) {
+    return make_unique<GetAclReply>(client, server, xid, zxid, error);
+  }
+
+  CHECK_LENGTH(payload, 88);
+
+  PayloadReader reader(payload, 20);
+  auto acls = read_acls(reader);
+  auto stat = read_stat(reader);
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<GetAclReply>(client, server, xid, zxid, error, move(acls), stat);
+}
+
+unique_ptr<GetEphemeralsReply> from_reply_payload_string_list(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
+{
+  // xid(int) + zxid(long) + error(int) + vector(int + strs)
+  if (error) {
+    return make_unique<GetEphemeralsReply>(client, server, xid, zxid, error);
   }
 
   CHECK_LENGTH(payload, 20);
-  auto vec = read_vector(payload, 20);
-  auto stat = read_stat(payload, vec.second);
 
-  return make_unique<T>(move(client), move(server), xid, zxid, error, move(vec.first), move(stat));
+  PayloadReader reader(payload, 20);
+  StringList paths;
+  read_string_list(reader, paths);
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<GetEphemeralsReply>(client, server, xid, zxid, error, move(paths));
+}
+
+unique_ptr<GetAllChildrenNumberReply> from_reply_payload_int(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string_view payload)
+{
+  // xid(int) + zxid(long) + error(int) + number(int)
+  if (error) {
+    return make_unique<GetAllChildrenNumberReply>(client, server, xid, zxid, error);
+  }
+
+  CHECK_LENGTH(payload, 20);
+
+  PayloadReader reader(payload, 20);
+  int number = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<GetAllChildrenNumberReply>(client, server, xid, zxid, error, number);
+}
+
+const char * status_reply_name(int opcode) {
+  switch (opcode) {
+  case enumToInt(Opcodes::CHECK):
+    return "CheckReply";
+  case enumToInt(Opcodes::CLOSE):
+    return "CloseReply";
+  case enumToInt(Opcodes::SETWATCHES):
+  case enumToInt(Opcodes::SETWATCHES2):
+    return "SetWatchesReply";
+  case enumToInt(Opcodes::SETAUTH):
+    return "AuthReply";
+  case enumToInt(Opcodes::ADDWATCH):
+    return "AddWatchReply";
+  case enumToInt(Opcodes::REMOVEWATCHES):
+    return "RemoveWatchesReply";
+  case enumToInt(Opcodes::CHECKWATCHES):
+    return "CheckWatchesReply";
+  case enumToInt(Opcodes::DELETECONTAINER):
+    return "DeleteContainerReply";
+  }
+  return "StatusReply";
+}
+
+// what from_reply_payload() decodes
+bool known_reply(int opcode) {
+  switch (opcode) {
+  case enumToInt(Opcodes::GETDATA):
+  case enumToInt(Opcodes::CREATE):
+  case enumToInt(Opcodes::CREATE2):
+  case enumToInt(Opcodes::CREATECONTAINER):
+  case enumToInt(Opcodes::CREATETTL):
+  case enumToInt(Opcodes::SETDATA):
+  case enumToInt(Opcodes::GETCHILDREN):
+  case enumToInt(Opcodes::GETCHILDREN2):
+  case enumToInt(Opcodes::DELETE):
+  case enumToInt(Opcodes::SYNC):
+  case enumToInt(Opcodes::EXISTS):
+  case enumToInt(Opcodes::GETACL):
+  case enumToInt(Opcodes::SETACL):
+  case enumToInt(Opcodes::MULTI):
+  case enumToInt(Opcodes::MULTIREAD):
+  case enumToInt(Opcodes::RECONFIG):
+  case enumToInt(Opcodes::GETEPHEMERALS):
+  case enumToInt(Opcodes::GETALLCHILDRENNUMBER):
+  case enumToInt(Opcodes::CHECK):
+  case enumToInt(Opcodes::CLOSE):
+  case enumToInt(Opcodes::SETWATCHES):
+  case enumToInt(Opcodes::SETWATCHES2):
+  case enumToInt(Opcodes::SETAUTH):
+  case enumToInt(Opcodes::ADDWATCH):
+  case enumToInt(Opcodes::REMOVEWATCHES):
+  case enumToInt(Opcodes::CHECKWATCHES):
+  case enumToInt(Opcodes::DELETECONTAINER):
+    return true;
+  }
+  return false;
 }
 
 } // namespace
 
-unique_ptr<ZKClientMessage> ZKClientMessage::from_payload(string client,
-  string server, const string& payload) {
+ZKMessage::operator std::string() const {
+  string rv;
+  Formatter out(rv);
+  format(out);
+  return rv;
+}
+
+unique_ptr<ZKClientMessage> ZKClientMessage::from_payload(const Endpoint& client,
+  const Endpoint& server, string_view payload, PathInterner *paths) {
+  auto rv = decode(client, server, payload);
+  if (rv != nullptr && paths != nullptr)
+    rv->path_id_ = paths->intern(rv->path_);
+  return rv;
+}
+
+unique_ptr<ZKClientMessage> ZKClientMessage::decode(const Endpoint& client,
+  const Endpoint& server, string_view payload) {
   CHECK_LENGTH(payload, 8);
 
+  PayloadReader reader(payload, 4);
+
   // "special" requests
-  int xid = read_number(payload, 4);
+  int xid = reader.read_int();
   switch (xid) {
   case CONNECT_XID:
-    return ConnectRequest::from_payload(move(client), move(server), payload);
+    return ConnectRequest::from_payload(client, server, payload);
   case PING_XID:
-    return make_unique<PingRequest>(move(client), move(server));
+    return make_unique<PingRequest>(client, server);
   case AUTH_XID:
-    return AuthRequest::from_payload(move(client), move(server), payload);
+    return AuthRequest::from_payload(client, server, payload);
   default:
     break;
   }
 
   // "regular" requests
-  int opcode = read_number(payload, 8);
+  int opcode = reader.read_int();
   switch (opcode) {
   case enumToInt(Opcodes::GETDATA):
-    return from_payload_path_watch<GetRequest>(move(client), move(server), payload);
+    return from_payload_path_watch<GetRequest>(client, server, payload);
   case enumToInt(Opcodes::CREATE):
   case enumToInt(Opcodes::CREATE2):
-    return CreateRequest::from_payload(move(client), move(server), payload);
+  case enumToInt(Opcodes::CREATECONTAINER):
+  case enumToInt(Opcodes::CREATETTL):
+    return CreateRequest::from_payload(client, server, payload);
   case enumToInt(Opcodes::SETDATA):
-    return from_payload_path_data_version<SetRequest>(move(client), move(server), payload);
+    return from_payload_path_data_version<SetRequest>(client, server, payload);
   case enumToInt(Opcodes::GETCHILDREN):
   case enumToInt(Opcodes::GETCHILDREN2):
-    return from_payload_path_watch<GetChildrenRequest>(move(client), move(server), payload);
+    return from_payload_path_watch<GetChildrenRequest>(client, server, payload);
   case enumToInt(Opcodes::DELETE):
-    return from_payload_path_version<DeleteRequest>(move(client), move(server), payload);
+    return from_payload_path_version<DeleteRequest>(client, server, payload);
   case enumToInt(Opcodes::SYNC):
-    return from_payload_path<SyncRequest>(move(client), move(server), payload);
+    return from_payload_path<SyncRequest>(client, server, payload);
   case enumToInt(Opcodes::EXISTS):
-    return from_payload_path_watch<ExistsRequest>(move(client), move(server), payload);
+    return from_payload_path_watch<ExistsRequest>(client, server, payload);
+  case enumToInt(Opcodes::GETACL):
+    return from_payload_path<GetAclRequest>(client, server, payload);
+  case enumToInt(Opcodes::SETACL):
+    return SetAclRequest::from_payload(client, server, payload);
+  case enumToInt(Opcodes::CHECK):
+    return from_payload_path_version<CheckRequest>(client, server, payload);
+  case enumToInt(Opcodes::MULTI):
+  case enumToInt(Opcodes::MULTIREAD):
+    return MultiRequest::from_payload(client, server, payload);
+  case enumToInt(Opcodes::CLOSE):
+    return make_unique<CloseRequest>(client, server, xid);
+  case enumToInt(Opcodes::RECONFIG):
+    return ReconfigRequest::from_payload(client, server, payload);
+  case enumToInt(Opcodes::SETWATCHES):
+  case enumToInt(Opcodes::SETWATCHES2):
+    return SetWatchesRequest::from_payload(client, server, payload);
+  case enumToInt(Opcodes::ADDWATCH):
+    return AddWatchRequest::from_payload(client, server, payload);
+  case enumToInt(Opcodes::REMOVEWATCHES):
+  case enumToInt(Opcodes::CHECKWATCHES):
+    return RemoveWatchesRequest::from_payload(client, server, payload);
+  case enumToInt(Opcodes::DELETECONTAINER):
+  case enumToInt(Opcodes::GETEPHEMERALS):
+  case enumToInt(Opcodes::GETALLCHILDRENNUMBER):
+    return from_payload_path_opcode<PathRequest>(client, server, payload);
   default:
     break;
   }
@@ -306,48 +490,92 @@ unique_ptr<ZKClientMessage> ZKClientMessage::from_payload(string client,
   return nullptr;
 }
 
-unique_ptr<ZKServerMessage> ZKServerMessage::from_payload(string client, string server,
-  const string& payload, const unordered_map<int, int>& requests) {
+int ZKServerMessage::xid_from_payload(string_view payload) {
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  return reader.ok() ? xid : -1;
+}
+
+unique_ptr<ZKServerMessage> ZKServerMessage::from_payload(const Endpoint& client, const Endpoint& server,
+  string_view payload, int opcode, PathInterner *paths) {
   CHECK_LENGTH(payload, 16);
 
   // "special" server messages
-  int xid = read_number(payload, 4);
-  long long zxid = read_long(payload, 8);
-  int error = read_number(payload, 16);
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  long long zxid = reader.read_long();
+  int error = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
 
   switch (xid) {
   case PING_XID:
-    return make_unique<PingReply>(move(client), move(server), zxid, error);
+    return make_unique<PingReply>(client, server, zxid, error);
   case WATCH_XID:
-    return WatchEvent::from_payload(move(client), move(server), payload, zxid, error);
+    return WatchEvent::from_payload(client, server, payload, zxid, error, paths);
   default:
     break;
   }
 
-  // handle responses from seen requests
-  auto opcode = requests.find(xid);
-  if (opcode == requests.end())
-    return nullptr;
+  return decode(client, server, xid, zxid, error, payload, opcode);
+}
+
+unique_ptr<ZKServerMessage> ZKServerMessage::decode(const Endpoint& client,
+  const Endpoint& server, int xid, long long zxid, int error, string_view payload, int opcode) {
+  auto reply = from_reply_payload(client, server, xid, zxid, error, payload, opcode);
+  if (reply != nullptr)
+    reply->opcode_ = opcode;
 
-  switch (opcode->second) {
+  return reply;
+}
+
+unique_ptr<ZKServerMessage> ZKServerMessage::from_reply_payload(const Endpoint& client,
+  const Endpoint& server, int xid, long long zxid, int error, string_view payload, int opcode) {
+  // handle responses from seen requests
+  switch (opcode) {
   case enumToInt(Opcodes::GETDATA):
-    return from_reply_payload_data_stat<GetReply>(move(client), move(server), xid, zxid, error, payload);
+    return from_reply_payload_data_stat<GetReply>(client, server, xid, zxid, error, payload);
   case enumToInt(Opcodes::CREATE):
-    return from_reply_payload_data<CreateReply>(move(client), move(server), xid, zxid, error, payload);
+    return from_reply_payload_data<CreateReply>(client, server, xid, zxid, error, payload);
   case enumToInt(Opcodes::CREATE2):
-    return from_reply_payload_data_stat<CreateReply>(move(client), move(server), xid, zxid, error, payload);
+  case enumToInt(Opcodes::CREATECONTAINER):
+  case enumToInt(Opcodes::CREATETTL):
+    return from_reply_payload_data_stat<CreateReply>(client, server, xid, zxid, error, payload);
   case enumToInt(Opcodes::SETDATA):
-    return from_reply_payload_stat<SetReply>(move(client), move(server), xid, zxid, error, payload);
+    return from_reply_payload_stat<SetReply>(client, server, xid, zxid, error, payload);
   case enumToInt(Opcodes::GETCHILDREN):
-    return from_reply_payload_vector<GetChildrenReply>(move(client), move(server), xid, zxid, error, payload);
+    return from_reply_payload_vector<GetChildrenReply>(client, server, xid, zxid, error, payload);
   case enumToInt(Opcodes::GETCHILDREN2):
-    return from_reply_payload_vector_stat<GetChildrenReply>(move(client), move(server), xid, zxid, error, payload);
+    return from_reply_payload_vector_stat<GetChildrenReply>(client, server, xid, zxid, error, payload);
   case enumToInt(Opcodes::DELETE):
-    return make_unique<DeleteReply>(move(client), move(server), xid, zxid, error);
+    return make_unique<DeleteReply>(client, server, xid, zxid, error);
   case enumToInt(Opcodes::SYNC):
-    return from_reply_payload_data<SyncReply>(move(client), move(server), xid, zxid, error, payload);
+    return from_reply_payload_data<SyncReply>(client, server, xid, zxid, error, payload);
   case enumToInt(Opcodes::EXISTS):
-    return from_reply_payload_stat<ExistsReply>(move(client), move(server), xid, zxid, error, payload);
+    return from_reply_payload_stat<ExistsReply>(client, server, xid, zxid, error, payload);
+  case enumToInt(Opcodes::GETACL):
+    return from_reply_payload_acls_stat(client, server, xid, zxid, error, payload);
+  case enumToInt(Opcodes::SETACL):
+    return from_reply_payload_stat<SetAclReply>(client, server, xid, zxid, error, payload);
+  case enumToInt(Opcodes::MULTI):
+  case enumToInt(Opcodes::MULTIREAD):
+    return MultiReply::from_payload(client, server, xid, zxid, error, payload);
+  case enumToInt(Opcodes::RECONFIG):
+    return from_reply_payload_data_stat<ReconfigReply>(client, server, xid, zxid, error, payload);
+  case enumToInt(Opcodes::GETEPHEMERALS):
+    return from_reply_payload_string_list(client, server, xid, zxid, error, payload);
+  case enumToInt(Opcodes::GETALLCHILDRENNUMBER):
+    return from_reply_payload_int(client, server, xid, zxid, error, payload);
+  case enumToInt(Opcodes::CHECK):
+  case enumToInt(Opcodes::CLOSE):
+  case enumToInt(Opcodes::SETWATCHES):
+  case enumToInt(Opcodes::SETWATCHES2):
+  case enumToInt(Opcodes::SETAUTH):
+  case enumToInt(Opcodes::ADDWATCH):
+  case enumToInt(Opcodes::REMOVEWATCHES):
+  case enumToInt(Opcodes::CHECKWATCHES):
+  case enumToInt(Opcodes::DELETECONTAINER):
+    return make_unique<StatusReply>(client, server, xid, zxid, error, status_reply_name(opcode));
   default:
     break;
   }
@@ -355,60 +583,456 @@ unique_ptr<ZKServerMessage> ZKServerMessage::from_payload(string client, string
   return nullptr;
 }
 
-unique_ptr<WatchEvent> WatchEvent::from_payload(string client, string server, const string& payload,
-  long long zxid, int error) {
+unique_ptr<WatchEvent> WatchEvent::from_payload(const Endpoint& client, const Endpoint& server, string_view payload,
+  long long zxid, int error, PathInterner *paths) {
   // reply_header(16) + event_type(int) + state(int) + path(int + str)
   CHECK_LENGTH(payload, 29);
 
-  int event_type = read_number(payload, 20);
-  int state = read_number(payload, 24);
-  string path = read_buffer(payload, 28);
+  PayloadReader reader(payload, 20);
+  int event_type = reader.read_int();
+  int state = reader.read_int();
+  auto path = reader.read_buffer();
+  if (!reader.ok())
+    return nullptr;
 
-  return make_unique<WatchEvent>(move(client), move(server), zxid, error, event_type, state, path);
+  auto rv = make_unique<WatchEvent>(client, server, zxid, error, event_type, state, string(path));
+  if (paths != nullptr)
+    rv->path_id_ = paths->intern(path);
+  return rv;
 }
 
-unique_ptr<ConnectRequest> ConnectRequest::from_payload(string client, string server, const string& payload) {
+unique_ptr<ConnectRequest> ConnectRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
   // proto(int) + zxid(long) + timeout(int) + session(long) + passwd(int + str) + readonly(bool)
   CHECK_LENGTH(payload, 29);
 
-  int protocol = read_number(payload, 4);
-  long long zxid = read_long(payload, 8);
-  int timeout = read_number(payload, 16);
-  long long session = read_long(payload, 20);
-  string passwd = read_buffer(payload, 28);
-  bool readonly = read_bool(payload, 28 + 4 + passwd.length());
+  PayloadReader reader(payload, 4);
+  int protocol = reader.read_int();
+  long long zxid = reader.read_long();
+  int timeout = reader.read_int();
+  long long session = reader.read_long();
+  auto passwd = reader.read_buffer();
+  if (!reader.ok())
+    return nullptr;
+
+  // older clients don't send it
+  bool readonly = reader.remaining() > 0 && reader.read_bool();
+
+  return make_unique<ConnectRequest>(client, server,
+    protocol, zxid, timeout, session, string(passwd), readonly);
+}
+
+unique_ptr<ConnectReply> ConnectReply::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // proto(int) + timeout(int) + session(long) + passwd(int + str) + readonly(bool)
+  CHECK_LENGTH(payload, 20);
+
+  PayloadReader reader(payload, 4);
+  int protocol = reader.read_int();
+  int timeout = reader.read_int();
+  long long session = reader.read_long();
+  reader.read_buffer();
+  if (!reader.ok())
+    return nullptr;
+
+  bool readonly = reader.remaining() > 0 && reader.read_bool();
 
-  return make_unique<ConnectRequest>(move(client), move(server),
-    protocol, zxid, timeout, session, move(passwd), readonly);
+  return make_unique<ConnectReply>(client, server, protocol, timeout, session, readonly);
 }
 
-unique_ptr<AuthRequest> AuthRequest::from_payload(string client, string server, const string& payload) {
+unique_ptr<AuthRequest> AuthRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
   // xid(int) + opcode(int) + type(int) + scheme(int + str) + cred(int + auth)
   CHECK_LENGTH(payload, 20);
 
-  int type = read_number(payload, 12);
-  string scheme = read_buffer(payload, 16);
-  string cred = read_buffer(payload, 20 + scheme.length());
+  PayloadReader reader(payload, 12);
+  int type = reader.read_int();
+  auto scheme = reader.read_buffer();
+  auto cred = reader.read_buffer();
+  if (!reader.ok())
+    return nullptr;
 
-  return make_unique<AuthRequest>(move(client), move(server), type, move(scheme), move(cred));
+  return make_unique<AuthRequest>(client, server, type, string(scheme), string(cred));
 }
 
-unique_ptr<CreateRequest> CreateRequest::from_payload(string client, string server, const string& payload) {
-  // xid(int) + opcode(int) + path(int + str) + data(str) + acls(vector) + ephemeral(bool) + sequence(bool)
+unique_ptr<CreateRequest> CreateRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + path(int + str) + data(str) + acls(vector) + mode(int) [+ ttl(long)]
   CHECK_LENGTH(payload, 25);
 
-  int xid = read_number(payload, 4);
-  int opcode = read_number(payload, 8);
-  string path = read_buffer(payload, 12);
-  int data_len = read_number(payload, 16 + path.length());
-  auto acls_rv = read_acls(payload, 20 + path.length() + data_len);
-  auto acls = acls_rv.first;
-  int flags = read_number(payload, acls_rv.second);
-  bool ephemeral = (flags & 0x1) == 1;
-  bool sequence = (flags & 0x2) == 2;
-
-  return make_unique<CreateRequest>(move(client), move(server), xid, move(path),
-    ephemeral, sequence, move(acls), opcode);
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  int opcode = reader.read_int();
+  auto path = reader.read_buffer();
+  reader.read_buffer();
+  auto acls = read_acls(reader);
+  int mode = reader.read_int();
+  long long ttl = opcode == enumToInt(Opcodes::CREATETTL) ? reader.read_long() : -1;
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<CreateRequest>(client, server, xid, path,
+    mode, move(acls), opcode, ttl);
+}
+
+unique_ptr<SetAclRequest> SetAclRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + path(int + str) + acls(vector) + version(int)
+  CHECK_LENGTH(payload, 20);
+
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  reader.read_int();
+  auto path = reader.read_buffer();
+  auto acls = read_acls(reader);
+  int version = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<SetAclRequest>(client, server, xid, path, move(acls), version);
+}
+
+unique_ptr<AddWatchRequest> AddWatchRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + path(int + str) + mode(int)
+  CHECK_LENGTH(payload, 16);
+
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  reader.read_int();
+  auto path = reader.read_buffer();
+  int mode = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<AddWatchRequest>(client, server, xid, path, mode);
+}
+
+unique_ptr<RemoveWatchesRequest> RemoveWatchesRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + path(int + str) + type(int)
+  CHECK_LENGTH(payload, 16);
+
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  int opcode = reader.read_int();
+  auto path = reader.read_buffer();
+  int type = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<RemoveWatchesRequest>(client, server, xid, path, type, opcode);
+}
+
+unique_ptr<ReconfigRequest> ReconfigRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + joining(str) + leaving(str) + members(str) + config id(long)
+  CHECK_LENGTH(payload, 28);
+
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  reader.read_int();
+  auto joining = reader.read_buffer();
+  auto leaving = reader.read_buffer();
+  auto members = reader.read_buffer();
+  long long config_id = reader.read_long();
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<ReconfigRequest>(client, server, xid,
+    string(joining), string(leaving), string(members), config_id);
+}
+
+unique_ptr<SetWatchesRequest> SetWatchesRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + relative zxid(long) + data, exist, child(vectors)
+  // [+ persistent, persistent recursive(vectors)]
+  CHECK_LENGTH(payload, 28);
+
+  PayloadReader reader(payload, 8);
+  int opcode = reader.read_int();
+  long long relative_zxid = reader.read_long();
+
+  int kinds = opcode == enumToInt(Opcodes::SETWATCHES2) ? KINDS : CHILD + 1;
+  StringList paths;
+  size_t ends[KINDS];
+  for (int i = 0; i < KINDS; i++) {
+    if (i < kinds)
+      read_string_list(reader, paths);
+    ends[i] = paths.size();
+  }
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<SetWatchesRequest>(client, server, relative_zxid, move(paths), ends, opcode);
+}
+
+unique_ptr<MultiRequest> MultiRequest::from_payload(const Endpoint& client, const Endpoint& server, string_view payload) {
+  // xid(int) + opcode(int) + (header + op)* + header, where header is
+  // type(int) + done(bool) + err(int) and the last one has done set
+  CHECK_LENGTH(payload, 17);
+
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  int opcode = reader.read_int();
+
+  vector<MultiOp> ops;
+  StringList paths;
+  paths.reserve(0, reader.remaining());
+  for (;;) {
+    int type = reader.read_int();
+    bool done = reader.read_bool();
+    reader.read_int();
+    if (!reader.ok())
+      return nullptr;
+    if (done)
+      break;
+
+    MultiOp op{type, -1, 0, false};
+    paths.push_back(reader.read_buffer());
+    switch (type) {
+    case enumToInt(Opcodes::CREATE):
+    case enumToInt(Opcodes::CREATE2):
+    case enumToInt(Opcodes::CREATECONTAINER):
+    case enumToInt(Opcodes::CREATETTL):
+      reader.read_buffer();
+      skip_acls(reader);
+      op.mode = reader.read_int();
+      if (type == enumToInt(Opcodes::CREATETTL))
+	reader.read_long();
+      break;
+    case enumToInt(Opcodes::SETDATA):
+      reader.read_buffer();
+      op.version = reader.read_int();
+      break;
+    case enumToInt(Opcodes::DELETE):
+    case enumToInt(Opcodes::CHECK):
+      op.version = reader.read_int();
+      break;
+    case enumToInt(Opcodes::GETDATA):
+    case enumToInt(Opcodes::GETCHILDREN):
+      op.watch = reader.read_bool();
+      break;
+    default:
+      // can't tell where the next op starts
+      return nullptr;
+    }
+    ops.push_back(op);
+  }
+
+  return make_unique<MultiRequest>(client, server, xid, move(ops), move(paths), opcode);
+}
+
+unique_ptr<MultiReply> MultiReply::from_payload(const Endpoint& client, const Endpoint& server,
+  int xid, long long zxid, int error, string_view payload) {
+  // reply_header(16) + (header + result)* + header, with the same
+  // header as requests
+  CHECK_LENGTH(payload, 16);
+
+  PayloadReader reader(payload, 20);
+  vector<MultiResult> results;
+  while (reader.remaining() > 0) {
+    int type = reader.read_int();
+    bool done = reader.read_bool();
+    int err = reader.read_int();
+    if (!reader.ok())
+      return nullptr;
+    if (done)
+      break;
+
+    switch (type) {
+    case enumToInt(Opcodes::CREATE):
+      reader.read_buffer();
+      break;
+    case enumToInt(Opcodes::CREATE2):
+    case enumToInt(Opcodes::CREATECONTAINER):
+    case enumToInt(Opcodes::CREATETTL):
+      reader.read_buffer();
+      reader.skip(STAT_SIZE);
+      break;
+    case enumToInt(Opcodes::SETDATA):
+      reader.skip(STAT_SIZE);
+      break;
+    case enumToInt(Opcodes::DELETE):
+    case enumToInt(Opcodes::CHECK):
+      break;
+    case enumToInt(Opcodes::GETDATA):
+      reader.read_buffer();
+      reader.skip(STAT_SIZE);
+      break;
+    case enumToInt(Opcodes::GETCHILDREN):
+      skip_vector(reader);
+      break;
+    case enumToInt(Opcodes::ERROR):
+      err = reader.read_int();
+      break;
+    default:
+      return nullptr;
+    }
+    results.push_back(MultiResult{type, err});
+  }
+  if (!reader.ok())
+    return nullptr;
+
+  return make_unique<MultiReply>(client, server, xid, zxid, error, move(results));
+}
+
+unique_ptr<ZKClientMessage> LazyRequest::from_payload(const Endpoint& client, const Endpoint& server,
+  string_view payload, bool copy, PathInterner *paths) {
+  CHECK_LENGTH(payload, 8);
+
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  switch (xid) {
+  case CONNECT_XID:
+  case PING_XID:
+  case AUTH_XID:
+    return ZKClientMessage::from_payload(client, server, payload, paths);
+  default:
+    break;
+  }
+
+  // Every request with a path starts with it. The rest is skipped over
+  // with the same checks the full decoders make, so that lazily or not
+  // the same frames are requests.
+  int opcode = reader.read_int();
+  string_view path;
+  switch (opcode) {
+  case enumToInt(Opcodes::GETDATA):
+  case enumToInt(Opcodes::GETCHILDREN):
+  case enumToInt(Opcodes::GETCHILDREN2):
+  case enumToInt(Opcodes::EXISTS):
+    CHECK_LENGTH(payload, 14);
+    path = reader.read_buffer();
+    reader.read_bool();
+    break;
+  case enumToInt(Opcodes::CREATE):
+  case enumToInt(Opcodes::CREATE2):
+  case enumToInt(Opcodes::CREATECONTAINER):
+  case enumToInt(Opcodes::CREATETTL):
+    CHECK_LENGTH(payload, 25);
+    path = reader.read_buffer();
+    reader.read_buffer();
+    skip_acls(reader);
+    reader.read_int();
+    if (opcode == enumToInt(Opcodes::CREATETTL))
+      reader.read_long();
+    break;
+  case enumToInt(Opcodes::SETDATA):
+    CHECK_LENGTH(payload, 22);
+    path = reader.read_buffer();
+    reader.read_buffer();
+    reader.read_int();
+    break;
+  case enumToInt(Opcodes::DELETE):
+  case enumToInt(Opcodes::CHECK):
+    CHECK_LENGTH(payload, 17);
+    path = reader.read_buffer();
+    reader.read_int();
+    break;
+  case enumToInt(Opcodes::SYNC):
+  case enumToInt(Opcodes::GETACL):
+    CHECK_LENGTH(payload, 17);
+    path = reader.read_buffer();
+    break;
+  case enumToInt(Opcodes::SETACL):
+    CHECK_LENGTH(payload, 20);
+    path = reader.read_buffer();
+    skip_acls(reader);
+    reader.read_int();
+    break;
+  case enumToInt(Opcodes::ADDWATCH):
+  case enumToInt(Opcodes::REMOVEWATCHES):
+  case enumToInt(Opcodes::CHECKWATCHES):
+    CHECK_LENGTH(payload, 16);
+    path = reader.read_buffer();
+    reader.read_int();
+    break;
+  case enumToInt(Opcodes::DELETECONTAINER):
+  case enumToInt(Opcodes::GETEPHEMERALS):
+  case enumToInt(Opcodes::GETALLCHILDRENNUMBER):
+    CHECK_LENGTH(payload, 12);
+    path = reader.read_buffer();
+    break;
+  case enumToInt(Opcodes::MULTI):
+  case enumToInt(Opcodes::MULTIREAD):
+  case enumToInt(Opcodes::RECONFIG):
+  case enumToInt(Opcodes::SETWATCHES):
+  case enumToInt(Opcodes::SETWATCHES2):
+  case enumToInt(Opcodes::CLOSE):
+    // no single path, and only decoding them tells them from garbage
+    return ZKClientMessage::from_payload(client, server, payload, paths);
+  default:
+    return nullptr;
+  }
+  if (!reader.ok())
+    return nullptr;
+
+  auto rv = make_unique<LazyRequest>(client, server, xid, opcode, path, payload, copy);
+  if (paths != nullptr)
+    rv->path_id_ = paths->intern(path);
+  return rv;
+}
+
+const ZKClientMessage *LazyRequest::body() const {
+  if (!decoded_) {
+    body_ = ZKClientMessage::decode(client_, server_, frame_.get());
+    if (body_ != nullptr) {
+      body_->set_timestamp(timestamp_);
+      body_->set_size(size_);
+    }
+    decoded_ = true;
+  }
+  return body_.get();
+}
+
+void LazyRequest::format(Formatter& out) const {
+  if (auto request = body()) {
+    request->format(out);
+    return;
+  }
+
+  out.begin("UndecodedRequest");
+  out.field("client", client_);
+  out.field("server", server_);
+  out.field("xid", xid_);
+  out.field("opcode", opcode_to_name(opcode_));
+  out.field("path", path_);
+  out.end();
+}
+
+unique_ptr<ZKServerMessage> LazyReply::from_payload(const Endpoint& client, const Endpoint& server,
+  string_view payload, int opcode, bool copy, PathInterner *paths) {
+  CHECK_LENGTH(payload, 16);
+
+  PayloadReader reader(payload, 4);
+  int xid = reader.read_int();
+  long long zxid = reader.read_long();
+  int error = reader.read_int();
+  if (!reader.ok())
+    return nullptr;
+
+  if (xid == PING_XID || xid == WATCH_XID)
+    return ZKServerMessage::from_payload(client, server, payload, opcode, paths);
+  if (!known_reply(opcode))
+    return nullptr;
+
+  return make_unique<LazyReply>(client, server, xid, zxid, error, opcode, payload, copy);
+}
+
+const ZKServerMessage *LazyReply::body() const {
+  if (!decoded_) {
+    body_ = decode(client_, server_, xid_, zxid_, error_, frame_.get(), opcode_);
+    if (body_ != nullptr) {
+      body_->set_latency(latency_);
+      body_->set_timestamp(timestamp_);
+      body_->set_size(size_);
+    }
+    decoded_ = true;
+  }
+  return body_.get();
+}
+
+void LazyReply::format(Formatter& out) const {
+  if (auto reply = body()) {
+    reply->format(out);
+    return;
+  }
+
+  begin_reply(out, "UndecodedReply");
+  out.field("opcode", opcode_to_name(opcode_));
+  out.end();
 }
 
 }
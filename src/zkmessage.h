@@ -1,12 +1,20 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
-#include <sstream>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "endpoint.h"
+#include "formatter.h"
+#include "message_pool.h"
+#include "path_interner.h"
+#include "string_list.h"
+
 using namespace std;
 
 namespace Zktraffic {
@@ -34,10 +42,42 @@ enum class Opcodes {
   MULTI = 14,
   CREATE2 = 15,
   RECONFIG = 16,
+  CHECKWATCHES = 17,
+  REMOVEWATCHES = 18,
+  CREATECONTAINER = 19,
+  DELETECONTAINER = 20,
+  CREATETTL = 21,
+  MULTIREAD = 22,
   CREATESESSION = -10,
   CLOSE = -11,
   SETAUTH = 100,
-  SETWATCHES = 101
+  SETWATCHES = 101,
+  SASL = 102,
+  GETEPHEMERALS = 103,
+  GETALLCHILDRENNUMBER = 104,
+  SETWATCHES2 = 105,
+  ADDWATCH = 106,
+  WHOAMI = 107,
+  // the type of a failed op in a multi reply
+  ERROR = -1
+};
+
+// CreateMode, these aren't bit flags (PERSISTENT_WITH_TTL is 5)
+enum class CreateMode {
+  PERSISTENT = 0,
+  EPHEMERAL = 1,
+  PERSISTENT_SEQUENTIAL = 2,
+  EPHEMERAL_SEQUENTIAL = 3,
+  CONTAINER = 4,
+  PERSISTENT_WITH_TTL = 5,
+  PERSISTENT_SEQUENTIAL_WITH_TTL = 6
+};
+
+// What a message is, so consumers can tell without a dynamic_cast.
+enum class MessageKind : uint8_t {
+  REQUEST = 0,
+  REPLY = 1,
+  WATCH = 2
 };
 
 class ZnodeStat {
@@ -50,22 +90,20 @@ public:
     ephemeralOwner_(ephemeralOwner), dataLength_(dataLength),
     numChildren_(numChildren), pzxid_(pzxid) {}
 
-  operator std::string() const {
-    stringstream ss;
-    ss << "Stat(" <<
-      "czxid=" << czxid_ << "," <<
-      "mzxid=" << mzxid_ << "," <<
-      "ctime=" << ctime_ << "," <<
-      "mtime=" << mtime_ << "," <<
-      "version=" << version_ << "," <<
-      "cversion=" << cversion_ << "," <<
-      "aversion=" << aversion_ << "," <<
-      "ephemeralOwner=" << ephemeralOwner_ << "," <<
-      "dataLength=" << dataLength_ << "," <<
-      "numChildren=" << numChildren_ << "," <<
-      "pzxid=" << pzxid_ <<
-      ")";
-    return ss.str();
+  void format(Formatter& out, string_view name) const {
+    out.begin_object(name, "Stat");
+    out.field("czxid", czxid_);
+    out.field("mzxid", mzxid_);
+    out.field("ctime", ctime_);
+    out.field("mtime", mtime_);
+    out.field("version", version_);
+    out.field("cversion", cversion_);
+    out.field("aversion", aversion_);
+    out.field("ephemeralOwner", ephemeralOwner_);
+    out.field("dataLength", dataLength_);
+    out.field("numChildren", numChildren_);
+    out.field("pzxid", pzxid_);
+    out.end_object();
   }
 
   int dataLength() const { return dataLength_; }
@@ -89,19 +127,17 @@ public:
   Acl(int perms, string scheme, string credential) :
     perms_(perms), scheme_(move(scheme)), credential_(move(credential)) {};
 
-  operator std::string() const { return repr(true); }
-
-  string repr(bool newlines=false) const {
-    auto nl = newlines ? "\n" : "";
-    auto prefix = newlines ? "  " : "";
-    stringstream ss;
-    ss << "Acl(" <<  nl <<
-      prefix << "perms=" << perms_ << "," << nl <<
-      prefix << "scheme=" << scheme_ << "," << nl <<
-      prefix << "credential=" << credential_ << nl <<
-      ")" << nl;
-    return ss.str();
-  };
+  static void format(Formatter& out, string_view name, const vector<Acl>& acls) {
+    out.begin_list(name);
+    for (const auto& acl : acls) {
+      out.begin_object("", "Acl");
+      out.field("perms", acl.perms_);
+      out.field("scheme", acl.scheme_);
+      out.field("credential", acl.credential_);
+      out.end_object();
+    }
+    out.end_list();
+  }
 
 private:
   int perms_;
@@ -114,19 +150,71 @@ constexpr int enumToInt(T val) {
   return static_cast<int>(val);
 }
 
+// Opcodes are sparse (negative ones, 100+), this maps them onto a dense
+// range for per-opcode arrays. Returns -1 for anything out of range.
+const int OPCODE_SLOTS = 64;
+
+constexpr int opcode_index(int opcode) {
+  if (opcode >= 0 && opcode < 40)
+    return opcode;
+  if (opcode >= 100 && opcode < 112)
+    return 40 + opcode - 100;
+  if (opcode < 0 && opcode >= -12)
+    return 51 - opcode;
+  return -1;
+}
+
+constexpr int opcode_from_index(int index) {
+  if (index < 40)
+    return index;
+  if (index < 52)
+    return 100 + index - 40;
+  return 51 - index;
+}
+
 class ZKMessage {
 public:
-  ZKMessage(string client, string server, int xid) :
-    client_(std::move(client)), server_(std::move(server)), xid_(xid) {};
-  virtual operator std::string() const = 0;
-
-  const string& client() const { return client_; }
-  const string& server() const { return server_; }
-  int xid() { return xid_; }
+  ZKMessage(const Endpoint& client, const Endpoint& server, int xid, MessageKind kind) :
+    client_(client), server_(server), xid_(xid), kind_(kind) {};
+  // messages are handed around as unique_ptr<ZKMessage>
+  virtual ~ZKMessage() = default;
+
+  // Messages are decoded and dropped at a high rate, so their memory is
+  // recycled (the destructor being virtual, delete gets the real size).
+  static void *operator new(size_t size) { return MessagePool::allocate(size); }
+  static void operator delete(void *p, size_t size) { MessagePool::release(p, size); }
+
+  // Writes the message out field by field, in whichever format out is in.
+  virtual void format(Formatter& out) const = 0;
+  // TEXT, as zkdump prints it
+  operator std::string() const;
+
+  // REQUEST is a ZKClientMessage, REPLY a ZKServerMessage and WATCH a WatchEvent
+  MessageKind kind() const { return kind_; }
+  const Endpoint& client() const { return client_; }
+  const Endpoint& server() const { return server_; }
+  int xid() const { return xid_; }
+  // pcap timestamp of the packet that completed the message, in usecs
+  uint64_t timestamp() const { return timestamp_; }
+  void set_timestamp(uint64_t timestamp) { timestamp_ = timestamp; }
+  // bytes on the wire, length prefix included
+  uint32_t size() const { return size_; }
+  void set_size(uint32_t size) { size_ = size; }
 
-protected:
   static const char * opcode_to_name(int opcode) {
     switch (opcode) {
+    case enumToInt(Opcodes::WHOAMI):
+      return "WHOAMI";
+    case enumToInt(Opcodes::ADDWATCH):
+      return "ADDWATCH";
+    case enumToInt(Opcodes::SETWATCHES2):
+      return "SETWATCHES2";
+    case enumToInt(Opcodes::GETALLCHILDRENNUMBER):
+      return "GETALLCHILDRENNUMBER";
+    case enumToInt(Opcodes::GETEPHEMERALS):
+      return "GETEPHEMERALS";
+    case enumToInt(Opcodes::SASL):
+      return "SASL";
     case enumToInt(Opcodes::SETWATCHES):
       return "SETWATCHES";
     case enumToInt(Opcodes::SETAUTH):
@@ -135,6 +223,18 @@ protected:
       return "CLOSE";
     case enumToInt(Opcodes::CREATESESSION):
       return "CREATESESSION";
+    case enumToInt(Opcodes::MULTIREAD):
+      return "MULTIREAD";
+    case enumToInt(Opcodes::CREATETTL):
+      return "CREATETTL";
+    case enumToInt(Opcodes::DELETECONTAINER):
+      return "DELETECONTAINER";
+    case enumToInt(Opcodes::CREATECONTAINER):
+      return "CREATECONTAINER";
+    case enumToInt(Opcodes::REMOVEWATCHES):
+      return "REMOVEWATCHES";
+    case enumToInt(Opcodes::CHECKWATCHES):
+      return "CHECKWATCHES";
     case enumToInt(Opcodes::RECONFIG):
       return "RECONFIG";
     case enumToInt(Opcodes::CREATE2):
@@ -170,279 +270,288 @@ protected:
     }
     return "unknown";
   }
-  string client_;
-  string server_;
+
+protected:
+  Endpoint client_;
+  Endpoint server_;
   int xid_;
+  uint64_t timestamp_ = 0;
+  uint32_t size_ = 0;
+  MessageKind kind_;
 };
 
 class ZKClientMessage : public ZKMessage {
 public:
-  ZKClientMessage(string client, string server, int xid) :
-    ZKMessage(move(client), move(server), xid) {};
-  ZKClientMessage(string client, string server, int xid, string path) :
-    ZKMessage(move(client), move(server), xid), path_(move(path)) {};
-  ZKClientMessage(string client, string server, int xid, string path, bool watch) :
-    ZKMessage(move(client), move(server), xid), path_(move(path)), watch_(watch) {};
-  ZKClientMessage(string client, string server, int xid, string path, int version) :
-    ZKMessage(move(client), move(server), xid), path_(move(path)), version_(version) {};
-  static std::unique_ptr<ZKClientMessage> from_payload(string, string, const string&);
+  ZKClientMessage(const Endpoint& client, const Endpoint& server, int xid) :
+    ZKMessage(client, server, xid, MessageKind::REQUEST) {};
+  ZKClientMessage(const Endpoint& client, const Endpoint& server, int xid, string_view path) :
+    ZKMessage(client, server, xid, MessageKind::REQUEST), path_(path) {};
+  ZKClientMessage(const Endpoint& client, const Endpoint& server, int xid, string_view path, bool watch) :
+    ZKMessage(client, server, xid, MessageKind::REQUEST), path_(path), watch_(watch) {};
+  ZKClientMessage(const Endpoint& client, const Endpoint& server, int xid, string_view path, int version) :
+    ZKMessage(client, server, xid, MessageKind::REQUEST), path_(path), version_(version) {};
+  // with paths, the message's path gets interned there (see path_id())
+  static std::unique_ptr<ZKClientMessage> from_payload(const Endpoint&, const Endpoint&, string_view,
+    PathInterner *paths = nullptr);
   virtual int opcode() const = 0;
+  string_view path() const { return path_; }
+  // PathInterner::NONE unless decoded with an interner (or without a path)
+  uint32_t path_id() const { return path_id_; }
 
 protected:
-  string req_version(const string& req) const {
-    stringstream ss;
-    ss << req << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  path=" << path_ << "\n" <<
-      "  version=" << version_ << "\n" <<
-      ")\n";
-    return ss.str();
-  }
-  string req_watch(const string& req) const {
-    stringstream ss;
-    ss << req << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  xid=" << xid_ << "\n" <<
-      "  path=" << path_ << "\n" <<
-      "  watch=" << watch_ << "\n" <<
-      ")\n";
-    return ss.str();
-  }
-  string req_path(const string& req) const {
-    stringstream ss;
-    ss << req << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  path=" << path_ << "\n" <<
-      ")\n";
-    return ss.str();
+  static std::unique_ptr<ZKClientMessage> decode(const Endpoint&, const Endpoint&, string_view);
+
+  void req_version(Formatter& out, string_view req) const {
+    out.begin(req);
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("path", path_);
+    out.field("version", version_);
+    out.end();
   }
-  string path_;
+  void req_watch(Formatter& out, string_view req) const {
+    out.begin(req);
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("xid", xid_);
+    out.field("path", path_);
+    out.field("watch", watch_);
+    out.end();
+  }
+  void req_path(Formatter& out, string_view req) const {
+    out.begin(req);
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("path", path_);
+    out.end();
+  }
+  PooledString path_;
   bool watch_;
   int version_;
+  uint32_t path_id_ = PathInterner::NONE;
 };
 
 class ZKServerMessage : public ZKMessage {
 public:
-  ZKServerMessage(string client, string server, int xid, long long zxid, int error) :
-    ZKMessage(move(client), move(server), xid), zxid_(zxid), error_(error) {};
-  static std::unique_ptr<ZKServerMessage> from_payload(string, string,
-      const string&, const unordered_map<int, int>&);
+  ZKServerMessage(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKMessage(client, server, xid, MessageKind::REPLY), zxid_(zxid), error_(error) {};
+  // opcode is the one from the request with this reply's xid, -1 if unknown
+  // with paths, watch events' paths get interned there
+  static std::unique_ptr<ZKServerMessage> from_payload(const Endpoint&, const Endpoint&,
+      string_view, int opcode, PathInterner *paths = nullptr);
+  static int xid_from_payload(string_view);
+
+  long long zxid() const { return zxid_; }
+  int error() const { return error_; }
+  // the request's opcode, -1 if unknown
+  int opcode() const { return opcode_; }
+
+  // usecs between the request and this reply, -1 if unknown
+  long long latency() const { return latency_; }
+  void set_latency(long long latency) { latency_ = latency; }
 
 protected:
-  string reply(const string& replytype) const {
-    stringstream ss;
-    ss << replytype << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  xid=" << xid_ << "\n" <<
-      "  zxid=" << zxid_ << "\n" <<
-      "  error=" << error_ << "\n" <<
-      ")\n";
-    return ss.str();
-  }
-  string reply_data(const string& reply, const string& fname, const string& data) const {
-    stringstream ss;
-    ss << reply << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  xid=" << xid_ << "\n" <<
-      "  zxid=" << zxid_ << "\n" <<
-      "  error=" << error_ << "\n" <<
-      "  " << fname << "=" << data << "\n" <<
-      ")\n";
-    return ss.str();
-  }
-  string reply_data_stat(const string& reply, const string& fname, const string& data, const string& stat) const {
-    stringstream ss;
-    ss << reply << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  xid=" << xid_ << "\n" <<
-      "  zxid=" << zxid_ << "\n" <<
-      "  error=" << error_ << "\n" <<
-      "  " << fname << "=" << data << "\n" <<
-      "  stat=" << stat << "\n" <<
-      ")\n";
-    return ss.str();
-  }
-  string reply_vec_stat(const string& reply, const string& fname, const vector<string>& vec, const string& stat) const {
-    stringstream ss;
-    ss << reply << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  xid=" << xid_ << "\n" <<
-      "  zxid=" << zxid_ << "\n" <<
-      "  error=" << error_ << "\n" <<
-      "  " << fname << "=" << join(vec, ",") << "\n" <<
-      "  stat=" << stat << "\n" <<
-      ")\n";
-    return ss.str();
-  }
-  string reply_stat(const string& reply, const string& stat) const {
-    stringstream ss;
-    ss << reply << "(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  xid=" << xid_ << "\n" <<
-      "  zxid=" << zxid_ << "\n" <<
-      "  error=" << error_ << "\n" <<
-      "  stat=" << stat << "\n" <<
-      ")\n";
-    return ss.str();
-  }
-  string join(const vector<string>& vec, const string& delim) const {
-    bool first = true;
-    stringstream ss;
-    for (auto s: vec) {
-      if (!first)
-	ss << delim;
-      ss << s;
-      first = false;
-    }
-    return ss.str();
+  // the header every reply starts with, the caller adds the rest and end()s
+  void begin_reply(Formatter& out, string_view type) const {
+    out.begin(type);
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("xid", xid_);
+    out.field("zxid", zxid_);
+    out.field("error", error_);
+  }
+  void reply(Formatter& out, string_view type) const {
+    begin_reply(out, type);
+    out.end();
+  }
+  // failed replies have no stat
+  void stat_field(Formatter& out, const optional<ZnodeStat>& stat) const {
+    if (!error_ && stat)
+      stat->format(out, "stat");
+    else
+      out.field_null("stat");
   }
   long long zxid_;
   int error_;
+  int opcode_ = -1;
+  long long latency_ = -1;
+
+  // a reply to opcode (not a ping or watch event) with this header
+  static std::unique_ptr<ZKServerMessage> decode(const Endpoint&, const Endpoint&,
+      int xid, long long zxid, int error, string_view, int opcode);
+
+private:
+  static std::unique_ptr<ZKServerMessage> from_reply_payload(const Endpoint&, const Endpoint&,
+      int xid, long long zxid, int error, string_view, int opcode);
 };
 
 class PingReply : public ZKServerMessage {
 public:
-  PingReply(string client, string server, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), PING_XID, zxid, error) {};
+  PingReply(const Endpoint& client, const Endpoint& server, long long zxid, int error) :
+    ZKServerMessage(client, server, PING_XID, zxid, error) { opcode_ = enumToInt(Opcodes::PING); };
 
-  operator std::string() const { return reply("PingReply"); }
+  void format(Formatter& out) const { reply(out, "PingReply"); }
 };
 
-class GetReply : public ZKServerMessage {
+// The server's answer to a ConnectRequest. It has no reply header: the
+// decoder knows it's one because it's the first thing the server sends on
+// a connection that's handshaking. A session id (and timeout) of 0 means
+// the session the client tried to resume has expired.
+class ConnectReply : public ZKServerMessage {
 public:
-  GetReply(string client, string server, int xid, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-    data_(nullptr), stat_(nullptr) {};
+  ConnectReply(const Endpoint& client, const Endpoint& server, int protocol, int timeout,
+    long long session, bool readonly) :
+    ZKServerMessage(client, server, CONNECT_XID, 0, 0),
+    protocol_(protocol), timeout_(timeout), session_(session), readonly_(readonly) {
+    opcode_ = enumToInt(Opcodes::CONNECT);
+  };
 
-  GetReply(string client, string server, int xid, long long zxid, int error,
-    string data, unique_ptr<ZnodeStat> stat) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-	data_(move(data)), stat_(move(stat)) {};
+  static std::unique_ptr<ConnectReply> from_payload(const Endpoint&, const Endpoint&, string_view);
+  // negotiated, msecs
+  int timeout() const { return timeout_; }
+  long long session() const { return session_; }
+  bool readonly() const { return readonly_; }
+  bool expired() const { return session_ == 0; }
+
+  void format(Formatter& out) const {
+    out.begin("ConnectReply");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field_hex("session", session_);
+    out.field("timeout", timeout_);
+    out.field("readonly", readonly_);
+    out.end();
+  }
 
-  operator std::string() const {
-    auto& data = error_ ? "" : data_;
-    string stat = "";
-    if (!error_)
-      stat = *stat_.get();
-    return reply_data_stat("GetReply", "data", data, stat);
+private:
+  int protocol_;
+  int timeout_;
+  long long session_;
+  bool readonly_;
+};
+
+class GetReply : public ZKServerMessage {
+public:
+  GetReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error),
+    data_() {};
+
+  GetReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    string data, const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error),
+	data_(move(data)), stat_(stat) {};
+
+  void format(Formatter& out) const {
+    begin_reply(out, "GetReply");
+    out.field("data", error_ ? string_view() : data_);
+    stat_field(out, stat_);
+    out.end();
   }
   const string& data() const { return data_; }
 
 private:
   string data_;
-  unique_ptr<ZnodeStat> stat_;
+  optional<ZnodeStat> stat_;
 };
 
 class CreateReply : public ZKServerMessage {
 public:
-  CreateReply(string client, string server, int xid, long long zxid, int error, string path) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-    path_(move(path)), stat_(nullptr) {};
+  CreateReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string path) :
+    ZKServerMessage(client, server, xid, zxid, error),
+    path_(move(path)) {};
 
-  CreateReply(string client, string server, int xid, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-    path_(nullptr), stat_(nullptr) {};
+  CreateReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error),
+    path_() {};
 
-  CreateReply(string client, string server, int xid, long long zxid, int error,
-    string path, unique_ptr<ZnodeStat> stat) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-	path_(move(path)), stat_(move(stat)) {};
+  CreateReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    string path, const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error),
+	path_(move(path)), stat_(stat) {};
 
-  operator std::string() const {
-    const auto name = stat_ == nullptr ? "CreateReply" : "Create2Reply";
-    auto& data = error_ ? "" : path_;
-    string stat = "";
-    if (!error_ && stat_ != nullptr)
-      stat = *stat_.get();
-    return reply_data_stat(name, "path", data, stat);
+  void format(Formatter& out) const {
+    begin_reply(out, stat_ ? "Create2Reply" : "CreateReply");
+    out.field("path", error_ ? string_view() : path_);
+    stat_field(out, stat_);
+    out.end();
   }
 
 private:
   string path_;
-  unique_ptr<ZnodeStat> stat_;
+  optional<ZnodeStat> stat_;
 };
 
 class GetChildrenReply : public ZKServerMessage {
 public:
-  GetChildrenReply(string client, string server, int xid, long long zxid, int error, vector<string> children) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-    children_(move(children)), stat_(nullptr) {};
-
-  GetChildrenReply(string client, string server, int xid, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-    children_(vector<string>{}), stat_(nullptr) {};
-
-  GetChildrenReply(string client, string server, int xid, long long zxid, int error,
-    vector<string> children, unique_ptr<ZnodeStat> stat) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-	children_(move(children)), stat_(move(stat)) {};
-
-  operator std::string() const {
-    const auto name = stat_ == nullptr ? "GetChildrenReply" : "GetChildren2Reply";
-    string stat = "";
-    if (!error_ && stat_ != nullptr)
-      stat = *stat_.get();
-    return reply_vec_stat(name, "children", children_, stat);
+  GetChildrenReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, StringList children) :
+    ZKServerMessage(client, server, xid, zxid, error),
+    children_(move(children)) {};
+
+  GetChildrenReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
+
+  GetChildrenReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    StringList children, const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error),
+	children_(move(children)), stat_(stat) {};
+
+  void format(Formatter& out) const {
+    begin_reply(out, stat_ ? "GetChildren2Reply" : "GetChildrenReply");
+    out.field("children", children_);
+    stat_field(out, stat_);
+    out.end();
   }
 
-  const vector<string>& children() const { return children_; }
+  const StringList& children() const { return children_; }
 
 private:
-  vector<string> children_{};
-  unique_ptr<ZnodeStat> stat_;
+  StringList children_;
+  optional<ZnodeStat> stat_;
 };
 
 class SetReply : public ZKServerMessage {
 public:
-  SetReply(string client, string server, int xid, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error), stat_(nullptr) {};
+  SetReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
 
-  SetReply(string client, string server, int xid, long long zxid, int error,
-    unique_ptr<ZnodeStat> stat) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error), stat_(move(stat)) {};
+  SetReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error), stat_(stat) {};
 
-  const ZnodeStat& stat() const { return *stat_.get(); }
+  const ZnodeStat& stat() const { return *stat_; }
 
-  operator std::string() const {
-    string stat = "";
-    if (!error_ && stat_ != nullptr)
-      stat = *stat_.get();
-    return reply_stat("SetReply", stat);
+  void format(Formatter& out) const {
+    begin_reply(out, "SetReply");
+    stat_field(out, stat_);
+    out.end();
   }
 
 private:
-  unique_ptr<ZnodeStat> stat_;
+  optional<ZnodeStat> stat_;
 };
 
 class DeleteReply : public ZKServerMessage {
 public:
-  DeleteReply(string client, string server, int xid, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error) {};
+  DeleteReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
 
-  operator std::string() const { return reply("DeleteReply"); }
+  void format(Formatter& out) const { reply(out, "DeleteReply"); }
 };
 
 class SyncReply : public ZKServerMessage {
 public:
-  SyncReply(string client, string server, int xid, long long zxid, int error, string path) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
+  SyncReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error, string path) :
+    ZKServerMessage(client, server, xid, zxid, error),
     path_(move(path)) {};
 
-  SyncReply(string client, string server, int xid, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error),
-    path_(nullptr) {};
+  SyncReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error),
+    path_() {};
 
-  operator std::string() const {
-    auto& data = error_ ? "" : path_;
-    return reply_data("SyncReply", "path", data);
+  void format(Formatter& out) const {
+    begin_reply(out, "SyncReply");
+    out.field("path", error_ ? string_view() : path_);
+    out.end();
   }
 
 private:
@@ -451,22 +560,175 @@ private:
 
 class ExistsReply : public ZKServerMessage {
 public:
-  ExistsReply(string client, string server, int xid, long long zxid, int error) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error), stat_(nullptr) {};
+  ExistsReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
 
-  ExistsReply(string client, string server, int xid, long long zxid, int error,
-    unique_ptr<ZnodeStat> stat) :
-    ZKServerMessage(move(client), move(server), xid, zxid, error), stat_(move(stat)) {};
+  ExistsReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error), stat_(stat) {};
 
-  operator std::string() const {
-    string stat = "";
-    if (!error_ && stat_ != nullptr)
-      stat = *stat_.get();
-    return reply_stat("ExistsReply", stat);
+  void format(Formatter& out) const {
+    begin_reply(out, "ExistsReply");
+    stat_field(out, stat_);
+    out.end();
   }
 
 private:
-  unique_ptr<ZnodeStat> stat_;
+  optional<ZnodeStat> stat_;
+};
+
+// Replies that carry nothing but the header: CHECK, CLOSE, SETWATCHES,
+// SETAUTH, ADDWATCH, REMOVEWATCHES/CHECKWATCHES and DELETECONTAINER.
+class StatusReply : public ZKServerMessage {
+public:
+  StatusReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    const char *name) :
+    ZKServerMessage(client, server, xid, zxid, error), name_(name) {};
+
+  void format(Formatter& out) const { reply(out, name_); }
+
+private:
+  const char *name_;
+};
+
+class GetAclReply : public ZKServerMessage {
+public:
+  GetAclReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
+
+  GetAclReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    vector<Acl> acls, const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error),
+	acls_(move(acls)), stat_(stat) {};
+
+  void format(Formatter& out) const {
+    begin_reply(out, "GetAclReply");
+    Acl::format(out, "acls", acls_);
+    stat_field(out, stat_);
+    out.end();
+  }
+  const vector<Acl>& acls() const { return acls_; }
+
+private:
+  vector<Acl> acls_;
+  optional<ZnodeStat> stat_;
+};
+
+class SetAclReply : public ZKServerMessage {
+public:
+  SetAclReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
+
+  SetAclReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error), stat_(stat) {};
+
+  void format(Formatter& out) const {
+    begin_reply(out, "SetAclReply");
+    stat_field(out, stat_);
+    out.end();
+  }
+
+private:
+  optional<ZnodeStat> stat_;
+};
+
+// The new config and its stat, like getData on /zookeeper/config.
+class ReconfigReply : public ZKServerMessage {
+public:
+  ReconfigReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
+
+  ReconfigReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    string data, const ZnodeStat& stat) :
+    ZKServerMessage(client, server, xid, zxid, error),
+	data_(move(data)), stat_(stat) {};
+
+  void format(Formatter& out) const {
+    begin_reply(out, "ReconfigReply");
+    out.field("config", data_);
+    stat_field(out, stat_);
+    out.end();
+  }
+  const string& config() const { return data_; }
+
+private:
+  string data_;
+  optional<ZnodeStat> stat_;
+};
+
+class GetEphemeralsReply : public ZKServerMessage {
+public:
+  GetEphemeralsReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error) :
+    ZKServerMessage(client, server, xid, zxid, error) {};
+
+  GetEphemeralsReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    StringList paths) :
+    ZKServerMessage(client, server, xid, zxid, error), paths_(move(paths)) {};
+
+  void format(Formatter& out) const {
+    begin_reply(out, "GetEphemeralsReply");
+    out.field("paths", paths_);
+    out.end();
+  }
+  const StringList& paths() const { return paths_; }
+
+private:
+  StringList paths_;
+};
+
+class GetAllChildrenNumberReply : public ZKServerMessage {
+public:
+  GetAllChildrenNumberReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    int number = 0) :
+    ZKServerMessage(client, server, xid, zxid, error), number_(number) {};
+
+  void format(Formatter& out) const {
+    begin_reply(out, "GetAllChildrenNumberReply");
+    out.field("number", number_);
+    out.end();
+  }
+  int number() const { return number_; }
+
+private:
+  int number_;
+};
+
+// One entry per op. A failed transaction comes back as ERROR for every
+// op, with the op that failed carrying the error and the others either 0
+// or RUNTIMEINCONSISTENCY.
+struct MultiResult {
+  int opcode;
+  int error;
+};
+
+class MultiReply : public ZKServerMessage {
+public:
+  MultiReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    vector<MultiResult> results = {}) :
+    ZKServerMessage(client, server, xid, zxid, error), results_(move(results)) {};
+
+  static std::unique_ptr<MultiReply> from_payload(const Endpoint&, const Endpoint&,
+    int xid, long long zxid, int error, string_view);
+  const vector<MultiResult>& results() const { return results_; }
+
+  void format(Formatter& out) const {
+    begin_reply(out, "MultiReply");
+    out.begin_list("results");
+    string item;
+    for (const auto& result : results_) {
+      item = result.opcode == enumToInt(Opcodes::ERROR) ? "ERROR" : opcode_to_name(result.opcode);
+      item += '(';
+      Formatter::append_int(item, result.error);
+      item += ')';
+      out.item(item);
+    }
+    out.end_list();
+    out.end();
+  }
+
+private:
+  vector<MultiResult> results_;
 };
 
 enum class EventType {
@@ -488,31 +750,30 @@ enum class State {
 
 class WatchEvent : public ZKServerMessage {
 public:
-  WatchEvent(string client, string server, long long zxid, int error,
+  WatchEvent(const Endpoint& client, const Endpoint& server, long long zxid, int error,
     int event_type, int state, string path) :
-    ZKServerMessage(move(client), move(server), WATCH_XID, zxid, error),
-    event_type_(event_type), state_(state), path_(move(path)) {};
-
-  static std::unique_ptr<WatchEvent> from_payload(string, string, const std::string&, long long, int);
-  operator std::string() const {
-    stringstream ss;
-    ss << "WatchEvent(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  xid=" << xid_ << "\n" <<
-      "  zxid=" << zxid_ << "\n" <<
-      "  error=" << error_ << "\n" <<
-      "  event_type=" << event_to_name(event_type_) << "\n" <<
-      "  state=" << state_to_name(state_) << "\n" <<
-      "  path=" << path_ << "\n" <<
-      ")\n";
-    return ss.str();
+    ZKServerMessage(client, server, WATCH_XID, zxid, error),
+    event_type_(event_type), state_(state), path_(move(path)) { kind_ = MessageKind::WATCH; };
+
+  static std::unique_ptr<WatchEvent> from_payload(const Endpoint&, const Endpoint&, string_view, long long, int,
+    PathInterner *paths = nullptr);
+  int event_type() const { return event_type_; }
+  int state() const { return state_; }
+  const string& path() const { return path_; }
+  uint32_t path_id() const { return path_id_; }
+  void format(Formatter& out) const {
+    begin_reply(out, "WatchEvent");
+    out.field("event_type", event_to_name(event_type_));
+    out.field("state", state_to_name(state_));
+    out.field("path", path_);
+    out.end();
   }
 
 protected:
   int event_type_;
   int state_;
   string path_;
+  uint32_t path_id_ = PathInterner::NONE;
 
 private:
   const char * event_to_name(int event) const {
@@ -554,25 +815,28 @@ private:
 
 class ConnectRequest : public ZKClientMessage {
 public:
-  ConnectRequest(string client, string server, int protocol, long long zxid, int timeout,
+  ConnectRequest(const Endpoint& client, const Endpoint& server, int protocol, long long zxid, int timeout,
     long long session, std::string passwd, bool readonly) :
-    ZKClientMessage(move(client), move(server), CONNECT_XID),
+    ZKClientMessage(client, server, CONNECT_XID),
     protocol_(protocol), zxid_(zxid), timeout_(timeout),
     session_(session), passwd_(move(passwd)), readonly_(readonly) {};
 
-  static std::unique_ptr<ConnectRequest> from_payload(string, string, const std::string&);
+  static std::unique_ptr<ConnectRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
   int opcode() const { return enumToInt(Opcodes::CONNECT); }
-
-  operator std::string() const {
-    std::stringstream ss;
-    ss << "ConnectRequest(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  timeout=" << timeout_ << "\n" <<
-      "  readonly=" << readonly_ << "\n" <<
-      ")\n";
-    return ss.str();
-  };
+  // requested, msecs
+  int timeout() const { return timeout_; }
+  // 0 for a new session, otherwise the one being resumed
+  long long session() const { return session_; }
+  bool readonly() const { return readonly_; }
+
+  void format(Formatter& out) const {
+    out.begin("ConnectRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("timeout", timeout_);
+    out.field("readonly", readonly_);
+    out.end();
+  }
 
 private:
   int protocol_;
@@ -585,43 +849,39 @@ private:
 
 class PingRequest : public ZKClientMessage {
 public:
-  PingRequest(string client, string server) :
-    ZKClientMessage(move(client), move(server), PING_XID) {};
+  PingRequest(const Endpoint& client, const Endpoint& server) :
+    ZKClientMessage(client, server, PING_XID) {};
 
-  static std::unique_ptr<PingRequest> from_payload(string, string, const string&);
+  static std::unique_ptr<PingRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
   int opcode() const { return enumToInt(Opcodes::PING); }
 
-  operator std::string() const {
-    std::stringstream ss;
-    ss << "Ping(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      ")\n";
-    return ss.str();
-  };
+  void format(Formatter& out) const {
+    out.begin("Ping");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.end();
+  }
 
 };
 
 class AuthRequest : public ZKClientMessage {
 public:
-  AuthRequest(string client, string server, int type, string scheme, string credential) :
-    ZKClientMessage(move(client), move(server), AUTH_XID),
+  AuthRequest(const Endpoint& client, const Endpoint& server, int type, string scheme, string credential) :
+    ZKClientMessage(client, server, AUTH_XID),
     type_(type), scheme_(move(scheme)), credential_(move(credential)) {};
 
-  static std::unique_ptr<AuthRequest> from_payload(string, string, const string&);
+  static std::unique_ptr<AuthRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
   int opcode() const { return enumToInt(Opcodes::SETAUTH); }
 
-  operator std::string() const {
-    stringstream ss;
-    ss << "AuthRequest(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  type=" << type_ << "\n" <<
-      "  scheme=" << scheme_ << "\n" <<
-      "  credential=" << credential_ << "\n" <<
-      ")\n";
-    return ss.str();
-  };
+  void format(Formatter& out) const {
+    out.begin("AuthRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("type", type_);
+    out.field("scheme", scheme_);
+    out.field("credential", credential_);
+    out.end();
+  }
 
 private:
   int type_;
@@ -631,83 +891,83 @@ private:
 
 class GetRequest : public ZKClientMessage {
 public:
-  GetRequest(string client, string server, int xid, string path, bool watch, int opcode) :
-    ZKClientMessage(move(client), move(server), xid, move(path), watch) {};
+  GetRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, bool watch, int opcode) :
+    ZKClientMessage(client, server, xid, path, watch) {};
 
-  static std::unique_ptr<GetRequest> from_payload(string, string, const string&);
-  operator std::string() const { return req_watch("GetRequest"); }
+  static std::unique_ptr<GetRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+  void format(Formatter& out) const { req_watch(out, "GetRequest"); }
   int opcode() const { return enumToInt(Opcodes::GETDATA); }
 };
 
 class CreateRequest : public ZKClientMessage {
 public:
-  CreateRequest(string client, string server, int xid, string path,
-    bool ephemeral, bool sequence, vector<Acl> acls, int opcode) :
-    ZKClientMessage(move(client), move(server), xid, move(path)),
-    ephemeral_(ephemeral), sequence_(sequence), acls_(move(acls)), opcode_(opcode) {};
-
-  static std::unique_ptr<CreateRequest> from_payload(string, string, const string&);
-
-  operator std::string() const {
-    auto ephemeral = ephemeral_ ? "true" : "false";
-    auto sequence = sequence_ ? "true" : "false";
-    stringstream ss;
-    ss << "CreateRequest(\n" <<
-      "  client=" << client_ << "\n" <<
-      "  server=" << server_ << "\n" <<
-      "  path=" << path_ << "\n" <<
-      "  ephemeral=" << ephemeral << "\n" <<
-      "  sequence=" << sequence << "\n" <<
-      "  acls=" << acls() << "\n" <<
-      ")\n";
-    return ss.str();
-  };
+  CreateRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path,
+    int mode, vector<Acl> acls, int opcode, long long ttl = -1) :
+    ZKClientMessage(client, server, xid, path),
+    mode_(mode), acls_(move(acls)), opcode_(opcode), ttl_(ttl) {};
+
+  static std::unique_ptr<CreateRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+
+  void format(Formatter& out) const {
+    out.begin("CreateRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("path", path_);
+    out.field("ephemeral", ephemeral_mode() ? "true" : "false");
+    out.field("sequence", sequence_mode() ? "true" : "false");
+    if (mode_ == enumToInt(CreateMode::CONTAINER))
+      out.field("container", "true");
+    if (opcode_ == enumToInt(Opcodes::CREATETTL))
+      out.field("ttl", ttl_);
+    Acl::format(out, "acls", acls_);
+    out.end();
+  }
   int opcode() const { return opcode_; }
+  int mode() const { return mode_; }
+  // msecs, -1 unless it's a CREATETTL
+  long long ttl() const { return ttl_; }
 
 private:
-  string acls() const {
-    bool first = true;
-    stringstream ss;
-    for (auto acl: acls_) {
-      if (!first)
-	ss << ",";
-      ss << acl.repr();
-      first = false;
-    }
-    return ss.str();
-  };
-  bool ephemeral_;
-  bool sequence_;
+  bool ephemeral_mode() const {
+    return mode_ == enumToInt(CreateMode::EPHEMERAL) ||
+      mode_ == enumToInt(CreateMode::EPHEMERAL_SEQUENTIAL);
+  }
+  bool sequence_mode() const {
+    return mode_ == enumToInt(CreateMode::PERSISTENT_SEQUENTIAL) ||
+      mode_ == enumToInt(CreateMode::EPHEMERAL_SEQUENTIAL) ||
+      mode_ == enumToInt(CreateMode::PERSISTENT_SEQUENTIAL_WITH_TTL);
+  }
+  int mode_;
   vector<Acl> acls_;
   int opcode_;
+  long long ttl_;
 };
 
 class SetRequest : public ZKClientMessage {
 public:
-  SetRequest(string client, string server, int xid, string path, int version) :
-    ZKClientMessage(move(client), move(server), xid, move(path), version) {};
+  SetRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, int version) :
+    ZKClientMessage(client, server, xid, path, version) {};
 
-  operator std::string() const { return req_version("SetRequest"); }
+  void format(Formatter& out) const { req_version(out, "SetRequest"); }
   int opcode() const { return enumToInt(Opcodes::SETDATA); }
 };
 
 class DeleteRequest : public ZKClientMessage {
 public:
-  DeleteRequest(string client, string server, int xid, string path, int version) :
-    ZKClientMessage(move(client), move(server), xid, move(path), version) {};
+  DeleteRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, int version) :
+    ZKClientMessage(client, server, xid, path, version) {};
 
-  operator std::string() const { return req_version("DeleteRequest"); }
+  void format(Formatter& out) const { req_version(out, "DeleteRequest"); }
   int opcode() const { return enumToInt(Opcodes::DELETE); }
 };
 
 class GetChildrenRequest : public ZKClientMessage {
 public:
-  GetChildrenRequest(string client, string server, int xid, string path, bool watch, int opcode) :
-    ZKClientMessage(move(client), move(server), xid, move(path), watch), opcode_(opcode) {};
+  GetChildrenRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, bool watch, int opcode) :
+    ZKClientMessage(client, server, xid, path, watch), opcode_(opcode) {};
 
-  operator std::string() const {
-    const auto name = opcode_ == enumToInt(Opcodes::GETCHILDREN) ? "GetChildrenRequest" : "GetChildren2Request";
-    return req_watch(name);
+  void format(Formatter& out) const {
+    req_watch(out, opcode_ == enumToInt(Opcodes::GETCHILDREN) ? "GetChildrenRequest" : "GetChildren2Request");
   }
   int opcode() const { return opcode_; }
 
@@ -717,20 +977,372 @@ private:
 
 class ExistsRequest : public ZKClientMessage {
 public:
-  ExistsRequest(string client, string server, int xid, string path, bool watch, int opcode) :
-    ZKClientMessage(move(client), move(server), xid, move(path), watch) {};
+  ExistsRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, bool watch, int opcode) :
+    ZKClientMessage(client, server, xid, path, watch) {};
 
-  operator std::string() const { return req_watch("ExistsRequest"); }
+  void format(Formatter& out) const { req_watch(out, "ExistsRequest"); }
   int opcode() const { return enumToInt(Opcodes::EXISTS); }
 };
 
 class SyncRequest : public ZKClientMessage {
 public:
-  SyncRequest(string client, string server, int xid, string path) :
-    ZKClientMessage(move(client), move(server), xid, move(path)) {};
+  SyncRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path) :
+    ZKClientMessage(client, server, xid, path) {};
 
-  operator std::string() const { return req_path("SyncRequest"); }
+  void format(Formatter& out) const { req_path(out, "SyncRequest"); }
   int opcode() const { return enumToInt(Opcodes::SYNC); }
 };
 
+class GetAclRequest : public ZKClientMessage {
+public:
+  GetAclRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path) :
+    ZKClientMessage(client, server, xid, path) {};
+
+  void format(Formatter& out) const { req_path(out, "GetAclRequest"); }
+  int opcode() const { return enumToInt(Opcodes::GETACL); }
+};
+
+class SetAclRequest : public ZKClientMessage {
+public:
+  SetAclRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path,
+    vector<Acl> acls, int version) :
+    ZKClientMessage(client, server, xid, path, version), acls_(move(acls)) {};
+
+  static std::unique_ptr<SetAclRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+
+  void format(Formatter& out) const {
+    out.begin("SetAclRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("path", path_);
+    Acl::format(out, "acls", acls_);
+    out.field("version", version_);
+    out.end();
+  }
+  int opcode() const { return enumToInt(Opcodes::SETACL); }
+  const vector<Acl>& acls() const { return acls_; }
+
+private:
+  vector<Acl> acls_;
+};
+
+class CheckRequest : public ZKClientMessage {
+public:
+  CheckRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, int version) :
+    ZKClientMessage(client, server, xid, path, version) {};
+
+  void format(Formatter& out) const { req_version(out, "CheckRequest"); }
+  int opcode() const { return enumToInt(Opcodes::CHECK); }
+};
+
+class CloseRequest : public ZKClientMessage {
+public:
+  CloseRequest(const Endpoint& client, const Endpoint& server, int xid) :
+    ZKClientMessage(client, server, xid) {};
+
+  void format(Formatter& out) const {
+    out.begin("CloseRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("xid", xid_);
+    out.end();
+  }
+  int opcode() const { return enumToInt(Opcodes::CLOSE); }
+};
+
+// Also used for DELETECONTAINER, GETEPHEMERALS (the path is a prefix) and
+// GETALLCHILDRENNUMBER: requests that are just a path.
+class PathRequest : public ZKClientMessage {
+public:
+  PathRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, int opcode) :
+    ZKClientMessage(client, server, xid, path), opcode_(opcode) {};
+
+  void format(Formatter& out) const {
+    switch (opcode_) {
+    case enumToInt(Opcodes::DELETECONTAINER):
+      req_path(out, "DeleteContainerRequest");
+      break;
+    case enumToInt(Opcodes::GETEPHEMERALS):
+      req_path(out, "GetEphemeralsRequest");
+      break;
+    default:
+      req_path(out, "GetAllChildrenNumberRequest");
+    }
+  }
+  int opcode() const { return opcode_; }
+
+private:
+  int opcode_;
+};
+
+enum class AddWatchMode {
+  PERSISTENT = 0,
+  PERSISTENT_RECURSIVE = 1
+};
+
+class AddWatchRequest : public ZKClientMessage {
+public:
+  AddWatchRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path, int mode) :
+    ZKClientMessage(client, server, xid, path), mode_(mode) {};
+
+  static std::unique_ptr<AddWatchRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+
+  void format(Formatter& out) const {
+    out.begin("AddWatchRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("path", path_);
+    out.field("mode", mode_ == enumToInt(AddWatchMode::PERSISTENT_RECURSIVE) ? "persistent_recursive" : "persistent");
+    out.end();
+  }
+  int opcode() const { return enumToInt(Opcodes::ADDWATCH); }
+  int mode() const { return mode_; }
+
+private:
+  int mode_;
+};
+
+enum class WatcherType {
+  CHILDREN = 1,
+  DATA = 2,
+  ANY = 3
+};
+
+// REMOVEWATCHES and CHECKWATCHES
+class RemoveWatchesRequest : public ZKClientMessage {
+public:
+  RemoveWatchesRequest(const Endpoint& client, const Endpoint& server, int xid, string_view path,
+    int type, int opcode) :
+    ZKClientMessage(client, server, xid, path), type_(type), opcode_(opcode) {};
+
+  static std::unique_ptr<RemoveWatchesRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+
+  void format(Formatter& out) const {
+    out.begin(opcode_ == enumToInt(Opcodes::CHECKWATCHES) ? "CheckWatchesRequest" : "RemoveWatchesRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("path", path_);
+    out.field("type", type_to_name(type_));
+    out.end();
+  }
+  int opcode() const { return opcode_; }
+  int type() const { return type_; }
+
+private:
+  static const char * type_to_name(int type) {
+    switch (type) {
+    case enumToInt(WatcherType::CHILDREN):
+      return "children";
+    case enumToInt(WatcherType::DATA):
+      return "data";
+    case enumToInt(WatcherType::ANY):
+      return "any";
+    }
+    return "unknown";
+  }
+  int type_;
+  int opcode_;
+};
+
+class ReconfigRequest : public ZKClientMessage {
+public:
+  ReconfigRequest(const Endpoint& client, const Endpoint& server, int xid,
+    string joining, string leaving, string members, long long config_id) :
+    ZKClientMessage(client, server, xid),
+    joining_(move(joining)), leaving_(move(leaving)), members_(move(members)), config_id_(config_id) {};
+
+  static std::unique_ptr<ReconfigRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+
+  void format(Formatter& out) const {
+    out.begin("ReconfigRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("joining", joining_);
+    out.field("leaving", leaving_);
+    out.field("members", members_);
+    out.field("config_id", config_id_);
+    out.end();
+  }
+  int opcode() const { return enumToInt(Opcodes::RECONFIG); }
+  const string& joining() const { return joining_; }
+  const string& leaving() const { return leaving_; }
+  const string& members() const { return members_; }
+  long long config_id() const { return config_id_; }
+
+private:
+  string joining_;
+  string leaving_;
+  string members_;
+  long long config_id_;
+};
+
+// Sent on reconnect with every watch the client holds, so it can be huge.
+// All the paths share one StringList; SETWATCHES2 adds the persistent
+// (3.6 addWatch) lists.
+class SetWatchesRequest : public ZKClientMessage {
+public:
+  enum Kind { DATA, EXIST, CHILD, PERSISTENT, PERSISTENT_RECURSIVE, KINDS };
+
+  SetWatchesRequest(const Endpoint& client, const Endpoint& server, long long relative_zxid,
+    StringList paths, const size_t (&ends)[KINDS], int opcode) :
+    ZKClientMessage(client, server, SET_WATCHES_XID),
+    relative_zxid_(relative_zxid), paths_(move(paths)), opcode_(opcode) {
+    for (int i = 0; i < KINDS; i++)
+      ends_[i] = ends[i];
+  };
+
+  static std::unique_ptr<SetWatchesRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+
+  void format(Formatter& out) const {
+    out.begin(opcode_ == enumToInt(Opcodes::SETWATCHES2) ? "SetWatches2Request" : "SetWatchesRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("relative_zxid", relative_zxid_);
+    out.field("data", paths_, begin(DATA), ends_[DATA]);
+    out.field("exist", paths_, begin(EXIST), ends_[EXIST]);
+    out.field("child", paths_, begin(CHILD), ends_[CHILD]);
+    if (opcode_ == enumToInt(Opcodes::SETWATCHES2)) {
+      out.field("persistent", paths_, begin(PERSISTENT), ends_[PERSISTENT]);
+      out.field("persistent_recursive", paths_, begin(PERSISTENT_RECURSIVE), ends_[PERSISTENT_RECURSIVE]);
+    }
+    out.end();
+  }
+  int opcode() const { return opcode_; }
+  long long relative_zxid() const { return relative_zxid_; }
+
+  size_t count(Kind kind) const { return ends_[kind] - begin(kind); }
+  string_view path(Kind kind, size_t i) const { return paths_[begin(kind) + i]; }
+  // every path, all kinds
+  const StringList& paths() const { return paths_; }
+
+private:
+  size_t begin(Kind kind) const { return kind == DATA ? 0 : ends_[kind - 1]; }
+
+  long long relative_zxid_;
+  StringList paths_;
+  size_t ends_[KINDS];
+  int opcode_;
+};
+
+// An op in a MULTI or MULTIREAD. version is -1 and watch false where the
+// op doesn't have them.
+struct MultiOp {
+  int opcode;
+  int version;
+  int mode;
+  bool watch;
+};
+
+// Ops are kept flat, with their paths in one StringList, so a big
+// transaction costs a handful of allocations.
+class MultiRequest : public ZKClientMessage {
+public:
+  MultiRequest(const Endpoint& client, const Endpoint& server, int xid,
+    vector<MultiOp> ops, StringList paths, int opcode) :
+    ZKClientMessage(client, server, xid),
+    ops_(move(ops)), paths_(move(paths)), opcode_(opcode) {};
+
+  static std::unique_ptr<MultiRequest> from_payload(const Endpoint&, const Endpoint&, string_view);
+
+  void format(Formatter& out) const {
+    out.begin(opcode_ == enumToInt(Opcodes::MULTIREAD) ? "MultiReadRequest" : "MultiRequest");
+    out.field("client", client_);
+    out.field("server", server_);
+    out.field("xid", xid_);
+    out.begin_list("ops");
+    string item;
+    for (size_t i = 0; i < ops_.size(); i++) {
+      item = opcode_to_name(ops_[i].opcode);
+      item += '(';
+      item += paths_[i];
+      item += ')';
+      out.item(item);
+    }
+    out.end_list();
+    out.end();
+  }
+  int opcode() const { return opcode_; }
+  const vector<MultiOp>& ops() const { return ops_; }
+  string_view path(size_t i) const { return paths_[i]; }
+
+private:
+  vector<MultiOp> ops_;
+  StringList paths_;
+  int opcode_;
+};
+
+// The frame a lazily decoded message views, or a copy of it (pooled, like
+// the message) when the message outlives the buffer the frame was
+// reassembled in.
+class LazyFrame {
+public:
+  LazyFrame(string_view frame, bool copy) : frame_(frame) {
+    if (copy) {
+      copy_ = PooledString(frame);
+      frame_ = copy_;
+    }
+  }
+  LazyFrame(const LazyFrame&) = delete;
+  LazyFrame& operator=(const LazyFrame&) = delete;
+
+  string_view get() const { return frame_; }
+
+private:
+  PooledString copy_;
+  string_view frame_;
+};
+
+// Lazily decoded messages (see SnifferOptions::lazy) only decode the
+// header up front, plus a request's path. The frame is kept and the full
+// message decoded from it the first time body() or format() needs it, so
+// consumers that only look at opcodes, xids, errors and latencies never
+// pay for data, children, ACLs or stats. Like any message, not thread
+// safe: body() belongs to whoever holds it.
+class LazyRequest : public ZKClientMessage {
+public:
+  LazyRequest(const Endpoint& client, const Endpoint& server, int xid, int opcode, string_view path,
+    string_view frame, bool copy) :
+    ZKClientMessage(client, server, xid, path), opcode_(opcode), frame_(frame, copy) {};
+
+  // Requests the Decoder needs whole (connects, auth, pings and closes)
+  // and those without a single path (multis, reconfigs, set watches) come
+  // back fully decoded. The others go through the same checks as when
+  // they're decoded whole, so both ways the same frames are requests.
+  // copy says whether the message outlives payload.
+  static std::unique_ptr<ZKClientMessage> from_payload(const Endpoint&, const Endpoint&, string_view,
+    bool copy, PathInterner *paths = nullptr);
+
+  int opcode() const { return opcode_; }
+  // as ZKClientMessage::from_payload() decodes it, nullptr if it doesn't
+  const ZKClientMessage *body() const;
+  void format(Formatter& out) const;
+
+private:
+  int opcode_;
+  LazyFrame frame_;
+  mutable std::unique_ptr<ZKClientMessage> body_;
+  mutable bool decoded_ = false;
+};
+
+class LazyReply : public ZKServerMessage {
+public:
+  LazyReply(const Endpoint& client, const Endpoint& server, int xid, long long zxid, int error,
+    int opcode, string_view frame, bool copy) :
+    ZKServerMessage(client, server, xid, zxid, error), frame_(frame, copy) { opcode_ = opcode; };
+
+  // As ZKServerMessage::from_payload(), pings and watch events (whose path
+  // gets interned) are decoded whole.
+  static std::unique_ptr<ZKServerMessage> from_payload(const Endpoint&, const Endpoint&, string_view,
+    int opcode, bool copy, PathInterner *paths = nullptr);
+
+  // as ZKServerMessage::from_payload() decodes it, nullptr if it doesn't
+  const ZKServerMessage *body() const;
+  void format(Formatter& out) const;
+
+private:
+  LazyFrame frame_;
+  mutable std::unique_ptr<ZKServerMessage> body_;
+  mutable bool decoded_ = false;
+};
+
 } // Zktraffic
@@ -0,0 +1,94 @@
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/bounded_queue.h"
+
+using namespace std;
+
+using Zktraffic::BoundedQueue;
+using Zktraffic::Overflow;
+
+TEST(BoundedQueue, FifoAndBatches) {
+  BoundedQueue<unique_ptr<int>> queue(8);
+
+  for (int i = 0; i < 5; i++)
+    EXPECT_TRUE(queue.push(make_unique<int>(i)));
+  EXPECT_EQ(queue.size(), 5u);
+
+  vector<unique_ptr<int>> batch;
+  EXPECT_EQ(queue.pop_batch(batch, 3), 3u);
+  EXPECT_EQ(queue.pop_batch(batch, 3), 2u);
+  for (int i = 0; i < 5; i++)
+    EXPECT_EQ(*batch[i], i);
+
+  queue.close();
+  EXPECT_FALSE(queue.push(make_unique<int>(5)));
+  EXPECT_EQ(queue.pop_batch(batch, 3), 0u);
+  EXPECT_EQ(queue.high_water(), 5u);
+}
+
+TEST(BoundedQueue, DropNewest) {
+  BoundedQueue<int> queue(4, Overflow::DROP_NEWEST);
+
+  for (int i = 0; i < 6; i++)
+    queue.push(move(i));
+
+  int item;
+  EXPECT_EQ(queue.dropped(), 2u);
+  EXPECT_TRUE(queue.try_pop(item));
+  EXPECT_EQ(item, 0);
+}
+
+TEST(BoundedQueue, DropOldest) {
+  BoundedQueue<int> queue(4, Overflow::DROP_OLDEST);
+
+  for (int i = 0; i < 6; i++)
+    EXPECT_TRUE(queue.push(move(i)));
+
+  int item;
+  EXPECT_EQ(queue.dropped(), 2u);
+  EXPECT_TRUE(queue.try_pop(item));
+  EXPECT_EQ(item, 2);
+  EXPECT_EQ(queue.high_water(), 4u);
+}
+
+TEST(BoundedQueue, BlockingIsLossless) {
+  const int producers = 3, consumers = 3, per_producer = 50000;
+  BoundedQueue<int> queue(64, Overflow::BLOCK, false);
+  atomic<long long> sum{0};
+  atomic<int> count{0};
+
+  vector<thread> threads;
+  for (int c = 0; c < consumers; c++) {
+    threads.emplace_back([&] {
+      vector<int> batch;
+      while (queue.pop_batch(batch, 16) > 0) {
+	for (auto i : batch)
+	  sum += i;
+	count += batch.size();
+	batch.clear();
+      }
+    });
+  }
+
+  vector<thread> pushers;
+  for (int p = 0; p < producers; p++) {
+    pushers.emplace_back([&] {
+      for (int i = 1; i <= per_producer; i++)
+	queue.push(move(i));
+    });
+  }
+  for (auto& t : pushers)
+    t.join();
+  queue.close();
+  for (auto& t : threads)
+    t.join();
+
+  EXPECT_EQ(count.load(), producers * per_producer);
+  EXPECT_EQ(sum.load(), (long long)producers * per_producer * (per_producer + 1) / 2);
+  EXPECT_EQ(queue.dropped(), 0u);
+  EXPECT_LE(queue.high_water(), 64u);
+}
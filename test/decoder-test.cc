@@ -0,0 +1,81 @@
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/decoder.h"
+
+using namespace std;
+
+using Zktraffic::enumToInt;
+using Zktraffic::Opcodes;
+
+namespace {
+
+// jute encoding, length prefix filled in by frame()
+class Writer {
+public:
+  Writer& i32(int32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out_ += (char)((uint32_t)v >> shift);
+    return *this;
+  }
+  Writer& i64(int64_t v) { return i32(v >> 32).i32(v & 0xffffffff); }
+  Writer& boolean(bool v) { out_ += (char)v; return *this; }
+  Writer& str(const string& s) { i32(s.size()); out_ += s; return *this; }
+  Writer& stat() { out_.append(68, '\0'); return *this; }
+  string frame() const { return Writer().i32(out_.size()).out_ + out_; }
+
+private:
+  string out_;
+};
+
+// one client connection, in sequence
+class Connection {
+public:
+  explicit Connection(Zktraffic::Decoder& decoder) : decoder_(decoder) {}
+
+  void send_up(const string& data, uint64_t timestamp) {
+    decoder_.handle(Zktraffic::TcpPacket(client_, server_, up_seq_, 0, data), timestamp);
+    up_seq_ += data.size();
+  }
+  void send_down(const string& data, uint64_t timestamp) {
+    decoder_.handle(Zktraffic::TcpPacket(server_, client_, down_seq_, 0, data), timestamp);
+    down_seq_ += data.size();
+  }
+
+private:
+  Zktraffic::Decoder& decoder_;
+  Zktraffic::Endpoint client_ = Zktraffic::Endpoint::from_v4(0x0200000a, 40000);
+  Zktraffic::Endpoint server_ = Zktraffic::Endpoint::from_v4(0x0100000a, 2181);
+  uint32_t up_seq_ = 100;
+  uint32_t down_seq_ = 5000;
+};
+
+}
+
+TEST(Decoder, MalformedConnectReply) {
+  Zktraffic::LatencyStats latencies;
+  Zktraffic::BoundedQueue<unique_ptr<Zktraffic::ZKMessage>> queue(16);
+  Zktraffic::Decoder decoder(latencies, queue);
+  Connection conn(decoder);
+
+  conn.send_up(Writer().i32(0).i64(0).i32(30000).i64(0).str(string(16, '\0')).boolean(false).frame(), 1);
+  // too short for a ConnectResponse
+  conn.send_down(Writer().i32(0).i32(30000).frame(), 2);
+
+  // what follows is a plain request and reply, not another handshake
+  conn.send_up(Writer().i32(1).i32(enumToInt(Opcodes::EXISTS)).str("/a").boolean(false).frame(), 3);
+  conn.send_down(Writer().i32(1).i64(5).i32(0).stat().frame(), 4);
+
+  auto stats = decoder.stats();
+  EXPECT_EQ(stats.requests, 2u);
+  EXPECT_EQ(stats.replies, 1u);
+  EXPECT_EQ(stats.undecoded, 1u);
+  EXPECT_EQ(stats.unmatched, 0u);
+
+  auto sessions = decoder.sessions().stats();
+  EXPECT_EQ(sessions.connecting, 0u);
+  EXPECT_EQ(sessions.created, 0u);
+  EXPECT_EQ(sessions.connections, 0u);
+}
@@ -0,0 +1,177 @@
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "src/event_log.h"
+#include "src/sniffer.h"
+#include "src/zkmessage.h"
+
+using namespace std;
+
+using Zktraffic::EventKind;
+using Zktraffic::EventLogReader;
+using Zktraffic::EventLogWriter;
+using Zktraffic::EventRecord;
+
+namespace {
+
+string temp_prefix(const string& name) {
+  return testing::TempDir() + "event-log-test-" + name + "-" + to_string(getpid());
+}
+
+vector<EventRecord> read_all(const string& file) {
+  EventLogReader reader(file);
+  vector<EventRecord> rv;
+  reader.for_each([&rv](const EventRecord& record) { rv.push_back(record); });
+  return rv;
+}
+
+}
+
+TEST(EventLog, RoundTrip) {
+  auto client = Zktraffic::Endpoint::from_v4(0x0100007f, 34236);
+  auto server = Zktraffic::Endpoint::from_v4(0x0100007f, 2181);
+  auto prefix = temp_prefix("roundtrip");
+
+  Zktraffic::GetRequest get(client, server, 7, "/a/b", true, 4);
+  get.set_timestamp(1430935560000000);
+  get.set_size(20);
+  Zktraffic::DeleteReply reply(client, server, 7, 12345678901, -101);
+  reply.set_timestamp(1430935560000250);
+  reply.set_latency(250);
+  Zktraffic::WatchEvent watch(client, server, 12345678905, 0, 3, 3, "/a/b");
+  watch.set_timestamp(1430935559000000);
+
+  {
+    EventLogWriter writer(prefix);
+    EXPECT_TRUE(writer.append(get));
+    EXPECT_TRUE(writer.append(reply));
+    EXPECT_TRUE(writer.append(watch));
+    EXPECT_EQ(writer.records(), 3u);
+  }
+
+  auto file = EventLogWriter::segment_name(prefix, 0);
+  EventLogReader reader(file);
+  ASSERT_TRUE(reader.ok());
+  vector<EventRecord> records;
+  ASSERT_TRUE(reader.next(records));
+  ASSERT_EQ(records.size(), 3u);
+
+  EXPECT_EQ(records[0].kind, EventKind::REQUEST);
+  EXPECT_EQ(records[0].timestamp, get.timestamp());
+  EXPECT_EQ(records[0].client, client);
+  EXPECT_EQ(records[0].server, server);
+  EXPECT_EQ(records[0].xid, 7);
+  EXPECT_EQ(records[0].opcode, 4);
+  EXPECT_EQ(records[0].size, 20u);
+  EXPECT_EQ(reader.path(records[0].path), "/a/b");
+
+  EXPECT_EQ(records[1].kind, EventKind::REPLY);
+  EXPECT_EQ(records[1].zxid, 12345678901);
+  EXPECT_EQ(records[1].error, -101);
+  EXPECT_EQ(records[1].latency, 250);
+  EXPECT_EQ(records[1].path, 0u);
+
+  EXPECT_EQ(records[2].kind, EventKind::WATCH);
+  EXPECT_EQ(records[2].timestamp, watch.timestamp());
+  EXPECT_EQ(records[2].xid, Zktraffic::WATCH_XID);
+  EXPECT_EQ(records[2].zxid, 12345678905);
+  EXPECT_EQ(records[2].event_type, 3);
+  EXPECT_EQ(records[2].path, records[0].path);
+
+  EXPECT_FALSE(reader.next(records));
+  EXPECT_FALSE(reader.truncated());
+  unlink(file.c_str());
+}
+
+TEST(EventLog, SegmentsAndPartialBlocks) {
+  auto client = Zktraffic::Endpoint::from_v4(0x0100007f, 34236);
+  auto server = Zktraffic::Endpoint::from_v4(0x0100007f, 2181);
+  auto prefix = temp_prefix("segments");
+  Zktraffic::EventLogOptions options;
+  options.block_records = 10;
+  options.segment_bytes = 1000;
+
+  EventLogWriter writer(prefix, options);
+  for (int i = 0; i < 1000; i++) {
+    Zktraffic::ExistsRequest exists(client, server, i, "/node-" + to_string(i % 50), false, 3);
+    exists.set_timestamp(1000000 + i * 1000);
+    ASSERT_TRUE(writer.append(exists));
+  }
+  writer.close();
+  ASSERT_GT(writer.segments(), 2u);
+
+  // every segment has its own string table
+  uint64_t count = 0;
+  int expected_xid = 0;
+  for (size_t i = 0; i < writer.segments(); i++) {
+    auto file = EventLogWriter::segment_name(prefix, i);
+    EventLogReader reader(file);
+    ASSERT_TRUE(reader.ok());
+    count += reader.for_each([&reader, &expected_xid](const EventRecord& record) {
+	EXPECT_EQ(record.xid, expected_xid);
+	EXPECT_EQ(reader.path(record.path), "/node-" + to_string(expected_xid % 50));
+	expected_xid++;
+      });
+    EXPECT_FALSE(reader.truncated());
+  }
+  EXPECT_EQ(count, 1000u);
+
+  // blocks outside the range aren't decoded
+  auto first = EventLogWriter::segment_name(prefix, 0);
+  EventLogReader ranged(first);
+  ranged.set_range(1015000, 1025000);
+  auto records = ranged.for_each([](const EventRecord& record) {
+      EXPECT_GE(record.timestamp, 1010000u);
+      EXPECT_LT(record.timestamp, 1030000u);
+    });
+  EXPECT_EQ(records, 20u);
+
+  // a crash mid-block loses that block only
+  auto size = read_all(first).size();
+  ASSERT_EQ(truncate(first.c_str(), EventLogReader(first).bytes() - 3), 0);
+  EventLogReader truncated(first);
+  EXPECT_EQ(truncated.for_each([](const EventRecord&) {}), size - options.block_records);
+  EXPECT_TRUE(truncated.truncated());
+
+  for (size_t i = 0; i < writer.segments(); i++)
+    unlink(EventLogWriter::segment_name(prefix, i).c_str());
+}
+
+TEST(EventLog, Sniffer) {
+  auto prefix = temp_prefix("sniffer");
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true};
+  EventLogWriter writer(prefix);
+
+  sniffer.run();
+  for (;;) {
+    auto message = sniffer.get();
+    if (message == nullptr)
+      break;
+    ASSERT_TRUE(writer.append(*message));
+  }
+  writer.close();
+
+  auto file = EventLogWriter::segment_name(prefix, 0);
+  EventLogReader reader(file);
+  uint64_t requests = 0, replies = 0, godi9 = 0, pings = 0;
+  reader.for_each([&](const EventRecord& record) {
+      if (record.kind == EventKind::REQUEST) {
+	requests++;
+	if (reader.path(record.path) == "/godi9")
+	  godi9++;
+      } else if (record.kind == EventKind::REPLY) {
+	replies++;
+	if (record.opcode == Zktraffic::enumToInt(Zktraffic::Opcodes::PING))
+	  pings++;
+      }
+    });
+  EXPECT_EQ(requests, 18u);
+  EXPECT_EQ(replies, 18u);
+  EXPECT_EQ(godi9, 6u);
+  EXPECT_EQ(pings, 5u);
+  unlink(file.c_str());
+}
@@ -0,0 +1,127 @@
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "src/output_writer.h"
+#include "src/zkmessage.h"
+
+using namespace std;
+
+using Zktraffic::OutputFormat;
+
+namespace {
+
+const auto client = Zktraffic::Endpoint::from_v4(0x0100007f, 34236);
+const auto server = Zktraffic::Endpoint::from_v4(0x0100007f, 2181);
+
+string format(const Zktraffic::ZKMessage& message, OutputFormat format) {
+  string rv;
+  Zktraffic::Formatter out(rv, format);
+  message.format(out);
+  return rv;
+}
+
+Zktraffic::GetAclReply acl_reply() {
+  vector<Zktraffic::Acl> acls{{31, "world", "anyone"}, {1, "digest", "u:p"}};
+  Zktraffic::ZnodeStat stat(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11);
+  return Zktraffic::GetAclReply(client, server, 3, 12, 0, acls, stat);
+}
+
+}
+
+TEST(Formatter, Text) {
+  EXPECT_EQ((string)acl_reply(),
+    "GetAclReply(\n"
+    "  client=127.0.0.1:34236\n"
+    "  server=127.0.0.1:2181\n"
+    "  xid=3\n"
+    "  zxid=12\n"
+    "  error=0\n"
+    "  acls=Acl(perms=31,scheme=world,credential=anyone),Acl(perms=1,scheme=digest,credential=u:p)\n"
+    "  stat=Stat(czxid=1,mzxid=2,ctime=3,mtime=4,version=5,cversion=6,aversion=7,"
+    "ephemeralOwner=8,dataLength=9,numChildren=10,pzxid=11)\n"
+    ")\n");
+
+  // failed replies have no stat
+  Zktraffic::SetReply failed(client, server, 3, 12, -101);
+  EXPECT_EQ((string)failed,
+    "SetReply(\n  client=127.0.0.1:34236\n  server=127.0.0.1:2181\n  xid=3\n  zxid=12\n  error=-101\n  stat=\n)\n");
+
+  Zktraffic::ConnectReply connect(client, server, 0, 30000, 0x1234abcdLL, true);
+  EXPECT_EQ((string)connect,
+    "ConnectReply(\n  client=127.0.0.1:34236\n  server=127.0.0.1:2181\n"
+    "  session=0x1234abcd\n  timeout=30000\n  readonly=1\n)\n");
+
+  uint8_t addr[16] = {0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+  Zktraffic::PingRequest v6(Zktraffic::Endpoint::from_v6(addr, 40000), server);
+  EXPECT_EQ((string)v6, "Ping(\n  client=[fd00::1]:40000\n  server=127.0.0.1:2181\n)\n");
+}
+
+TEST(Formatter, Line) {
+  EXPECT_EQ(format(acl_reply(), OutputFormat::LINE),
+    "GetAclReply client=127.0.0.1:34236 server=127.0.0.1:2181 xid=3 zxid=12 error=0 "
+    "acls=Acl(perms=31,scheme=world,credential=anyone),Acl(perms=1,scheme=digest,credential=u:p) "
+    "stat=Stat(czxid=1,mzxid=2,ctime=3,mtime=4,version=5,cversion=6,aversion=7,"
+    "ephemeralOwner=8,dataLength=9,numChildren=10,pzxid=11)\n");
+
+  // whatever would split the line or a field is escaped
+  Zktraffic::ZnodeStat stat(1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11);
+  Zktraffic::GetReply get(client, server, 3, 12, 0, string("a b\n\\\xff", 6), stat);
+  auto line = format(get, OutputFormat::LINE);
+  EXPECT_NE(line.find(" data=a\\x20b\\x0a\\x5c\\xff "), string::npos) << line;
+  EXPECT_EQ(line.find('\n'), line.size() - 1);
+}
+
+TEST(Formatter, Json) {
+  EXPECT_EQ(format(acl_reply(), OutputFormat::JSON),
+    "{\"type\":\"GetAclReply\",\"client\":\"127.0.0.1:34236\",\"server\":\"127.0.0.1:2181\","
+    "\"xid\":3,\"zxid\":12,\"error\":0,"
+    "\"acls\":[{\"perms\":31,\"scheme\":\"world\",\"credential\":\"anyone\"},"
+    "{\"perms\":1,\"scheme\":\"digest\",\"credential\":\"u:p\"}],"
+    "\"stat\":{\"czxid\":1,\"mzxid\":2,\"ctime\":3,\"mtime\":4,\"version\":5,\"cversion\":6,"
+    "\"aversion\":7,\"ephemeralOwner\":8,\"dataLength\":9,\"numChildren\":10,\"pzxid\":11}}\n");
+
+  Zktraffic::GetReply get(client, server, 3, 12, -101);
+  EXPECT_EQ(format(get, OutputFormat::JSON),
+    "{\"type\":\"GetReply\",\"client\":\"127.0.0.1:34236\",\"server\":\"127.0.0.1:2181\","
+    "\"xid\":3,\"zxid\":12,\"error\":-101,\"data\":\"\",\"stat\":null}\n");
+
+  Zktraffic::StringList children;
+  children.push_back("a\"b");
+  children.push_back(string("\x01\xe9", 2));
+  Zktraffic::GetChildrenReply list(client, server, 3, 12, 0, children);
+  auto json = format(list, OutputFormat::JSON);
+  EXPECT_NE(json.find("\"children\":[\"a\\\"b\",\"\\u0001\\u00e9\"]"), string::npos) << json;
+}
+
+TEST(Formatter, OutputWriter) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+
+  {
+    Zktraffic::OutputWriter writer(fds[1], OutputFormat::TEXT);
+    auto reply = acl_reply();
+    EXPECT_TRUE(writer.write(reply));
+    EXPECT_TRUE(writer.write(reply));
+    EXPECT_EQ(writer.messages(), 2u);
+  }
+  close(fds[1]);
+
+  string got;
+  char buf[4096];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+    got.append(buf, n);
+  close(fds[0]);
+
+  auto text = (string)acl_reply() + "\n";
+  EXPECT_EQ(got, text + text);
+
+  Zktraffic::OutputFormat format;
+  EXPECT_TRUE(Zktraffic::OutputWriter::parse_format("json", format));
+  EXPECT_EQ(format, OutputFormat::JSON);
+  EXPECT_FALSE(Zktraffic::OutputWriter::parse_format("xml", format));
+}
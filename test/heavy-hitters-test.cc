@@ -0,0 +1,104 @@
+#include <map>
+#include <random>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/heavy_hitters.h"
+#include "src/sniffer.h"
+
+using namespace std;
+
+namespace {
+
+// zipf-ish: key i shows up ~1/i as often as key 1
+vector<int> skewed_stream(size_t len, int keys) {
+  mt19937 gen(42);
+  vector<double> weights;
+  for (int i = 1; i <= keys; i++)
+    weights.push_back(1.0 / i);
+  discrete_distribution<int> dist(weights.begin(), weights.end());
+
+  vector<int> rv;
+  for (size_t i = 0; i < len; i++)
+    rv.push_back(dist(gen));
+  return rv;
+}
+
+}
+
+TEST(HeavyHitters, CountMinNeverUnderestimates) {
+  Zktraffic::CountMinSketch sketch(256, 4);
+  map<int, uint64_t> exact;
+
+  for (auto key : skewed_stream(100000, 5000)) {
+    sketch.add(Zktraffic::mix64(key));
+    exact[key]++;
+  }
+
+  size_t too_far = 0;
+  for (const auto& entry : exact) {
+    auto estimate = sketch.estimate(Zktraffic::mix64(entry.first));
+    EXPECT_GE(estimate, entry.second);
+    if (estimate > entry.second + 2.72 / 256 * 100000)
+      too_far++;
+  }
+  // allowed for e^-4 (~2%) of the keys
+  EXPECT_LT(too_far, exact.size() / 50);
+}
+
+TEST(HeavyHitters, SpaceSavingBounds) {
+  const size_t capacity = 100, len = 200000;
+  Zktraffic::SpaceSaving<int> summary(capacity);
+  Zktraffic::SpaceSaving<int> first(capacity), second(capacity);
+  map<int, uint64_t> exact;
+
+  auto stream = skewed_stream(len, 10000);
+  for (size_t i = 0; i < stream.size(); i++) {
+    summary.add(stream[i]);
+    (i % 2 ? first : second).add(stream[i]);
+    exact[stream[i]]++;
+  }
+  first.merge(second);
+
+  for (auto *s : {&summary, &first}) {
+    EXPECT_EQ(s->total(), len);
+    auto top = s->top(capacity);
+    ASSERT_EQ(top.size(), capacity);
+    for (const auto& entry : top) {
+      EXPECT_GE(entry.count, exact[entry.key]);
+      EXPECT_LE(entry.count - entry.error, exact[entry.key]);
+    }
+    // anything above N / capacity must be there, the heaviest first
+    EXPECT_EQ(top[0].key, 0);
+    for (const auto& entry : exact) {
+      if (entry.second <= len / capacity)
+	continue;
+      bool found = false;
+      for (const auto& kept : top)
+	found |= kept.key == entry.first;
+      EXPECT_TRUE(found) << entry.first;
+    }
+  }
+}
+
+TEST(HeavyHitters, Sniffer) {
+  Zktraffic::SnifferOptions options;
+  options.heavy_hitters = 64;
+  options.workers = 2;
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true, options};
+  sniffer.run();
+  while (sniffer.get() != nullptr)
+    ;
+
+  auto snapshot = sniffer.heavy_hitters(1);
+  EXPECT_EQ(snapshot.requests, 18u);
+  ASSERT_EQ(snapshot.paths.size(), 1u);
+  EXPECT_EQ(snapshot.paths[0].key, "/godi9");
+  EXPECT_EQ(snapshot.paths[0].count, 6u);
+  EXPECT_EQ(snapshot.paths[0].lower_bound, 6u);
+  ASSERT_EQ(snapshot.clients.size(), 1u);
+  EXPECT_EQ(snapshot.clients[0].key, "127.0.0.1");
+  ASSERT_EQ(snapshot.client_opcodes.size(), 1u);
+  EXPECT_EQ(snapshot.client_opcodes[0].key, "127.0.0.1 EXISTS");
+}
@@ -0,0 +1,49 @@
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/histogram.h"
+
+using namespace std;
+
+TEST(Histogram, Buckets) {
+  for (uint64_t value : {0ULL, 1ULL, 127ULL, 128ULL, 129ULL, 1000ULL, 123456789ULL, 1ULL << 37}) {
+    auto bucket = Zktraffic::Histogram::bucket_for(value);
+    EXPECT_GE(Zktraffic::Histogram::bucket_limit(bucket), value);
+    if (bucket > 0) {
+      EXPECT_LT(Zktraffic::Histogram::bucket_limit(bucket - 1), value);
+    }
+  }
+  EXPECT_EQ(Zktraffic::Histogram::bucket_for(~0ULL), Zktraffic::Histogram::BUCKETS - 1);
+}
+
+TEST(Histogram, Percentiles) {
+  Zktraffic::Histogram histogram;
+  for (uint64_t value = 1; value <= 10000; value++)
+    histogram.record(value);
+
+  auto snap = histogram.snapshot();
+  EXPECT_EQ(snap.count(), 10000);
+  EXPECT_EQ(snap.max(), 10000);
+  EXPECT_NEAR(snap.percentile(0.5), 5000, 5000 / 64);
+  EXPECT_NEAR(snap.percentile(0.99), 9900, 9900 / 64);
+  EXPECT_NEAR(snap.percentile(0.999), 9990, 9990 / 64);
+  EXPECT_EQ(snap.percentile(1), 10000);
+  EXPECT_DOUBLE_EQ(snap.mean(), 5000.5);
+}
+
+TEST(Histogram, ConcurrentRecord) {
+  Zktraffic::Histogram histogram;
+  vector<thread> threads;
+  for (int i = 0; i < 4; i++)
+    threads.emplace_back([&histogram]() {
+      for (int j = 0; j < 100000; j++)
+        histogram.record(j % 1000);
+    });
+  for (auto& t : threads)
+    t.join();
+
+  EXPECT_EQ(histogram.snapshot().count(), 400000);
+  EXPECT_EQ(histogram.snapshot().max(), 999);
+}
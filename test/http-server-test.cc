@@ -0,0 +1,146 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "src/http_server.h"
+#include "src/metrics.h"
+#include "src/sniffer.h"
+
+using namespace std;
+
+namespace {
+
+int http_connect(int port) {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+string http_get(int port, const string& path) {
+  int fd = http_connect(port);
+  if (fd < 0)
+    return "";
+
+  auto request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+  if (write(fd, request.data(), request.size()) < 0) {
+    close(fd);
+    return "";
+  }
+
+  string response;
+  char buf[4096];
+  ssize_t len;
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    response.append(buf, len);
+  close(fd);
+
+  return response;
+}
+
+}
+
+TEST(HttpServer, Routes) {
+  Zktraffic::HttpServer server("127.0.0.1", 0);
+  server.handle("/hello", []() {
+      Zktraffic::HttpResponse response;
+      response.body = "hi\n";
+      return response;
+    });
+  ASSERT_TRUE(server.start());
+  ASSERT_GT(server.port(), 0);
+
+  auto response = http_get(server.port(), "/hello?x=1");
+  EXPECT_EQ(response.find("HTTP/1.0 200 OK\r\n"), 0u);
+  EXPECT_NE(response.find("Content-Length: 3\r\n"), string::npos);
+  EXPECT_EQ(response.substr(response.size() - 3), "hi\n");
+
+  response = http_get(server.port(), "/nope");
+  EXPECT_EQ(response.find("HTTP/1.0 404 Not Found\r\n"), 0u);
+
+  server.stop();
+}
+
+TEST(HttpServer, IdleConnections) {
+  Zktraffic::HttpServer server("127.0.0.1", 0, chrono::milliseconds(100));
+  server.handle("/hello", []() {
+      Zktraffic::HttpResponse response;
+      response.body = "hi\n";
+      return response;
+    });
+  ASSERT_TRUE(server.start());
+
+  // clients that connect and never send anything
+  vector<int> idle;
+  for (int i = 0; i < Zktraffic::HttpServer::MAX_CONNECTIONS; i++) {
+    int fd = http_connect(server.port());
+    ASSERT_GE(fd, 0);
+    idle.push_back(fd);
+  }
+  EXPECT_EQ(http_get(server.port(), "/hello"), "");
+
+  // they're hung up on once they time out, and there's room again
+  char c;
+  for (int fd : idle) {
+    EXPECT_EQ(read(fd, &c, 1), 0);
+    close(fd);
+  }
+  auto response = http_get(server.port(), "/hello");
+  EXPECT_EQ(response.find("HTTP/1.0 200 OK\r\n"), 0u);
+
+  server.stop();
+}
+
+TEST(HttpServer, Metrics) {
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true};
+  sniffer.run();
+  while (sniffer.get() != nullptr)
+    ;
+
+  Zktraffic::HttpServer server("127.0.0.1", 0);
+  server.handle("/metrics", [&sniffer]() {
+      Zktraffic::HttpResponse response;
+      response.body = Zktraffic::prometheus_metrics(sniffer);
+      return response;
+    });
+  ASSERT_TRUE(server.start());
+
+  auto response = http_get(server.port(), "/metrics");
+  EXPECT_NE(response.find("\nzktraffic_packets_total 58\n"), string::npos);
+  EXPECT_NE(response.find("\nzktraffic_requests_total{opcode=\"PING\"} 5\n"), string::npos);
+  EXPECT_NE(response.find("\nzktraffic_latency_seconds_count{opcode=\"PING\"} 5\n"), string::npos);
+
+  auto json = Zktraffic::json_metrics(sniffer);
+  EXPECT_NE(json.find("\"packets\":58,"), string::npos);
+  EXPECT_NE(json.find("\"PING\":5"), string::npos);
+}
+
+TEST(HttpServer, EnsembleLabels) {
+  Zktraffic::SnifferOptions options;
+  options.servers = Zktraffic::ServerSet("a\"b\\c\nd\te=2181; other=2182");
+  ASSERT_TRUE(options.servers.ok()) << options.servers.error();
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true, options};
+  sniffer.run();
+  while (sniffer.get() != nullptr)
+    ;
+
+  // only backslashes, quotes and newlines are escaped in label values
+  auto metrics = Zktraffic::prometheus_metrics(sniffer);
+  EXPECT_NE(metrics.find("\nzktraffic_ensemble_requests_total{ensemble=\"a\\\"b\\\\c\\nd\te\"} "),
+    string::npos);
+}
@@ -0,0 +1,115 @@
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/message_pool.h"
+#include "src/zkmessage.h"
+
+using namespace std;
+
+using Zktraffic::MessagePool;
+
+TEST(MessagePool, Reuse) {
+  auto p = MessagePool::allocate(100);
+  MessagePool::release(p, 100);
+  // same size class, same thread: the block comes right back
+  EXPECT_EQ(MessagePool::allocate(112), p);
+  MessagePool::release(p, 112);
+
+  // too big to pool
+  auto big = MessagePool::allocate(MessagePool::MAX_SIZE + 1);
+  MessagePool::release(big, MessagePool::MAX_SIZE + 1);
+}
+
+TEST(MessagePool, AcrossThreads) {
+  const size_t count = 4 * MessagePool::BATCH;
+  vector<void *> blocks;
+  thread producer([&] {
+    for (size_t i = 0; i < count; i++)
+      blocks.push_back(MessagePool::allocate(48));
+  });
+  producer.join();
+
+  // released here, the blocks pile up past 2 * BATCH and move to the depot
+  set<void *> released(blocks.begin(), blocks.end());
+  auto before = MessagePool::stats();
+  for (auto p : blocks)
+    MessagePool::release(p, 48);
+  MessagePool::flush();
+  EXPECT_GE(MessagePool::stats().depot, before.depot + count);
+
+  // and another thread gets them back without going to the heap
+  size_t reused = 0;
+  uint64_t heap = 0;
+  thread consumer([&] {
+    auto start = MessagePool::stats().heap;
+    vector<void *> again;
+    for (size_t i = 0; i < count; i++) {
+      again.push_back(MessagePool::allocate(48));
+      reused += released.count(again.back());
+    }
+    heap = MessagePool::stats().heap - start;
+    for (auto p : again)
+      MessagePool::release(p, 48);
+  });
+  consumer.join();
+  EXPECT_EQ(reused, count);
+  EXPECT_EQ(heap, 0u);
+}
+
+TEST(MessagePool, PartialBatches) {
+  // flushing leaves batches of fewer than BATCH blocks in the depot
+  thread releaser([] {
+    vector<void *> blocks;
+    for (int i = 0; i < 3; i++)
+      blocks.push_back(MessagePool::allocate(400));
+    for (auto p : blocks)
+      MessagePool::release(p, 400);
+  });
+  releaser.join();
+
+  thread consumer([] {
+    vector<void *> blocks;
+    for (size_t i = 0; i < MessagePool::BATCH; i++)
+      blocks.push_back(MessagePool::allocate(400));
+    set<void *> distinct(blocks.begin(), blocks.end());
+    EXPECT_EQ(distinct.size(), blocks.size());
+    for (auto p : blocks)
+      MessagePool::release(p, 400);
+  });
+  consumer.join();
+}
+
+TEST(MessagePool, Messages) {
+  auto client = Zktraffic::Endpoint::from_v4(0x0100007f, 34236);
+  auto server = Zktraffic::Endpoint::from_v4(0x0100007f, 2181);
+
+  auto first = make_unique<Zktraffic::PingRequest>(client, server);
+  void *p = first.get();
+  first.reset();
+  auto second = make_unique<Zktraffic::PingRequest>(client, server);
+  EXPECT_EQ(second.get(), p);
+}
+
+TEST(MessagePool, PooledString) {
+  string path = "/service/members/node-0000000042";
+  Zktraffic::PooledString first(path);
+  EXPECT_EQ(string_view(first), path);
+  const void *p = string_view(first).data();
+
+  Zktraffic::PooledString second(move(first));
+  EXPECT_TRUE(first.empty());
+  EXPECT_EQ(string_view(second), path);
+
+  // released into the pool, and handed out again
+  second = Zktraffic::PooledString();
+  Zktraffic::PooledString third(path);
+  EXPECT_EQ(string_view(third).data(), p);
+
+  string big(MessagePool::MAX_SIZE * 2, 'x');
+  Zktraffic::PooledString fourth(big);
+  EXPECT_EQ(string_view(fourth), big);
+  EXPECT_TRUE(Zktraffic::PooledString().empty());
+}
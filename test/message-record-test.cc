@@ -0,0 +1,129 @@
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/message_record.h"
+#include "src/sniffer.h"
+#include "src/stats.h"
+
+using namespace std;
+
+namespace {
+
+vector<unique_ptr<Zktraffic::ZKMessage>> decoded(bool lazy = false) {
+  Zktraffic::SnifferOptions options;
+  options.lazy = lazy;
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true, options};
+  sniffer.run();
+  sniffer.wait();
+
+  vector<unique_ptr<Zktraffic::ZKMessage>> rv;
+  while (!sniffer.empty())
+    rv.push_back(sniffer.get());
+  return rv;
+}
+
+vector<unique_ptr<Zktraffic::MessageBatch>> batched(bool frames, bool lazy = false) {
+  Zktraffic::SnifferOptions options;
+  options.records = true;
+  options.record_frames = frames;
+  options.lazy = lazy;
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true, options};
+  sniffer.run();
+  sniffer.wait();
+
+  vector<unique_ptr<Zktraffic::MessageBatch>> rv;
+  while (auto batch = sniffer.get_records())
+    rv.push_back(move(batch));
+  return rv;
+}
+
+}
+
+TEST(MessageRecord, Sniffer) {
+  auto expected = decoded();
+  auto records = batched(true);
+
+  size_t n = 0;
+  for (const auto& batch : records) {
+    ASSERT_TRUE(batch->has_frames());
+    for (size_t i = 0; i < batch->size(); i++, n++) {
+      ASSERT_LT(n, expected.size());
+      const auto& message = *expected[n];
+      auto record = batch->record(i);
+      EXPECT_EQ(record.kind, message.kind());
+      EXPECT_EQ(record.xid, message.xid());
+      EXPECT_EQ(record.timestamp, message.timestamp());
+      EXPECT_EQ(record.size, message.size());
+      EXPECT_EQ(batch->endpoints()[record.client], message.client());
+      if (message.kind() == Zktraffic::MessageKind::REQUEST) {
+	auto& request = static_cast<const Zktraffic::ZKClientMessage&>(message);
+	EXPECT_EQ(record.opcode, request.opcode());
+	EXPECT_EQ(batch->path(record.path), request.path());
+      }
+
+      // and the message itself, decoded again
+      auto view = batch->message(i);
+      ASSERT_NE(view, nullptr);
+      EXPECT_EQ((string)*view, (string)message);
+    }
+  }
+  EXPECT_EQ(n, expected.size());
+}
+
+TEST(MessageRecord, Lazy) {
+  auto expected = decoded();
+  auto lazy = decoded(true);
+  ASSERT_EQ(lazy.size(), expected.size());
+  for (size_t i = 0; i < lazy.size(); i++) {
+    EXPECT_EQ(lazy[i]->kind(), expected[i]->kind());
+    EXPECT_EQ(lazy[i]->xid(), expected[i]->xid());
+    // bodies get decoded from the copy of the frame, long after it's gone
+    EXPECT_EQ((string)*lazy[i], (string)*expected[i]);
+  }
+
+  // batches only need the headers
+  vector<Zktraffic::MessageRecord> records, lazy_records;
+  for (const auto& batch : batched(false))
+    for (size_t i = 0; i < batch->size(); i++)
+      records.push_back(batch->record(i));
+  for (const auto& batch : batched(false, true))
+    for (size_t i = 0; i < batch->size(); i++)
+      lazy_records.push_back(batch->record(i));
+  ASSERT_EQ(lazy_records.size(), records.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    const auto& a = lazy_records[i];
+    const auto& b = records[i];
+    EXPECT_EQ(tie(a.timestamp, a.zxid, a.latency, a.xid, a.error, a.path, a.size, a.opcode, a.kind),
+      tie(b.timestamp, b.zxid, b.latency, b.xid, b.error, b.path, b.size, b.opcode, b.kind)) << i;
+  }
+}
+
+TEST(MessageRecord, Stats) {
+  Zktraffic::StatsOptions options;
+  options.window = 1;
+
+  Zktraffic::StatsAggregator by_message(options);
+  string expected;
+  for (const auto& message : decoded()) {
+    if (by_message.expired(message->timestamp()))
+      expected += by_message.rotate(message->timestamp());
+    by_message.add(*message);
+  }
+  expected += by_message.rotate();
+
+  Zktraffic::StatsAggregator by_batch(options);
+  string got;
+  for (const auto& batch : batched(false)) {
+    EXPECT_FALSE(batch->has_frames());
+    EXPECT_EQ(batch->message(0), nullptr);
+    for (size_t i = by_batch.add(*batch); i < batch->size(); i = by_batch.add(*batch, i))
+      got += by_batch.rotate(batch->timestamps()[i]);
+  }
+  got += by_batch.rotate();
+
+  EXPECT_EQ(got, expected);
+}
@@ -0,0 +1,88 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/path_interner.h"
+#include "src/sniffer.h"
+
+using namespace std;
+
+TEST(PathInterner, Basic) {
+  Zktraffic::PathInterner paths(16);
+
+  auto a = paths.intern("/service/members/node-1");
+  auto b = paths.intern("/service/members/node-2");
+  EXPECT_NE(a, Zktraffic::PathInterner::NONE);
+  EXPECT_NE(a, b);
+  EXPECT_EQ(paths.intern(string("/service/members/node-1")), a);
+  EXPECT_EQ(paths.path(a), "/service/members/node-1");
+  EXPECT_EQ(paths.path(b), "/service/members/node-2");
+  EXPECT_EQ(paths.intern(""), Zktraffic::PathInterner::NONE);
+  EXPECT_EQ(paths.path(Zktraffic::PathInterner::NONE), "");
+  EXPECT_EQ(paths.size(), 2u);
+
+  auto stats = paths.stats();
+  EXPECT_EQ(stats.lookups, 3u);
+  EXPECT_EQ(stats.hits, 1u);
+  EXPECT_EQ(stats.entries, 2u);
+  EXPECT_GE(stats.bytes, Zktraffic::PathInterner::CHUNK_SIZE);
+}
+
+TEST(PathInterner, Eviction) {
+  Zktraffic::PathInterner paths(64);
+
+  // hot paths, seen over and over
+  vector<uint32_t> hot;
+  for (int i = 0; i < 8; i++) {
+    hot.push_back(paths.intern("/hot/" + to_string(i)));
+    for (int j = 0; j < 10; j++)
+      paths.intern("/hot/" + to_string(i));
+  }
+
+  // one-off sequential nodes, far more than fit
+  uint32_t first = paths.intern("/locks/lock-0000000000");
+  for (int i = 1; i < 10000; i++) {
+    paths.intern("/locks/lock-" + to_string(1000000000 + i));
+    for (size_t j = 0; j < hot.size() && i % 16 == 0; j++)
+      EXPECT_EQ(paths.intern("/hot/" + to_string(j)), hot[j]);
+  }
+
+  EXPECT_LE(paths.size(), paths.capacity());
+  for (size_t i = 0; i < hot.size(); i++)
+    EXPECT_EQ(paths.path(hot[i]), "/hot/" + to_string(i));
+  // evicted ids don't match anything, even once their slot is reused
+  EXPECT_FALSE(paths.contains(first));
+
+  auto stats = paths.stats();
+  EXPECT_GT(stats.evictions, 9000u);
+  // compaction keeps the arena from growing with what was evicted
+  EXPECT_LT(stats.bytes, 4 * Zktraffic::PathInterner::CHUNK_SIZE);
+}
+
+TEST(PathInterner, Sniffer) {
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true};
+  sniffer.run();
+  sniffer.wait();
+
+  uint32_t root = Zktraffic::PathInterner::NONE;
+  size_t with_path = 0;
+  while (!sniffer.empty()) {
+    auto msg = sniffer.get();
+    auto request = dynamic_cast<Zktraffic::ZKClientMessage *>(msg.get());
+    if (request == nullptr || request->path().empty())
+      continue;
+    with_path++;
+    EXPECT_NE(request->path_id(), Zktraffic::PathInterner::NONE);
+    if (request->path() == "/") {
+      if (root != Zktraffic::PathInterner::NONE) {
+	EXPECT_EQ(request->path_id(), root);
+      }
+      root = request->path_id();
+    }
+  }
+
+  auto stats = sniffer.decoder_stats();
+  EXPECT_GT(with_path, 0u);
+  EXPECT_EQ(stats.paths.lookups, with_path);
+  EXPECT_GT(stats.paths.hits, 0u);
+}
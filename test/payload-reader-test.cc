@@ -0,0 +1,56 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/payload_reader.h"
+#include "src/zkmessage.h"
+
+using namespace std;
+
+TEST(PayloadReader, ReadsBigEndian) {
+  string payload("\x00\x00\x00\x2a"
+                 "\x00\x00\x00\x01\x00\x00\x00\x02"
+                 "\x01"
+                 "\x00\x00\x00\x03/ab"
+                 "\xff\xff\xff\xff", 24);
+  Zktraffic::PayloadReader reader(payload);
+
+  EXPECT_EQ(reader.read_int(), 42);
+  EXPECT_EQ(reader.read_long(), (1LL << 32) + 2);
+  EXPECT_TRUE(reader.read_bool());
+  EXPECT_EQ(reader.read_buffer(), "/ab");
+  EXPECT_TRUE(reader.read_buffer().empty());
+  EXPECT_TRUE(reader.ok());
+  EXPECT_EQ(reader.remaining(), 0u);
+}
+
+TEST(PayloadReader, TruncatedIsSticky) {
+  // buffer claims 16 bytes, only 2 are there
+  string payload("\x00\x00\x00\x10zk", 6);
+  Zktraffic::PayloadReader reader(payload);
+
+  EXPECT_TRUE(reader.read_buffer().empty());
+  EXPECT_FALSE(reader.ok());
+  EXPECT_EQ(reader.read_int(), 0);
+  EXPECT_FALSE(reader.ok());
+
+  EXPECT_FALSE(Zktraffic::PayloadReader(payload, 7).ok());
+}
+
+TEST(PayloadReader, TruncatedMessageIsDropped) {
+  auto client = Zktraffic::Endpoint::from_v4(0x0100007f, 34236);
+  auto server = Zktraffic::Endpoint::from_v4(0x0100007f, 2181);
+
+  // getData("/foo", watch) with a path length that runs past the frame
+  string payload("\x00\x00\x00\x11"
+                 "\x00\x00\x00\x01\x00\x00\x00\x04"
+                 "\x00\x00\x01\x00/foo"
+                 "\x01", 21);
+  EXPECT_EQ(Zktraffic::ZKClientMessage::from_payload(client, server, payload), nullptr);
+
+  payload[14] = '\x00';
+  payload[15] = '\x04';
+  auto msg = Zktraffic::ZKClientMessage::from_payload(client, server, payload);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->xid(), 1);
+}
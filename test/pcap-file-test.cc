@@ -0,0 +1,213 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "src/pcap_file.h"
+#include "src/sniffer.h"
+
+using namespace std;
+
+using Zktraffic::PcapFile;
+using Zktraffic::PcapRecord;
+
+namespace {
+
+const string BASIC = "test/data/basic.pcap";
+
+string temp_file(const string& name) {
+  return testing::TempDir() + "pcap-file-test-" + name + "-" + to_string(getpid());
+}
+
+vector<PcapRecord> read_all(PcapFile& file) {
+  vector<PcapRecord> rv;
+  PcapRecord record;
+  while (file.next(record))
+    rv.push_back(record);
+  return rv;
+}
+
+void put32(string& out, uint32_t value) {
+  out.append(reinterpret_cast<const char *>(&value), 4);
+}
+
+void put16(string& out, uint16_t value) {
+  out.append(reinterpret_cast<const char *>(&value), 2);
+}
+
+void write_file(const string& path, const string& data) {
+  auto f = fopen(path.c_str(), "wb");
+  ASSERT_NE(f, nullptr);
+  fwrite(data.data(), 1, data.size(), f);
+  fclose(f);
+}
+
+// pcap with the packets for which keep(index) is true
+string pcap_bytes(const vector<PcapRecord>& records, int linktype, bool (*keep)(size_t)) {
+  string out;
+  put32(out, 0xa1b2c3d4);
+  put16(out, 2);
+  put16(out, 4);
+  put32(out, 0);
+  put32(out, 0);
+  put32(out, 65535);
+  put32(out, linktype);
+  for (size_t i = 0; i < records.size(); i++) {
+    if (!keep(i))
+      continue;
+    put32(out, records[i].timestamp / 1000000);
+    put32(out, records[i].timestamp % 1000000);
+    put32(out, records[i].caplen);
+    put32(out, records[i].len);
+    out.append(reinterpret_cast<const char *>(records[i].data), records[i].caplen);
+  }
+  return out;
+}
+
+// pcapng with nanosecond timestamps
+string pcapng_bytes(const vector<PcapRecord>& records, int linktype) {
+  string out;
+
+  // section header
+  put32(out, 0x0a0d0d0a);
+  put32(out, 28);
+  put32(out, 0x1a2b3c4d);
+  put16(out, 1);
+  put16(out, 0);
+  put32(out, 0xffffffff);
+  put32(out, 0xffffffff);
+  put32(out, 28);
+
+  // interface, with if_tsresol = 9
+  put32(out, 1);
+  put32(out, 32);
+  put16(out, linktype);
+  put16(out, 0);
+  put32(out, 65535);
+  put16(out, 9);
+  put16(out, 1);
+  out.append("\x09\0\0\0", 4);
+  put32(out, 0);
+  put32(out, 32);
+
+  // a block we don't know about
+  put32(out, 0x0bad);
+  put32(out, 16);
+  put32(out, 0);
+  put32(out, 16);
+
+  for (const auto& record : records) {
+    uint32_t padded = (record.caplen + 3) & ~3;
+    uint64_t nanos = record.timestamp * 1000 + 999;
+    put32(out, 6);
+    put32(out, 32 + padded);
+    put32(out, 0);
+    put32(out, nanos >> 32);
+    put32(out, nanos & 0xffffffff);
+    put32(out, record.caplen);
+    put32(out, record.len);
+    out.append(reinterpret_cast<const char *>(record.data), record.caplen);
+    out.append(padded - record.caplen, '\0');
+    put32(out, 32 + padded);
+  }
+
+  return out;
+}
+
+vector<int> xids(Zktraffic::Sniffer& sniffer) {
+  vector<int> rv;
+  for (auto msg = sniffer.get(); msg != nullptr; msg = sniffer.get())
+    rv.push_back(msg->xid());
+  return rv;
+}
+
+}
+
+TEST(PcapFile, Pcap) {
+  PcapFile file(BASIC);
+  ASSERT_TRUE(file.ok());
+  EXPECT_EQ(file.linktype(), DLT_EN10MB);
+
+  auto records = read_all(file);
+  ASSERT_EQ(records.size(), 58u);
+  uint64_t bytes = 0;
+  for (const auto& record : records)
+    bytes += record.len;
+  EXPECT_EQ(bytes, 5414u);
+  EXPECT_EQ(records[0].timestamp / 1000000, 1524267928u);
+
+  PcapFile missing("test/data/missing.pcap");
+  EXPECT_FALSE(missing.ok());
+  EXPECT_FALSE(missing.error().empty());
+}
+
+TEST(PcapFile, Pcapng) {
+  PcapFile basic(BASIC);
+  auto expected = read_all(basic);
+  auto path = temp_file("ng");
+  write_file(path, pcapng_bytes(expected, DLT_EN10MB));
+
+  PcapFile file(path);
+  ASSERT_TRUE(file.ok()) << file.error();
+  EXPECT_EQ(file.linktype(), DLT_EN10MB);
+  auto records = read_all(file);
+  ASSERT_EQ(records.size(), expected.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    EXPECT_EQ(records[i].timestamp, expected[i].timestamp);
+    EXPECT_EQ(records[i].caplen, expected[i].caplen);
+    EXPECT_EQ(string((const char *)records[i].data, records[i].caplen),
+      string((const char *)expected[i].data, expected[i].caplen));
+  }
+
+  // cut short in the middle of the last block
+  auto size = file.size();
+  ASSERT_EQ(truncate(path.c_str(), size - 8), 0);
+  PcapFile truncated(path);
+  EXPECT_EQ(read_all(truncated).size(), expected.size() - 1);
+
+  unlink(path.c_str());
+}
+
+TEST(PcapFile, MergedReplay) {
+  PcapFile basic(BASIC);
+  auto records = read_all(basic);
+  auto even = temp_file("even");
+  auto odd = temp_file("odd");
+  write_file(even, pcap_bytes(records, DLT_EN10MB, [](size_t i) { return i % 2 == 0; }));
+  write_file(odd, pcap_bytes(records, DLT_EN10MB, [](size_t i) { return i % 2 == 1; }));
+
+  Zktraffic::Sniffer single{BASIC, "port 2181", true};
+  single.run();
+  auto expected = xids(single);
+
+  // the halves of one capture, put back together by timestamp
+  Zktraffic::SnifferOptions options;
+  options.merge_files = true;
+  Zktraffic::Sniffer merged{vector<string>{odd, even}, "port 2181", options};
+  merged.run();
+  EXPECT_EQ(xids(merged), expected);
+  merged.wait();
+  EXPECT_EQ(merged.capture_stats().packets, 58u);
+
+  unlink(even.c_str());
+  unlink(odd.c_str());
+}
+
+TEST(PcapFile, ParallelReplay) {
+  Zktraffic::SnifferOptions options;
+  options.file_threads = 2;
+  Zktraffic::Sniffer sniffer{vector<string>{BASIC, BASIC, BASIC}, "port 2181", options};
+  sniffer.run();
+
+  // separate captures, each decoded on its own
+  EXPECT_EQ(xids(sniffer).size(), 3 * 36u);
+  sniffer.wait();
+  auto stats = sniffer.capture_stats();
+  EXPECT_EQ(stats.packets, 3 * 58u);
+  EXPECT_EQ(stats.bytes, 3 * 5414u);
+  EXPECT_EQ(sniffer.decoder_stats().requests, 3 * 18u);
+  EXPECT_EQ(sniffer.latencies().by_opcode()[Zktraffic::enumToInt(Zktraffic::Opcodes::PING)].count(), 15u);
+}
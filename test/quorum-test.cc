@@ -0,0 +1,205 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/quorum.h"
+
+using namespace std;
+
+using Zktraffic::QuorumType;
+using Zktraffic::enumToInt;
+
+namespace {
+
+class Writer {
+public:
+  Writer& i32(int32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out_ += (char)((uint32_t)v >> shift);
+    return *this;
+  }
+  Writer& i64(int64_t v) { return i32(v >> 32).i32(v & 0xffffffff); }
+  Writer& buffer(const string& s) { i32(s.size()); out_ += s; return *this; }
+  Writer& raw(const string& s) { out_ += s; return *this; }
+  // a QuorumPacket, without auth info
+  Writer& packet(QuorumType type, int64_t zxid, const string& data = "") {
+    i32(enumToInt(type)).i64(zxid);
+    if (data.empty())
+      i32(-1);
+    else
+      buffer(data);
+    return i32(-1);
+  }
+  // length prefixed, as election messages go
+  Writer& frame(const string& s) { return buffer(s); }
+  const string& str() const { return out_; }
+
+private:
+  string out_;
+};
+
+string txn(int type) {
+  return Writer().i64(0x100).i32(1).i64(0).i64(0).i32(type).buffer("/a").str();
+}
+
+string notification(int state, int64_t leader, int64_t epoch) {
+  return Writer().i32(state).i64(leader).i64(0x200000005).i64(epoch).i64(2).i32(2).i32(0).str();
+}
+
+// Feeds both directions of one connection to a decoder, keeping track of
+// sequence numbers.
+class Connection {
+public:
+  Connection(Zktraffic::QuorumDecoder& decoder, uint16_t server_port) :
+    decoder_(decoder),
+    client_(Zktraffic::Endpoint::from_v4(0x0200000a, 40000)),
+    server_(Zktraffic::Endpoint::from_v4(0x0100000a, server_port)) {}
+
+  void open() {
+    send_up("", 0, Zktraffic::TcpPacket::SYN);
+    send_down("", 0, Zktraffic::TcpPacket::SYN);
+  }
+  void send_up(const string& data, uint64_t timestamp, uint8_t flags = 0) {
+    send(client_, server_, up_seq_, data, timestamp, flags);
+  }
+  void send_down(const string& data, uint64_t timestamp, uint8_t flags = 0) {
+    send(server_, client_, down_seq_, data, timestamp, flags);
+  }
+
+private:
+  void send(const Zktraffic::Endpoint& src, const Zktraffic::Endpoint& dst, uint32_t& seq,
+    const string& data, uint64_t timestamp, uint8_t flags) {
+    EXPECT_TRUE(decoder_.handle(Zktraffic::TcpPacket(src, dst, seq, flags, data), timestamp));
+    seq += data.size() + ((flags & Zktraffic::TcpPacket::SYN) ? 1 : 0);
+  }
+
+  Zktraffic::QuorumDecoder& decoder_;
+  Zktraffic::Endpoint client_;
+  Zktraffic::Endpoint server_;
+  uint32_t up_seq_ = 100;
+  uint32_t down_seq_ = 5000;
+};
+
+}
+
+TEST(Quorum, Follower) {
+  Zktraffic::QuorumOptions options;
+  options.enabled = true;
+  Zktraffic::QuorumDecoder decoder(options);
+  Connection conn(decoder, 2888);
+
+  conn.open();
+  conn.send_up(Writer().packet(QuorumType::FOLLOWERINFO, 0, Writer().i64(2).i32(0x10000).i64(0).str()).str(), 10);
+  // syncing: replayed proposals don't count
+  conn.send_down(Writer()
+    .packet(QuorumType::LEADERINFO, 0x200000000)
+    .packet(QuorumType::DIFF, 0x100000003)
+    .packet(QuorumType::PROPOSAL, 0x100000003, txn(1))
+    .packet(QuorumType::COMMIT, 0x100000003)
+    .packet(QuorumType::NEWLEADER, 0x200000000).str(), 20);
+  conn.send_up(Writer().packet(QuorumType::ACK, 0x200000000).str(), 30);
+  conn.send_down(Writer().packet(QuorumType::UPTODATE, 0).str(), 40);
+
+  conn.send_down(Writer().packet(QuorumType::PROPOSAL, 0x200000001, txn(1)).str(), 1000);
+  conn.send_up(Writer().packet(QuorumType::ACK, 0x200000001).str(), 1500);
+  conn.send_down(Writer().packet(QuorumType::COMMIT, 0x200000001).str(), 3000);
+  // split across segments
+  auto proposal = Writer().packet(QuorumType::PROPOSAL, 0x200000002, txn(5)).str();
+  conn.send_down(proposal.substr(0, 7), 4000);
+  conn.send_down(proposal.substr(7), 4000);
+  conn.send_down(Writer().packet(QuorumType::PING, 0x200000002).str(), 5000);
+
+  auto stats = decoder.stats();
+  EXPECT_EQ(stats.undecoded, 0u);
+  EXPECT_EQ(stats.packets_by_type[enumToInt(QuorumType::PROPOSAL)], 3u);
+  EXPECT_EQ(stats.proposals, 2u);
+  EXPECT_EQ(stats.proposals_by_txn[Zktraffic::opcode_index(1)], 1u);
+  EXPECT_EQ(stats.proposals_by_txn[Zktraffic::opcode_index(5)], 1u);
+  ASSERT_EQ(stats.followers.size(), 1u);
+  const auto& f = stats.followers[0];
+  EXPECT_EQ(f.sid, 2);
+  EXPECT_FALSE(f.observer);
+  EXPECT_EQ(f.diffs, 1u);
+  EXPECT_EQ(f.proposals, 2u);
+  EXPECT_EQ(f.acks, 1u);
+  EXPECT_EQ(f.commits, 1u);
+  EXPECT_EQ(f.pings, 1u);
+  EXPECT_EQ(f.pending_acks, 1u);
+  EXPECT_EQ(f.pending_commits, 1u);
+  EXPECT_EQ(f.last_committed, 0x200000001);
+  EXPECT_EQ(f.ack_latency.count(), 1u);
+  EXPECT_EQ(f.ack_latency.max(), 500u);
+  EXPECT_EQ(f.commit_latency.max(), 2000u);
+
+  // not quorum traffic
+  auto client = Zktraffic::Endpoint::from_v4(0x0200000a, 40000);
+  auto server = Zktraffic::Endpoint::from_v4(0x0100000a, 2181);
+  EXPECT_FALSE(decoder.handle(Zktraffic::TcpPacket(client, server, 1, 0, "x"), 0));
+}
+
+TEST(Quorum, Snapshot) {
+  Zktraffic::QuorumOptions options;
+  options.enabled = true;
+  Zktraffic::QuorumDecoder decoder(options);
+  Connection conn(decoder, 2888);
+
+  conn.open();
+  conn.send_down(Writer().packet(QuorumType::SNAP, 0x100000009).str(), 10);
+  // the snapshot, its signature split in two
+  string snapshot(1000, 'x');
+  string signature = Writer().buffer("BenWasHere").str();
+  conn.send_down(snapshot + signature.substr(0, 6), 20);
+  conn.send_down(signature.substr(6) + Writer().packet(QuorumType::NEWLEADER, 0x200000000).str(), 30);
+  conn.send_down(Writer().packet(QuorumType::UPTODATE, 0).str(), 40);
+  conn.send_down(Writer().packet(QuorumType::PROPOSAL, 0x200000001, txn(2)).str(), 50);
+
+  auto stats = decoder.stats();
+  EXPECT_EQ(stats.undecoded, 0u);
+  EXPECT_EQ(stats.packets_by_type[enumToInt(QuorumType::NEWLEADER)], 1u);
+  ASSERT_EQ(stats.followers.size(), 1u);
+  EXPECT_EQ(stats.followers[0].snapshots, 1u);
+  EXPECT_EQ(stats.followers[0].snapshot_bytes, snapshot.size() + signature.size());
+  EXPECT_EQ(stats.followers[0].pending_acks, 1u);
+
+  // garbage is skipped up to the next segment
+  conn.send_down("garbage, not a packet", 60);
+  conn.send_down(Writer().packet(QuorumType::COMMIT, 0x200000001).str(), 70);
+  stats = decoder.stats();
+  EXPECT_EQ(stats.undecoded, 1u);
+  EXPECT_EQ(stats.followers[0].commits, 1u);
+}
+
+TEST(Quorum, Election) {
+  Zktraffic::QuorumOptions options;
+  options.enabled = true;
+  Zktraffic::QuorumDecoder decoder(options);
+  Connection conn(decoder, 3888);
+
+  conn.open();
+  // protocol version, sid and addresses, then a vote
+  conn.send_up(Writer().i64(-65535).i64(3).buffer("10.0.0.2:3888")
+    .frame(notification(0, 3, 5)).str(), 1000000);
+  conn.send_down(Writer().frame(notification(0, 1, 5)).str(), 1200000);
+  conn.send_down(Writer().frame(notification(2, 1, 5)).str(), 2000000);
+  // a peer too old to send a peer epoch
+  conn.send_up(Writer().frame(notification(1, 1, 5).substr(0, 28)).str(), 2100000);
+
+  auto stats = decoder.stats();
+  EXPECT_EQ(stats.undecoded, 0u);
+  EXPECT_EQ(stats.notifications, 4u);
+  EXPECT_EQ(stats.notifications_by_state[0], 2u);
+  EXPECT_EQ(stats.elections, 1u);
+  EXPECT_EQ(stats.election_epoch, 5);
+  EXPECT_EQ(stats.election_usecs, 200000u);
+  ASSERT_EQ(stats.votes.size(), 2u);
+  for (const auto& vote : stats.votes) {
+    if (vote.sid == 3) {
+      EXPECT_EQ(vote.notification.state, 1);
+      EXPECT_EQ(vote.notification.peer_epoch, -1);
+    } else {
+      EXPECT_EQ(vote.from.port, 3888);
+      EXPECT_EQ(vote.notification.state, 2);
+      EXPECT_EQ(vote.notification.leader, 1);
+    }
+  }
+}
@@ -0,0 +1,114 @@
+#include "gtest/gtest.h"
+
+#include "src/request_table.h"
+
+using namespace std;
+
+namespace {
+
+Zktraffic::FlowKey conn(uint16_t port) {
+  return Zktraffic::FlowKey{
+    Zktraffic::Endpoint::from_v4(0x0100007f, port),
+    Zktraffic::Endpoint::from_v4(0x0100007f, 2181),
+  };
+}
+
+}
+
+TEST(RequestTable, SameXidDifferentConnections) {
+  Zktraffic::RequestTable requests;
+  Zktraffic::RequestTable::Request request;
+
+  requests.add(conn(1000), 7, 4, 0);
+  requests.add(conn(1001), 7, 8, 0);
+
+  EXPECT_TRUE(requests.take(conn(1001), 7, request));
+  EXPECT_EQ(request.opcode, 8);
+  EXPECT_TRUE(requests.take(conn(1000), 7, request));
+  EXPECT_EQ(request.opcode, 4);
+  EXPECT_FALSE(requests.take(conn(1000), 7, request));
+  EXPECT_EQ(requests.unmatched(), 1);
+  EXPECT_EQ(requests.size(), 0);
+}
+
+TEST(RequestTable, CapacityEvictsOldest) {
+  Zktraffic::RequestTable requests(4);
+  Zktraffic::RequestTable::Request request;
+
+  for (int xid = 1; xid <= 6; xid++)
+    requests.add(conn(1000), xid, 4, 0);
+
+  EXPECT_EQ(requests.size(), 4);
+  EXPECT_EQ(requests.evictions(), 2);
+  EXPECT_FALSE(requests.take(conn(1000), 1, request));
+  EXPECT_FALSE(requests.take(conn(1000), 2, request));
+  EXPECT_TRUE(requests.take(conn(1000), 3, request));
+}
+
+TEST(RequestTable, CompletedRequestsDontCauseEvictions) {
+  Zktraffic::RequestTable requests(4);
+  Zktraffic::RequestTable::Request request;
+
+  // a slow request stays in flight while many others come and go
+  requests.add(conn(1000), 1, 9, 0);
+  for (int xid = 2; xid < 1000; xid++) {
+    requests.add(conn(1000), xid, 4, 0);
+    EXPECT_TRUE(requests.take(conn(1000), xid, request));
+  }
+
+  EXPECT_EQ(requests.evictions(), 0);
+  EXPECT_TRUE(requests.take(conn(1000), 1, request));
+  EXPECT_EQ(request.opcode, 9);
+}
+
+TEST(RequestTable, MaxAge) {
+  Zktraffic::RequestTable requests(16, 10);
+  Zktraffic::RequestTable::Request request;
+
+  requests.add(conn(1000), 1, 4, 100000000);
+  requests.add(conn(1000), 2, 4, 105000000);
+  requests.add(conn(1000), 3, 4, 111000000);
+
+  EXPECT_EQ(requests.evictions(), 1);
+  EXPECT_FALSE(requests.take(conn(1000), 1, request));
+  EXPECT_TRUE(requests.take(conn(1000), 2, request));
+  EXPECT_EQ(request.timestamp, 105000000);
+}
+
+TEST(RequestTable, Collisions) {
+  Zktraffic::RequestTable requests(1024);
+  Zktraffic::RequestTable::Request request;
+
+  for (int xid = 0; xid < 1024; xid++)
+    requests.add(conn(1000 + xid % 7), xid, xid, 0);
+  for (int xid = 0; xid < 1024; xid += 2)
+    EXPECT_TRUE(requests.take(conn(1000 + xid % 7), xid, request));
+  for (int xid = 1; xid < 1024; xid += 2) {
+    EXPECT_TRUE(requests.take(conn(1000 + xid % 7), xid, request));
+    EXPECT_EQ(request.opcode, xid);
+  }
+  EXPECT_EQ(requests.size(), 0);
+}
+
+TEST(RequestTable, ChurnKeepsInsertionOrder) {
+  Zktraffic::RequestTable requests(4);
+  Zktraffic::RequestTable::Request request;
+
+  for (int xid = 1; xid <= 3; xid++)
+    requests.add(conn(1000), xid, xid, 0);
+  for (int xid = 100; xid < 1000; xid++) {
+    requests.add(conn(1001), xid, 4, 0);
+    EXPECT_TRUE(requests.take(conn(1001), xid, request));
+  }
+
+  // the fifth request in flight evicts the first one, not whichever the
+  // churn left at the front
+  requests.add(conn(1000), 4, 4, 0);
+  requests.add(conn(1000), 5, 5, 0);
+  EXPECT_EQ(requests.evictions(), 1);
+  EXPECT_FALSE(requests.take(conn(1000), 1, request));
+  for (int xid = 2; xid <= 5; xid++) {
+    EXPECT_TRUE(requests.take(conn(1000), xid, request));
+    EXPECT_EQ(request.opcode, xid);
+  }
+}
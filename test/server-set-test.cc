@@ -0,0 +1,100 @@
+#include <arpa/inet.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/metrics.h"
+#include "src/server_set.h"
+#include "src/sniffer.h"
+
+using namespace std;
+
+namespace {
+
+Zktraffic::Endpoint v4(const char *addr, uint16_t port) {
+  uint32_t raw;
+  inet_pton(AF_INET, addr, &raw);
+  return Zktraffic::Endpoint::from_v4(raw, port);
+}
+
+Zktraffic::Endpoint v6(const char *addr, uint16_t port) {
+  uint8_t raw[16];
+  inet_pton(AF_INET6, addr, raw);
+  return Zktraffic::Endpoint::from_v6(raw, port);
+}
+
+void drain(Zktraffic::Sniffer& sniffer) {
+  sniffer.run();
+  while (sniffer.get() != nullptr)
+    ;
+  sniffer.wait();
+}
+
+}
+
+TEST(ServerSet, Default) {
+  Zktraffic::ServerSet servers;
+  ASSERT_TRUE(servers.ok());
+  EXPECT_EQ(servers.ensembles(), vector<string>{"2181"});
+  EXPECT_EQ(servers.ensemble(v4("10.0.0.1", 2181)), 0);
+  EXPECT_EQ(servers.ensemble(v6("fd00::1", 2181)), 0);
+  EXPECT_FALSE(servers.is_server(v4("10.0.0.1", 34567)));
+  EXPECT_EQ(servers.filter(), "tcp and (port 2181)");
+}
+
+TEST(ServerSet, Ensembles) {
+  Zktraffic::ServerSet servers("prod=2181-2183,2184; test=10.1.0.0/16:2181,[fd00::/8]:2281");
+  ASSERT_TRUE(servers.ok()) << servers.error();
+  EXPECT_EQ(servers.ensembles(), (vector<string>{"prod", "test"}));
+
+  // the more specific rule wins, the port-only one catches the rest
+  EXPECT_EQ(servers.ensemble(v4("10.1.2.3", 2181)), 1);
+  EXPECT_EQ(servers.ensemble(v4("10.2.2.3", 2181)), 0);
+  EXPECT_EQ(servers.ensemble(v4("10.1.2.3", 2184)), 0);
+  EXPECT_EQ(servers.ensemble(v6("fd12::5", 2281)), 1);
+  EXPECT_EQ(servers.ensemble(v6("fe80::5", 2281)), -1);
+  EXPECT_EQ(servers.ensemble(v4("10.1.2.3", 2281)), -1);
+
+  EXPECT_EQ(servers.filter(), "tcp and (portrange 2181-2184 or "
+    "(src net 10.1.0.0/16 and src port 2181) or (dst net 10.1.0.0/16 and dst port 2181) or "
+    "(src net fd00::/8 and src port 2281) or (dst net fd00::/8 and dst port 2281))");
+}
+
+TEST(ServerSet, Errors) {
+  EXPECT_FALSE(Zktraffic::ServerSet("").ok());
+  EXPECT_FALSE(Zktraffic::ServerSet("70000").ok());
+  EXPECT_FALSE(Zktraffic::ServerSet("2182-2181").ok());
+  EXPECT_FALSE(Zktraffic::ServerSet("10.0.0.0/33:2181").ok());
+  EXPECT_FALSE(Zktraffic::ServerSet("nothost:2181").ok());
+  EXPECT_FALSE(Zktraffic::ServerSet("a=2181;a=2182").ok());
+
+  // nothing matches a set that didn't parse
+  Zktraffic::ServerSet bad("2181,x");
+  EXPECT_FALSE(bad.ok());
+  EXPECT_FALSE(bad.is_server(v4("127.0.0.1", 2181)));
+}
+
+TEST(ServerSet, Sniffer) {
+  Zktraffic::SnifferOptions options;
+  options.servers = Zktraffic::ServerSet("other=2182;local=127.0.0.1:2181");
+  Zktraffic::Sniffer sniffer("test/data/basic.pcap", "port 2181", true, options);
+  drain(sniffer);
+
+  auto stats = sniffer.decoder_stats();
+  EXPECT_EQ(stats.ignored, 0u);
+  EXPECT_EQ(stats.requests_by_ensemble[0], 0u);
+  EXPECT_EQ(stats.requests_by_ensemble[1], 18u);
+  EXPECT_EQ(stats.replies_by_ensemble[1], 18u);
+  EXPECT_EQ(sniffer.latencies().by_ensemble().count(1), 1u);
+  EXPECT_NE(Zktraffic::prometheus_metrics(sniffer).find(
+    "zktraffic_ensemble_requests_total{ensemble=\"local\"} 18"), string::npos);
+
+  // not a server, so not a client either
+  options.servers = Zktraffic::ServerSet("2182");
+  Zktraffic::Sniffer ignoring("test/data/basic.pcap", "port 2181", true, options);
+  drain(ignoring);
+  stats = ignoring.decoder_stats();
+  EXPECT_EQ(stats.ignored, stats.packets);
+  EXPECT_EQ(stats.requests, 0u);
+}
@@ -0,0 +1,110 @@
+#include "gtest/gtest.h"
+
+#include "src/session_table.h"
+
+using namespace std;
+
+using Zktraffic::SessionState;
+
+namespace {
+
+Zktraffic::FlowKey conn(uint16_t port) {
+  return Zktraffic::FlowKey{
+    Zktraffic::Endpoint::from_v4(0x0100007f, port),
+    Zktraffic::Endpoint::from_v4(0x0100007f, 2181),
+  };
+}
+
+}
+
+TEST(SessionTable, Lifecycle) {
+  Zktraffic::SessionTable sessions;
+  Zktraffic::Session session;
+
+  sessions.connect_request(conn(1000), 0, 30000, 1);
+  EXPECT_TRUE(sessions.connecting(conn(1000)));
+  EXPECT_FALSE(sessions.connecting(conn(1001)));
+  sessions.connect_reply(conn(1000), 0x42, 10000, false, 2);
+  EXPECT_FALSE(sessions.connecting(conn(1000)));
+
+  ASSERT_TRUE(sessions.find(conn(1000), session));
+  EXPECT_EQ(session.id, 0x42);
+  EXPECT_EQ(session.requested_timeout, 30000);
+  EXPECT_EQ(session.timeout, 10000);
+  EXPECT_EQ(session.state, SessionState::CONNECTED);
+
+  // the same session moves to another connection, the old one drops
+  sessions.connect_request(conn(1001), 0x42, 30000, 3);
+  sessions.connect_reply(conn(1001), 0x42, 10000, false, 4);
+  sessions.disconnected(conn(1000).reversed());
+
+  // a resume of a session that's gone
+  sessions.connect_request(conn(1002), 0x43, 30000, 5);
+  sessions.connect_reply(conn(1002), 0, 0, false, 6);
+
+  sessions.close_request(conn(1001), 7);
+  ASSERT_TRUE(sessions.find(conn(1001), session));
+  EXPECT_EQ(session.state, SessionState::CLOSING);
+  sessions.close_reply(conn(1001));
+
+  auto stats = sessions.stats();
+  EXPECT_EQ(stats.connections, 0u);
+  EXPECT_EQ(stats.created, 1u);
+  EXPECT_EQ(stats.resumed, 1u);
+  EXPECT_EQ(stats.expired, 1u);
+  EXPECT_EQ(stats.disconnected, 1u);
+  EXPECT_EQ(stats.closed, 1u);
+  EXPECT_EQ(stats.timeouts.count(), 2u);
+  EXPECT_DOUBLE_EQ(stats.churn(1000000), 4.0);
+}
+
+TEST(SessionTable, Bounded) {
+  Zktraffic::SessionTable sessions(100);
+
+  for (uint16_t i = 0; i < 1000; i++) {
+    sessions.connect_request(conn(i), 0, 10000, i);
+    sessions.connect_reply(conn(i), i + 1, 10000, false, i);
+  }
+
+  EXPECT_LE(sessions.size(), 100u);
+  auto stats = sessions.stats();
+  EXPECT_EQ(stats.created, 1000u);
+  EXPECT_EQ(stats.evicted + stats.connections, 1000u);
+
+  // the newest ones are kept
+  Zktraffic::Session session;
+  EXPECT_TRUE(sessions.find(conn(999), session));
+  EXPECT_FALSE(sessions.find(conn(0), session));
+}
+
+TEST(SessionTable, EvictsATenthOnTies) {
+  Zktraffic::SessionTable sessions(100);
+
+  for (uint16_t i = 0; i < 101; i++) {
+    sessions.connect_request(conn(i), 0, 10000, 0);
+    sessions.connect_reply(conn(i), i + 1, 10000, false, 0);
+  }
+
+  EXPECT_EQ(sessions.stats().evicted, 10u);
+  EXPECT_EQ(sessions.size(), 91u);
+}
+
+TEST(SessionTable, ConnectFailed) {
+  Zktraffic::SessionTable sessions;
+  Zktraffic::Session session;
+
+  // the server's answer didn't decode as a ConnectResponse
+  sessions.connect_request(conn(1000), 0, 30000, 1);
+  sessions.connect_failed(conn(1000));
+  EXPECT_FALSE(sessions.connecting(conn(1000)));
+  EXPECT_FALSE(sessions.find(conn(1000), session));
+
+  // so the next reply isn't taken for one
+  sessions.connect_reply(conn(1000), 0x42, 10000, false, 2);
+  EXPECT_FALSE(sessions.find(conn(1000), session));
+
+  auto stats = sessions.stats();
+  EXPECT_EQ(stats.connections, 0u);
+  EXPECT_EQ(stats.connecting, 0u);
+  EXPECT_EQ(stats.created, 0u);
+}
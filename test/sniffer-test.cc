@@ -1,7 +1,5 @@
 #include <iostream>
 
-#include <unistd.h>
-
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -14,16 +12,20 @@ TEST(Sniffer, Basic) {
   Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true};
   sniffer.run();
 
-  // wait for packets to be consumed
-  while (!sniffer.stopped())
-    usleep(500000);
+  sniffer.wait();
+  EXPECT_TRUE(sniffer.stopped());
 
   // connect requests
   auto msg = sniffer.get();
   auto cmsg = dynamic_cast<Zktraffic::ZKClientMessage *>(msg.get());
   EXPECT_EQ(cmsg->opcode(), Zktraffic::enumToInt(Zktraffic::Opcodes::CONNECT));
 
-  // TODO: handle connect reply
+  msg = sniffer.get();
+  auto connect = dynamic_cast<Zktraffic::ConnectReply *>(msg.get());
+  ASSERT_NE(connect, nullptr);
+  EXPECT_NE(connect->session(), 0);
+  EXPECT_GT(connect->timeout(), 0);
+  auto timeout = connect->timeout();
 
   // exists request/reply
   msg = sniffer.get();
@@ -57,6 +59,8 @@ TEST(Sniffer, Basic) {
   EXPECT_EQ(msg.get()->xid(), 4);
   auto getdata = dynamic_cast<Zktraffic::GetReply *>(msg.get());
   EXPECT_THAT(getdata->data(), "feb7");
+  EXPECT_GE(getdata->latency(), 0);
+  EXPECT_GT(getdata->timestamp(), 0);
 
   // pings reqs/replies
   msg = sniffer.get();
@@ -95,5 +99,47 @@ TEST(Sniffer, Basic) {
   auto stat = setdata->stat();
   EXPECT_THAT(stat.dataLength(), 12);
 
-  // ignore the rest...
+  // ignore the rest, the queue is closed once it's drained
+  while (sniffer.get() != nullptr)
+    ;
+  EXPECT_TRUE(sniffer.empty());
+
+  auto stats = sniffer.capture_stats();
+  EXPECT_EQ(stats.packets, 58);
+  EXPECT_EQ(stats.bytes, 5414);
+  EXPECT_EQ(stats.queue_dropped, 0);
+
+  auto latencies = sniffer.latencies().by_opcode();
+  EXPECT_EQ(latencies.count(Zktraffic::enumToInt(Zktraffic::Opcodes::GETDATA)), 1);
+  EXPECT_EQ(latencies[Zktraffic::enumToInt(Zktraffic::Opcodes::PING)].count(), 5);
+
+  // one session, its connection was closed at the end of the capture
+  auto sessions = sniffer.session_stats();
+  EXPECT_EQ(sessions.created, 1u);
+  EXPECT_EQ(sessions.connecting, 0u);
+  EXPECT_EQ(sessions.timeouts.count(), 1u);
+  EXPECT_EQ(sessions.timeouts.max(), (uint64_t)timeout);
+}
+
+TEST(Sniffer, Workers) {
+  Zktraffic::SnifferOptions options;
+  options.workers = 4;
+  Zktraffic::Sniffer sniffer{"test/data/basic.pcap", "port 2181", true, options};
+  sniffer.run();
+
+  // one connection, so everything comes out in capture order
+  vector<int> xids;
+  for (auto msg = sniffer.get(); msg != nullptr; msg = sniffer.get())
+    xids.push_back(msg->xid());
+
+  ASSERT_GE(xids.size(), 5u);
+  EXPECT_EQ(xids[0], 0);
+  EXPECT_EQ(xids[1], 0);
+  EXPECT_EQ(xids[2], 1);
+  EXPECT_EQ(xids[3], 1);
+  EXPECT_EQ(xids[4], 2);
+
+  auto latencies = sniffer.latencies().by_opcode();
+  EXPECT_EQ(latencies[Zktraffic::enumToInt(Zktraffic::Opcodes::PING)].count(), 5);
+  EXPECT_EQ(sniffer.capture_stats().packets, 58);
 }
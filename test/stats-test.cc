@@ -0,0 +1,76 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/stats.h"
+#include "src/zkmessage.h"
+
+using namespace std;
+
+using Zktraffic::StatsAggregator;
+
+TEST(Stats, Prefix) {
+  EXPECT_EQ(StatsAggregator::prefix("/a/b/c", 2), "/a/b");
+  EXPECT_EQ(StatsAggregator::prefix("/a/b/c", 1), "/a");
+  EXPECT_EQ(StatsAggregator::prefix("/a/b", 5), "/a/b");
+  EXPECT_EQ(StatsAggregator::prefix("/", 2), "/");
+}
+
+TEST(Stats, TopTableIsBounded) {
+  Zktraffic::TopTable<string> table(8);
+
+  for (int i = 0; i < 100; i++)
+    table.add("/hot", 10);
+  for (int i = 0; i < 1000; i++)
+    table.add("/cold" + to_string(i), 1);
+
+  EXPECT_LE(table.size(), 8u);
+  auto top = table.top(1);
+  ASSERT_EQ(top.size(), 1u);
+  EXPECT_EQ(top[0].first, "/hot");
+  EXPECT_EQ(top[0].second.count, 100u);
+  EXPECT_EQ(top[0].second.bytes, 1000u);
+  EXPECT_GT(table.other().count, 990u);
+}
+
+TEST(Stats, Windows) {
+  auto client = Zktraffic::Endpoint::from_v4(0x0100007f, 34236);
+  auto server = Zktraffic::Endpoint::from_v4(0x0100007f, 2181);
+  Zktraffic::StatsOptions options;
+  options.window = 10;
+  options.prefix_depth = 1;
+  StatsAggregator stats(options);
+
+  Zktraffic::GetRequest get(client, server, 1, "/a/b", false, 4);
+  get.set_timestamp(100000000);
+  get.set_size(20);
+  Zktraffic::DeleteReply reply(client, server, 2, 7, -101);
+  reply.set_timestamp(105000000);
+  Zktraffic::WatchEvent watch(client, server, -1, 0, 3, 3, "/a/b");
+  watch.set_timestamp(111000000);
+
+  stats.add(get);
+  stats.add(reply);
+  EXPECT_FALSE(stats.expired(reply.timestamp()));
+  EXPECT_TRUE(stats.expired(watch.timestamp()));
+
+  auto snapshot = stats.rotate(watch.timestamp());
+  EXPECT_EQ(snapshot.start, 100000000u);
+  EXPECT_EQ(snapshot.requests, 1u);
+  EXPECT_EQ(snapshot.replies, 1u);
+  auto getdata = Zktraffic::enumToInt(Zktraffic::Opcodes::GETDATA);
+  EXPECT_EQ(snapshot.opcodes[getdata].requests.bytes, 20u);
+  ASSERT_EQ(snapshot.clients.size(), 1u);
+  EXPECT_EQ(snapshot.clients[0].first, "127.0.0.1");
+  ASSERT_EQ(snapshot.prefixes.size(), 1u);
+  EXPECT_EQ(snapshot.prefixes[0].first, "/a");
+  EXPECT_EQ(snapshot.errors[-101], 1u);
+
+  stats.add(watch);
+  snapshot = stats.rotate();
+  EXPECT_EQ(snapshot.start, 110000000u);
+  EXPECT_EQ(snapshot.requests, 0u);
+  EXPECT_EQ(snapshot.watches[3], 1u);
+  ASSERT_EQ(snapshot.watch_paths.size(), 1u);
+  EXPECT_EQ(snapshot.watch_paths[0].first, "/a/b");
+}
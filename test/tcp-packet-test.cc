@@ -0,0 +1,139 @@
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "src/pcap_file.h"
+#include "src/tcp_packet.h"
+
+using namespace std;
+
+using Zktraffic::TcpPacket;
+
+namespace {
+
+// The first packet of basic.pcap with a payload, without its ethernet header.
+string first_ipv4_packet(string& ethernet) {
+  Zktraffic::PcapFile file("test/data/basic.pcap");
+  Zktraffic::PcapRecord record;
+  while (file.next(record)) {
+    auto header = record.header();
+    TcpPacket packet;
+    if (TcpPacket::from_pcap(&header, record.data, packet) && !packet.payload().empty()) {
+      ethernet.assign((const char *)record.data, 14);
+      return string((const char *)record.data + 14, record.caplen - 14);
+    }
+  }
+  return "";
+}
+
+bool parse(const string& data, int linktype, TcpPacket& packet) {
+  struct pcap_pkthdr header = {};
+  header.caplen = header.len = data.size();
+  return TcpPacket::from_pcap(&header, (const u_char *)data.data(), packet, linktype);
+}
+
+}
+
+TEST(TcpPacket, LinkTypes) {
+  string ethernet;
+  auto ip = first_ipv4_packet(ethernet);
+  ASSERT_FALSE(ip.empty());
+
+  TcpPacket expected;
+  auto frame = ethernet + ip;
+  ASSERT_TRUE(parse(frame, DLT_EN10MB, expected));
+  EXPECT_EQ(expected.dst_port(), 2181);
+
+  auto macs = ethernet.substr(0, 12);
+  string ipv4_type("\x08\x00", 2);
+  string vlan("\x81\x00\x00\x07", 4);
+  string qinq("\x88\xa8\x00\x05", 4);
+  string sll("\x00\x00\x03\x04\x00\x06" "abcdef\0\0" "\x08\x00", 16);
+  string sll2("\x08\x00\x00\x00\x00\x00\x00\x01\x00\x01\x00\x06" "abcdef\0\0", 20);
+  string null_le("\x02\x00\x00\x00", 4);
+  string null_be("\x00\x00\x00\x02", 4);
+
+  struct {
+    int linktype;
+    string data;
+  } cases[] = {
+    {DLT_EN10MB, macs + vlan + ipv4_type + ip},
+    {DLT_EN10MB, macs + qinq + vlan + ipv4_type + ip},
+    {DLT_LINUX_SLL, sll + ip},
+    {DLT_LINUX_SLL2, sll2 + ip},
+    {DLT_NULL, null_le + ip},
+    {DLT_NULL, null_be + ip},
+    {DLT_LOOP, null_be + ip},
+    {DLT_RAW, ip},
+  };
+
+  for (const auto& c : cases) {
+    TcpPacket packet;
+    ASSERT_TRUE(parse(c.data, c.linktype, packet)) << c.linktype;
+    EXPECT_EQ(packet.flow(), expected.flow());
+    EXPECT_EQ(packet.seq(), expected.seq());
+    EXPECT_EQ(packet.payload(), expected.payload());
+  }
+
+  TcpPacket packet;
+  EXPECT_FALSE(parse(macs + string("\x08\x06", 2) + ip, DLT_EN10MB, packet));
+  EXPECT_FALSE(parse(ip, 147, packet));
+}
+
+TEST(TcpPacket, IPv6) {
+  string ethernet;
+  auto ip = first_ipv4_packet(ethernet);
+  ASSERT_FALSE(ip.empty());
+  auto segment = ip.substr((ip[0] & 0x0f) * 4);
+
+  // a hop-by-hop options header (8 bytes) before TCP
+  string ext("\x06\x00\x01\x04\x00\x00\x00\x00", 8);
+  string ip6("\x60\x00\x00\x00", 4);
+  uint16_t plen = ext.size() + segment.size();
+  ip6 += (char)(plen >> 8);
+  ip6 += (char)(plen & 0xff);
+  ip6 += '\x00';  // next header: hop-by-hop
+  ip6 += '\x40';
+  string src(16, '\0'), dst(16, '\0');
+  src[15] = 1;
+  dst[0] = '\xfd';
+  dst[15] = 2;
+  ip6 += src + dst;
+
+  TcpPacket packet;
+  auto frame = ethernet.substr(0, 12) + string("\x86\xdd", 2) + ip6 + ext + segment;
+  ASSERT_TRUE(parse(frame, DLT_EN10MB, packet));
+  EXPECT_FALSE(packet.src().is_v4());
+  EXPECT_EQ(packet.dst_port(), 2181);
+  EXPECT_EQ(packet.dst(), Zktraffic::Endpoint::from_v6((const uint8_t *)dst.data(), 2181));
+  EXPECT_FALSE(packet.payload().empty());
+  EXPECT_EQ(packet.payload().size(), segment.size() - (((uint8_t)segment[12] >> 4) * 4));
+
+  frame = ip6 + ext + segment;
+  ASSERT_TRUE(parse(frame, DLT_RAW, packet));
+  EXPECT_EQ(packet.dst_port(), 2181);
+
+  // fragments are dropped
+  ip6[6] = 44;
+  EXPECT_FALSE(parse(ip6 + ext + segment, DLT_RAW, packet));
+}
+
+TEST(TcpPacket, IPv4Fragments) {
+  string ethernet;
+  auto ip = first_ipv4_packet(ethernet);
+  ASSERT_FALSE(ip.empty());
+
+  TcpPacket packet;
+  auto frame = ip;
+  frame[6] = '\x40';  // don't fragment
+  frame[7] = 0;
+  EXPECT_TRUE(parse(frame, DLT_RAW, packet));
+
+  // more fragments, first one
+  frame[6] = '\x20';
+  EXPECT_FALSE(parse(frame, DLT_RAW, packet));
+
+  // last fragment, at offset 8 * 0x100
+  frame[6] = '\x01';
+  EXPECT_FALSE(parse(ethernet + frame, DLT_EN10MB, packet));
+}
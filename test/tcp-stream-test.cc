@@ -0,0 +1,122 @@
+#include <string>
+#include <vector>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "src/tcp_stream.h"
+
+using namespace std;
+
+namespace {
+
+string frame(const string& body) {
+  string rv(4, '\0');
+  rv[0] = (body.size() >> 24) & 0xff;
+  rv[1] = (body.size() >> 16) & 0xff;
+  rv[2] = (body.size() >> 8) & 0xff;
+  rv[3] = body.size() & 0xff;
+  return rv + body;
+}
+
+struct Collector {
+  void operator()(string_view frame) { frames.emplace_back(frame.substr(4)); }
+  vector<string> frames;
+};
+
+}
+
+TEST(TcpStream, Pipelined) {
+  Zktraffic::TcpStream stream;
+  Collector collect;
+  auto data = frame("first") + frame("second") + frame("third");
+
+  stream.sync(999);
+  stream.consume(1000, data.data(), data.size(), collect);
+
+  EXPECT_THAT(collect.frames, testing::ElementsAre("first", "second", "third"));
+  EXPECT_EQ(stream.buffered(), 0);
+}
+
+TEST(TcpStream, MultiSegment) {
+  Zktraffic::TcpStream stream;
+  Collector collect;
+  auto data = frame(string(3000, 'x')) + frame("tail");
+
+  stream.sync(0);
+  for (size_t off = 0; off < data.size(); off += 1448) {
+    auto len = min<size_t>(1448, data.size() - off);
+    stream.consume(1 + off, data.data() + off, len, collect);
+  }
+
+  ASSERT_EQ(collect.frames.size(), 2);
+  EXPECT_EQ(collect.frames[0], string(3000, 'x'));
+  EXPECT_EQ(collect.frames[1], "tail");
+}
+
+TEST(TcpStream, OutOfOrderAndRetransmit) {
+  Zktraffic::TcpStream stream;
+  Collector collect;
+  auto data = frame("abcdef") + frame("ghijkl");
+
+  stream.sync(0xfffffff0);  // wraps around
+  uint32_t base = 0xfffffff1;
+  stream.consume(base + 8, data.data() + 8, data.size() - 8, collect);
+  EXPECT_TRUE(collect.frames.empty());
+  stream.consume(base, data.data(), 8, collect);
+  stream.consume(base, data.data(), 8, collect);
+
+  EXPECT_THAT(collect.frames, testing::ElementsAre("abcdef", "ghijkl"));
+  EXPECT_EQ(stream.retransmits(), 1);
+}
+
+TEST(TcpStream, BoundedOutOfOrder) {
+  Zktraffic::TcpStream stream(16);
+  Collector collect;
+  auto data = frame("0123456789");
+
+  stream.sync(0);
+  stream.consume(100, data.data(), data.size(), collect);  // buffered
+  stream.consume(200, data.data(), data.size(), collect);  // over the limit, restart here
+
+  EXPECT_THAT(collect.frames, testing::ElementsAre("0123456789"));
+  EXPECT_EQ(stream.resyncs(), 1);
+  EXPECT_EQ(stream.buffered(), 0);
+}
+
+TEST(TcpStream, BadFrameResyncs) {
+  Zktraffic::TcpStream stream;
+  Collector collect;
+  string garbage("\xff\xff\xff\xff junk", 9);
+  auto good = frame("ok");
+
+  stream.consume(0, garbage.data(), garbage.size(), collect);
+  stream.consume(50, good.data(), good.size(), collect);
+
+  EXPECT_THAT(collect.frames, testing::ElementsAre("ok"));
+  EXPECT_EQ(stream.resyncs(), 1);
+}
+
+TEST(TcpStream, BoundedBuffer) {
+  Zktraffic::TcpStream stream;
+  Collector collect;
+  auto big = frame(string(1024 * 1024, 'x'));
+  auto small = frame("small");
+
+  // a length prefix alone doesn't get its whole frame reserved
+  stream.sync(0);
+  stream.consume(1, big.data(), 1000, collect);
+  EXPECT_LE(stream.buffer_capacity(), Zktraffic::TcpStream::MAX_RESERVE);
+
+  // and once the big frame is through, its buffer goes
+  uint32_t seq = 1001;
+  for (size_t off = 1000; off < big.size(); off += 1460) {
+    auto len = min<size_t>(1460, big.size() - off);
+    stream.consume(seq, big.data() + off, len, collect);
+    seq += len;
+  }
+  stream.consume(seq, small.data(), 3, collect);
+  ASSERT_EQ(collect.frames.size(), 1u);
+  EXPECT_EQ(collect.frames[0].size(), 1024u * 1024);
+  EXPECT_LE(stream.buffer_capacity(), Zktraffic::TcpStream::MAX_RESERVE);
+}
@@ -0,0 +1,251 @@
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "src/zkmessage.h"
+
+using namespace std;
+
+using Zktraffic::enumToInt;
+using Zktraffic::Opcodes;
+
+namespace {
+
+const auto client = Zktraffic::Endpoint::from_v4(0x0100007f, 34236);
+const auto server = Zktraffic::Endpoint::from_v4(0x0100007f, 2181);
+
+// jute encoding, length prefix filled in by frame()
+class Writer {
+public:
+  Writer& i32(int32_t v) {
+    for (int shift = 24; shift >= 0; shift -= 8)
+      out_ += (char)((uint32_t)v >> shift);
+    return *this;
+  }
+  Writer& i64(int64_t v) { return i32(v >> 32).i32(v & 0xffffffff); }
+  Writer& boolean(bool v) { out_ += (char)v; return *this; }
+  Writer& str(const string& s) { i32(s.size()); out_ += s; return *this; }
+  Writer& strs(const vector<string>& v) {
+    i32(v.size());
+    for (const auto& s : v)
+      str(s);
+    return *this;
+  }
+  Writer& multi_header(int type, bool done, int err) { return i32(type).boolean(done).i32(err); }
+  Writer& stat() { out_.append(68, '\0'); return *this; }
+  string frame() const { return Writer().i32(out_.size()).out_ + out_; }
+
+private:
+  string out_;
+};
+
+template <typename T>
+const T *as(const unique_ptr<Zktraffic::ZKClientMessage>& msg) {
+  return dynamic_cast<const T *>(msg.get());
+}
+
+}
+
+TEST(ZKMessage, Multi) {
+  auto request = Writer().i32(7).i32(enumToInt(Opcodes::MULTI))
+    .multi_header(enumToInt(Opcodes::CREATE), false, -1)
+      .str("/a").str("data").i32(1).i32(31).str("world").str("anyone").i32(1)
+    .multi_header(enumToInt(Opcodes::CHECK), false, -1).str("/b").i32(3)
+    .multi_header(enumToInt(Opcodes::SETDATA), false, -1).str("/c").str("x").i32(4)
+    .multi_header(enumToInt(Opcodes::DELETE), false, -1).str("/d").i32(-1)
+    .multi_header(-1, true, -1)
+    .frame();
+
+  auto msg = Zktraffic::ZKClientMessage::from_payload(client, server, request);
+  auto multi = as<Zktraffic::MultiRequest>(msg);
+  ASSERT_NE(multi, nullptr);
+  EXPECT_EQ(multi->xid(), 7);
+  ASSERT_EQ(multi->ops().size(), 4u);
+  EXPECT_EQ(multi->ops()[0].opcode, enumToInt(Opcodes::CREATE));
+  EXPECT_EQ(multi->ops()[0].mode, 1);
+  EXPECT_EQ(multi->ops()[1].version, 3);
+  EXPECT_EQ(multi->ops()[2].version, 4);
+  EXPECT_EQ(multi->path(3), "/d");
+
+  // the check failed, the rest were rolled back
+  auto reply = Writer().i32(7).i64(100).i32(0)
+    .multi_header(-1, false, 0).i32(0)
+    .multi_header(-1, false, -103).i32(-103)
+    .multi_header(-1, false, -2).i32(-2)
+    .multi_header(-1, false, -2).i32(-2)
+    .multi_header(-1, true, -1)
+    .frame();
+  auto server_msg = Zktraffic::ZKServerMessage::from_payload(client, server, reply, enumToInt(Opcodes::MULTI));
+  auto multi_reply = dynamic_cast<Zktraffic::MultiReply *>(server_msg.get());
+  ASSERT_NE(multi_reply, nullptr);
+  ASSERT_EQ(multi_reply->results().size(), 4u);
+  EXPECT_EQ(multi_reply->results()[1].error, -103);
+
+  reply = Writer().i32(8).i64(101).i32(0)
+    .multi_header(enumToInt(Opcodes::CREATE), false, 0).str("/a")
+    .multi_header(enumToInt(Opcodes::CHECK), false, 0)
+    .multi_header(enumToInt(Opcodes::SETDATA), false, 0).stat()
+    .multi_header(enumToInt(Opcodes::DELETE), false, 0)
+    .multi_header(-1, true, -1)
+    .frame();
+  server_msg = Zktraffic::ZKServerMessage::from_payload(client, server, reply, enumToInt(Opcodes::MULTI));
+  multi_reply = dynamic_cast<Zktraffic::MultiReply *>(server_msg.get());
+  ASSERT_NE(multi_reply, nullptr);
+  ASSERT_EQ(multi_reply->results().size(), 4u);
+  EXPECT_EQ(multi_reply->results()[2].opcode, enumToInt(Opcodes::SETDATA));
+
+  // an op we can't size
+  request = Writer().i32(9).i32(enumToInt(Opcodes::MULTI))
+    .multi_header(42, false, -1).str("/a")
+    .multi_header(-1, true, -1)
+    .frame();
+  EXPECT_EQ(Zktraffic::ZKClientMessage::from_payload(client, server, request), nullptr);
+}
+
+TEST(ZKMessage, SetWatches) {
+  vector<string> data;
+  for (int i = 0; i < 1000; i++)
+    data.push_back("/data/" + to_string(i));
+
+  auto request = Writer().i32(Zktraffic::SET_WATCHES_XID).i32(enumToInt(Opcodes::SETWATCHES2)).i64(0x200)
+    .strs(data).strs({}).strs({"/c1", "/c2"}).strs({"/p"}).strs({"/r"})
+    .frame();
+  auto msg = Zktraffic::ZKClientMessage::from_payload(client, server, request);
+  auto watches = as<Zktraffic::SetWatchesRequest>(msg);
+  ASSERT_NE(watches, nullptr);
+  using Request = Zktraffic::SetWatchesRequest;
+  EXPECT_EQ(watches->relative_zxid(), 0x200);
+  EXPECT_EQ(watches->count(Request::DATA), 1000u);
+  EXPECT_EQ(watches->path(Request::DATA, 999), "/data/999");
+  EXPECT_EQ(watches->count(Request::EXIST), 0u);
+  EXPECT_EQ(watches->path(Request::CHILD, 1), "/c2");
+  EXPECT_EQ(watches->path(Request::PERSISTENT, 0), "/p");
+  EXPECT_EQ(watches->path(Request::PERSISTENT_RECURSIVE, 0), "/r");
+  EXPECT_EQ(watches->paths().size(), 1004u);
+
+  // the 3.4 version stops after the child watches
+  request = Writer().i32(Zktraffic::SET_WATCHES_XID).i32(enumToInt(Opcodes::SETWATCHES)).i64(1)
+    .strs({"/d"}).strs({"/e"}).strs({"/c"})
+    .frame();
+  msg = Zktraffic::ZKClientMessage::from_payload(client, server, request);
+  watches = as<Zktraffic::SetWatchesRequest>(msg);
+  ASSERT_NE(watches, nullptr);
+  EXPECT_EQ(watches->path(Request::EXIST, 0), "/e");
+  EXPECT_EQ(watches->count(Request::PERSISTENT), 0u);
+}
+
+TEST(ZKMessage, ImpossibleCounts) {
+  // more strings than there are bytes left
+  auto request = Writer().i32(Zktraffic::SET_WATCHES_XID).i32(enumToInt(Opcodes::SETWATCHES)).i64(1)
+    .i32(1000).str("/d").strs({}).strs({})
+    .frame();
+  EXPECT_EQ(Zktraffic::ZKClientMessage::from_payload(client, server, request), nullptr);
+
+  auto reply = Writer().i32(6).i64(7).i32(0).i32(1000).str("a").frame();
+  EXPECT_EQ(Zktraffic::ZKServerMessage::from_payload(client, server, reply, enumToInt(Opcodes::GETCHILDREN)), nullptr);
+
+  request = Writer().i32(3).i32(enumToInt(Opcodes::SETACL)).str("/a").i32(1000).i32(0).frame();
+  EXPECT_EQ(Zktraffic::ZKClientMessage::from_payload(client, server, request), nullptr);
+
+  // null lists are just empty
+  request = Writer().i32(Zktraffic::SET_WATCHES_XID).i32(enumToInt(Opcodes::SETWATCHES)).i64(1)
+    .i32(-1).i32(-1).i32(-1)
+    .frame();
+  auto msg = Zktraffic::ZKClientMessage::from_payload(client, server, request);
+  auto watches = as<Zktraffic::SetWatchesRequest>(msg);
+  ASSERT_NE(watches, nullptr);
+  EXPECT_EQ(watches->paths().size(), 0u);
+}
+
+TEST(ZKMessage, NewerOpcodes) {
+  auto request = Writer().i32(3).i32(enumToInt(Opcodes::CREATETTL))
+    .str("/ttl").str("").i32(0).i32(enumToInt(Zktraffic::CreateMode::PERSISTENT_WITH_TTL)).i64(60000)
+    .frame();
+  auto msg = Zktraffic::ZKClientMessage::from_payload(client, server, request);
+  auto create = as<Zktraffic::CreateRequest>(msg);
+  ASSERT_NE(create, nullptr);
+  EXPECT_EQ(create->ttl(), 60000);
+  // mode 5 isn't ephemeral, even with the low bit set
+  EXPECT_NE(string(*create).find("ephemeral=false"), string::npos);
+
+  request = Writer().i32(4).i32(enumToInt(Opcodes::ADDWATCH)).str("/w").i32(1).frame();
+  msg = Zktraffic::ZKClientMessage::from_payload(client, server, request);
+  ASSERT_NE(as<Zktraffic::AddWatchRequest>(msg), nullptr);
+  EXPECT_EQ(as<Zktraffic::AddWatchRequest>(msg)->mode(), 1);
+
+  request = Writer().i32(5).i32(enumToInt(Opcodes::CLOSE)).frame();
+  msg = Zktraffic::ZKClientMessage::from_payload(client, server, request);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(msg->opcode(), enumToInt(Opcodes::CLOSE));
+
+  auto reply = Writer().i32(6).i64(7).i32(0).strs({"/e1", "/e2"}).frame();
+  auto server_msg = Zktraffic::ZKServerMessage::from_payload(client, server, reply, enumToInt(Opcodes::GETEPHEMERALS));
+  auto ephemerals = dynamic_cast<Zktraffic::GetEphemeralsReply *>(server_msg.get());
+  ASSERT_NE(ephemerals, nullptr);
+  EXPECT_EQ(ephemerals->paths().join(","), "/e1,/e2");
+
+  reply = Writer().i32(6).i64(7).i32(0).i32(1).i32(31).str("digest").str("u:p").stat().frame();
+  server_msg = Zktraffic::ZKServerMessage::from_payload(client, server, reply, enumToInt(Opcodes::GETACL));
+  auto acl = dynamic_cast<Zktraffic::GetAclReply *>(server_msg.get());
+  ASSERT_NE(acl, nullptr);
+  EXPECT_EQ(acl->acls().size(), 1u);
+
+  reply = Writer().i32(6).i64(7).i32(-101).frame();
+  server_msg = Zktraffic::ZKServerMessage::from_payload(client, server, reply, enumToInt(Opcodes::CHECK));
+  ASSERT_NE(server_msg, nullptr);
+  EXPECT_EQ(server_msg->error(), -101);
+  EXPECT_EQ(string(*server_msg).rfind("CheckReply", 0), 0u);
+}
+
+TEST(ZKMessage, Lazy) {
+  auto reply = Writer().i32(6).i64(7).i32(0).strs({"a", "b", "c"}).stat().frame();
+  auto eager = Zktraffic::ZKServerMessage::from_payload(client, server, reply, enumToInt(Opcodes::GETCHILDREN2));
+  // the frame goes away before the body is needed
+  auto frame = make_unique<string>(reply);
+  auto msg = Zktraffic::LazyReply::from_payload(client, server, *frame, enumToInt(Opcodes::GETCHILDREN2), true);
+  frame.reset();
+  auto lazy = dynamic_cast<Zktraffic::LazyReply *>(msg.get());
+  ASSERT_NE(lazy, nullptr);
+  EXPECT_EQ(lazy->xid(), 6);
+  EXPECT_EQ(lazy->zxid(), 7);
+  EXPECT_EQ(lazy->opcode(), enumToInt(Opcodes::GETCHILDREN2));
+  auto children = dynamic_cast<const Zktraffic::GetChildrenReply *>(lazy->body());
+  ASSERT_NE(children, nullptr);
+  EXPECT_EQ(children->children().join(","), "a,b,c");
+  EXPECT_EQ(string(*lazy), string(*eager));
+
+  // the header decodes, the body doesn't
+  reply = Writer().i32(6).i64(7).i32(0).i32(1000).frame();
+  msg = Zktraffic::LazyReply::from_payload(client, server, reply, enumToInt(Opcodes::GETDATA), false);
+  ASSERT_NE(msg, nullptr);
+  EXPECT_EQ(static_cast<Zktraffic::LazyReply *>(msg.get())->body(), nullptr);
+  EXPECT_EQ(string(*msg).rfind("UndecodedReply", 0), 0u);
+  // no request to go with it
+  EXPECT_EQ(Zktraffic::LazyReply::from_payload(client, server, reply, -1, false), nullptr);
+
+  auto request = Writer().i32(3).i32(enumToInt(Opcodes::CREATE))
+    .str("/node").str("data").i32(0).i32(enumToInt(Zktraffic::CreateMode::EPHEMERAL))
+    .frame();
+  auto client_msg = Zktraffic::LazyRequest::from_payload(client, server, request, false);
+  ASSERT_NE(client_msg, nullptr);
+  EXPECT_EQ(client_msg->opcode(), enumToInt(Opcodes::CREATE));
+  EXPECT_EQ(client_msg->path(), "/node");
+  EXPECT_EQ(string(*client_msg), string(*Zktraffic::ZKClientMessage::from_payload(client, server, request)));
+
+  // what the Decoder needs whole is decoded whole
+  request = Writer().i32(5).i32(enumToInt(Opcodes::CLOSE)).frame();
+  client_msg = Zktraffic::LazyRequest::from_payload(client, server, request, false);
+  EXPECT_NE(dynamic_cast<Zktraffic::CloseRequest *>(client_msg.get()), nullptr);
+
+  // what isn't a request whole isn't one lazily either
+  request = Writer().i32(3).i32(enumToInt(Opcodes::EXISTS)).str("/a").frame();
+  EXPECT_EQ(Zktraffic::ZKClientMessage::from_payload(client, server, request), nullptr);
+  EXPECT_EQ(Zktraffic::LazyRequest::from_payload(client, server, request, false), nullptr);
+  request = Writer().i32(3).i32(enumToInt(Opcodes::MULTI)).i32(-7).i32(1).frame();
+  EXPECT_EQ(Zktraffic::ZKClientMessage::from_payload(client, server, request), nullptr);
+  EXPECT_EQ(Zktraffic::LazyRequest::from_payload(client, server, request, false), nullptr);
+  request = Writer().i32(3).i32(enumToInt(Opcodes::SETACL)).str("/a").i32(100).i32(1).frame();
+  EXPECT_EQ(Zktraffic::ZKClientMessage::from_payload(client, server, request), nullptr);
+  EXPECT_EQ(Zktraffic::LazyRequest::from_payload(client, server, request, false), nullptr);
+}